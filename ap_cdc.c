@@ -0,0 +1,198 @@
+// ap_cdc.c
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <assert.h>
+#include "twl_list.h"
+#include "ap_command.h"
+#include "ap_support.h"
+#include "ap_cdc.h"
+
+#define TRUE  1
+#define FALSE 0
+
+#define CDC_MASK (AP_CDC_SLOTS - 1)
+
+void ap_cdc_init(ap_cdc_t *cdc, FILE *sink)
+{
+    atomic_init(&cdc->head, 0);
+    for (int i = 0; i < AP_CDC_SLOTS; i++)
+        atomic_init(&cdc->slot[i].seq, 0);
+    cdc->sink = sink;
+    ap_cdc_subscribe(cdc, &cdc->sink_cursor);
+}
+
+/* Writer only.  The slot's seq is cleared before the fields change and
+ * set after, so a reader that copied a slot while it was rewritten sees a
+ * different seq when it checks again.
+ */
+void ap_cdc_emit(ap_cdc_t *cdc, int eth, int old_rank, int new_rank, int mobile_count)
+{
+    uint64_t seq = atomic_load_explicit(&cdc->head, memory_order_relaxed) + 1;
+    ap_cdc_slot_t *s = &cdc->slot[seq & CDC_MASK];
+
+    atomic_store_explicit(&s->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&s->eth, eth, memory_order_relaxed);
+    atomic_store_explicit(&s->old_rank, old_rank, memory_order_relaxed);
+    atomic_store_explicit(&s->new_rank, new_rank, memory_order_relaxed);
+    atomic_store_explicit(&s->mobile_count, mobile_count, memory_order_relaxed);
+    atomic_store_explicit(&s->seq, seq, memory_order_release);
+    atomic_store_explicit(&cdc->head, seq, memory_order_release);
+
+    /* the sink must not fall so far behind that it loses events */
+    if (cdc->sink != NULL && seq - cdc->sink_cursor.next >= AP_CDC_SLOTS / 2)
+        ap_cdc_flush(cdc);
+}
+
+/* Starts cur at the next event */
+void ap_cdc_subscribe(ap_cdc_t *cdc, ap_cdc_cursor_t *cur)
+{
+    cur->next = atomic_load_explicit(&cdc->head, memory_order_acquire) + 1;
+    cur->lost = 0;
+}
+
+/* Copies up to max events from cur on into ev and returns how many. */
+int ap_cdc_poll(ap_cdc_t *cdc, ap_cdc_cursor_t *cur, ap_cdc_event_t *ev, int max)
+{
+    int count = 0;
+
+    while (count < max) {
+        uint64_t head = atomic_load_explicit(&cdc->head, memory_order_acquire);
+        if (cur->next > head)
+            break;
+        if (head - cur->next >= AP_CDC_SLOTS) {
+            /* overwritten; skip to the oldest event still kept */
+            cur->lost += head - AP_CDC_SLOTS + 1 - cur->next;
+            cur->next = head - AP_CDC_SLOTS + 1;
+        }
+
+        ap_cdc_slot_t *s = &cdc->slot[cur->next & CDC_MASK];
+        ap_cdc_event_t *e = &ev[count];
+        if (atomic_load_explicit(&s->seq, memory_order_acquire) != cur->next)
+            continue;               // being overwritten; the head moved on
+        e->seq = cur->next;
+        e->eth = atomic_load_explicit(&s->eth, memory_order_relaxed);
+        e->old_rank = atomic_load_explicit(&s->old_rank, memory_order_relaxed);
+        e->new_rank = atomic_load_explicit(&s->new_rank, memory_order_relaxed);
+        e->mobile_count = atomic_load_explicit(&s->mobile_count, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&s->seq, memory_order_relaxed) != cur->next)
+            continue;
+        cur->next++;
+        count++;
+    }
+    return count;
+}
+
+/* Writes the events the sink has not seen yet */
+void ap_cdc_flush(ap_cdc_t *cdc)
+{
+    ap_cdc_event_t ev[64];
+    int count;
+
+    if (cdc->sink == NULL)
+        return;
+    while ((count = ap_cdc_poll(cdc, &cdc->sink_cursor, ev, 64)) > 0) {
+        for (int i = 0; i < count; i++)
+            fprintf(cdc->sink, "%llu %d %d %d %d\n", (unsigned long long) ev[i].seq,
+                    ev[i].eth, ev[i].old_rank, ev[i].new_rank, ev[i].mobile_count);
+    }
+    assert(cdc->sink_cursor.lost == 0);
+    fflush(cdc->sink);
+}
+
+void ap_cdc_close(ap_cdc_t *cdc)
+{
+    ap_cdc_flush(cdc);
+    if (cdc->sink != NULL)
+        fclose(cdc->sink);
+    cdc->sink = NULL;
+}
+
+static int rank_of(twl_list_t *leaderboard, int eth)
+{
+    ap_info_t key;
+    key.eth_address = eth;
+    return twl_list_elem_find_position(leaderboard, &key, ap_match_eth);
+}
+
+/* Called before cmd runs.  Returns the rank of the record cmd may move,
+ * or -1.  REMOVEALL's events are all known now, so they are emitted here.
+ */
+int ap_cdc_before(ap_cdc_t *cdc, twl_list_t *leaderboard, const ap_cmd_t *cmd)
+{
+    switch (cmd->op) {
+    case AP_OP_REMOVE:
+    case AP_OP_INC:
+    case AP_OP_DEC:
+        return rank_of(leaderboard, cmd->id);
+    case AP_OP_REMOVEALL:
+        for (int rank = twl_list_size(leaderboard) - 1; rank >= 0; rank--) {
+            ap_info_t *rec = twl_list_access(leaderboard, rank);
+            ap_cdc_emit(cdc, rec->eth_address, rank, -1, rec->mobile_count);
+        }
+        return -1;
+    case AP_OP_EXPIRE:
+        /* the same test as EXPIRE's, bottom up so the ranks above stay */
+        for (int rank = twl_list_size(leaderboard) - 1; rank >= 0 && cmd->arg >= 0; rank--) {
+            ap_info_t *rec = twl_list_access(leaderboard, rank);
+            if (rec->time_received < (long long) cmd->id - cmd->arg)
+                ap_cdc_emit(cdc, rec->eth_address, rank, -1, rec->mobile_count);
+        }
+        return -1;
+    default:
+        return -1;
+    }
+}
+
+/* Called after cmd ran, with the rank ap_cdc_before returned */
+void ap_cdc_after(ap_cdc_t *cdc, twl_list_t *leaderboard, const ap_cmd_t *cmd,
+        const ap_result_t *res, int old_rank)
+{
+    int rank, count;
+
+    switch (cmd->op) {
+    case AP_OP_ADD:
+        if (res->code != 0)
+            break;
+        rank = rank_of(leaderboard, res->eth);
+        ap_cdc_emit(cdc, res->eth, -1, rank,
+                ((ap_info_t *) twl_list_access(leaderboard, rank))->mobile_count);
+        break;
+    case AP_OP_MOVEQTOL:
+        if (res->code != 1)
+            break;
+        rank = rank_of(leaderboard, res->eth);
+        ap_cdc_emit(cdc, res->eth, -1, rank,
+                ((ap_info_t *) twl_list_access(leaderboard, rank))->mobile_count);
+        break;
+    case AP_OP_REMOVE:
+        if (res->code == 0)
+            ap_cdc_emit(cdc, res->eth, old_rank, -1, res->rec.mobile_count);
+        break;
+    case AP_OP_INC:
+    case AP_OP_DEC:
+        if (res->code >= 0)
+            ap_cdc_emit(cdc, res->eth, old_rank, rank_of(leaderboard, res->eth), res->value);
+        break;
+    case AP_OP_LOAD:
+        if (res->code != 0)
+            break;
+        ap_cdc_emit(cdc, -1, -1, -1, 0);
+        count = twl_list_size(leaderboard);
+        for (rank = 0; rank < count; rank++) {
+            ap_info_t *rec = twl_list_access(leaderboard, rank);
+            ap_cdc_emit(cdc, rec->eth_address, -1, rank, rec->mobile_count);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -0,0 +1,79 @@
+// ap_cdc.h
+
+/* Change-data-capture stream of leaderboard rank changes.
+ *
+ * With --cdc file, every command that moves a record on the leaderboard
+ * appends one compact event to an in-process ring:
+ *
+ *     seq             1, 2, 3, ... with no gaps
+ *     eth             the record
+ *     old_rank        its index before the command, -1 if it was not on
+ *                     the leaderboard
+ *     new_rank        its index after the command, -1 if it left
+ *     mobile_count    its count after the command
+ *
+ * ADD and MOVEQTOL that insert give an enter event, REMOVE a leave, and
+ * INC and DEC a move (old_rank may equal new_rank, the count changed).
+ * With --coalesce, a batch of INC and DEC gives one move per AP whose
+ * count changed.
+ * REMOVEALL and EXPIRE leave from the bottom up.  A LOAD gives a reset
+ * event (eth, old_rank and new_rank all -1) and then enters in rank
+ * order.  Every event is exact for the leaderboard as the previous events
+ * left it, and the records between old_rank and new_rank shift by one, so
+ * a consumer can keep a copy of the leaderboard up to date with work
+ * proportional to the changes.
+ *
+ * Consumers hold a cursor.  ap_cdc_subscribe starts it at the next event
+ * and ap_cdc_poll copies the events since, from any thread, without locks.
+ * The ring keeps the last AP_CDC_SLOTS events; a consumer that falls
+ * further behind skips to the oldest one kept and the cursor counts what
+ * it lost.  The file sink is a cursor the writer drains itself, as one
+ * text line per event: "seq eth old_rank new_rank mobile_count".
+ *
+ * Ranks are global, so the stream is not available with --shards.
+ */
+
+#define AP_CDC_SLOTS 4096           // power of two
+
+typedef struct ap_cdc_event_tag {
+    uint64_t seq;
+    int eth;
+    int old_rank;
+    int new_rank;
+    int mobile_count;
+} ap_cdc_event_t;
+
+typedef struct ap_cdc_slot_tag {
+    _Atomic uint64_t seq;           // 0 while being written
+    _Atomic int eth;
+    _Atomic int old_rank;
+    _Atomic int new_rank;
+    _Atomic int mobile_count;
+} ap_cdc_slot_t;
+
+typedef struct ap_cdc_cursor_tag {
+    uint64_t next;                  // seq of the next event to read
+    uint64_t lost;                  // events overwritten before they were read
+} ap_cdc_cursor_t;
+
+typedef struct ap_cdc_tag {
+    _Atomic uint64_t head;          // seq of the last event
+    ap_cdc_slot_t slot[AP_CDC_SLOTS];
+    FILE *sink;                     // NULL without a file sink
+    ap_cdc_cursor_t sink_cursor;
+} ap_cdc_t;
+
+void ap_cdc_init(ap_cdc_t *cdc, FILE *sink);
+void ap_cdc_emit(ap_cdc_t *cdc, int eth, int old_rank, int new_rank, int mobile_count);
+void ap_cdc_subscribe(ap_cdc_t *cdc, ap_cdc_cursor_t *cur);
+int ap_cdc_poll(ap_cdc_t *cdc, ap_cdc_cursor_t *cur, ap_cdc_event_t *ev, int max);
+void ap_cdc_flush(ap_cdc_t *cdc);
+void ap_cdc_close(ap_cdc_t *cdc);
+
+/* the events of one command, see ap_cdc.c */
+int ap_cdc_before(ap_cdc_t *cdc, twl_list_t *leaderboard, const ap_cmd_t *cmd);
+void ap_cdc_after(ap_cdc_t *cdc, twl_list_t *leaderboard, const ap_cmd_t *cmd,
+        const ap_result_t *res, int old_rank);
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -0,0 +1,130 @@
+// ap_coalesce.c
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include "twl_list.h"
+#include "ap_command.h"
+#include "ap_support.h"
+#include "ap_order.h"
+#include "ap_coalesce.h"
+
+#define TRUE  1
+#define FALSE 0
+
+void ap_coalesce_init(ap_coalesce_t *co, int window)
+{
+    assert(window >= 1);
+    co->window = window;
+    co->count = 0;
+    co->ap_count = 0;
+    co->cmds = (ap_cmd_t *) malloc((size_t) window * sizeof(ap_cmd_t));
+    co->results = (ap_result_t *) malloc((size_t) window * sizeof(ap_result_t));
+    co->aps = (ap_coalesce_ap_t *) malloc((size_t) window * sizeof(ap_coalesce_ap_t));
+    assert(co->cmds != NULL && co->results != NULL && co->aps != NULL);
+    co->table_size = 4;
+    while (co->table_size < 2 * window)
+        co->table_size *= 2;
+    co->table = (int *) malloc((size_t) co->table_size * sizeof(int));
+    assert(co->table != NULL);
+    for (int i = 0; i < co->table_size; i++)
+        co->table[i] = -1;
+}
+
+void ap_coalesce_free(ap_coalesce_t *co)
+{
+    free(co->cmds);
+    free(co->results);
+    free(co->aps);
+    free(co->table);
+}
+
+/* Adds an INC or DEC to the batch, which must not be full */
+void ap_coalesce_add(ap_coalesce_t *co, const ap_cmd_t *cmd)
+{
+    assert(cmd->op == AP_OP_INC || cmd->op == AP_OP_DEC);
+    assert(co->count < co->window);
+    co->cmds[co->count++] = *cmd;
+}
+
+/* The batch entry of the AP, added on first use with the count it has
+ * now.  The table is at most half full, so a probe always ends.
+ */
+static ap_coalesce_ap_t *ap_of(ap_coalesce_t *co, ap_order_t *order, int eth)
+{
+    unsigned int mask = (unsigned int) co->table_size - 1;
+    unsigned int h = ((uint32_t) eth * 2654435761u) & mask;
+    ap_coalesce_ap_t *ap;
+
+    while (co->table[h] != -1) {
+        if (co->aps[co->table[h]].eth == eth)
+            return &co->aps[co->table[h]];
+        h = (h + 1) & mask;
+    }
+    ap = &co->aps[co->ap_count];
+    co->table[h] = co->ap_count++;
+    ap->eth = eth;
+    ap->rec = ap_order_find(order, eth);
+    ap->count = ap->rec != NULL ? ap->rec->mobile_count : 0;
+    ap->slot = (int) h;
+    return ap;
+}
+
+/* Fills in the result of every command in the batch, in order, without
+ * touching the leaderboard.  The codes are those of ap_inc and ap_dec.
+ */
+void ap_coalesce_plan(ap_coalesce_t *co, ap_order_t *order)
+{
+    for (int i = 0; i < co->count; i++) {
+        const ap_cmd_t *cmd = &co->cmds[i];
+        ap_result_t *res = &co->results[i];
+        ap_coalesce_ap_t *ap = ap_of(co, order, cmd->id);
+
+        memset(res, 0, sizeof(*res));
+        res->op = cmd->op;
+        res->eth = cmd->id;
+        if (ap->rec == NULL)
+            res->code = -2;
+        else if (cmd->op == AP_OP_INC)
+            res->code = ++ap->count;
+        else if (ap->count > 0)
+            res->code = --ap->count;
+        else
+            res->code = -1;
+        res->value = res->code;
+    }
+}
+
+/* Moves the i-th AP of the batch to the place of its final count in the
+ * leaderboard, which the rank index follows.  Returns TRUE if its count
+ * changed.
+ */
+int ap_coalesce_settle(ap_coalesce_t *co, int i, twl_list_t *leaderboard)
+{
+    ap_coalesce_ap_t *ap = &co->aps[i];
+    ap_info_t *removed;
+    int position;
+
+    assert(i >= 0 && i < co->ap_count);
+    if (ap->rec == NULL || ap->rec->mobile_count == ap->count)
+        return FALSE;
+    position = twl_list_elem_find_position(leaderboard, ap->rec, ap_match_eth);
+    removed = twl_list_remove(leaderboard, position);
+    assert(removed == ap->rec);
+    ap->rec->mobile_count = ap->count;
+    twl_list_insert_sorted(leaderboard, ap->rec);
+    return TRUE;
+}
+
+void ap_coalesce_reset(ap_coalesce_t *co)
+{
+    for (int i = 0; i < co->ap_count; i++)
+        co->table[co->aps[i].slot] = -1;
+    co->count = 0;
+    co->ap_count = 0;
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
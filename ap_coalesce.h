@@ -0,0 +1,53 @@
+// ap_coalesce.h
+
+/* Coalescing of INC and DEC runs, for --coalesce window.
+ *
+ * Collectors send long runs of INC and DEC for a few APs, and each one
+ * finds its record, takes it out of the leaderboard and inserts it again.
+ * wifi gathers up to window consecutive INC and DEC commands instead and
+ * runs them as one batch:
+ *
+ *     ap_coalesce_add      each command, in input order
+ *     ap_coalesce_plan     finds each AP once, through the rank index, and
+ *                          works out every command's result in order:
+ *                          the count it left, the zero floor of DEC and
+ *                          not found, exactly as ap_inc and ap_dec would
+ *     ap_coalesce_settle   moves each AP whose count changed to its final
+ *                          place, with one remove and sorted insert
+ *     ap_coalesce_reset    empties the batch for the next one
+ *
+ * The results go out one per command, so the output is the same as
+ * without coalescing.  Each command is still journaled on its own.
+ */
+
+#define AP_COALESCE_MAX 65536     // largest window
+
+typedef struct ap_coalesce_ap_tag {
+    int eth;
+    ap_info_t *rec;             // the leaderboard record, NULL if none
+    int count;                  // mobile count after the batch
+    int slot;                   // its entry in the table
+} ap_coalesce_ap_t;
+
+typedef struct ap_coalesce_tag {
+    int window;                 // most commands in a batch
+    int count;                  // commands in the batch
+    ap_cmd_t *cmds;             // window of them
+    ap_result_t *results;       // one per command, after ap_coalesce_plan
+    ap_coalesce_ap_t *aps;      // the distinct APs, in order of first use
+    int ap_count;
+    int *table;                 // eth hash to aps index, -1 empty
+    int table_size;             // power of two, at least twice window
+} ap_coalesce_t;
+
+struct ap_order_tag;
+
+void ap_coalesce_init(ap_coalesce_t *co, int window);
+void ap_coalesce_free(ap_coalesce_t *co);
+void ap_coalesce_add(ap_coalesce_t *co, const ap_cmd_t *cmd);
+void ap_coalesce_plan(ap_coalesce_t *co, struct ap_order_tag *order);
+int ap_coalesce_settle(ap_coalesce_t *co, int i, twl_list_t *leaderboard);
+void ap_coalesce_reset(ap_coalesce_t *co);
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -0,0 +1,397 @@
+// ap_command.c
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include "twl_list.h"
+#include "ap_command.h"
+#include "ap_support.h"
+#include "ap_input.h"
+
+#define TRUE  1
+#define FALSE 0
+
+/* The scanners below follow the scanf conversions they replace.  Each one
+ * advances *pp past what it consumed and returns TRUE if the conversion
+ * succeeded.
+ */
+static int is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+static const char *skip_space(const char *p, const char *end)
+{
+    while (p < end && is_space(*p))
+        p++;
+    return p;
+}
+
+/* %s */
+static int scan_token(const char **pp, const char *end, const char **tok, size_t *tok_len)
+{
+    const char *p = skip_space(*pp, end);
+    const char *start = p;
+
+    while (p < end && !is_space(*p))
+        p++;
+    if (p == start)
+        return FALSE;
+    *tok = start;
+    *tok_len = (size_t) (p - start);
+    *pp = p;
+    return TRUE;
+}
+
+/* %d.  Like glibc the value is read as a saturated long and then
+ * truncated to int.
+ */
+static int scan_int(const char **pp, const char *end, int *val)
+{
+    const char *p = skip_space(*pp, end);
+    long v = 0;
+    int neg = FALSE, over = FALSE;
+
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = *p == '-';
+        p++;
+    }
+    if (p >= end || *p < '0' || *p > '9')
+        return FALSE;
+    while (p < end && *p >= '0' && *p <= '9') {
+        int d = *p - '0';
+        if (v > (LONG_MAX - d) / 10)
+            over = TRUE;
+        else
+            v = v * 10 + d;
+        p++;
+    }
+    if (over)
+        v = neg ? LONG_MIN : LONG_MAX;
+    else if (neg)
+        v = -v;
+    *val = (int) v;
+    *pp = p;
+    return TRUE;
+}
+
+/* %f.  Only the few characters of the number are copied, so strtof can do
+ * the correctly rounded conversion.
+ */
+static int scan_float(const char **pp, const char *end, float *val)
+{
+    char buf[64];
+    const char *p = skip_space(*pp, end);
+    size_t n = 0;
+    char *stop;
+
+    while (p + n < end && n < sizeof(buf) - 1 && !is_space(p[n]))
+        n++;
+    memcpy(buf, p, n);
+    buf[n] = '\0';
+    float v = strtof(buf, &stop);
+    if (stop == buf)
+        return FALSE;
+    *val = v;
+    *pp = p + (stop - buf);
+    return TRUE;
+}
+
+/* Field conversions shared by the prompted and the inline record forms.
+ * They give the same encoding ap_create_info does.
+ */
+static int auth_code(const char *str)
+{
+    return strcmp(str, "T")==0 || strcmp(str, "t")==0;
+}
+
+static int privacy_code(const char *str)
+{
+    if (strcmp(str, "WEP")==0)
+        return 1;
+    else if (strcmp(str, "WPA")==0)
+        return 2;
+    else if (strcmp(str, "WPA2")==0)
+        return 3;
+    else
+        return 0;
+}
+
+static int letter_code(char letter)
+{
+    if (letter < 'a' || letter > 'z')
+        letter = 'a';
+    return letter - 'a';
+}
+
+/* %s into a NUL terminated buffer of MAXLINE bytes */
+static int scan_word(const char **pp, const char *end, char *str)
+{
+    const char *tok;
+    size_t tok_len;
+
+    if (!scan_token(pp, end, &tok, &tok_len))
+        return FALSE;
+    memcpy(str, tok, tok_len);
+    str[tok_len] = '\0';
+    return TRUE;
+}
+
+/* Parses the inline record of ADDR and JOINQR:
+ *     eth ip loc auth privacy letter band channel rate time
+ * Every field must be present and nothing may follow.  Returns the record,
+ * or NULL if the line does not have that shape.
+ */
+static ap_info_t *parse_inline_info(const char *p, const char *end)
+{
+    char str[MAXLINE];
+    ap_info_t *new = (ap_info_t *) calloc(1, sizeof(ap_info_t));
+    assert(new != NULL);
+
+    if (!scan_int(&p, end, &new->eth_address)
+            || !scan_int(&p, end, &new->ip_address)
+            || !scan_int(&p, end, &new->location_code))
+        goto bad;
+    if (!scan_word(&p, end, str))
+        goto bad;
+    new->authenticated = auth_code(str);
+    if (!scan_word(&p, end, str))
+        goto bad;
+    new->privacy = privacy_code(str);
+    if (!scan_word(&p, end, str))
+        goto bad;
+    new->standard_letter = letter_code(str[0]);
+    if (!scan_float(&p, end, &new->band)
+            || !scan_int(&p, end, &new->channel)
+            || !scan_float(&p, end, &new->data_rate)
+            || !scan_int(&p, end, &new->time_received))
+        goto bad;
+    if (skip_space(p, end) != end)
+        goto bad;
+    return new;
+
+bad:
+    free(new);
+    return NULL;
+}
+
+/* Fills in cmd from one input line.  The line does not need to be NUL
+ * terminated.
+ *
+ * ADDR and JOINQR carry the whole record on the command line and come back
+ * as AP_OP_ADD and AP_OP_JOINQ with cmd->rec already filled in.  The caller
+ * owns that record.  For the prompted forms cmd->rec is NULL and the record
+ * lines are read with ap_read_info.
+ */
+void ap_parse_command(const char *line, size_t len, ap_cmd_t *cmd)
+{
+    char command[MAXLINE];
+    const char *p = line;
+    const char *end = line + len;
+    const char *tok;
+    size_t tok_len;
+    int num_items;
+
+    cmd->op = AP_OP_NONE;
+    cmd->id = 0;
+    cmd->arg = 0;
+    cmd->rec = NULL;
+    cmd->prompted = FALSE;
+    cmd->text = line;
+    cmd->text_len = len;
+    cmd->image = NULL;
+    cmd->image_len = 0;
+
+    if (!scan_token(&p, end, &tok, &tok_len))
+        return;
+    assert(tok_len < MAXLINE);
+    memcpy(command, tok, tok_len);
+    command[tok_len] = '\0';
+    if (strcmp(command, "ADDR") == 0 || strcmp(command, "JOINQR") == 0) {
+        cmd->rec = parse_inline_info(p, end);
+        if (cmd->rec != NULL) {
+            cmd->op = command[0] == 'A' ? AP_OP_ADD : AP_OP_JOINQ;
+            cmd->id = cmd->rec->eth_address;
+        }
+        return;
+    }
+    if (strcmp(command, "SAVE") == 0 || strcmp(command, "LOAD") == 0) {
+        const char *path;
+        size_t path_len;
+        if (scan_token(&p, end, &path, &path_len) && skip_space(p, end) == end) {
+            cmd->op = command[0] == 'S' ? AP_OP_SAVE : AP_OP_LOAD;
+            cmd->text = path;
+            cmd->text_len = path_len;
+        }
+        return;
+    }
+
+    num_items = 1;
+    if (scan_int(&p, end, &cmd->id)) {
+        num_items++;
+        if (scan_int(&p, end, &cmd->arg)) {
+            num_items++;
+            if (scan_token(&p, end, &tok, &tok_len))
+                num_items++;
+        }
+    }
+
+    if (num_items == 2 && strcmp(command, "ADD") == 0) {
+        cmd->op = AP_OP_ADD;
+    } else if (num_items == 2 && strcmp(command, "REMOVE") == 0) {
+        cmd->op = AP_OP_REMOVE;
+    } else if (num_items == 2 && strcmp(command, "FIND") == 0) {
+        cmd->op = AP_OP_FIND;
+    } else if (num_items == 2 && strcmp(command, "INC") == 0) {
+        cmd->op = AP_OP_INC;
+    } else if (num_items == 2 && strcmp(command, "DEC") == 0) {
+        cmd->op = AP_OP_DEC;
+    } else if (num_items == 1 && strcmp(command, "PRINT") == 0) {
+        cmd->op = AP_OP_PRINT;
+    } else if (num_items == 1 && strcmp(command, "REMOVEALL") == 0) {
+        cmd->op = AP_OP_REMOVEALL;
+    } else if (num_items == 2 && strcmp(command, "JOINQ") == 0) {
+        cmd->op = AP_OP_JOINQ;
+    } else if (num_items == 1 && strcmp(command, "MOVEQTOL") == 0) {
+        cmd->op = AP_OP_MOVEQTOL;
+    } else if (num_items == 2 && strcmp(command, "SORTAP") == 0) {
+        cmd->op = AP_OP_SORTAP;
+    } else if (num_items == 2 && strcmp(command, "SORTETH") == 0) {
+        cmd->op = AP_OP_SORTETH;
+    } else if (num_items == 3 && strcmp(command, "APPENDQ") == 0) {
+        cmd->op = AP_OP_APPENDQ;
+    } else if (num_items == 1 && strcmp(command, "PRINTQ") == 0) {
+        cmd->op = AP_OP_PRINTQ;
+    } else if (num_items == 1 && strcmp(command, "STATS") == 0) {
+        cmd->op = AP_OP_STATS;
+    } else if (num_items == 1 && strcmp(command, "QUIT") == 0) {
+        cmd->op = AP_OP_QUIT;
+    } else if (num_items == 1 && strcmp(command, "METRICS") == 0) {
+        cmd->op = AP_OP_METRICS;
+    } else if (num_items == 1 && strcmp(command, "LISTSTATS") == 0) {
+        cmd->op = AP_OP_LISTSTATS;
+    } else if (num_items == 1 && strcmp(command, "PERFON") == 0) {
+        cmd->op = AP_OP_PERFON;
+    } else if (num_items == 1 && strcmp(command, "PERFOFF") == 0) {
+        cmd->op = AP_OP_PERFOFF;
+    } else if (num_items == 1 && strcmp(command, "CALIBRATE") == 0) {
+        cmd->op = AP_OP_CALIBRATE;
+    } else if (num_items == 2 && strcmp(command, "TOPQ") == 0) {
+        cmd->op = AP_OP_TOPQ;
+    } else if (num_items == 2 && strcmp(command, "PARTQ") == 0) {
+        cmd->op = AP_OP_PARTQ;
+    } else if (num_items == 2 && strcmp(command, "RANK") == 0) {
+        cmd->op = AP_OP_RANK;
+    } else if (num_items == 2 && strcmp(command, "TOPK") == 0) {
+        cmd->op = AP_OP_TOPK;
+    } else if (num_items == 3 && strcmp(command, "RANGE") == 0) {
+        cmd->op = AP_OP_RANGE;
+    } else if (num_items == 3 && strcmp(command, "EXPIRE") == 0) {
+        cmd->op = AP_OP_EXPIRE;
+    } else if (num_items == 2 && strcmp(command, "FINDIP") == 0) {
+        cmd->op = AP_OP_FINDIP;
+    } else if (num_items == 2 && strcmp(command, "FINDLOC") == 0) {
+        cmd->op = AP_OP_FINDLOC;
+    } else if (num_items == 2 && strcmp(command, "VIEWQ") == 0) {
+        cmd->op = AP_OP_VIEWQ;
+    }
+}
+
+/* The command word of op, or NULL for AP_OP_NONE */
+const char *ap_op_name(int op)
+{
+    static const char *names[AP_OP_COUNT] = {
+        NULL, "ADD", "REMOVE", "FIND", "INC", "DEC", "PRINT", "REMOVEALL",
+        "JOINQ", "MOVEQTOL", "SORTAP", "SORTETH", "APPENDQ", "PRINTQ", "STATS",
+        "QUIT", "SAVE", "LOAD", "METRICS", "LISTSTATS",
+        "PERFON", "PERFOFF", "CALIBRATE", "TOPQ", "PARTQ", "RANK", "TOPK",
+        "RANGE", "EXPIRE", "FINDIP", "FINDLOC", "VIEWQ"
+    };
+
+    assert(op >= 0 && op < AP_OP_COUNT);
+    return names[op];
+}
+
+/* fgets leaves its buffer untouched at end of input, so a missing line
+ * parses the previous one again.
+ */
+static void next_field(in_src_t *in, const char **line, size_t *len)
+{
+    const char *l;
+    size_t n;
+
+    if (in_next_line(in, &l, &n)) {
+        *line = l;
+        *len = n;
+    }
+}
+
+/* %s into str.  str is left alone if the line has no token, as sscanf
+ * does.
+ */
+static void read_word(const char *line, size_t len, char *str)
+{
+    const char *p = line;
+    scan_word(&p, line + len, str);
+}
+
+/* Reads the nine lines that follow an ADD or JOINQ and builds the record.
+ *
+ * This is ap_create_info without the prompts: the lines are parsed with
+ * the same conversions and defaults, in place, from the input source.  The
+ * caller prints the prompts (see ap_print_prompts) if they are wanted.
+ */
+ap_info_t *ap_read_info(in_src_t *in, int sta_id)
+{
+    const char *line = "";
+    size_t len = 0;
+    const char *p;
+    char str[MAXLINE] = "";
+    char letter = 'a';
+    ap_info_t *new = (ap_info_t *) calloc(1, sizeof(ap_info_t));
+    assert(new != NULL);
+
+    new->eth_address = sta_id;
+    next_field(in, &line, &len);
+    p = line;
+    scan_int(&p, line + len, &new->ip_address);
+    next_field(in, &line, &len);
+    p = line;
+    scan_int(&p, line + len, &new->location_code);
+
+    next_field(in, &line, &len);
+    read_word(line, len, str);
+    new->authenticated = auth_code(str);
+
+    next_field(in, &line, &len);
+    read_word(line, len, str);
+    new->privacy = privacy_code(str);
+
+    next_field(in, &line, &len);
+    if (len > 0)
+        letter = line[0];
+    new->standard_letter = letter_code(letter);
+
+    next_field(in, &line, &len);
+    p = line;
+    scan_float(&p, line + len, &new->band);
+
+    next_field(in, &line, &len);
+    p = line;
+    scan_int(&p, line + len, &new->channel);
+
+    next_field(in, &line, &len);
+    p = line;
+    scan_float(&p, line + len, &new->data_rate);
+
+    next_field(in, &line, &len);
+    p = line;
+    scan_int(&p, line + len, &new->time_received);
+
+    return new;
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -0,0 +1,114 @@
+// ap_command.h
+
+/* Parsed form of one command line.
+ *
+ * The text parser works directly on a line handed out by an in_src_t, so it
+ * never needs a NUL terminated copy of the input.  It accepts exactly the
+ * lines the original
+ *     sscanf(line, "%s%d%d%s", command, &ap_id, &mob_cnt, junk)
+ * dispatch accepted; every other line becomes AP_OP_NONE and is echoed.
+ *
+ * It also accepts a single-line form of ADD and JOINQ that carries the
+ * whole record and needs no prompts:
+ *     ADDR eth ip loc T WPA2 n 5.0 36 54 1700000000
+ *     JOINQR eth ip loc auth privacy letter band channel rate time
+ *
+ * SAVE and LOAD take a file name, which is left in text/text_len:
+ *     SAVE path
+ *     LOAD path
+ *
+ * TOPQ n, PARTQ n and TOPK k take the count in id, RANGE lo hi the
+ * bounds in id and arg, and EXPIRE now ttl the time in id and the ttl in
+ * arg.  FINDIP ip and FINDLOC loc take the key in id, and VIEWQ view the
+ * view.
+ *
+ * The op values double as the opcodes of the binary protocol (ap_proto.h),
+ * so they must not be renumbered.
+ */
+
+enum ap_op {
+    AP_OP_NONE = 0,     // not a command, echo the line
+    AP_OP_ADD = 1,
+    AP_OP_REMOVE = 2,
+    AP_OP_FIND = 3,
+    AP_OP_INC = 4,
+    AP_OP_DEC = 5,
+    AP_OP_PRINT = 6,
+    AP_OP_REMOVEALL = 7,
+    AP_OP_JOINQ = 8,
+    AP_OP_MOVEQTOL = 9,
+    AP_OP_SORTAP = 10,
+    AP_OP_SORTETH = 11,
+    AP_OP_APPENDQ = 12,
+    AP_OP_PRINTQ = 13,
+    AP_OP_STATS = 14,
+    AP_OP_QUIT = 15,
+    AP_OP_SAVE = 16,    // write a snapshot, see ap_snapshot.h
+    AP_OP_LOAD = 17,    // replace both lists from a snapshot
+    AP_OP_METRICS = 18, // latency per command, see ap_metrics.h
+    AP_OP_LISTSTATS = 19, // list operation counts, see twl_list.h
+    AP_OP_PERFON = 20,  // start counting a command range, see ap_perf.h
+    AP_OP_PERFOFF = 21, // report the counts since PERFON
+    AP_OP_CALIBRATE = 22, // tune sort_type 0, see ap_tune.h
+    AP_OP_TOPQ = 23,    // the best n queue records, see ap_topq
+    AP_OP_PARTQ = 24,   // TOPQ that also moves them to the front
+    AP_OP_RANK = 25,    // position of an AP, see ap_order.h
+    AP_OP_TOPK = 26,    // the first k leaderboard records
+    AP_OP_RANGE = 27,   // the records with a mobile count from lo to hi
+    AP_OP_EXPIRE = 28,  // stale records out of both lists, see ap_expire.h
+    AP_OP_FINDIP = 29,  // the records with an IP address, see ap_lookup.h
+    AP_OP_FINDLOC = 30, // the records at a location
+    AP_OP_VIEWQ = 31,   // the queue in another order, see ap_views.h
+    AP_OP_COUNT
+};
+
+typedef struct ap_cmd_tag {
+    int op;             // one of enum ap_op
+    int id;             // eth address, sort type, IP address, location
+                        // or view
+    int arg;            // mobile count for APPENDQ, RANGE hi, EXPIRE ttl
+    ap_info_t *rec;     // ADD/JOINQ record, owned by the command
+    int prompted;       // the ADD/JOINQ prompts still have to be printed
+    const char *text;   // the raw line, for echo; SAVE/LOAD: the path
+    size_t text_len;
+    const unsigned char *image; // LOAD from the journal: the snapshot it
+    size_t image_len;           // loaded, NULL otherwise
+} ap_cmd_t;
+
+#define AP_PERF_EVENTS 4    // hardware counters, see ap_perf.h
+
+/* Outcome of one command.  The ap_support functions fill it in and
+ * ap_report (text) or ap_proto_put_result (binary) turn it into output.
+ */
+typedef struct ap_result_tag {
+    int op;             // one of enum ap_op
+    int code;           // add_result, move_result, inc_result, ...
+    int eth;            // AP the command was about
+    int value;          // new mobile count, records removed, list size
+    int aux;            // leaderboard limit, queue size
+    double elapsed;     // sort time in milliseconds
+    int prompted;       // print the ADD/JOINQ prompts first
+    ap_info_t rec;      // REMOVE: copy of the removed record; RANK: of
+                        // the record found
+    twl_list_t *list;   // PRINT/PRINTQ/TOPQ/PARTQ/TOPK/RANGE/FINDIP/
+                        // FINDLOC/VIEWQ: the list
+    int owns_list;      // list is a copy to free after the report
+    const char *text;   // AP_OP_NONE: line to echo; SAVE/LOAD/CALIBRATE:
+    size_t text_len;    // the path
+    const char *note;   // SAVE/LOAD/PERFON/PERFOFF/CALIBRATE: why it failed
+    struct ap_metrics_tag *metrics; // METRICS: a copy, freed after the report
+    twl_list_stats_t stats[2];  // LISTSTATS: leaderboard, queue
+    int counted;        // perf is set: SORTAP/SORTETH with --perf, PERFOFF
+    long long perf[AP_PERF_EVENTS]; // counter deltas, -1 if not counted
+    twl_sort_tuning_t tuning;   // CALIBRATE: the new choices
+} ap_result_t;
+
+struct in_src_tag;
+
+const char *ap_op_name(int op);
+
+void ap_parse_command(const char *line, size_t len, ap_cmd_t *cmd);
+ap_info_t *ap_read_info(struct in_src_tag *in, int sta_id);
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -0,0 +1,243 @@
+// ap_expire.c
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include "twl_list.h"
+#include "ap_expire.h"
+
+#define TRUE  1
+#define FALSE 0
+
+#define EXPIRE_MIN_BUCKETS 64
+#define EXPIRE_MIN_HEAP 64
+
+static void observe(void *ctx, twl_list_t *list, ll_node_t *node, int event);
+
+void ap_expire_init(ap_expire_t *ex)
+{
+    ex->count = 0;
+    ex->capacity = EXPIRE_MIN_HEAP;
+    ex->heap = (ap_expire_entry_t **) malloc((size_t) ex->capacity
+            * sizeof(ap_expire_entry_t *));
+    assert(ex->heap != NULL);
+    ex->bucket_count = EXPIRE_MIN_BUCKETS;
+    ex->buckets = (ap_expire_entry_t **) calloc((size_t) ex->bucket_count,
+            sizeof(ap_expire_entry_t *));
+    assert(ex->buckets != NULL);
+    ex->list_count = 0;
+}
+
+/* Stops watching the lists, which stay as they are */
+void ap_expire_free(ap_expire_t *ex)
+{
+    for (int i = 0; i < ex->list_count; i++)
+        twl_list_unobserve(ex->lists[i], observe, ex);
+    for (int i = 0; i < ex->count; i++)
+        free(ex->heap[i]);
+    free(ex->heap);
+    free(ex->buckets);
+}
+
+static unsigned int hash_node(const ap_expire_t *ex, const ll_node_t *node)
+{
+    return ((uint32_t) ((uintptr_t) node >> 4) * 2654435761u)
+        & (unsigned int) (ex->bucket_count - 1);
+}
+
+static ap_expire_entry_t **hash_slot(ap_expire_t *ex, const ll_node_t *node)
+{
+    ap_expire_entry_t **slot = &ex->buckets[hash_node(ex, node)];
+
+    while (*slot != NULL && (*slot)->node != node)
+        slot = &(*slot)->hash_next;
+    return slot;
+}
+
+/* Puts every entry in the buckets again, after they changed size or lost
+ * entries
+ */
+static void hash_rebuild(ap_expire_t *ex)
+{
+    memset(ex->buckets, 0, (size_t) ex->bucket_count * sizeof(ap_expire_entry_t *));
+    for (int i = 0; i < ex->count; i++) {
+        unsigned int h = hash_node(ex, ex->heap[i]->node);
+        ex->heap[i]->hash_next = ex->buckets[h];
+        ex->buckets[h] = ex->heap[i];
+    }
+}
+
+static void heap_set(ap_expire_t *ex, int i, ap_expire_entry_t *e)
+{
+    ex->heap[i] = e;
+    e->slot = i;
+}
+
+static void heap_up(ap_expire_t *ex, int i)
+{
+    ap_expire_entry_t *e = ex->heap[i];
+
+    while (i > 0 && ex->heap[(i - 1) / 2]->time > e->time) {
+        heap_set(ex, i, ex->heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    heap_set(ex, i, e);
+}
+
+static void heap_down(ap_expire_t *ex, int i)
+{
+    ap_expire_entry_t *e = ex->heap[i];
+
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= ex->count)
+            break;
+        if (child + 1 < ex->count && ex->heap[child + 1]->time < ex->heap[child]->time)
+            child++;
+        if (ex->heap[child]->time >= e->time)
+            break;
+        heap_set(ex, i, ex->heap[child]);
+        i = child;
+    }
+    heap_set(ex, i, e);
+}
+
+static void add_node(ap_expire_t *ex, twl_list_t *list, ll_node_t *node)
+{
+    ap_expire_entry_t **slot = hash_slot(ex, node);
+    ap_expire_entry_t *e;
+
+    assert(*slot == NULL);
+    e = (ap_expire_entry_t *) malloc(sizeof(ap_expire_entry_t));
+    assert(e != NULL);
+    e->node = node;
+    e->list = list;
+    e->time = ((ap_info_t *) twl_list_node_data(node))->time_received;
+    e->hash_next = NULL;
+    *slot = e;
+
+    if (ex->count == ex->capacity) {
+        ex->capacity *= 2;
+        ex->heap = (ap_expire_entry_t **) realloc(ex->heap, (size_t) ex->capacity
+                * sizeof(ap_expire_entry_t *));
+        assert(ex->heap != NULL);
+    }
+    heap_set(ex, ex->count++, e);
+    heap_up(ex, e->slot);
+
+    if (ex->count > ex->bucket_count) {
+        free(ex->buckets);
+        ex->bucket_count *= 2;
+        ex->buckets = (ap_expire_entry_t **) calloc((size_t) ex->bucket_count,
+                sizeof(ap_expire_entry_t *));
+        assert(ex->buckets != NULL);
+        hash_rebuild(ex);
+    }
+}
+
+static void drop_node(ap_expire_t *ex, ll_node_t *node)
+{
+    ap_expire_entry_t **slot = hash_slot(ex, node);
+    ap_expire_entry_t *e = *slot;
+    int i;
+
+    assert(e != NULL);
+    *slot = e->hash_next;
+    i = e->slot;
+    ex->count--;
+    if (i < ex->count) {
+        ap_expire_entry_t *last = ex->heap[ex->count];
+        heap_set(ex, i, last);
+        heap_down(ex, i);
+        heap_up(ex, last->slot);
+    }
+    free(e);
+}
+
+/* Forgets the nodes of one list, in O(n) */
+static void drop_list(ap_expire_t *ex, twl_list_t *list)
+{
+    int kept = 0;
+
+    for (int i = 0; i < ex->count; i++) {
+        if (ex->heap[i]->list == list)
+            free(ex->heap[i]);
+        else
+            ex->heap[kept++] = ex->heap[i];
+    }
+    ex->count = kept;
+    for (int i = kept / 2 - 1; i >= 0; i--)
+        heap_down(ex, i);
+    for (int i = 0; i < kept; i++)
+        ex->heap[i]->slot = i;
+    hash_rebuild(ex);
+}
+
+static void add_list(ap_expire_t *ex, twl_list_t *list)
+{
+    for (ll_node_t *node = twl_list_front_node(list); node != NULL;
+            node = twl_list_next_node(node))
+        add_node(ex, list, node);
+}
+
+static void observe(void *ctx, twl_list_t *list, ll_node_t *node, int event)
+{
+    ap_expire_t *ex = (ap_expire_t *) ctx;
+
+    switch (event) {
+    case TWL_LIST_LINKED:
+        add_node(ex, list, node);
+        break;
+    case TWL_LIST_UNLINKED:
+        drop_node(ex, node);
+        break;
+    case TWL_LIST_RESHAPED:
+        drop_list(ex, list);
+        add_list(ex, list);
+        break;
+    case TWL_LIST_DESTROYED:
+        drop_list(ex, list);
+        for (int i = 0; i < ex->list_count; i++) {
+            if (ex->lists[i] == list)
+                ex->lists[i] = ex->lists[--ex->list_count];
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/* Indexes the records of list and follows its changes from now on, until
+ * it is destructed.  At most AP_EXPIRE_LISTS lists at a time.
+ */
+void ap_expire_watch(ap_expire_t *ex, twl_list_t *list)
+{
+    assert(ex->list_count < AP_EXPIRE_LISTS);
+    ex->lists[ex->list_count++] = list;
+    twl_list_observe(list, observe, ex);
+    add_list(ex, list);
+}
+
+ap_info_t *ap_expire_next(ap_expire_t *ex, long long cutoff, twl_list_t **list)
+{
+    while (ex->count > 0 && ex->heap[0]->time < cutoff) {
+        ap_expire_entry_t *top = ex->heap[0];
+        ap_info_t *rec = (ap_info_t *) twl_list_node_data(top->node);
+
+        if (rec->time_received != top->time) {
+            /* refreshed since it went in */
+            top->time = rec->time_received;
+            heap_down(ex, 0);
+            continue;
+        }
+        /* the list tells the observer, which drops the entry */
+        *list = top->list;
+        return twl_list_remove_node(top->list, top->node);
+    }
+    return NULL;
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
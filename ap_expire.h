@@ -0,0 +1,53 @@
+// ap_expire.h
+
+/* Expiry index of both lists, for EXPIRE now ttl.
+ *
+ * A record is stale once its time_received is before now - ttl.  The
+ * index keeps a min-heap of the records of the lists it watches, keyed by
+ * time_received, so an EXPIRE looks only at the records it removes, at
+ * O(log n) each, instead of scanning the lists.
+ *
+ * The heap holds node handles and watches the lists as an observer (see
+ * twl_list_observer_t), so it follows every insert, remove and sort by
+ * itself, whichever code made them, and a stale record is unlinked in
+ * O(1) wherever it is in its list.  A hash table from node to heap entry
+ * finds the entry of a node that is unlinked.
+ *
+ * A record may get a later time_received while it is in the heap, as INC
+ * and DEC refresh it: its entry then sorts too early, and is moved down
+ * to the new time when it comes to the top.  A record must not get an
+ * earlier time_received in place.
+ */
+
+#define AP_EXPIRE_LISTS 2           // the leaderboard and the queue
+
+typedef struct ap_expire_entry_tag {
+    ll_node_t *node;
+    twl_list_t *list;
+    int time;                       // at most the record's time_received
+    int slot;                       // position in the heap
+    struct ap_expire_entry_tag *hash_next;
+} ap_expire_entry_t;
+
+typedef struct ap_expire_tag {
+    ap_expire_entry_t **heap;       // earliest time at heap[0]
+    int count;
+    int capacity;
+    ap_expire_entry_t **buckets;    // node hash, chained by hash_next
+    int bucket_count;               // power of two
+    twl_list_t *lists[AP_EXPIRE_LISTS];
+    int list_count;
+} ap_expire_t;
+
+void ap_expire_init(ap_expire_t *ex);
+void ap_expire_free(ap_expire_t *ex);
+void ap_expire_watch(ap_expire_t *ex, twl_list_t *list);
+
+/* Unlinks and returns the next record with a time_received before cutoff,
+ * or NULL if there is none left; *list is the list it was in.  The caller
+ * frees the record.
+ */
+ap_info_t *ap_expire_next(ap_expire_t *ex, long long cutoff, twl_list_t **list);
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -0,0 +1,148 @@
+// ap_export.c
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "twl_list.h"
+#include "ap_export.h"
+
+#define TRUE  1
+#define FALSE 0
+
+static ap_export_buf_t *export_buf(ap_export_seg_t *seg, uint64_t generation)
+{
+    return (ap_export_buf_t *) ((char *) seg + AP_EXPORT_HEADER_SIZE
+            + (generation & 1) * seg->buf_size);
+}
+
+/* Creates the shared memory object name, replacing one left behind, with
+ * room for capacity records.  Generation 0 is an empty leaderboard.
+ * Returns 0, or -1 with a reason in *why.
+ */
+int ap_export_open(ap_export_t *ex, const char *name, int capacity, const char **why)
+{
+    size_t buf_size = (sizeof(ap_export_buf_t) + (size_t) capacity * sizeof(ap_info_t)
+            + 63) & ~(size_t) 63;
+    int fd;
+    void *p;
+
+    assert(sizeof(ap_export_seg_t) <= AP_EXPORT_HEADER_SIZE && capacity > 0);
+    memset(ex, 0, sizeof(*ex));
+    if (name[0] != '/' || strchr(name + 1, '/') != NULL || strlen(name) >= sizeof(ex->name)) {
+        *why = "the name must be /name";
+        return -1;
+    }
+    strcpy(ex->name, name);
+    ex->size = AP_EXPORT_HEADER_SIZE + 2 * buf_size;
+
+    shm_unlink(name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        *why = strerror(errno);
+        return -1;
+    }
+    if (ftruncate(fd, (off_t) ex->size) != 0) {
+        *why = strerror(errno);
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+    p = mmap(NULL, ex->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        *why = strerror(errno);
+        shm_unlink(name);
+        return -1;
+    }
+
+    /* the object is new, so it is all zeros: both buffers are empty and
+     * even.  The magic goes in last, once the header is complete.
+     */
+    ex->seg = (ap_export_seg_t *) p;
+    ex->seg->version = AP_EXPORT_VERSION;
+    ex->seg->capacity = (uint32_t) capacity;
+    ex->seg->buf_size = (uint32_t) buf_size;
+    atomic_thread_fence(memory_order_release);
+    memcpy(ex->seg->magic, AP_EXPORT_MAGIC, 4);
+    return 0;
+}
+
+/* Counts a command that changed the lists.  Returns TRUE when a publish is
+ * due.
+ */
+int ap_export_changed(ap_export_t *ex)
+{
+    return ++ex->changes >= AP_EXPORT_BATCH;
+}
+
+/* A publish in three steps, for a leaderboard that is not one list:
+ * ap_export_begin starts filling the buffer that is not current,
+ * ap_export_put adds the records in ap_rank_aps order and ap_export_end
+ * makes the buffer current.
+ */
+void ap_export_begin(ap_export_t *ex)
+{
+    uint64_t generation = atomic_load_explicit(&ex->seg->generation, memory_order_relaxed) + 1;
+    ap_export_buf_t *buf = export_buf(ex->seg, generation);
+
+    atomic_store_explicit(&buf->seq, atomic_load_explicit(&buf->seq, memory_order_relaxed) + 1,
+            memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    buf->generation = generation;
+    buf->count = 0;
+}
+
+void ap_export_put(ap_export_t *ex, const ap_info_t *rec)
+{
+    ap_export_buf_t *buf = export_buf(ex->seg,
+            atomic_load_explicit(&ex->seg->generation, memory_order_relaxed) + 1);
+
+    assert(buf->count < ex->seg->capacity);
+    buf->rec[buf->count++] = *rec;
+}
+
+void ap_export_end(ap_export_t *ex, int queue_size)
+{
+    ap_export_seg_t *seg = ex->seg;
+    uint64_t generation = atomic_load_explicit(&seg->generation, memory_order_relaxed) + 1;
+    ap_export_buf_t *buf = export_buf(seg, generation);
+
+    buf->queue_size = (uint32_t) queue_size;
+    atomic_store_explicit(&buf->seq, atomic_load_explicit(&buf->seq, memory_order_relaxed) + 1,
+            memory_order_release);
+    atomic_store_explicit(&seg->generation, generation, memory_order_release);
+    ex->changes = 0;
+}
+
+/* Copies leaderboard, which must be in ap_rank_aps order, into the buffer
+ * that is not current and makes it current.
+ */
+void ap_export_publish(ap_export_t *ex, twl_list_t *leaderboard, int queue_size)
+{
+    ap_export_begin(ex);
+    for (ll_node_t *node = twl_list_front_node(leaderboard); node != NULL;
+            node = twl_list_next_node(node))
+        ap_export_put(ex, (ap_info_t *) twl_list_node_data(node));
+    ap_export_end(ex, queue_size);
+}
+
+/* Marks the export closed and removes its name.  Mapped readers keep the
+ * last leaderboard.
+ */
+void ap_export_close(ap_export_t *ex)
+{
+    atomic_store_explicit(&ex->seg->closed, TRUE, memory_order_release);
+    munmap(ex->seg, ex->size);
+    shm_unlink(ex->name);
+    ex->seg = NULL;
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -0,0 +1,89 @@
+// ap_export.h
+
+/* Read-only leaderboard export in POSIX shared memory.
+ *
+ * wifi --export /name publishes the leaderboard into the shared memory
+ * object /name.  Other processes on the host map it and copy out the top
+ * records without a syscall and without parsing PRINT text.
+ *
+ * The segment holds a header and two buffers.  A publish fills the buffer
+ * that is not current and then advances the generation, which makes it
+ * current (buffer generation & 1).  Each buffer also carries a sequence
+ * number that is odd while the writer is filling it, so a reader that was
+ * still copying from a buffer when the writer came back round to it sees
+ * the sequence change and copies again.  With two buffers that only
+ * happens to a reader that sleeps through a whole publish.
+ *
+ * The layout is native to the host (the segment never leaves it):
+ *
+ *     ap_export_seg_t         header, AP_EXPORT_HEADER_SIZE bytes
+ *     ap_export_buf_t         buffer 0, buf_size bytes
+ *     ap_export_buf_t         buffer 1, buf_size bytes
+ *
+ * A buffer has room for capacity records, the leaderboard size limit, and
+ * holds count of them in ap_rank_aps order.
+ *
+ * wifi publishes after every AP_EXPORT_BATCH commands that change the
+ * lists, after each batch of client commands in server mode, after each
+ * command when the output is a terminal, and at exit.  At exit it sets
+ * closed and removes the name; a reader that has it mapped keeps the last
+ * leaderboard.
+ *
+ * Writer: ap_export_open, ap_export_changed, ap_export_publish,
+ * ap_export_close (ap_export.c).  Readers link only ap_export_read.c:
+ * ap_export_attach, ap_export_read, ap_export_detach.  ap_export_top.c is
+ * an example reader.  Includers supply stdint.h and stdatomic.h.
+ */
+
+#define AP_EXPORT_MAGIC       "APSX"
+#define AP_EXPORT_VERSION     1
+#define AP_EXPORT_HEADER_SIZE 64
+#define AP_EXPORT_BATCH       64
+
+typedef struct ap_export_seg_tag {
+    char magic[4];
+    uint32_t version;
+    uint32_t capacity;                  // records per buffer
+    uint32_t buf_size;                  // bytes per buffer
+    _Atomic uint64_t generation;        // publishes so far
+    _Atomic uint32_t closed;            // the writer has exited
+} ap_export_seg_t;
+
+typedef struct ap_export_buf_tag {
+    _Atomic uint64_t seq;               // odd while being filled
+    uint64_t generation;                // the publish it holds
+    uint32_t count;                     // records in rec
+    uint32_t queue_size;
+    ap_info_t rec[];                    // ap_rank_aps order
+} ap_export_buf_t;
+
+/* writer */
+typedef struct ap_export_tag {
+    ap_export_seg_t *seg;
+    size_t size;
+    char name[256];
+    int changes;                        // since the last publish
+} ap_export_t;
+
+int ap_export_open(ap_export_t *ex, const char *name, int capacity, const char **why);
+int ap_export_changed(ap_export_t *ex);
+void ap_export_publish(ap_export_t *ex, twl_list_t *leaderboard, int queue_size);
+void ap_export_begin(ap_export_t *ex);
+void ap_export_put(ap_export_t *ex, const ap_info_t *rec);
+void ap_export_end(ap_export_t *ex, int queue_size);
+void ap_export_close(ap_export_t *ex);
+
+/* reader */
+typedef struct ap_export_view_tag {
+    const ap_export_seg_t *seg;
+    size_t size;
+} ap_export_view_t;
+
+int ap_export_attach(ap_export_view_t *v, const char *name, const char **why);
+int ap_export_read(const ap_export_view_t *v, ap_info_t *rec, int max,
+        uint64_t *generation, int *queue_size);
+int ap_export_closed(const ap_export_view_t *v);
+void ap_export_detach(ap_export_view_t *v);
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
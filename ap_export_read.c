@@ -0,0 +1,113 @@
+// ap_export_read.c
+
+/* Reader side of the leaderboard export (see ap_export.h).  A reader
+ * process links this file alone; it does not need the list code.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "twl_list.h"
+#include "ap_export.h"
+
+#define TRUE  1
+#define FALSE 0
+
+/* Maps the export name read-only.  Returns 0, or -1 with a reason in *why.
+ */
+int ap_export_attach(ap_export_view_t *v, const char *name, const char **why)
+{
+    struct stat st;
+    const ap_export_seg_t *seg;
+    int fd;
+    void *p;
+
+    memset(v, 0, sizeof(*v));
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        *why = strerror(errno);
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < AP_EXPORT_HEADER_SIZE) {
+        *why = "not a leaderboard export";
+        close(fd);
+        return -1;
+    }
+    p = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        *why = strerror(errno);
+        return -1;
+    }
+    seg = (const ap_export_seg_t *) p;
+    atomic_thread_fence(memory_order_acquire);
+    if (memcmp(seg->magic, AP_EXPORT_MAGIC, 4) != 0 || seg->version != AP_EXPORT_VERSION
+            || AP_EXPORT_HEADER_SIZE + 2 * (size_t) seg->buf_size > (size_t) st.st_size
+            || sizeof(ap_export_buf_t) + seg->capacity * sizeof(ap_info_t) > seg->buf_size) {
+        *why = "not a leaderboard export";
+        munmap(p, (size_t) st.st_size);
+        return -1;
+    }
+    v->seg = seg;
+    v->size = (size_t) st.st_size;
+    return 0;
+}
+
+/* Copies the top max records of the current leaderboard into rec and
+ * returns how many it copied.  *generation (and *queue_size, if not NULL)
+ * are set to the publish they came from.  The copy is consistent: it never
+ * mixes two publishes.  No syscalls are made.
+ */
+int ap_export_read(const ap_export_view_t *v, ap_info_t *rec, int max,
+        uint64_t *generation, int *queue_size)
+{
+    const ap_export_seg_t *seg = v->seg;
+
+    for (;;) {
+        uint64_t gen = atomic_load_explicit(&seg->generation, memory_order_acquire);
+        const ap_export_buf_t *buf = (const ap_export_buf_t *) ((const char *) seg
+                + AP_EXPORT_HEADER_SIZE + (gen & 1) * seg->buf_size);
+        uint64_t seq = atomic_load_explicit(&buf->seq, memory_order_acquire);
+        uint32_t count, queue;
+        uint64_t buf_gen;
+
+        if (seq & 1)
+            continue;
+        buf_gen = buf->generation;
+        count = buf->count;
+        queue = buf->queue_size;
+        if (count > seg->capacity)
+            continue;                   // torn, the seq check would fail
+        if ((int) count > max)
+            count = (uint32_t) max;
+        memcpy(rec, buf->rec, count * sizeof(ap_info_t));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&buf->seq, memory_order_relaxed) != seq || buf_gen != gen)
+            continue;
+        *generation = gen;
+        if (queue_size != NULL)
+            *queue_size = (int) queue;
+        return (int) count;
+    }
+}
+
+/* TRUE once the writer has exited */
+int ap_export_closed(const ap_export_view_t *v)
+{
+    return atomic_load_explicit(&v->seg->closed, memory_order_acquire) != 0;
+}
+
+void ap_export_detach(ap_export_view_t *v)
+{
+    munmap((void *) v->seg, v->size);
+    v->seg = NULL;
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -0,0 +1,88 @@
+// ap_export_top.c
+
+/* Example reader of the leaderboard export (see ap_export.h).
+ *
+ *     ap_export_top [-n k] [-w] /name
+ *
+ * Prints the top k records (10 by default) of the leaderboard that a
+ * wifi --export /name is publishing.  With -w it keeps watching and prints
+ * the top k again whenever a new generation is published, until wifi
+ * exits.  make builds it; it needs only ap_export_read.c.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "twl_list.h"
+#include "ap_export.h"
+
+#define TRUE  1
+#define FALSE 0
+
+static void print_top(const ap_info_t *rec, int count, uint64_t generation, int queue_size)
+{
+    printf("generation %llu, queue %d, top %d:\n", (unsigned long long) generation,
+            queue_size, count);
+    for (int i = 0; i < count; i++)
+        printf("%4d: eth %d, mc %d, loc %d\n", i, rec[i].eth_address,
+                rec[i].mobile_count, rec[i].location_code);
+}
+
+int main(int argc, char *argv[])
+{
+    ap_export_view_t view;
+    ap_info_t *rec;
+    uint64_t generation, shown = 0;
+    const char *why;
+    int top = 10;
+    int watch = FALSE;
+    int queue_size, count, opt;
+    struct timespec pause = {0, 1000000};
+
+    while ((opt = getopt(argc, argv, "n:w")) != -1) {
+        if (opt == 'n') {
+            top = atoi(optarg);
+        } else if (opt == 'w') {
+            watch = TRUE;
+        } else {
+            exit(1);
+        }
+    }
+    if (argc - optind != 1 || top < 1) {
+        fprintf(stderr, "usage: ap_export_top [-n k] [-w] /name\n");
+        exit(1);
+    }
+    if (ap_export_attach(&view, argv[optind], &why) != 0) {
+        fprintf(stderr, "Cannot read %s: %s\n", argv[optind], why);
+        exit(1);
+    }
+    rec = (ap_info_t *) malloc((size_t) top * sizeof(ap_info_t));
+
+    count = ap_export_read(&view, rec, top, &generation, &queue_size);
+    print_top(rec, count, generation, queue_size);
+    shown = generation;
+    while (watch) {
+        /* the generation is a plain load from the mapping */
+        int closed = ap_export_closed(&view);
+        count = ap_export_read(&view, rec, top, &generation, &queue_size);
+        if (generation != shown) {
+            print_top(rec, count, generation, queue_size);
+            fflush(stdout);
+            shown = generation;
+        }
+        if (closed)
+            break;
+        nanosleep(&pause, NULL);
+    }
+
+    free(rec);
+    ap_export_detach(&view);
+    return 0;
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -0,0 +1,164 @@
+// ap_input.c
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "twl_list.h"
+#include "ap_command.h"
+#include "ap_support.h"
+#include "ap_input.h"
+
+/* Pages behind the read position are handed back to the kernel in chunks
+ * of this size so a multi-GB replay does not keep the whole trace resident.
+ */
+#define IN_RELEASE_CHUNK (64UL * 1024 * 1024)
+
+void in_open_stdin(in_src_t *in)
+{
+    memset(in, 0, sizeof(*in));
+    in->fp = stdin;
+}
+
+/* Maps the trace file read-only and tells the kernel it will be read once
+ * from front to back.  Returns 0 on success and -1 if the file cannot be
+ * opened or mapped.
+ */
+int in_open_trace(in_src_t *in, const char *path)
+{
+    struct stat st;
+    int fd;
+
+    memset(in, 0, sizeof(*in));
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    in->map_len = (size_t) st.st_size;
+    if (in->map_len > 0) {
+        void *p = mmap(NULL, in->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        in->map = (const char *) p;
+        madvise(p, in->map_len, MADV_SEQUENTIAL);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    /* the mapping stays valid after the descriptor is closed */
+    close(fd);
+    return 0;
+}
+
+/* Gives back the pages well behind the read position.  The chunk right
+ * behind it is kept, since the caller may still look at the last line.
+ */
+static void in_release(in_src_t *in)
+{
+    if (in->pos - in->released >= 2 * IN_RELEASE_CHUNK) {
+        madvise((void *) (in->map + in->released), IN_RELEASE_CHUNK, MADV_DONTNEED);
+        in->released += IN_RELEASE_CHUNK;
+    }
+}
+
+/* Returns the next line in *line and *len, including the newline if there
+ * is one.  Returns 0 at end of input.
+ */
+int in_next_line(in_src_t *in, const char **line, size_t *len)
+{
+    if (in->fp != NULL) {
+        if (fgets(in->line, MAXLINE, in->fp) == NULL)
+            return 0;
+        *line = in->line;
+        *len = strlen(in->line);
+        return 1;
+    }
+
+    if (in->pos >= in->map_len)
+        return 0;
+
+    const char *start = in->map + in->pos;
+    size_t avail = in->map_len - in->pos;
+    size_t max = avail < MAXLINE - 1 ? avail : MAXLINE - 1;
+    const char *nl = memchr(start, '\n', max);
+    size_t n = nl != NULL ? (size_t) (nl - start) + 1 : max;
+
+    /* fgets stops at an embedded NUL as far as the caller can tell */
+    const char *nul = memchr(start, '\0', n);
+    *line = start;
+    *len = nul != NULL ? (size_t) (nul - start) : n;
+    in->pos += n;
+    in_release(in);
+    return 1;
+}
+
+/* Returns the next n bytes of a binary stream in *bytes.  n must be less
+ * than MAXLINE.  Returns 0 if fewer than n bytes are left.
+ */
+int in_next_bytes(in_src_t *in, size_t n, const unsigned char **bytes)
+{
+    assert(n < MAXLINE);
+    if (in->fp != NULL) {
+        if (fread(in->line, 1, n, in->fp) != n)
+            return 0;
+        *bytes = (const unsigned char *) in->line;
+        return 1;
+    }
+
+    if (in->map_len - in->pos < n)
+        return 0;
+    *bytes = (const unsigned char *) in->map + in->pos;
+    in->pos += n;
+    in_release(in);
+    return 1;
+}
+
+/* in_next_bytes for any n, on a mapped trace only.  The bytes stay valid
+ * until in_close.
+ */
+int in_next_span(in_src_t *in, size_t n, const unsigned char **bytes)
+{
+    assert(in->fp == NULL);
+    if (in->map_len - in->pos < n)
+        return 0;
+    *bytes = (const unsigned char *) in->map + in->pos;
+    in->pos += n;
+    return 1;
+}
+
+/* TRUE if the next read will not wait for input: a mapped trace, stdio
+ * has bytes buffered, or the descriptor is readable (or at its end).
+ */
+int in_ready(in_src_t *in)
+{
+    struct pollfd pfd;
+
+    if (in->fp == NULL)
+        return 1;
+#ifdef __GLIBC__
+    if (in->fp->_IO_read_ptr < in->fp->_IO_read_end)
+        return 1;
+#endif
+    pfd.fd = fileno(in->fp);
+    pfd.events = POLLIN;
+    return poll(&pfd, 1, 0) != 0;
+}
+
+void in_close(in_src_t *in)
+{
+    if (in->map != NULL)
+        munmap((void *) in->map, in->map_len);
+    in->map = NULL;
+    in->fp = NULL;
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
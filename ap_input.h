@@ -0,0 +1,36 @@
+// ap_input.h
+
+/* Line sources for the command stream.
+ *
+ * A source hands out one line at a time as a pointer and a length.  The
+ * stdin source reads with fgets into its own buffer.  The trace source maps
+ * a whole trace file and returns pointers straight into the mapping, so a
+ * replay never copies the input.
+ *
+ * Both sources split lines exactly the way fgets(line, MAXLINE, stdin)
+ * does: a line longer than MAXLINE-1 characters comes back in pieces.  That
+ * keeps the results of a mapped replay identical to piping the same file
+ * into stdin.
+ *
+ * The returned line is not NUL terminated and is valid until the next call.
+ */
+
+typedef struct in_src_tag {
+    FILE *fp;               // stdin source, NULL for a mapped trace
+    char line[MAXLINE];
+    const char *map;        // mapped trace
+    size_t map_len;
+    size_t pos;
+    size_t released;        // bytes of the mapping already given back
+} in_src_t;
+
+void in_open_stdin(in_src_t *in);
+int in_open_trace(in_src_t *in, const char *path);
+int in_next_line(in_src_t *in, const char **line, size_t *len);
+int in_next_bytes(in_src_t *in, size_t n, const unsigned char **bytes);
+int in_next_span(in_src_t *in, size_t n, const unsigned char **bytes);
+int in_ready(in_src_t *in);
+void in_close(in_src_t *in);
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -0,0 +1,311 @@
+// ap_journal.c
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "twl_list.h"
+#include "ap_command.h"
+#include "ap_support.h"
+#include "ap_input.h"
+#include "ap_proto.h"
+#include "ap_snapshot.h"
+#include "ap_journal.h"
+
+#define TRUE  1
+#define FALSE 0
+
+#define JOURNAL_MAGIC_SIZE 4
+#define JOURNAL_HEADER_SIZE (JOURNAL_MAGIC_SIZE + 8)
+#define JOURNAL_ENTRY_MAX  (8 + AP_PROTO_MAX_FRAME + 4)
+
+static void journal_fail(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+static void put_u64(unsigned char *buf, long long v)
+{
+    unsigned long long u = (unsigned long long) v;
+    for (int i = 0; i < 8; i++)
+        buf[i] = (unsigned char) (u >> (8 * i));
+}
+
+static long long get_u64(const unsigned char *buf)
+{
+    unsigned long long u = 0;
+    for (int i = 7; i >= 0; i--)
+        u = u << 8 | buf[i];
+    return (long long) u;
+}
+
+static void put_u32(unsigned char *buf, unsigned int v)
+{
+    for (int i = 0; i < 4; i++)
+        buf[i] = (unsigned char) (v >> (8 * i));
+}
+
+static unsigned int get_u32(const unsigned char *buf)
+{
+    return (unsigned int) buf[0] | (unsigned int) buf[1] << 8
+        | (unsigned int) buf[2] << 16 | (unsigned int) buf[3] << 24;
+}
+
+/* Writes seq, frame and crc for cmd into buf and returns the length */
+static size_t encode_entry(unsigned char *buf, long long seq, const ap_cmd_t *cmd)
+{
+    size_t n;
+
+    put_u64(buf, seq);
+    n = 8 + ap_proto_put_cmd(buf + 8, cmd);
+    put_u32(buf + n, ap_crc32(0, buf, n));
+    return n + 4;
+}
+
+static void write_all(int fd, const unsigned char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            journal_fail("journal write");
+        buf += n;
+        len -= (size_t) n;
+    }
+}
+
+/* Writes the header with base at the start of the file and syncs it */
+static void write_header(ap_journal_t *j, long long base)
+{
+    unsigned char header[JOURNAL_HEADER_SIZE];
+
+    memcpy(header, AP_JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE);
+    put_u64(header + JOURNAL_MAGIC_SIZE, base);
+    if (pwrite(j->fd, header, sizeof(header), 0) != (ssize_t) sizeof(header))
+        journal_fail("journal write");
+    if (fdatasync(j->fd) != 0)
+        journal_fail("journal sync");
+    j->base = base;
+}
+
+/* Opens the journal at path, creating it with base 0 if needed, and gets
+ * it ready for replay with ap_journal_next.  Returns 0 on success and -1
+ * with a reason in *why otherwise.
+ */
+int ap_journal_open(ap_journal_t *j, const char *path, const char **why)
+{
+    struct stat st;
+    const unsigned char *b;
+
+    memset(j, 0, sizeof(*j));
+    j->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (j->fd < 0 || fstat(j->fd, &st) != 0) {
+        *why = strerror(errno);
+        return -1;
+    }
+    if (st.st_size == 0)
+        write_header(j, 0);
+    if (in_open_trace(&j->replay, path) != 0) {
+        *why = strerror(errno);
+        close(j->fd);
+        return -1;
+    }
+    if (!in_next_bytes(&j->replay, JOURNAL_HEADER_SIZE, &b)
+            || memcmp(b, AP_JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE) != 0) {
+        *why = "not a journal";
+        in_close(&j->replay);
+        close(j->fd);
+        return -1;
+    }
+    j->base = get_u64(b + JOURNAL_MAGIC_SIZE);
+    j->seq = j->base;
+    j->good_len = JOURNAL_HEADER_SIZE;
+    j->buf = (unsigned char *) malloc(AP_JOURNAL_BUF_SIZE);
+    assert(j->buf != NULL);
+    return 0;
+}
+
+/* Reads the image that follows the frame of a LOAD entry into cmd */
+static int get_image(in_src_t *in, ap_cmd_t *cmd)
+{
+    const unsigned char *b;
+
+    if (!in_next_bytes(in, 4, &b))
+        return FALSE;
+    cmd->image_len = get_u32(b);
+    return in_next_span(in, cmd->image_len, &cmd->image);
+}
+
+/* Hands out the next journal entry in cmd and *seq.  The frame is decoded
+ * with ap_proto_get_cmd, and the checksum is taken over the entry's bytes
+ * in the mapping.  A LOAD hands out its snapshot in cmd->image, which
+ * stays valid until the next call.
+ *
+ * Returns 1 for an entry.  At the end, or at the first entry that is torn,
+ * out of sequence or fails its checksum, the file is cut after the last
+ * good entry, the journal is ready for appends and 0 is returned.
+ */
+int ap_journal_next(ap_journal_t *j, ap_cmd_t *cmd, long long *seq)
+{
+    const unsigned char *entry = (const unsigned char *) j->replay.map + j->replay.pos;
+    const unsigned char *b;
+
+    if (in_next_bytes(&j->replay, 8, &b)) {
+        *seq = get_u64(b);
+        if (*seq == j->seq + 1 && ap_proto_get_cmd(&j->replay, cmd) > 0
+                && (cmd->op != AP_OP_LOAD || get_image(&j->replay, cmd))) {
+            unsigned int crc = ap_crc32(0, entry,
+                    (size_t) ((const unsigned char *) j->replay.map + j->replay.pos - entry));
+            if (in_next_bytes(&j->replay, 4, &b) && get_u32(b) == crc) {
+                j->seq = *seq;
+                j->good_len = j->replay.pos;
+                return 1;
+            }
+        }
+        free(cmd->rec);
+        cmd->rec = NULL;
+    }
+
+    in_close(&j->replay);
+    if (ftruncate(j->fd, (off_t) j->good_len) != 0)
+        journal_fail("journal truncate");
+    if (lseek(j->fd, 0, SEEK_END) < 0)
+        journal_fail("journal seek");
+    return 0;
+}
+
+/* TRUE for the commands that change the lists and go into the journal */
+int ap_journal_mutates(int op)
+{
+    switch (op) {
+    case AP_OP_ADD:
+    case AP_OP_REMOVE:
+    case AP_OP_INC:
+    case AP_OP_DEC:
+    case AP_OP_REMOVEALL:
+    case AP_OP_JOINQ:
+    case AP_OP_APPENDQ:
+    case AP_OP_MOVEQTOL:
+    case AP_OP_SORTAP:
+    case AP_OP_SORTETH:
+    case AP_OP_PARTQ:
+    case AP_OP_LOAD:
+    case AP_OP_EXPIRE:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+static long elapsed_ms(const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000L + (now.tv_nsec - since->tv_nsec) / 1000000L;
+}
+
+/* Adds cmd to the pending group.  It must be called before the command
+ * runs, while cmd still owns its record.  The group is committed when it
+ * is full or its window is over.
+ */
+void ap_journal_append(ap_journal_t *j, const ap_cmd_t *cmd)
+{
+    if (j->len + JOURNAL_ENTRY_MAX > AP_JOURNAL_BUF_SIZE)
+        ap_journal_commit(j);
+    if (j->pending == 0)
+        clock_gettime(CLOCK_MONOTONIC, &j->first);
+    j->seq++;
+    j->len += encode_entry(j->buf + j->len, j->seq, cmd);
+    j->pending++;
+    if (j->pending >= AP_JOURNAL_GROUP)
+        ap_journal_commit(j);
+    else
+        ap_journal_poll(j);
+}
+
+/* Journals a LOAD that has read image, the size bytes of a snapshot, so a
+ * replay loads the same lists whatever the file holds by then.  The entry
+ * is written and synced on its own, after the pending group.  LOAD is
+ * journaled once it has succeeded, not through ap_journal_append.
+ */
+void ap_journal_append_load(ap_journal_t *j, const ap_cmd_t *cmd,
+        const unsigned char *image, size_t size)
+{
+    unsigned char head[8 + AP_PROTO_MAX_FRAME + 4];
+    unsigned char tail[4];
+    size_t n;
+    unsigned int crc;
+
+    assert(cmd->op == AP_OP_LOAD && size <= 0xffffffffu);
+    ap_journal_commit(j);
+    j->seq++;
+    put_u64(head, j->seq);
+    n = 8 + ap_proto_put_cmd(head + 8, cmd);
+    put_u32(head + n, (unsigned int) size);
+    n += 4;
+    crc = ap_crc32(ap_crc32(0, head, n), image, size);
+    put_u32(tail, crc);
+    write_all(j->fd, head, n);
+    write_all(j->fd, image, size);
+    write_all(j->fd, tail, sizeof(tail));
+    if (fdatasync(j->fd) != 0)
+        journal_fail("journal sync");
+}
+
+/* Commits the pending group if its time window is over.  Call it between
+ * commands so a slow trickle of input is not left unsynced.
+ */
+void ap_journal_poll(ap_journal_t *j)
+{
+    if (j->pending > 0 && elapsed_ms(&j->first) >= AP_JOURNAL_WINDOW_MS)
+        ap_journal_commit(j);
+}
+
+/* Writes the pending group and waits for it to reach the disk */
+void ap_journal_commit(ap_journal_t *j)
+{
+    if (j->pending == 0)
+        return;
+    write_all(j->fd, j->buf, j->len);
+    if (fdatasync(j->fd) != 0)
+        journal_fail("journal sync");
+    j->len = 0;
+    j->pending = 0;
+}
+
+/* Empties the journal once a snapshot holds everything in it, with the
+ * snapshot's seq, the current one, as the new base.  The seq keeps
+ * counting so entries stay ordered after the snapshot's seq.
+ *
+ * The base goes in before the entries are cut.  A crash in between leaves
+ * old entries behind a base they do not follow, and replay drops them.
+ */
+void ap_journal_reset(ap_journal_t *j)
+{
+    assert(j->pending == 0);
+    write_header(j, j->seq);
+    if (ftruncate(j->fd, JOURNAL_HEADER_SIZE) != 0)
+        journal_fail("journal truncate");
+    if (lseek(j->fd, 0, SEEK_END) < 0)
+        journal_fail("journal seek");
+    if (fdatasync(j->fd) != 0)
+        journal_fail("journal sync");
+}
+
+void ap_journal_close(ap_journal_t *j)
+{
+    ap_journal_commit(j);
+    close(j->fd);
+    free(j->buf);
+    j->buf = NULL;
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -0,0 +1,70 @@
+// ap_journal.h
+
+/* Write-ahead journal of the commands that change the lists.
+ *
+ * Layout (little-endian):
+ *     "APJ1"                  magic
+ *     u64 base                seq of the snapshot the entries follow, 0 for
+ *                             the empty lists
+ *     entries, each
+ *         u64 seq             base + 1, base + 2, ...
+ *         frame               the binary command frame of ap_proto.h
+ *         LOAD only:
+ *         u32 size            the snapshot it loaded (ap_snapshot.h),
+ *         image               size bytes
+ *         u32 crc32           of everything in the entry before it
+ *
+ * Appends go to a memory buffer and are written and fdatasync'ed as a
+ * group, either when AP_JOURNAL_GROUP entries are pending or when the
+ * oldest pending entry is AP_JOURNAL_WINDOW_MS old, whichever comes first.
+ * A crash therefore loses at most the last group.  Acknowledgements are
+ * not held back for the sync, so one may be printed for a command in that
+ * last group.  Callers also commit before they wait for more input, so
+ * the window never stays open while nothing comes in.
+ *
+ * A LOAD keeps the whole snapshot it read in its entry, since the file
+ * may have changed or be gone by the time the journal is replayed.
+ *
+ * A snapshot records the seq of the last entry it includes.  At startup
+ * the entries after that seq are replayed on top of it, and a SAVE
+ * truncates the journal back to its header with the snapshot's seq as the
+ * new base.  The seq keeps counting, so a snapshot only fits a journal
+ * whose base is at or before it and whose entries reach it; wifi refuses
+ * to start with any other pair.  Replay stops at the first torn, corrupt
+ * or out of sequence entry and the file is cut there before new entries
+ * go in.
+ *
+ * A journal that cannot be written is fatal: carrying on would acknowledge
+ * commands that a restart cannot recover.
+ */
+
+#define AP_JOURNAL_MAGIC      "APJ1"
+#define AP_JOURNAL_GROUP      64
+#define AP_JOURNAL_WINDOW_MS  10
+#define AP_JOURNAL_BUF_SIZE   (64 * 1024)
+
+typedef struct ap_journal_tag {
+    int fd;
+    long long base;             // seq the first entry follows
+    long long seq;              // seq of the last entry appended or replayed
+    unsigned char *buf;         // entries not yet written
+    size_t len;
+    int pending;                // entries in buf
+    struct timespec first;      // when the oldest pending entry came in
+    in_src_t replay;            // mapping read by ap_journal_next
+    size_t good_len;            // file length up to the last good entry
+} ap_journal_t;
+
+int ap_journal_open(ap_journal_t *j, const char *path, const char **why);
+int ap_journal_next(ap_journal_t *j, ap_cmd_t *cmd, long long *seq);
+int ap_journal_mutates(int op);
+void ap_journal_append(ap_journal_t *j, const ap_cmd_t *cmd);
+void ap_journal_append_load(ap_journal_t *j, const ap_cmd_t *cmd,
+        const unsigned char *image, size_t size);
+void ap_journal_poll(ap_journal_t *j);
+void ap_journal_commit(ap_journal_t *j);
+void ap_journal_reset(ap_journal_t *j);
+void ap_journal_close(ap_journal_t *j);
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
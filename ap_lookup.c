@@ -0,0 +1,353 @@
+// ap_lookup.c
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include "twl_list.h"
+#include "ap_command.h"
+#include "ap_support.h"
+#include "ap_lookup.h"
+
+#define TRUE  1
+#define FALSE 0
+
+#define LOOKUP_MIN_BUCKETS 64
+
+static void observe(void *ctx, twl_list_t *list, ll_node_t *node, int event);
+
+static unsigned int hash_key(uint32_t key, int bucket_count)
+{
+    return (key * 2654435761u) & (unsigned int) (bucket_count - 1);
+}
+
+static unsigned int hash_node(const ll_node_t *node, int bucket_count)
+{
+    return hash_key((uint32_t) ((uintptr_t) node >> 4), bucket_count);
+}
+
+/* the key of rec in table w */
+static int key_of(const ap_info_t *rec, int w)
+{
+    return w == 0 ? rec->ip_address : rec->location_code;
+}
+
+static void *new_buckets(int count)
+{
+    void *buckets = calloc((size_t) count, sizeof(void *));
+    assert(buckets != NULL);
+    return buckets;
+}
+
+void ap_lookup_init(ap_lookup_t *lk)
+{
+    for (int w = 0; w < AP_LOOKUP_KEYS; w++) {
+        lk->table[w].bucket_count = LOOKUP_MIN_BUCKETS;
+        lk->table[w].buckets = (ap_lookup_group_t **) new_buckets(LOOKUP_MIN_BUCKETS);
+        lk->table[w].group_count = 0;
+    }
+    lk->node_bucket_count = LOOKUP_MIN_BUCKETS;
+    lk->nodes = (ap_lookup_entry_t **) new_buckets(LOOKUP_MIN_BUCKETS);
+    lk->count = 0;
+    lk->list_count = 0;
+}
+
+static ap_lookup_group_t *group_find(ap_lookup_table_t *t, int key)
+{
+    ap_lookup_group_t *g = t->buckets[hash_key((uint32_t) key, t->bucket_count)];
+
+    while (g != NULL && g->key != key)
+        g = g->next;
+    return g;
+}
+
+/* Doubles the buckets once there is more than one group per bucket */
+static void table_grow(ap_lookup_table_t *t)
+{
+    ap_lookup_group_t **old = t->buckets;
+    int old_count = t->bucket_count;
+
+    t->bucket_count *= 2;
+    t->buckets = (ap_lookup_group_t **) new_buckets(t->bucket_count);
+    for (int b = 0; b < old_count; b++) {
+        ap_lookup_group_t *g = old[b];
+        while (g != NULL) {
+            ap_lookup_group_t *next = g->next;
+            unsigned int h = hash_key((uint32_t) g->key, t->bucket_count);
+            g->next = t->buckets[h];
+            t->buckets[h] = g;
+            g = next;
+        }
+    }
+    free(old);
+}
+
+/* Files entry e under key in table w, at the head of the key's group */
+static void link_entry(ap_lookup_t *lk, ap_lookup_entry_t *e, int w, int key)
+{
+    ap_lookup_table_t *t = &lk->table[w];
+    ap_lookup_group_t *g = group_find(t, key);
+
+    if (g == NULL) {
+        unsigned int h = hash_key((uint32_t) key, t->bucket_count);
+        g = (ap_lookup_group_t *) malloc(sizeof(ap_lookup_group_t));
+        assert(g != NULL);
+        g->key = key;
+        g->count = 0;
+        g->first = NULL;
+        g->next = t->buckets[h];
+        t->buckets[h] = g;
+        if (++t->group_count > t->bucket_count)
+            table_grow(t);
+    }
+    e->link[w].group = g;
+    e->link[w].prev = NULL;
+    e->link[w].next = g->first;
+    if (g->first != NULL)
+        g->first->link[w].prev = e;
+    g->first = e;
+    g->count++;
+}
+
+/* Takes entry e out of its group in table w, and the group out of the
+ * table once it is empty
+ */
+static void unlink_entry(ap_lookup_t *lk, ap_lookup_entry_t *e, int w)
+{
+    ap_lookup_table_t *t = &lk->table[w];
+    ap_lookup_group_t *g = e->link[w].group;
+
+    if (e->link[w].prev != NULL)
+        e->link[w].prev->link[w].next = e->link[w].next;
+    else
+        g->first = e->link[w].next;
+    if (e->link[w].next != NULL)
+        e->link[w].next->link[w].prev = e->link[w].prev;
+    if (--g->count == 0) {
+        ap_lookup_group_t **slot = &t->buckets[hash_key((uint32_t) g->key, t->bucket_count)];
+        while (*slot != g)
+            slot = &(*slot)->next;
+        *slot = g->next;
+        free(g);
+        t->group_count--;
+    }
+}
+
+static ap_lookup_entry_t **node_slot(ap_lookup_t *lk, const ll_node_t *node)
+{
+    ap_lookup_entry_t **slot = &lk->nodes[hash_node(node, lk->node_bucket_count)];
+
+    while (*slot != NULL && (*slot)->node != node)
+        slot = &(*slot)->node_next;
+    return slot;
+}
+
+static void nodes_grow(ap_lookup_t *lk)
+{
+    ap_lookup_entry_t **old = lk->nodes;
+    int old_count = lk->node_bucket_count;
+
+    lk->node_bucket_count *= 2;
+    lk->nodes = (ap_lookup_entry_t **) new_buckets(lk->node_bucket_count);
+    for (int b = 0; b < old_count; b++) {
+        ap_lookup_entry_t *e = old[b];
+        while (e != NULL) {
+            ap_lookup_entry_t *next = e->node_next;
+            unsigned int h = hash_node(e->node, lk->node_bucket_count);
+            e->node_next = lk->nodes[h];
+            lk->nodes[h] = e;
+            e = next;
+        }
+    }
+    free(old);
+}
+
+static void add_node(ap_lookup_t *lk, twl_list_t *list, ll_node_t *node)
+{
+    ap_lookup_entry_t **slot = node_slot(lk, node);
+    ap_info_t *rec = (ap_info_t *) twl_list_node_data(node);
+    ap_lookup_entry_t *e;
+
+    assert(*slot == NULL);
+    e = (ap_lookup_entry_t *) malloc(sizeof(ap_lookup_entry_t));
+    assert(e != NULL);
+    e->node = node;
+    e->list = list;
+    e->node_next = NULL;
+    *slot = e;
+    for (int w = 0; w < AP_LOOKUP_KEYS; w++)
+        link_entry(lk, e, w, key_of(rec, w));
+    if (++lk->count > lk->node_bucket_count)
+        nodes_grow(lk);
+}
+
+static void drop_entry(ap_lookup_t *lk, ap_lookup_entry_t *e)
+{
+    for (int w = 0; w < AP_LOOKUP_KEYS; w++)
+        unlink_entry(lk, e, w);
+    free(e);
+    lk->count--;
+}
+
+static void drop_node(ap_lookup_t *lk, ll_node_t *node)
+{
+    ap_lookup_entry_t **slot = node_slot(lk, node);
+    ap_lookup_entry_t *e = *slot;
+
+    assert(e != NULL);
+    *slot = e->node_next;
+    drop_entry(lk, e);
+}
+
+/* Forgets the nodes of one list, or of every list if list is NULL */
+static void drop_list(ap_lookup_t *lk, twl_list_t *list)
+{
+    for (int b = 0; b < lk->node_bucket_count; b++) {
+        ap_lookup_entry_t **slot = &lk->nodes[b];
+        while (*slot != NULL) {
+            ap_lookup_entry_t *e = *slot;
+            if (list == NULL || e->list == list) {
+                *slot = e->node_next;
+                drop_entry(lk, e);
+            } else {
+                slot = &e->node_next;
+            }
+        }
+    }
+}
+
+static void add_list(ap_lookup_t *lk, twl_list_t *list)
+{
+    for (ll_node_t *node = twl_list_front_node(list); node != NULL;
+            node = twl_list_next_node(node))
+        add_node(lk, list, node);
+}
+
+static void observe(void *ctx, twl_list_t *list, ll_node_t *node, int event)
+{
+    ap_lookup_t *lk = (ap_lookup_t *) ctx;
+
+    switch (event) {
+    case TWL_LIST_LINKED:
+        add_node(lk, list, node);
+        break;
+    case TWL_LIST_UNLINKED:
+        drop_node(lk, node);
+        break;
+    case TWL_LIST_RESHAPED:
+        drop_list(lk, list);
+        add_list(lk, list);
+        break;
+    case TWL_LIST_DESTROYED:
+        drop_list(lk, list);
+        for (int i = 0; i < lk->list_count; i++) {
+            if (lk->lists[i] == list)
+                lk->lists[i] = lk->lists[--lk->list_count];
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/* Indexes the records of list and follows its changes from now on, until
+ * it is destructed.  At most AP_LOOKUP_LISTS lists at a time.
+ */
+void ap_lookup_watch(ap_lookup_t *lk, twl_list_t *list)
+{
+    assert(lk->list_count < AP_LOOKUP_LISTS);
+    lk->lists[lk->list_count++] = list;
+    twl_list_observe(list, observe, lk);
+    add_list(lk, list);
+}
+
+/* Stops watching the lists, which stay as they are */
+void ap_lookup_free(ap_lookup_t *lk)
+{
+    for (int i = 0; i < lk->list_count; i++)
+        twl_list_unobserve(lk->lists[i], observe, lk);
+    drop_list(lk, NULL);
+    for (int w = 0; w < AP_LOOKUP_KEYS; w++)
+        free(lk->table[w].buckets);
+    free(lk->nodes);
+}
+
+/* qsort order of record pointers: ap_rank_aps, best first */
+static int by_rank(const void *a, const void *b)
+{
+    return -ap_rank_aps(*(ap_info_t * const *) a, *(ap_info_t * const *) b);
+}
+
+/* Fills in res from the records found: recs[0 .. on_board - 1] from the
+ * leaderboard and the in_queue after them
+ */
+static void found(int op, int key, ap_info_t **recs, int on_board, int in_queue,
+        ap_result_t *res)
+{
+    res->op = op;
+    res->code = 0;
+    res->eth = key;
+    res->value = on_board;
+    res->aux = in_queue;
+    qsort(recs, (size_t) on_board, sizeof(ap_info_t *), by_rank);
+    qsort(recs + on_board, (size_t) in_queue, sizeof(ap_info_t *), by_rank);
+    res->list = twl_list_construct(NULL);
+    res->owns_list = TRUE;
+    for (int i = 0; i < on_board + in_queue; i++) {
+        ap_info_t *rec = (ap_info_t *) malloc(sizeof(ap_info_t));
+        assert(rec != NULL);
+        *rec = *recs[i];
+        twl_list_append(res->list, rec);
+    }
+}
+
+void ap_lookup_find(ap_lookup_t *lk, int op, int key, twl_list_t *leaderboard,
+        ap_result_t *res)
+{
+    int w = op == AP_OP_FINDIP ? 0 : 1;
+    ap_lookup_group_t *g = group_find(&lk->table[w], key);
+    int count = g != NULL ? g->count : 0;
+    ap_info_t **recs = (ap_info_t **) malloc((size_t) (count + 1) * sizeof(ap_info_t *));
+    int on_board = 0, in_queue = 0;
+
+    assert(recs != NULL);
+    /* the leaderboard's from the front, the queue's from the back */
+    for (ap_lookup_entry_t *e = g != NULL ? g->first : NULL; e != NULL; e = e->link[w].next) {
+        ap_info_t *rec = (ap_info_t *) twl_list_node_data(e->node);
+        if (e->list == leaderboard)
+            recs[on_board++] = rec;
+        else
+            recs[count - ++in_queue] = rec;
+    }
+    found(op, key, recs, on_board, in_queue, res);
+    free(recs);
+}
+
+/* The same answer as ap_lookup_find, by walking both lists */
+void ap_lookup_scan(int op, int key, twl_list_t *leaderboard, twl_list_t *queue,
+        ap_result_t *res)
+{
+    int w = op == AP_OP_FINDIP ? 0 : 1;
+    int size = twl_list_size(leaderboard) + twl_list_size(queue);
+    ap_info_t **recs = (ap_info_t **) malloc((size_t) (size + 1) * sizeof(ap_info_t *));
+    int count[2] = { 0, 0 };
+    twl_list_t *lists[2] = { leaderboard, queue };
+
+    assert(recs != NULL);
+    for (int i = 0; i < 2; i++) {
+        for (ll_node_t *node = twl_list_front_node(lists[i]); node != NULL;
+                node = twl_list_next_node(node)) {
+            ap_info_t *rec = (ap_info_t *) twl_list_node_data(node);
+            if (key_of(rec, w) == key) {
+                recs[count[0] + count[1]] = rec;
+                count[i]++;
+            }
+        }
+    }
+    found(op, key, recs, count[0], count[1], res);
+    free(recs);
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
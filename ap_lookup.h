@@ -0,0 +1,81 @@
+// ap_lookup.h
+
+/* Secondary indexes of both lists, for FINDIP ip and FINDLOC loc.
+ *
+ * The only keyed lookup of the lists is by eth address, so finding the
+ * APs with an IP address or at a location means a walk of both lists.
+ * With --lookup wifi keeps two multimaps over the records of both lists:
+ *
+ *     ip_address       FINDIP
+ *     location_code    FINDLOC
+ *
+ * Each key has a group of the entries with that key, found through a hash
+ * table of the keys, so a query costs O(1) plus the records it returns.
+ * An entry holds the node handle of its record and is in the group of
+ * each of its keys, on a two-way chain, so it leaves both in O(1).
+ *
+ * The index watches the lists as an observer (see twl_list_observer_t),
+ * so ADD, REMOVE, MOVEQTOL, REMOVEALL, EXPIRE, the sorts, LOAD and the
+ * final destruct all keep it in step without wifi calling it.  A record
+ * must not change its IP address or location code while it is indexed.
+ *
+ * Without --lookup, and with --shards, the same queries scan the lists;
+ * the answer is the same either way.  Both give copies of the records,
+ * the leaderboard's first, each part in ap_rank_aps order.
+ */
+
+#define AP_LOOKUP_KEYS 2            // ip_address, location_code
+#define AP_LOOKUP_LISTS 2           // the leaderboard and the queue
+
+struct ap_lookup_entry_tag;
+
+typedef struct ap_lookup_group_tag {
+    int key;
+    int count;                      // entries in the group
+    struct ap_lookup_entry_tag *first;
+    struct ap_lookup_group_tag *next;   // bucket chain
+} ap_lookup_group_t;
+
+typedef struct ap_lookup_table_tag {
+    ap_lookup_group_t **buckets;    // key hash, chained by next
+    int bucket_count;               // power of two
+    int group_count;
+} ap_lookup_table_t;
+
+typedef struct ap_lookup_link_tag {
+    ap_lookup_group_t *group;
+    struct ap_lookup_entry_tag *prev;
+    struct ap_lookup_entry_tag *next;
+} ap_lookup_link_t;
+
+typedef struct ap_lookup_entry_tag {
+    ll_node_t *node;
+    twl_list_t *list;
+    struct ap_lookup_entry_tag *node_next;  // node hash chain
+    ap_lookup_link_t link[AP_LOOKUP_KEYS];
+} ap_lookup_entry_t;
+
+typedef struct ap_lookup_tag {
+    ap_lookup_table_t table[AP_LOOKUP_KEYS];
+    ap_lookup_entry_t **nodes;      // node hash, chained by node_next
+    int node_bucket_count;          // power of two
+    int count;                      // entries
+    twl_list_t *lists[AP_LOOKUP_LISTS];
+    int list_count;
+} ap_lookup_t;
+
+void ap_lookup_init(ap_lookup_t *lk);
+void ap_lookup_free(ap_lookup_t *lk);
+void ap_lookup_watch(ap_lookup_t *lk, twl_list_t *list);
+
+/* FINDIP and FINDLOC: op is AP_OP_FINDIP or AP_OP_FINDLOC.  res->value
+ * is the leaderboard records found and res->aux the queue records, with
+ * copies of them in res->list.
+ */
+void ap_lookup_find(ap_lookup_t *lk, int op, int key, twl_list_t *leaderboard,
+        ap_result_t *res);
+void ap_lookup_scan(int op, int key, twl_list_t *leaderboard, twl_list_t *queue,
+        ap_result_t *res);
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -0,0 +1,100 @@
+// ap_metrics.c
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "twl_list.h"
+#include "ap_command.h"
+#include "ap_output.h"
+#include "ap_metrics.h"
+
+#define TRUE  1
+#define FALSE 0
+
+static int bucket_of(long long ns)
+{
+    unsigned long long v = ns < 0 ? 0 : (unsigned long long) ns;
+    int e;
+
+    if (v < AP_HIST_SUB)
+        return (int) v;
+    e = 63 - __builtin_clzll(v);
+    if (e > AP_HIST_MAX_EXP)
+        return AP_HIST_BUCKETS - 1;
+    return (e - AP_HIST_SUB_BITS + 1) * AP_HIST_SUB
+        + (int) ((v >> (e - AP_HIST_SUB_BITS)) & (AP_HIST_SUB - 1));
+}
+
+/* The largest value that lands in bucket i */
+static long long bucket_high(int i)
+{
+    int e, sub;
+
+    if (i < AP_HIST_SUB)
+        return i;
+    e = i / AP_HIST_SUB + AP_HIST_SUB_BITS - 1;
+    sub = i % AP_HIST_SUB;
+    return ((long long) (AP_HIST_SUB + sub + 1) << (e - AP_HIST_SUB_BITS)) - 1;
+}
+
+void ap_metrics_init(ap_metrics_t *m)
+{
+    memset(m, 0, sizeof(*m));
+}
+
+void ap_metrics_record(ap_metrics_t *m, int op, long long ns)
+{
+    ap_hist_t *h;
+
+    assert(op >= 0 && op < AP_OP_COUNT);
+    h = &m->hist[op];
+    h->bucket[bucket_of(ns)]++;
+    h->count++;
+    if (ns > h->max)
+        h->max = ns;
+}
+
+/* The value at or below which percent of the recorded values fall, to
+ * within a bucket.  0 if nothing was recorded.
+ */
+long long ap_hist_percentile(const ap_hist_t *h, double percent)
+{
+    long long rank = (long long) (percent / 100.0 * (double) h->count + 0.999999);
+    long long seen = 0;
+
+    if (h->count == 0)
+        return 0;
+    if (rank < 1)
+        rank = 1;
+    for (int i = 0; i < AP_HIST_BUCKETS; i++) {
+        seen += h->bucket[i];
+        if (seen >= rank) {
+            long long high = bucket_high(i);
+            return high < h->max ? high : h->max;
+        }
+    }
+    return h->max;
+}
+
+/* Prints the table for METRICS, one line per verb that ran */
+void ap_metrics_report(const ap_metrics_t *m)
+{
+    static const double percents[] = { 50.0, 90.0, 99.0, 99.9 };
+
+    out_str("Latency in microseconds\n");
+    out_str("command        count      p50      p90      p99    p99.9      max\n");
+    for (int op = 0; op < AP_OP_COUNT; op++) {
+        const ap_hist_t *h = &m->hist[op];
+        const char *name = ap_op_name(op);
+        if (h->count == 0)
+            continue;
+        out_printf("%-10s %9lld", name != NULL ? name : "(other)", h->count);
+        for (int i = 0; i < 4; i++)
+            out_printf(" %8.2f", ap_hist_percentile(h, percents[i]) / 1000.0);
+        out_printf(" %8.2f\n", h->max / 1000.0);
+    }
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
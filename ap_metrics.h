@@ -0,0 +1,42 @@
+// ap_metrics.h
+
+/* Per-command latency histograms.
+ *
+ * wifi times every command it applies with CLOCK_MONOTONIC, from the
+ * start of execute to its return on the thread that owns the lists, and
+ * records the nanoseconds in the histogram of the command's verb.  With
+ * --shards that is the time to dispatch the command to its shard.
+ *
+ * The histograms are log-linear, as in HdrHistogram: values below
+ * AP_HIST_SUB get a bucket each, and every power of two above that is cut
+ * into AP_HIST_SUB equal buckets, so a percentile is within 1/AP_HIST_SUB
+ * (3%) of the true value at any scale.  Recording is a shift, a count
+ * leading zeros and an increment.
+ *
+ * METRICS prints count, p50, p90, p99, p99.9 and max per verb, in
+ * microseconds, for every verb seen so far.  wifi --metrics prints the same
+ * table on stderr at QUIT or at the end of the input.
+ */
+
+#define AP_HIST_SUB_BITS 5
+#define AP_HIST_SUB      (1 << AP_HIST_SUB_BITS)
+#define AP_HIST_MAX_EXP  47         // 2^48 ns is over three days
+#define AP_HIST_BUCKETS  ((AP_HIST_MAX_EXP - AP_HIST_SUB_BITS + 2) * AP_HIST_SUB)
+
+typedef struct ap_hist_tag {
+    long long count;
+    long long max;
+    long long bucket[AP_HIST_BUCKETS];
+} ap_hist_t;
+
+typedef struct ap_metrics_tag {
+    ap_hist_t hist[AP_OP_COUNT];    // by enum ap_op
+} ap_metrics_t;
+
+void ap_metrics_init(ap_metrics_t *m);
+void ap_metrics_record(ap_metrics_t *m, int op, long long ns);
+long long ap_hist_percentile(const ap_hist_t *h, double percent);
+void ap_metrics_report(const ap_metrics_t *m);
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -0,0 +1,80 @@
+// ap_mpsc.c
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <assert.h>
+#include "datatypes.h"
+#include "ap_mpsc.h"
+
+#define TRUE  1
+#define FALSE 0
+
+void ap_mpsc_init(ap_mpsc_t *q)
+{
+    atomic_init(&q->stub.next, NULL);
+    atomic_init(&q->head, &q->stub);
+    q->tail = &q->stub;
+}
+
+/* Returns a zeroed record that may be pushed on any ap_mpsc_t */
+ap_info_t *ap_mpsc_new_rec(void)
+{
+    ap_mpsc_node_t *node = (ap_mpsc_node_t *) calloc(1, sizeof(ap_mpsc_node_t));
+    assert(node != NULL);
+    return &node->rec;
+}
+
+static void push_node(ap_mpsc_t *q, ap_mpsc_node_t *node)
+{
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    ap_mpsc_node_t *prev = atomic_exchange_explicit(&q->head, node, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+/* Any thread.  rec must come from ap_mpsc_new_rec. */
+void ap_mpsc_push(ap_mpsc_t *q, ap_info_t *rec, int op)
+{
+    ap_mpsc_node_t *node = (ap_mpsc_node_t *) rec;
+
+    node->op = op;
+    push_node(q, node);
+}
+
+/* Consumer only.  Returns the oldest record and its op, or NULL if there
+ * is none ready.
+ */
+ap_info_t *ap_mpsc_pop(ap_mpsc_t *q, int *op)
+{
+    ap_mpsc_node_t *tail = q->tail;
+    ap_mpsc_node_t *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if (tail == &q->stub) {
+        if (next == NULL)
+            return NULL;
+        q->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+    if (next != NULL) {
+        q->tail = next;
+        *op = tail->op;
+        return &tail->rec;
+    }
+    /* tail is the last node.  Unless a producer is mid-push, put the stub
+     * behind it so tail can be handed out.
+     */
+    if (tail != atomic_load_explicit(&q->head, memory_order_acquire))
+        return NULL;
+    push_node(q, &q->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next != NULL) {
+        q->tail = next;
+        *op = tail->op;
+        return &tail->rec;
+    }
+    return NULL;
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -0,0 +1,45 @@
+// ap_mpsc.h
+
+/* Lock-free multi-producer/single-consumer queue of AP records.
+ *
+ * This is the intrusive queue of D. Vyukov: a producer swaps its node in
+ * as the new head with one atomic exchange and then links the old head to
+ * it, so producers never wait for each other or for the consumer, and
+ * there is no lock around malloc or the links.  The single consumer pops
+ * from the tail.
+ *
+ * Records that go through the queue are allocated with ap_mpsc_new_rec.
+ * The record is the first member of its node, so a popped record is an
+ * ordinary malloc'ed ap_info_t that the consumer may link into a twl_list
+ * and later free.  Each record carries the op it was pushed with, so the
+ * consumer knows what to do with it.
+ *
+ * A pop can come back empty for a moment while a producer is between its
+ * exchange and its link; the record shows up on a later pop.
+ *
+ * wifi --listen with --collect runs one producer thread per collector
+ * connection, and the server thread pops their records into the queue
+ * (see ap_server.h).  bench/mpsc_bench measures it against a
+ * mutex-protected twl_list.
+ */
+
+typedef struct ap_mpsc_node_tag {
+    ap_info_t rec;                              // must stay first
+    int op;                                     // enum ap_op
+    _Atomic(struct ap_mpsc_node_tag *) next;
+} ap_mpsc_node_t;
+
+typedef struct ap_mpsc_tag {
+    _Atomic(ap_mpsc_node_t *) head;             // producers push here
+    char pad[64 - sizeof(void *)];
+    ap_mpsc_node_t *tail;                       // the consumer pops here
+    ap_mpsc_node_t stub;
+} ap_mpsc_t;
+
+void ap_mpsc_init(ap_mpsc_t *q);
+ap_info_t *ap_mpsc_new_rec(void);
+void ap_mpsc_push(ap_mpsc_t *q, ap_info_t *rec, int op);
+ap_info_t *ap_mpsc_pop(ap_mpsc_t *q, int *op);
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -0,0 +1,357 @@
+// ap_order.c
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include "twl_list.h"
+#include "ap_command.h"
+#include "ap_support.h"
+#include "ap_order.h"
+
+#define TRUE  1
+#define FALSE 0
+
+#define ORDER_MIN_BUCKETS 64
+
+static void observe(void *ctx, twl_list_t *list, ll_node_t *node, int event);
+
+static ap_order_node_t *new_node(ap_info_t *rec, int height)
+{
+    ap_order_node_t *node = (ap_order_node_t *) malloc(sizeof(ap_order_node_t)
+            + (size_t) height * sizeof(ap_order_link_t));
+
+    assert(node != NULL);
+    node->rec = rec;
+    node->count = rec != NULL ? rec->mobile_count : 0;
+    node->eth = rec != NULL ? rec->eth_address : 0;
+    node->hash_next = NULL;
+    node->height = height;
+    for (int i = 0; i < height; i++) {
+        node->link[i].next = NULL;
+        node->link[i].span = 0;
+    }
+    return node;
+}
+
+void ap_order_init(ap_order_t *o)
+{
+    o->head = new_node(NULL, AP_ORDER_LEVELS);
+    o->levels = 1;
+    o->count = 0;
+    o->bucket_count = ORDER_MIN_BUCKETS;
+    o->buckets = (ap_order_node_t **) calloc((size_t) o->bucket_count,
+            sizeof(ap_order_node_t *));
+    assert(o->buckets != NULL);
+    o->rng = 2463534242u;
+    o->list = NULL;
+}
+
+/* Empties the index.  The records belong to the leaderboard and stay. */
+static void clear(ap_order_t *o)
+{
+    ap_order_node_t *node = o->head->link[0].next;
+
+    while (node != NULL) {
+        ap_order_node_t *next = node->link[0].next;
+        free(node);
+        node = next;
+    }
+    for (int i = 0; i < AP_ORDER_LEVELS; i++) {
+        o->head->link[i].next = NULL;
+        o->head->link[i].span = 0;
+    }
+    o->levels = 1;
+    o->count = 0;
+    memset(o->buckets, 0, (size_t) o->bucket_count * sizeof(ap_order_node_t *));
+}
+
+/* Stops watching the leaderboard, which stays as it is */
+void ap_order_free(ap_order_t *o)
+{
+    if (o->list != NULL)
+        twl_list_unobserve(o->list, observe, o);
+    clear(o);
+    free(o->head);
+    free(o->buckets);
+}
+
+static unsigned int hash_eth(const ap_order_t *o, int eth)
+{
+    return ((uint32_t) eth * 2654435761u) & (unsigned int) (o->bucket_count - 1);
+}
+
+static ap_order_node_t **hash_slot(ap_order_t *o, int eth)
+{
+    ap_order_node_t **slot = &o->buckets[hash_eth(o, eth)];
+
+    while (*slot != NULL && (*slot)->eth != eth)
+        slot = &(*slot)->hash_next;
+    return slot;
+}
+
+/* Doubles the buckets once there is more than one node per bucket */
+static void hash_grow(ap_order_t *o)
+{
+    ap_order_node_t **old = o->buckets;
+    int old_count = o->bucket_count;
+
+    o->bucket_count *= 2;
+    o->buckets = (ap_order_node_t **) calloc((size_t) o->bucket_count,
+            sizeof(ap_order_node_t *));
+    assert(o->buckets != NULL);
+    for (int b = 0; b < old_count; b++) {
+        ap_order_node_t *node = old[b];
+        while (node != NULL) {
+            ap_order_node_t *next = node->hash_next;
+            unsigned int h = hash_eth(o, node->eth);
+            node->hash_next = o->buckets[h];
+            o->buckets[h] = node;
+            node = next;
+        }
+    }
+    free(old);
+}
+
+/* 1 + the number of heads in a row of a coin that lands heads 1/4 of the
+ * time
+ */
+static int random_height(ap_order_t *o)
+{
+    int height = 1;
+
+    for (;;) {
+        o->rng ^= o->rng << 13;
+        o->rng ^= o->rng >> 17;
+        o->rng ^= o->rng << 5;
+        if ((o->rng & 3) != 0 || height == AP_ORDER_LEVELS)
+            return height;
+        height++;
+    }
+}
+
+/* TRUE if node ranks ahead of the key count and eth, in the ap_rank_aps
+ * sense
+ */
+static int ahead(const ap_order_node_t *node, int count, int eth)
+{
+    return node->count > count || (node->count == count && node->eth < eth);
+}
+
+/* Finds, on every level, the last node that ranks ahead of the key, and
+ * the number of records before it.  Returns the number of records ahead
+ * of the key.
+ */
+static int find_path(ap_order_t *o, int count, int eth, ap_order_node_t **path, int *before)
+{
+    ap_order_node_t *node = o->head;
+    int rank = 0;
+
+    for (int i = o->levels - 1; i >= 0; i--) {
+        while (node->link[i].next != NULL && ahead(node->link[i].next, count, eth)) {
+            rank += node->link[i].span;
+            node = node->link[i].next;
+        }
+        if (path != NULL) {
+            path[i] = node;
+            before[i] = rank;
+        }
+    }
+    return rank;
+}
+
+/* Adds a leaderboard record.  Its eth address must not be in the index. */
+static void insert(ap_order_t *o, ap_info_t *rec)
+{
+    ap_order_node_t *path[AP_ORDER_LEVELS];
+    int before[AP_ORDER_LEVELS];
+    ap_order_node_t **slot = hash_slot(o, rec->eth_address);
+    ap_order_node_t *node;
+    int height, rank;
+
+    assert(*slot == NULL);
+    rank = find_path(o, rec->mobile_count, rec->eth_address, path, before);
+    height = random_height(o);
+    for (int i = o->levels; i < height; i++) {
+        path[i] = o->head;
+        before[i] = 0;
+        o->head->link[i].span = o->count;
+    }
+    if (height > o->levels)
+        o->levels = height;
+
+    node = new_node(rec, height);
+    for (int i = 0; i < height; i++) {
+        node->link[i].next = path[i]->link[i].next;
+        path[i]->link[i].next = node;
+        node->link[i].span = path[i]->link[i].span - (rank - before[i]);
+        path[i]->link[i].span = rank - before[i] + 1;
+    }
+    for (int i = height; i < o->levels; i++)
+        path[i]->link[i].span++;
+    o->count++;
+
+    *slot = node;
+    if (o->count > o->bucket_count)
+        hash_grow(o);
+}
+
+/* Takes the AP out of the index.  Its node has the mobile count it went in
+ * with, which ap_inc and ap_dec have changed by the time they unlink it.
+ */
+static void drop(ap_order_t *o, int eth)
+{
+    ap_order_node_t *path[AP_ORDER_LEVELS];
+    int before[AP_ORDER_LEVELS];
+    ap_order_node_t **slot = hash_slot(o, eth);
+    ap_order_node_t *node = *slot;
+
+    assert(node != NULL);
+    *slot = node->hash_next;
+    find_path(o, node->count, node->eth, path, before);
+    assert(path[0]->link[0].next == node);
+    for (int i = 0; i < o->levels; i++) {
+        if (path[i]->link[i].next == node) {
+            path[i]->link[i].span += node->link[i].span - 1;
+            path[i]->link[i].next = node->link[i].next;
+        } else {
+            path[i]->link[i].span--;
+        }
+    }
+    while (o->levels > 1 && o->head->link[o->levels - 1].next == NULL)
+        o->levels--;
+    o->count--;
+    free(node);
+}
+
+static void add_list(ap_order_t *o, twl_list_t *list)
+{
+    for (ll_node_t *node = twl_list_front_node(list); node != NULL;
+            node = twl_list_next_node(node))
+        insert(o, (ap_info_t *) twl_list_node_data(node));
+}
+
+static void observe(void *ctx, twl_list_t *list, ll_node_t *node, int event)
+{
+    ap_order_t *o = (ap_order_t *) ctx;
+
+    switch (event) {
+    case TWL_LIST_LINKED:
+        insert(o, (ap_info_t *) twl_list_node_data(node));
+        break;
+    case TWL_LIST_UNLINKED:
+        drop(o, ((ap_info_t *) twl_list_node_data(node))->eth_address);
+        break;
+    case TWL_LIST_RESHAPED:
+        clear(o);
+        add_list(o, list);
+        break;
+    case TWL_LIST_DESTROYED:
+        clear(o);
+        o->list = NULL;
+        break;
+    default:
+        break;
+    }
+}
+
+/* Indexes the records of the leaderboard and follows its changes from now
+ * on, until it is destructed.  One list at a time.
+ */
+void ap_order_watch(ap_order_t *o, twl_list_t *leaderboard)
+{
+    assert(o->list == NULL);
+    o->list = leaderboard;
+    twl_list_observe(leaderboard, observe, o);
+    add_list(o, leaderboard);
+}
+
+/* The number of records that rank ahead of the key count and eth, which
+ * need not be in the index
+ */
+int ap_order_ahead(ap_order_t *o, int count, int eth)
+{
+    return find_path(o, count, eth, NULL, NULL);
+}
+
+/* The leaderboard record of the AP in O(1), or NULL */
+ap_info_t *ap_order_find(ap_order_t *o, int eth)
+{
+    ap_order_node_t *node = *hash_slot(o, eth);
+
+    return node != NULL ? node->rec : NULL;
+}
+
+/* RANK eth: res->code is 0 and res->value the position of the AP, with
+ * res->rec a copy of its record, or res->code is -1 if it is not on the
+ * leaderboard.  res->aux is the leaderboard size.
+ */
+void ap_order_rank(ap_order_t *o, int eth, ap_result_t *res)
+{
+    ap_order_node_t *node = *hash_slot(o, eth);
+
+    res->op = AP_OP_RANK;
+    res->eth = eth;
+    res->aux = o->count;
+    if (node == NULL) {
+        res->code = -1;
+        return;
+    }
+    res->code = 0;
+    res->value = find_path(o, node->count, node->eth, NULL, NULL);
+    res->rec = *node->rec;
+}
+
+/* Copies the records from node on, at most count of them or while the
+ * mobile count is at least min_count, to res->list.  Returns how many.
+ */
+static int copy_from(ap_order_node_t *node, int count, int min_count, ap_result_t *res)
+{
+    int copied = 0;
+
+    res->list = twl_list_construct(NULL);
+    res->owns_list = TRUE;
+    for (; node != NULL && copied < count && node->count >= min_count;
+            node = node->link[0].next) {
+        ap_info_t *rec = (ap_info_t *) malloc(sizeof(ap_info_t));
+        assert(rec != NULL);
+        *rec = *node->rec;
+        twl_list_append(res->list, rec);
+        copied++;
+    }
+    return copied;
+}
+
+/* TOPK k: the first k records, best first.  res->code is -1 for k below
+ * 1; res->value is the records given and res->aux the leaderboard size.
+ */
+void ap_order_topk(ap_order_t *o, int k, ap_result_t *res)
+{
+    res->op = AP_OP_TOPK;
+    res->aux = o->count;
+    res->code = k < 1 ? -1 : 0;
+    res->value = copy_from(o->head->link[0].next, k, INT_MIN, res);
+}
+
+/* RANGE lo hi: the records with a mobile count from lo to hi, best
+ * first.  res->value is how many and res->aux the position of the first.
+ */
+void ap_order_range(ap_order_t *o, int lo, int hi, ap_result_t *res)
+{
+    ap_order_node_t *path[AP_ORDER_LEVELS];
+    int before[AP_ORDER_LEVELS];
+
+    /* the key ranks behind every record with a larger count, and ahead of
+     * every record with the count hi
+     */
+    res->op = AP_OP_RANGE;
+    res->code = 0;
+    res->aux = find_path(o, hi, INT_MIN, path, before);
+    res->value = lo > hi ? copy_from(NULL, 0, lo, res)
+        : copy_from(path[0]->link[0].next, INT_MAX, lo, res);
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -0,0 +1,71 @@
+// ap_order.h
+
+/* Rank index of the leaderboard, for RANK, TOPK and RANGE.
+ *
+ * The leaderboard is a linked list, so the position of a record or the
+ * records from some position on cost a walk from the front.  The index
+ * keeps the same records, not copies, in an indexable skip list ordered
+ * by ap_rank_aps, and a hash table from eth address to skip list node:
+ *
+ *     RANK eth      the position of the AP, as PRINT numbers it
+ *     TOPK k        the first k records
+ *     RANGE lo hi   the records with lo <= mobile_count <= hi, best first
+ *
+ * Each link of the skip list also counts the records it jumps over, so
+ * the search for a record or a mobile count also gives its position, in
+ * O(log n).  The queries then cost O(log n) plus the records they return.
+ *
+ * The index watches the leaderboard as an observer (see
+ * twl_list_observer_t), like ap_expire.h and ap_lookup.h, so it follows
+ * every insert and remove, whichever code made them.  Each node keeps the
+ * mobile count and eth address it went in with, as ap_inc and ap_dec
+ * change the count before they unlink the record to insert it again.
+ * A record must not otherwise change them while it is on the list.
+ *
+ * With --shards every shard has an index of its own list, kept by its
+ * worker, and the queries add up or merge the answers of the shards (see
+ * ap_shard.h); ap_order_ahead counts a shard's records ahead of an AP
+ * that is in another one.
+ */
+
+#define AP_ORDER_LEVELS 24          // enough for 4^24 records
+
+struct ap_order_node_tag;
+
+typedef struct ap_order_link_tag {
+    struct ap_order_node_tag *next;
+    int span;                       // records from this node to next
+} ap_order_link_t;
+
+typedef struct ap_order_node_tag {
+    ap_info_t *rec;                 // the leaderboard's record
+    int count;                      // its mobile count and eth address
+    int eth;                        // when it went in, the key
+    struct ap_order_node_tag *hash_next;
+    int height;
+    ap_order_link_t link[];         // height links, level 0 first
+} ap_order_node_t;
+
+typedef struct ap_order_tag {
+    ap_order_node_t *head;          // AP_ORDER_LEVELS links, no record
+    int levels;                     // levels in use
+    int count;
+    ap_order_node_t **buckets;      // eth hash, chained by hash_next
+    int bucket_count;               // power of two
+    unsigned int rng;               // picks node heights
+    twl_list_t *list;               // the watched list, NULL once destructed
+} ap_order_t;
+
+void ap_order_init(ap_order_t *o);
+void ap_order_free(ap_order_t *o);
+void ap_order_watch(ap_order_t *o, twl_list_t *leaderboard);
+ap_info_t *ap_order_find(ap_order_t *o, int eth);
+int ap_order_ahead(ap_order_t *o, int count, int eth);
+
+/* the queries; TOPK and RANGE give copies of the records in res->list */
+void ap_order_rank(ap_order_t *o, int eth, ap_result_t *res);
+void ap_order_topk(ap_order_t *o, int k, ap_result_t *res);
+void ap_order_range(ap_order_t *o, int lo, int hi, ap_result_t *res);
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
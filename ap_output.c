@@ -0,0 +1,232 @@
+// ap_output.c
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <assert.h>
+#include "ap_output.h"
+
+#define TRUE  1
+#define FALSE 0
+
+/* %g uses fixed notation with six significant digits for values in
+ * [1e-4, 1e6).  pow10_tab[i] is 10^i for the scaling that needs.
+ */
+static const double pow10_tab[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9
+};
+
+static char out_store[OUT_BUF_SIZE];
+static out_buf_t out_stdout = { out_store, 0, OUT_BUF_SIZE, NULL, FALSE, 0 };
+static _Thread_local out_buf_t *out_cur = &out_stdout;
+
+/* Sets up the stdout buffer.  In quiet mode acknowledgements are counted
+ * but not printed.
+ */
+void out_init(int quiet)
+{
+    out_stdout.fp = stdout;
+    out_stdout.quiet = quiet;
+    out_stdout.acks = 0;
+    out_stdout.len = 0;
+}
+
+/* Makes b the buffer the out_ functions write to and returns the one that
+ * was current.  A buffer without a flush target (fp NULL) grows instead of
+ * flushing; its owner sends data[0..len) and empties it.
+ */
+out_buf_t *out_select(out_buf_t *b)
+{
+    out_buf_t *prev = out_cur;
+    out_cur = b != NULL ? b : &out_stdout;
+    return prev;
+}
+
+/* Writes everything buffered so far to the flush target.
+ */
+void out_flush(void)
+{
+    out_buf_t *b = out_cur;
+    if (b->len > 0 && b->fp != NULL) {
+        fwrite(b->data, 1, b->len, b->fp);
+        b->len = 0;
+    }
+    if (b->fp != NULL)
+        fflush(b->fp);
+}
+
+/* Makes room for n more bytes, flushing if the buffer is full.
+ */
+static void out_reserve(size_t n)
+{
+    out_buf_t *b = out_cur;
+    if (b->len + n <= b->cap)
+        return;
+    if (b->fp == NULL) {
+        size_t cap = b->cap > 0 ? b->cap * 2 : 4096;
+        while (cap < b->len + n)
+            cap *= 2;
+        b->data = (char *) realloc(b->data, cap);
+        assert(b->data != NULL);
+        b->cap = cap;
+        return;
+    }
+    fwrite(b->data, 1, b->len, b->fp);
+    b->len = 0;
+}
+
+void out_mem(const char *s, size_t n)
+{
+    out_buf_t *b = out_cur;
+    if (n > b->cap && b->fp != NULL) {
+        fwrite(b->data, 1, b->len, b->fp);
+        b->len = 0;
+        fwrite(s, 1, n, b->fp);
+        return;
+    }
+    out_reserve(n);
+    memcpy(b->data + b->len, s, n);
+    b->len += n;
+}
+
+void out_str(const char *s)
+{
+    out_mem(s, strlen(s));
+}
+
+void out_char(char c)
+{
+    out_reserve(1);
+    out_cur->data[out_cur->len++] = c;
+}
+
+/* Same text as printf("%d", v)
+ */
+void out_int(int v)
+{
+    char tmp[12];
+    int n = 0;
+    unsigned int u = v < 0 ? 0u - (unsigned int) v : (unsigned int) v;
+
+    do {
+        tmp[n++] = (char) ('0' + u % 10);
+        u /= 10;
+    } while (u != 0);
+    out_reserve(n + 1);
+    if (v < 0)
+        out_cur->data[out_cur->len++] = '-';
+    while (n > 0)
+        out_cur->data[out_cur->len++] = tmp[--n];
+}
+
+/* Formats v the way %g does and returns the length.
+ *
+ * Only the fixed notation range is formatted by hand, which covers every
+ * band and data rate in practice.  Values that need exponent notation, and
+ * values that sit so close to a rounding tie that the scaled product cannot
+ * be trusted, are passed to snprintf so the text is always identical.
+ */
+static int format_g(char *dst, double v)
+{
+    double a = v < 0 ? -v : v;
+    double scaled, whole, frac, limit;
+    unsigned long long digits, ipart, fpart, div;
+    int x, decimals, n = 0, k;
+    char tmp[24];
+
+    if (a == 0.0)
+        return snprintf(dst, 32, "%g", v);     // keeps the sign of -0
+    if (!(a >= 1e-4 && a < 1e6))
+        return snprintf(dst, 32, "%g", v);     // exponent form, inf, nan
+
+    /* find x with 10^x <= a < 10^(x+1) */
+    x = 5;
+    while (x > -4 && a < pow10_tab[x + 4] / 1e4)
+        x--;
+    decimals = 5 - x;
+    scaled = a * pow10_tab[decimals];
+    whole = (double) (unsigned long long) scaled;
+    frac = scaled - whole;
+    if (frac > 0.5 - 1e-7 && frac < 0.5 + 1e-7)
+        return snprintf(dst, 32, "%g", v);
+    digits = (unsigned long long) whole + (frac > 0.5 ? 1 : 0);
+    limit = 1e6;
+    if ((double) digits >= limit)
+        return snprintf(dst, 32, "%g", v);     // rounding moved the exponent
+
+    div = (unsigned long long) pow10_tab[decimals];
+    ipart = digits / div;
+    fpart = digits % div;
+
+    if (v < 0)
+        dst[n++] = '-';
+    k = 0;
+    do {
+        tmp[k++] = (char) ('0' + ipart % 10);
+        ipart /= 10;
+    } while (ipart != 0);
+    while (k > 0)
+        dst[n++] = tmp[--k];
+
+    /* drop trailing zeros of the fraction, as %g does */
+    while (decimals > 0 && fpart % 10 == 0) {
+        fpart /= 10;
+        decimals--;
+    }
+    if (decimals > 0) {
+        dst[n++] = '.';
+        for (k = decimals - 1; k >= 0; k--) {
+            dst[n + k] = (char) ('0' + fpart % 10);
+            fpart /= 10;
+        }
+        n += decimals;
+    }
+    dst[n] = '\0';
+    return n;
+}
+
+/* Same text as printf("%g", v)
+ */
+void out_float(double v)
+{
+    char tmp[32];
+    int n = format_g(tmp, v);
+    out_mem(tmp, (size_t) n);
+}
+
+/* Slow path for the rare lines that need a full printf conversion.
+ */
+void out_printf(const char *fmt, ...)
+{
+    char tmp[512];
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+    va_end(ap);
+    assert(n >= 0);
+    if ((size_t) n >= sizeof(tmp))
+        n = sizeof(tmp) - 1;
+    out_mem(tmp, (size_t) n);
+}
+
+int out_ack(void)
+{
+    out_cur->acks++;
+    return !out_cur->quiet;
+}
+
+long out_ack_count(void)
+{
+    return out_cur->acks;
+}
+
+int out_is_quiet(void)
+{
+    return out_cur->quiet;
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
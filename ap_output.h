@@ -0,0 +1,50 @@
+// ap_output.h
+
+/* Buffered output layer.
+ *
+ * All command results are formatted by hand into one large reusable buffer
+ * instead of going through printf for every field.  The buffer is written
+ * to stdout only at explicit flush points (buffer full, before reading
+ * interactive input, and at exit), so a long replay costs a handful of
+ * write calls instead of several stdio calls per record.
+ *
+ * The integer and float formatters produce exactly the same text as the
+ * %d and %g conversions they replace.
+ *
+ * The out_ functions write to the current buffer, which is the stdout
+ * buffer unless out_select picked another one.  Each thread has its own
+ * current buffer.  The server mode gives each connection its own buffer
+ * with no flush target, and so do the query readers (ap_readers.h).
+ */
+
+#define OUT_BUF_SIZE (256 * 1024)
+
+typedef struct out_buf_tag {
+    char *data;
+    size_t len;
+    size_t cap;
+    FILE *fp;       // flush target, NULL: grow instead
+    int quiet;      // suppress acknowledgements
+    long acks;      // acknowledgements issued (printed or not)
+} out_buf_t;
+
+void out_init(int quiet);
+out_buf_t *out_select(out_buf_t *b);
+void out_flush(void);
+
+void out_mem(const char *s, size_t n);
+void out_str(const char *s);
+void out_char(char c);
+void out_int(int v);
+void out_float(double v);
+void out_printf(const char *fmt, ...);
+
+/* Every per-command acknowledgement must start with out_ack().  It counts
+ * the acknowledgement and returns false if it is to be suppressed.
+ */
+int out_ack(void);
+long out_ack_count(void);
+int out_is_quiet(void);
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
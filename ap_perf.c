@@ -0,0 +1,129 @@
+// ap_perf.c
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "twl_list.h"
+#include "ap_command.h"
+#include "ap_perf.h"
+
+#define TRUE  1
+#define FALSE 0
+
+static const struct {
+    const char *name;
+    uint64_t config;
+} events[AP_PERF_EVENTS] = {
+    { "cycles", PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions", PERF_COUNT_HW_INSTRUCTIONS },
+    { "cache-misses", PERF_COUNT_HW_CACHE_MISSES },
+    { "branch-misses", PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+void ap_perf_init(ap_perf_t *p)
+{
+    for (int i = 0; i < AP_PERF_EVENTS; i++)
+        p->fd[i] = -1;
+    p->state = 0;
+    p->why = NULL;
+}
+
+static const char *reason(int err)
+{
+    switch (err) {
+    case ENOENT:
+    case EOPNOTSUPP:
+        return "this machine has no hardware counters";
+    case EACCES:
+    case EPERM:
+        return "not permitted, see /proc/sys/kernel/perf_event_paranoid";
+    case ENOSYS:
+        return "the kernel has no perf events";
+    default:
+        return strerror(err);
+    }
+}
+
+/* Opens the counters for the calling thread.  Returns 0 if at least one
+ * opened, else -1 with p->why set.
+ */
+int ap_perf_open(ap_perf_t *p)
+{
+    struct perf_event_attr attr;
+    int opened = 0, err = 0;
+
+    for (int i = 0; i < AP_PERF_EVENTS; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = events[i].config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        p->fd[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+                PERF_FLAG_FD_CLOEXEC);
+        if (p->fd[i] < 0)
+            err = errno;
+        else
+            opened++;
+    }
+    if (opened == 0) {
+        p->state = -1;
+        p->why = reason(err);
+        return -1;
+    }
+    p->state = 1;
+    return 0;
+}
+
+/* Samples every counter into sample[AP_PERF_EVENTS], -1 for one that is
+ * not open
+ */
+void ap_perf_read(ap_perf_t *p, long long *sample)
+{
+    uint64_t v[3];          // value, time enabled, time running
+
+    for (int i = 0; i < AP_PERF_EVENTS; i++) {
+        sample[i] = -1;
+        if (p->fd[i] < 0 || read(p->fd[i], v, sizeof(v)) != sizeof(v))
+            continue;
+        if (v[2] != 0 && v[2] < v[1])
+            v[0] = (uint64_t) ((double) v[0] * (double) v[1] / (double) v[2]);
+        sample[i] = (long long) v[0];
+    }
+}
+
+void ap_perf_delta(const long long *before, const long long *after, long long *delta)
+{
+    for (int i = 0; i < AP_PERF_EVENTS; i++) {
+        if (before[i] < 0 || after[i] < 0)
+            delta[i] = -1;
+        else
+            delta[i] = after[i] - before[i];
+    }
+}
+
+void ap_perf_close(ap_perf_t *p)
+{
+    for (int i = 0; i < AP_PERF_EVENTS; i++) {
+        if (p->fd[i] >= 0)
+            close(p->fd[i]);
+        p->fd[i] = -1;
+    }
+    p->state = 0;
+}
+
+const char *ap_perf_name(int i)
+{
+    assert(i >= 0 && i < AP_PERF_EVENTS);
+    return events[i].name;
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -0,0 +1,36 @@
+// ap_perf.h
+
+/* Hardware performance counters around sorts and command ranges.
+ *
+ * ap_perf_open opens four counters with perf_event_open for the calling
+ * thread, user space only: cycles, instructions, cache misses and branch
+ * misses.  They run from then on.  ap_perf_read takes a sample of all
+ * four and a measurement is the difference of two samples.  When the
+ * kernel has to share the hardware among more counters than it has, it
+ * scales the values by the time each counter actually ran.
+ *
+ * A counter the machine does not have is left out and reads as -1.  When
+ * none opens (no PMU in a virtual machine, perf_event_paranoid, seccomp)
+ * ap_perf_open fails and why says so; wifi then reports that instead of
+ * numbers and everything else works as before.
+ *
+ * The counters follow the thread that opened them, so wifi opens them
+ * lazily on the thread that executes the commands.  With --shards a
+ * command range does not include the list work of the shard workers.
+ */
+
+typedef struct ap_perf_tag {
+    int fd[AP_PERF_EVENTS];     // -1 for a counter that did not open
+    int state;                  // 0 not opened yet, 1 open, -1 unavailable
+    const char *why;            // state -1: the reason
+} ap_perf_t;
+
+void ap_perf_init(ap_perf_t *p);
+int ap_perf_open(ap_perf_t *p);
+void ap_perf_read(ap_perf_t *p, long long *sample);
+void ap_perf_delta(const long long *before, const long long *after, long long *delta);
+void ap_perf_close(ap_perf_t *p);
+const char *ap_perf_name(int i);
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
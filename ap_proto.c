@@ -0,0 +1,327 @@
+// ap_proto.c
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <assert.h>
+#include "twl_list.h"
+#include "ap_command.h"
+#include "ap_support.h"
+#include "ap_output.h"
+#include "ap_input.h"
+#include "ap_proto.h"
+#include "ap_metrics.h"
+
+#define TRUE  1
+#define FALSE 0
+
+static void put_i32(unsigned char *buf, int v)
+{
+    uint32_t u = (uint32_t) v;
+    buf[0] = (unsigned char) u;
+    buf[1] = (unsigned char) (u >> 8);
+    buf[2] = (unsigned char) (u >> 16);
+    buf[3] = (unsigned char) (u >> 24);
+}
+
+static void put_i64(unsigned char *buf, long long v)
+{
+    uint64_t u = (uint64_t) v;
+    for (int i = 0; i < 8; i++)
+        buf[i] = (unsigned char) (u >> (8 * i));
+}
+
+static int get_i32(const unsigned char *buf)
+{
+    uint32_t u = (uint32_t) buf[0] | (uint32_t) buf[1] << 8
+        | (uint32_t) buf[2] << 16 | (uint32_t) buf[3] << 24;
+    return (int) u;
+}
+
+static void put_f32(unsigned char *buf, float f)
+{
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    put_i32(buf, (int) u);
+}
+
+static float get_f32(const unsigned char *buf)
+{
+    uint32_t u = (uint32_t) get_i32(buf);
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+void ap_proto_put_rec(unsigned char *buf, const ap_info_t *rec)
+{
+    put_i32(buf + 0, rec->mobile_count);
+    put_i32(buf + 4, rec->eth_address);
+    put_i32(buf + 8, rec->ip_address);
+    put_i32(buf + 12, rec->location_code);
+    put_i32(buf + 16, rec->authenticated);
+    put_i32(buf + 20, rec->privacy);
+    put_i32(buf + 24, rec->standard_letter);
+    put_f32(buf + 28, rec->band);
+    put_i32(buf + 32, rec->channel);
+    put_f32(buf + 36, rec->data_rate);
+    put_i32(buf + 40, rec->time_received);
+}
+
+/* Decodes a record.  Returns FALSE if a field is outside the range the
+ * text parser can produce, since ap_print_info indexes tables with them.
+ */
+int ap_proto_get_rec(const unsigned char *buf, ap_info_t *rec)
+{
+    rec->mobile_count = get_i32(buf + 0);
+    rec->eth_address = get_i32(buf + 4);
+    rec->ip_address = get_i32(buf + 8);
+    rec->location_code = get_i32(buf + 12);
+    rec->authenticated = get_i32(buf + 16);
+    rec->privacy = get_i32(buf + 20);
+    rec->standard_letter = get_i32(buf + 24);
+    rec->band = get_f32(buf + 28);
+    rec->channel = get_i32(buf + 32);
+    rec->data_rate = get_f32(buf + 36);
+    rec->time_received = get_i32(buf + 40);
+    return rec->privacy >= 0 && rec->privacy <= 3
+        && rec->standard_letter >= 0 && rec->standard_letter <= 'z' - 'a'
+        && (rec->authenticated == 0 || rec->authenticated == 1);
+}
+
+/* Size of the command frame after the opcode, or -1 for an unknown
+ * opcode.  AP_OP_NONE, SAVE and LOAD are variable and handled by the
+ * callers.
+ */
+static int has_text(int op)
+{
+    return op == AP_OP_NONE || op == AP_OP_SAVE || op == AP_OP_LOAD;
+}
+
+static int cmd_payload(int op)
+{
+    switch (op) {
+    case AP_OP_ADD:
+    case AP_OP_JOINQ:
+        return AP_PROTO_REC_SIZE;
+    case AP_OP_REMOVE:
+    case AP_OP_FIND:
+    case AP_OP_INC:
+    case AP_OP_DEC:
+    case AP_OP_SORTAP:
+    case AP_OP_SORTETH:
+    case AP_OP_TOPQ:
+    case AP_OP_PARTQ:
+    case AP_OP_RANK:
+    case AP_OP_TOPK:
+    case AP_OP_FINDIP:
+    case AP_OP_FINDLOC:
+    case AP_OP_VIEWQ:
+        return 4;
+    case AP_OP_APPENDQ:
+    case AP_OP_RANGE:
+    case AP_OP_EXPIRE:
+        return 8;
+    case AP_OP_PRINT:
+    case AP_OP_REMOVEALL:
+    case AP_OP_MOVEQTOL:
+    case AP_OP_PRINTQ:
+    case AP_OP_STATS:
+    case AP_OP_QUIT:
+    case AP_OP_METRICS:
+    case AP_OP_LISTSTATS:
+    case AP_OP_PERFON:
+    case AP_OP_PERFOFF:
+    case AP_OP_CALIBRATE:
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+/* Encodes one command into buf, which must hold AP_PROTO_MAX_FRAME bytes.
+ * Returns the frame length.
+ */
+size_t ap_proto_put_cmd(unsigned char *buf, const ap_cmd_t *cmd)
+{
+    buf[0] = (unsigned char) cmd->op;
+    if (has_text(cmd->op)) {
+        size_t n = cmd->text_len < MAXLINE ? cmd->text_len : MAXLINE - 1;
+        buf[1] = (unsigned char) n;
+        memcpy(buf + 2, cmd->text, n);
+        return 2 + n;
+    }
+
+    int size = cmd_payload(cmd->op);
+    assert(size >= 0);
+    if (size == AP_PROTO_REC_SIZE) {
+        assert(cmd->rec != NULL);
+        ap_proto_put_rec(buf + 1, cmd->rec);
+    } else if (size >= 4) {
+        put_i32(buf + 1, cmd->id);
+        if (size == 8)
+            put_i32(buf + 5, cmd->arg);
+    }
+    return 1 + (size_t) size;
+}
+
+/* Checks the stream magic.  Returns TRUE if it matches.
+ */
+int ap_proto_get_magic(in_src_t *in, const char *magic)
+{
+    const unsigned char *b;
+    if (!in_next_bytes(in, AP_PROTO_MAGIC_SIZE, &b))
+        return FALSE;
+    return memcmp(b, magic, AP_PROTO_MAGIC_SIZE) == 0;
+}
+
+/* Reads and decodes one command frame.  For ADD and JOINQ a record is
+ * allocated and owned by cmd.  The text of an AP_OP_NONE, SAVE or LOAD
+ * frame points into the input and is valid until the next read.
+ *
+ * Returns 1 for a frame, 0 at a clean end of input and -1 for an unknown
+ * opcode, a bad record or a frame cut short.
+ */
+int ap_proto_get_cmd(in_src_t *in, ap_cmd_t *cmd)
+{
+    const unsigned char *b;
+    int size;
+
+    cmd->op = AP_OP_NONE;
+    cmd->id = 0;
+    cmd->arg = 0;
+    cmd->rec = NULL;
+    cmd->prompted = FALSE;
+    cmd->text = NULL;
+    cmd->text_len = 0;
+    cmd->image = NULL;
+    cmd->image_len = 0;
+
+    if (!in_next_bytes(in, 1, &b))
+        return 0;
+    cmd->op = b[0];
+    if (has_text(cmd->op)) {
+        if (!in_next_bytes(in, 1, &b))
+            return -1;
+        cmd->text_len = b[0];
+        if (cmd->text_len >= MAXLINE)
+            return -1;
+        if (!in_next_bytes(in, cmd->text_len, &b))
+            return -1;
+        cmd->text = (const char *) b;
+        return 1;
+    }
+
+    size = cmd_payload(cmd->op);
+    if (size < 0)
+        return -1;
+    if (size > 0 && !in_next_bytes(in, (size_t) size, &b))
+        return -1;
+    if (size == AP_PROTO_REC_SIZE) {
+        cmd->rec = (ap_info_t *) calloc(1, sizeof(ap_info_t));
+        assert(cmd->rec != NULL);
+        if (!ap_proto_get_rec(b, cmd->rec)) {
+            free(cmd->rec);
+            cmd->rec = NULL;
+            return -1;
+        }
+        cmd->id = cmd->rec->eth_address;
+    } else if (size >= 4) {
+        cmd->id = get_i32(b);
+        if (size == 8)
+            cmd->arg = get_i32(b + 4);
+    }
+    return 1;
+}
+
+/* Writes the binary response for one result to the output buffer.
+ */
+void ap_proto_put_result(const ap_result_t *res)
+{
+    unsigned char buf[AP_PROTO_RES_SIZE + AP_PROTO_REC_SIZE];
+    int aux = res->aux;
+
+    if (res->op == AP_OP_SORTAP || res->op == AP_OP_SORTETH)
+        aux = (int) (res->elapsed * 1000.0);
+    buf[0] = (unsigned char) res->op;
+    put_i32(buf + 1, res->code);
+    put_i32(buf + 5, res->eth);
+    put_i32(buf + 9, res->value);
+    put_i32(buf + 13, aux);
+
+    if (res->op == AP_OP_PRINT || res->op == AP_OP_PRINTQ || res->op == AP_OP_TOPQ
+            || res->op == AP_OP_PARTQ || res->op == AP_OP_TOPK || res->op == AP_OP_RANGE
+            || res->op == AP_OP_FINDIP || res->op == AP_OP_FINDLOC
+            || res->op == AP_OP_VIEWQ) {
+        int count = twl_list_size(res->list);
+        if (res->op != AP_OP_FINDIP && res->op != AP_OP_FINDLOC)
+            put_i32(buf + 9, count);
+        out_mem((const char *) buf, AP_PROTO_RES_SIZE);
+        for (int i = 0; i < count; i++) {
+            ap_proto_put_rec(buf, twl_list_access(res->list, i));
+            out_mem((const char *) buf, AP_PROTO_REC_SIZE);
+        }
+    } else if ((res->op == AP_OP_REMOVE || res->op == AP_OP_RANK) && res->code == 0) {
+        ap_proto_put_rec(buf + AP_PROTO_RES_SIZE, &res->rec);
+        out_mem((const char *) buf, AP_PROTO_RES_SIZE + AP_PROTO_REC_SIZE);
+    } else if (res->op == AP_OP_METRICS) {
+        /* one row per verb that ran: i32 op, i32 count, then p50, p90,
+         * p99, p99.9 and max in nanoseconds, each capped at INT_MAX
+         */
+        static const double percents[] = { 50.0, 90.0, 99.0, 99.9, 100.0 };
+        unsigned char row[AP_PROTO_METRICS_ROW];
+        int rows = 0;
+        for (int op = 0; op < AP_OP_COUNT; op++)
+            rows += res->metrics->hist[op].count > 0;
+        put_i32(buf + 9, rows);
+        out_mem((const char *) buf, AP_PROTO_RES_SIZE);
+        for (int op = 0; op < AP_OP_COUNT; op++) {
+            const ap_hist_t *h = &res->metrics->hist[op];
+            if (h->count == 0)
+                continue;
+            put_i32(row, op);
+            put_i32(row + 4, h->count < INT_MAX ? (int) h->count : INT_MAX);
+            for (int i = 0; i < 5; i++) {
+                long long ns = i < 4 ? ap_hist_percentile(h, percents[i]) : h->max;
+                put_i32(row + 8 + 4 * i, ns < INT_MAX ? (int) ns : INT_MAX);
+            }
+            out_mem((const char *) row, AP_PROTO_METRICS_ROW);
+        }
+    } else if (res->op == AP_OP_LISTSTATS) {
+        /* each count capped at INT_MAX */
+        unsigned char row[AP_PROTO_LISTSTATS_ROW];
+        out_mem((const char *) buf, AP_PROTO_RES_SIZE);
+        for (int i = 0; i < 2; i++) {
+            const twl_list_stats_t *s = &res->stats[i];
+            long counts[5] = { s->compares, s->hops, s->allocs, s->frees, s->validates };
+            for (int j = 0; j < 5; j++)
+                put_i32(row + 4 * j, counts[j] < INT_MAX ? (int) counts[j] : INT_MAX);
+            out_mem((const char *) row, AP_PROTO_LISTSTATS_ROW);
+        }
+    } else if (res->op == AP_OP_PERFOFF && res->code == 0) {
+        for (int i = 0; i < AP_PERF_EVENTS; i++)
+            put_i64(buf + AP_PROTO_RES_SIZE + 8 * i, res->perf[i]);
+        out_mem((const char *) buf, AP_PROTO_RES_SIZE + AP_PROTO_PERF_SIZE);
+    } else if (res->op == AP_OP_CALIBRATE) {
+        unsigned char row[AP_PROTO_TUNE_ROW];
+        put_i32(buf + 9, TWL_SORT_BUCKETS);
+        out_mem((const char *) buf, AP_PROTO_RES_SIZE);
+        for (int b = 0; b < TWL_SORT_BUCKETS; b++) {
+            put_i32(row, b == TWL_SORT_BUCKETS - 1 ? -1 : res->tuning.size[b]);
+            for (int c = 0; c < TWL_SORT_CLASSES; c++)
+                put_i32(row + 4 + 4 * c, res->tuning.type[c][b]);
+            out_mem((const char *) row, AP_PROTO_TUNE_ROW);
+        }
+    } else if (res->op == AP_OP_NONE) {
+        put_i32(buf + 9, (int) res->text_len);
+        out_mem((const char *) buf, AP_PROTO_RES_SIZE);
+        out_mem(res->text, res->text_len);
+    } else {
+        out_mem((const char *) buf, AP_PROTO_RES_SIZE);
+    }
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
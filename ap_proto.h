@@ -0,0 +1,113 @@
+// ap_proto.h
+
+/* Binary command and response protocol.
+ *
+ * A binary stream starts with a four byte magic and is followed by frames.
+ * Every frame starts with a one byte opcode (the enum ap_op value) and the
+ * rest of the frame has a fixed size for that opcode.  All fields are
+ * little-endian; ints are 32-bit two's complement and floats are IEEE-754
+ * single precision.
+ *
+ * Command frames (after the opcode):
+ *     ADD, JOINQ           record (AP_PROTO_REC_SIZE bytes, see below)
+ *     REMOVE, FIND, INC,
+ *     DEC, SORTAP, SORTETH i32 eth address or sort type
+ *     TOPQ, PARTQ, TOPK    i32 count
+ *     RANK                 i32 eth address
+ *     APPENDQ              i32 eth address, i32 mobile count
+ *     RANGE                i32 lo, i32 hi
+ *     EXPIRE               i32 now, i32 ttl
+ *     FINDIP, FINDLOC      i32 IP address or location code
+ *     VIEWQ                i32 view
+ *     NONE                 u8 length, then that many bytes of text
+ *     SAVE, LOAD           u8 length, then the file name
+ *     all others           nothing
+ *
+ * A record is the eleven ap_info_t fields in declaration order:
+ *     mobile_count eth_address ip_address location_code authenticated
+ *     privacy standard_letter band(f32) channel data_rate(f32) time_received
+ *
+ * Response frames (after the opcode) are i32 code, i32 eth, i32 value,
+ * i32 aux, followed by a body for a few opcodes.  The codes are the values
+ * ap_support.c computes:
+ *     ADD          code add_result (0 inserted, 1 full, 2 duplicate),
+ *                  aux leaderboard limit
+ *     MOVEQTOL     code move_result (0 queue empty, 1 moved, 2 full,
+ *                  3 duplicate), aux leaderboard limit
+ *     INC          code inc_result (-2 not found, else new count)
+ *     DEC          code dec_result (-2 not found, -1 already zero,
+ *                  else new count)
+ *     FIND         code 0 found or -1, value mobile count
+ *     REMOVE       code 0 found or -1; when found the removed record
+ *                  follows
+ *     REMOVEALL    value records removed
+ *     JOINQ,
+ *     APPENDQ      code 0
+ *     SORTAP,
+ *     SORTETH      code sort type (with sort type 0 the one that ran, 0
+ *                  if the list was already in order), value records, aux
+ *                  microseconds
+ *     PRINT,
+ *     PRINTQ       value records, followed by that many records
+ *     TOPQ,
+ *     PARTQ        code 0, or -1 for a count below 1; value records, aux
+ *                  queue records, followed by the records best first
+ *     RANK         code 0 found or -1, value position (0 is the front),
+ *                  aux leaderboard records; when found the record follows
+ *     TOPK         code 0, or -1 for a count below 1; value records, aux
+ *                  leaderboard records, followed by the records
+ *     RANGE        code 0, value records, aux position of the first,
+ *                  followed by the records
+ *     EXPIRE       code 0, value leaderboard and aux queue records
+ *                  removed; code 1 for a ttl below 0, value the clock;
+ *                  code -1 with --shards
+ *     FINDIP,
+ *     FINDLOC      code 0, eth the key, value leaderboard and aux queue
+ *                  records, followed by value + aux records, the
+ *                  leaderboard's first
+ *     VIEWQ        code 0, or -1 for an unknown view; value records, aux
+ *                  the view, followed by the records in its order
+ *     STATS        value leaderboard records, aux queue records
+ *     SAVE, LOAD   code 0 or -1, value leaderboard records, aux queue
+ *                  records
+ *     METRICS      value rows, followed by that many rows of
+ *                  AP_PROTO_METRICS_ROW bytes: i32 op, i32 count, i32
+ *                  p50, p90, p99, p99.9 and max in nanoseconds
+ *     LISTSTATS    value 1 if the counters are compiled in, followed by
+ *                  two rows (leaderboard, queue) of AP_PROTO_LISTSTATS_ROW
+ *                  bytes: i32 compares, hops, allocs, frees and validates
+ *     PERFON       code 0, or -1 if there are no counters
+ *     PERFOFF      code 0, -1 no counters, -2 no PERFON; value commands
+ *                  counted.  With code 0 AP_PROTO_PERF_SIZE bytes follow:
+ *                  i64 cycles, instructions, cache misses and branch
+ *                  misses, -1 for a counter the machine does not have.
+ *                  SORTAP and SORTETH do not carry the --perf counts.
+ *     CALIBRATE    code 0 saved or -1 not saved, value rows, followed by
+ *                  that many rows of AP_PROTO_TUNE_ROW bytes: i32 size
+ *                  bound (-1 for the last bucket), then the sort types of
+ *                  the random, nearly sorted and nearly reversed classes
+ *     NONE         value length, followed by the echoed text
+ */
+
+#define AP_PROTO_CMD_MAGIC  "APB1"
+#define AP_PROTO_RES_MAGIC  "APR1"
+#define AP_PROTO_MAGIC_SIZE 4
+#define AP_PROTO_REC_SIZE   44
+#define AP_PROTO_RES_SIZE   17
+#define AP_PROTO_MAX_FRAME  (2 + MAXLINE)
+#define AP_PROTO_METRICS_ROW 28
+#define AP_PROTO_LISTSTATS_ROW 20
+#define AP_PROTO_PERF_SIZE  (8 * AP_PERF_EVENTS)
+#define AP_PROTO_TUNE_ROW   (4 + 4 * TWL_SORT_CLASSES)
+
+void ap_proto_put_rec(unsigned char *buf, const ap_info_t *rec);
+int ap_proto_get_rec(const unsigned char *buf, ap_info_t *rec);
+
+size_t ap_proto_put_cmd(unsigned char *buf, const ap_cmd_t *cmd);
+int ap_proto_get_cmd(in_src_t *in, ap_cmd_t *cmd);
+int ap_proto_get_magic(in_src_t *in, const char *magic);
+
+void ap_proto_put_result(const ap_result_t *res);
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
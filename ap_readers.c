@@ -0,0 +1,422 @@
+// ap_readers.c
+
+#define _GNU_SOURCE     // accept4
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "twl_list.h"
+#include "ap_command.h"
+#include "ap_support.h"
+#include "ap_output.h"
+#include "ap_input.h"
+#include "ap_server.h"
+#include "ap_readers.h"
+
+#define TRUE  1
+#define FALSE 0
+
+/* Builds a view around copy, a list made by ap_create_leaderboard, which
+ * it takes over.  The copy is a sorted list, so list_debug_validate also
+ * checks its order.
+ */
+static ap_view_t *view_wrap(twl_list_t *copy, int queue_size, long version)
+{
+    ap_view_t *v = (ap_view_t *) calloc(1, sizeof(ap_view_t));
+
+    assert(v != NULL);
+    v->leaderboard = copy;
+    v->queue_size = queue_size;
+    v->version = version;
+    v->max_eth = -1;
+    for (ll_node_t *node = twl_list_front_node(copy); node != NULL;
+            node = twl_list_next_node(node)) {
+        ap_info_t *rec = (ap_info_t *) twl_list_node_data(node);
+        if (rec->eth_address > v->max_eth)
+            v->max_eth = rec->eth_address;
+    }
+    return v;
+}
+
+/* Builds a view from a copy of leaderboard.  twl_list_append asserts the
+ * order as it goes.
+ */
+static ap_view_t *view_make(twl_list_t *leaderboard, int queue_size, long version)
+{
+    twl_list_t *copy = ap_create_leaderboard();
+    int count = twl_list_size(leaderboard);
+
+    for (int i = 0; i < count; i++) {
+        ap_info_t *rec = (ap_info_t *) malloc(sizeof(ap_info_t));
+        assert(rec != NULL);
+        *rec = *(ap_info_t *) twl_list_access(leaderboard, i);
+        twl_list_append(copy, rec);
+    }
+    return view_wrap(copy, queue_size, version);
+}
+
+static void view_free(ap_view_t *v)
+{
+    ap_cleanup(v->leaderboard);
+    free(v);
+}
+
+/* PRINT of a view.  The same text as ap_print_list, which walks the list
+ * with twl_list_access and so cannot be used on a shared view.
+ */
+static void print_view(twl_list_t *leaderboard)
+{
+    int i = 0;
+
+    if (twl_list_size(leaderboard) == 0) {
+        out_str("Leaderboard is empty\n");
+    } else {
+        out_str("Leaderboard has ");
+        out_int(twl_list_size(leaderboard));
+        out_str(" records\n");
+        for (ll_node_t *node = twl_list_front_node(leaderboard); node != NULL;
+                node = twl_list_next_node(node), i++) {
+            out_int(i);
+            out_str(": ");
+            ap_print_info((ap_info_t *) twl_list_node_data(node));
+        }
+    }
+    out_char('\n');
+}
+
+/* Answers one query client command from the current view, into the
+ * current output buffer.  The reply is formatted inside the read-side
+ * critical section, so the view cannot be freed under it.
+ */
+static void query(ap_reader_t *r, const ap_cmd_t *cmd)
+{
+    ap_readers_t *rd = r->group;
+    ap_result_t res;
+
+    atomic_store(&r->epoch, atomic_load(&rd->epoch));
+    ap_view_t *v = atomic_load(&rd->current);
+
+    memset(&res, 0, sizeof(res));
+    switch (cmd->op) {
+    case AP_OP_FIND:
+        ap_find(v->leaderboard, cmd->id, &res);
+        ap_report(&res);
+        break;
+    case AP_OP_PRINT:
+        print_view(v->leaderboard);
+        break;
+    case AP_OP_STATS:
+        res.op = AP_OP_STATS;
+        res.value = twl_list_size(v->leaderboard);
+        res.aux = v->queue_size;
+        ap_report(&res);
+        break;
+    case AP_OP_NONE:
+        res.op = AP_OP_NONE;
+        res.text = cmd->text;
+        res.text_len = cmd->text_len;
+        ap_report(&res);
+        break;
+    default:
+        out_printf("%s is not served here; only FIND, PRINT and STATS are\n",
+                ap_op_name(cmd->op));
+        break;
+    }
+
+    atomic_store_explicit(&r->epoch, 0, memory_order_release);
+    r->reads++;
+}
+
+static int send_all(int fd, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return FALSE;
+        data += n;
+        len -= (size_t) n;
+    }
+    return TRUE;
+}
+
+/* Serves one client until it sends QUIT or its input ends.  Each reply is
+ * sent before the next line is read.
+ */
+static void serve_client(ap_reader_t *r, int fd)
+{
+    int in_fd = dup(fd);
+    out_buf_t out, *prev;
+    const char *line;
+    size_t len;
+    ap_cmd_t cmd;
+    in_src_t src;
+
+    memset(&src, 0, sizeof(src));
+    src.fp = in_fd >= 0 ? fdopen(in_fd, "r") : NULL;
+    if (src.fp == NULL) {
+        if (in_fd >= 0)
+            close(in_fd);
+        return;
+    }
+    memset(&out, 0, sizeof(out));
+    prev = out_select(&out);
+    while (in_next_line(&src, &line, &len)) {
+        ap_parse_command(line, len, &cmd);
+        free(cmd.rec);
+        if (cmd.op == AP_OP_QUIT)
+            break;
+        query(r, &cmd);
+        if (!send_all(fd, out.data, out.len))
+            break;
+        out.len = 0;
+    }
+    out_select(prev);
+    free(out.data);
+    fclose(src.fp);
+}
+
+/* A query reader.  It takes clients until ap_readers_stop shuts the
+ * listening socket down.
+ */
+static void query_main(ap_reader_t *r)
+{
+    ap_readers_t *rd = r->group;
+
+    for (;;) {
+        int fd = accept4(rd->query_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (atomic_load(&rd->stop) || errno == EINVAL)
+                return;
+            continue;
+        }
+        pthread_mutex_lock(&r->client_lock);
+        if (atomic_load(&rd->stop)) {
+            pthread_mutex_unlock(&r->client_lock);
+            close(fd);
+            return;
+        }
+        r->client_fd = fd;
+        pthread_mutex_unlock(&r->client_lock);
+        r->clients++;
+        serve_client(r, fd);
+        pthread_mutex_lock(&r->client_lock);
+        r->client_fd = -1;
+        pthread_mutex_unlock(&r->client_lock);
+        close(fd);
+    }
+}
+
+/* One reader.  With --query it serves clients.  Otherwise every pass is a
+ * read-side critical section on the current view: it validates a view the
+ * first time it sees it, then runs a FIND or a STATS.
+ */
+static void *reader_main(void *arg)
+{
+    ap_reader_t *r = (ap_reader_t *) arg;
+    ap_readers_t *rd = r->group;
+    long last_version = -1;
+    ap_info_t key;
+
+    if (rd->query_fd >= 0) {
+        query_main(r);
+        return NULL;
+    }
+    while (!atomic_load_explicit(&rd->stop, memory_order_relaxed)) {
+        atomic_store(&r->epoch, atomic_load(&rd->epoch));
+        ap_view_t *v = atomic_load(&rd->current);
+
+        assert(v->version >= last_version);
+        if (v->version != last_version) {
+            list_debug_validate(v->leaderboard);
+            r->validations++;
+            last_version = v->version;
+        }
+        r->seed = r->seed * 1103515245u + 12345u;
+        if ((r->seed >> 16) % 4 != 0 && v->max_eth >= 0) {
+            key.eth_address = (int) ((r->seed >> 8) % ((unsigned int) v->max_eth + 1));
+            ap_info_t *rec = twl_list_elem_find_data_ptr(v->leaderboard, &key,
+                    ap_match_eth);
+            if (rec != NULL) {
+                assert(rec->eth_address == key.eth_address);
+                r->finds_hit++;
+            }
+        } else {
+            /* STATS */
+            assert(twl_list_size(v->leaderboard) >= 0 && v->queue_size >= 0);
+        }
+
+        atomic_store_explicit(&r->epoch, 0, memory_order_release);
+        r->reads++;
+    }
+    return NULL;
+}
+
+/* Frees the retired views no reader can still hold */
+static void reclaim(ap_readers_t *rd)
+{
+    long oldest = atomic_load(&rd->epoch);
+    ap_view_t **pp = &rd->retired;
+
+    for (int i = 0; i < rd->count; i++) {
+        long e = atomic_load(&rd->reader[i].epoch);
+        if (e != 0 && e < oldest)
+            oldest = e;
+    }
+    while (*pp != NULL) {
+        ap_view_t *v = *pp;
+        if (v->retired < oldest) {
+            *pp = v->next;
+            view_free(v);
+            rd->reclaimed++;
+        } else {
+            pp = &v->next;
+        }
+    }
+}
+
+/* Publishes the first view and starts count readers, which serve clients
+ * on query_path unless it is NULL.  The readers block SIGINT and SIGTERM,
+ * so the signals reach the thread that runs the commands.  Returns 0, or
+ * -1 with errno set if the socket cannot be set up.
+ */
+int ap_readers_start(ap_readers_t *rd, int count, twl_list_t *leaderboard, int queue_size,
+        const char *query_path)
+{
+    sigset_t block, old;
+    int err;
+
+    assert(count >= 1 && count <= AP_READERS_MAX);
+    memset(rd, 0, sizeof(*rd));
+    rd->query_fd = -1;
+    rd->query_path = query_path;
+    if (query_path != NULL) {
+        /* the readers wait in accept */
+        rd->query_fd = ap_server_listen(query_path);
+        if (rd->query_fd < 0)
+            return -1;
+        if (fcntl(rd->query_fd, F_SETFL, 0) != 0) {
+            err = errno;
+            close(rd->query_fd);
+            unlink(query_path);
+            errno = err;
+            return -1;
+        }
+    }
+    atomic_init(&rd->current, view_make(leaderboard, queue_size, 0));
+    atomic_init(&rd->epoch, 1);
+    atomic_init(&rd->stop, FALSE);
+    rd->count = count;
+    rd->published = 1;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+    for (int i = 0; i < count; i++) {
+        ap_reader_t *r = &rd->reader[i];
+        atomic_init(&r->epoch, 0);
+        r->group = rd;
+        r->seed = 2463534242u + (unsigned int) i * 7919u;
+        r->client_fd = -1;
+        if ((err = pthread_mutex_init(&r->client_lock, NULL)) != 0
+                || (err = pthread_create(&r->thread, NULL, reader_main, r)) != 0) {
+            fprintf(stderr, "Cannot start a reader: %s\n", strerror(err));
+            exit(1);
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return 0;
+}
+
+/* Counts a command that changed the lists.  Returns TRUE when a new view
+ * is due; the writer then calls ap_readers_publish.
+ */
+int ap_readers_changed(ap_readers_t *rd)
+{
+    return ++rd->changes >= AP_READERS_PUBLISH;
+}
+
+static void publish_view(ap_readers_t *rd, ap_view_t *v)
+{
+    ap_view_t *old = atomic_exchange(&rd->current, v);
+
+    old->retired = atomic_load(&rd->epoch);
+    old->next = rd->retired;
+    rd->retired = old;
+    atomic_fetch_add(&rd->epoch, 1);
+    rd->published++;
+    rd->changes = 0;
+    reclaim(rd);
+}
+
+/* Publishes a copy of leaderboard, which must be in ap_rank_aps order,
+ * and frees the views no reader holds any more.
+ */
+void ap_readers_publish(ap_readers_t *rd, twl_list_t *leaderboard, int queue_size)
+{
+    publish_view(rd, view_make(leaderboard, queue_size, rd->published));
+}
+
+/* ap_readers_publish of a copy the caller made for it with
+ * ap_create_leaderboard; the readers take it over.
+ */
+void ap_readers_publish_copy(ap_readers_t *rd, twl_list_t *copy, int queue_size)
+{
+    publish_view(rd, view_wrap(copy, queue_size, rd->published));
+}
+
+/* Stops the readers, reports on stderr and frees every view. */
+void ap_readers_stop(ap_readers_t *rd)
+{
+    long reads = 0, hits = 0, validations = 0;
+
+    long clients = 0;
+
+    atomic_store(&rd->stop, TRUE);
+    if (rd->query_fd >= 0) {
+        /* wakes the readers in accept and in the middle of a client */
+        shutdown(rd->query_fd, SHUT_RDWR);
+        for (int i = 0; i < rd->count; i++) {
+            ap_reader_t *r = &rd->reader[i];
+            pthread_mutex_lock(&r->client_lock);
+            if (r->client_fd >= 0)
+                shutdown(r->client_fd, SHUT_RDWR);
+            pthread_mutex_unlock(&r->client_lock);
+        }
+    }
+    for (int i = 0; i < rd->count; i++) {
+        pthread_join(rd->reader[i].thread, NULL);
+        pthread_mutex_destroy(&rd->reader[i].client_lock);
+        reads += rd->reader[i].reads;
+        hits += rd->reader[i].finds_hit;
+        validations += rd->reader[i].validations;
+        clients += rd->reader[i].clients;
+    }
+    /* every reader is idle now, so this frees all retired views */
+    reclaim(rd);
+    assert(rd->retired == NULL);
+    if (rd->query_fd >= 0) {
+        close(rd->query_fd);
+        unlink(rd->query_path);
+        fprintf(stderr, "%d readers: %ld queries from %ld clients; "
+                "%ld views published, %ld reclaimed\n",
+                rd->count, reads, clients, rd->published, rd->reclaimed);
+    } else {
+        fprintf(stderr, "%d readers: %ld reads, %ld finds hit, %ld views validated; "
+                "%ld views published, %ld reclaimed\n",
+                rd->count, reads, hits, validations, rd->published, rd->reclaimed);
+    }
+    view_free(atomic_load(&rd->current));
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -0,0 +1,89 @@
+// ap_readers.h
+
+/* Snapshot-isolated reader threads.
+ *
+ * The thread that runs the commands (the writer) publishes an immutable
+ * copy of the leaderboard, a view, after every AP_READERS_PUBLISH
+ * commands that change the lists.  Readers only ever look at a published
+ * view, so they never wait for the writer and never see a node that
+ * twl_list_insert_sorted or twl_list_remove is in the middle of linking.
+ * A reader sees the lists as of some recent command, never a mix of two.
+ *
+ * Old views are freed with epoch-based reclamation.  A reader announces
+ * the global epoch before it loads the current view and clears the
+ * announcement when it is done.  The writer swaps in a new view, stamps
+ * the old one with the epoch and advances the epoch; the old view is freed
+ * once every reader is either idle or announced a later epoch.
+ *
+ * Readers must not call twl_list_access on a view: it moves the list's
+ * rover.  The read-only calls are twl_list_size,
+ * twl_list_elem_find_data_ptr, twl_list_elem_find_position and
+ * list_debug_validate.
+ *
+ * --readers n with --query path serves clients from the views.  The
+ * readers take connections on the Unix domain socket at path, one client
+ * per reader at a time, and answer FIND, PRINT and STATS exactly as the
+ * main output would, as of the current view.  Every other command gets a
+ * line saying it is not served there; QUIT or end of input ends the
+ * connection.  A view is published every AP_READERS_PUBLISH commands that
+ * change the lists, and after every --listen batch and interactive
+ * command, so an answer can lag the writer by up to that many commands
+ * but never shows half of one.
+ *
+ * --readers n alone is a self-test of the mechanism: the readers issue
+ * FIND, STATS and full-list validation against the views as fast as they
+ * can, check every view with list_debug_validate, and report what they
+ * did on stderr at exit.  The command output does not change.
+ */
+
+#define AP_READERS_MAX      64
+#define AP_READERS_PUBLISH  64
+
+typedef struct ap_view_tag {
+    twl_list_t *leaderboard;        // sorted copy, never changed
+    int queue_size;
+    int max_eth;                    // largest eth address in the copy
+    long version;                   // views published before this one
+    long retired;                   // epoch it was replaced in
+    struct ap_view_tag *next;       // retired list, writer only
+} ap_view_t;
+
+typedef struct ap_reader_tag {
+    _Atomic long epoch;             // announced epoch, 0 while idle
+    char pad[64 - sizeof(long)];
+    pthread_t thread;
+    struct ap_readers_tag *group;
+    unsigned int seed;
+    long reads;
+    long finds_hit;
+    long validations;
+    /* --query */
+    pthread_mutex_t client_lock;    // the stopper shuts client_fd down
+    int client_fd;                  // -1 between clients
+    long clients;
+} ap_reader_t;
+
+typedef struct ap_readers_tag {
+    _Atomic(ap_view_t *) current;
+    _Atomic long epoch;
+    _Atomic int stop;
+    int count;
+    int query_fd;                   // -1 without --query
+    const char *query_path;
+    ap_reader_t reader[AP_READERS_MAX];
+    /* writer only */
+    int changes;                    // since the last publish
+    long published;
+    long reclaimed;
+    ap_view_t *retired;
+} ap_readers_t;
+
+int ap_readers_start(ap_readers_t *rd, int count, twl_list_t *leaderboard, int queue_size,
+        const char *query_path);
+int ap_readers_changed(ap_readers_t *rd);
+void ap_readers_publish(ap_readers_t *rd, twl_list_t *leaderboard, int queue_size);
+void ap_readers_publish_copy(ap_readers_t *rd, twl_list_t *copy, int queue_size);
+void ap_readers_stop(ap_readers_t *rd);
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -0,0 +1,142 @@
+// ap_ring.c
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <assert.h>
+#include <sched.h>
+#include <pthread.h>
+#include "ap_ring.h"
+
+/* a waiting side spins, then yields the CPU a few times, then parks */
+#define RING_SPINS 256
+#define RING_YIELDS 64
+
+/* The pthread calls return the error instead of setting errno */
+static void ring_fail(const char *what, int err)
+{
+    fprintf(stderr, "%s: %s\n", what, strerror(err));
+    exit(1);
+}
+
+void ap_ring_init(ap_ring_t *ring, size_t slot_count, size_t slot_size)
+{
+    int err;
+
+    assert(slot_count > 0 && (slot_count & (slot_count - 1)) == 0);
+    memset(ring, 0, sizeof(*ring));
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->parked, 0);
+    if ((err = pthread_mutex_init(&ring->lock, NULL)) != 0)
+        ring_fail("pthread_mutex_init", err);
+    if ((err = pthread_cond_init(&ring->moved, NULL)) != 0)
+        ring_fail("pthread_cond_init", err);
+    ring->mask = slot_count - 1;
+    /* keep slots on their own cache lines */
+    ring->slot_size = (slot_size + AP_RING_CACHE_LINE - 1) & ~(size_t) (AP_RING_CACHE_LINE - 1);
+    ring->slots = (unsigned char *) aligned_alloc(AP_RING_CACHE_LINE, slot_count * ring->slot_size);
+    assert(ring->slots != NULL);
+}
+
+void ap_ring_destroy(ap_ring_t *ring)
+{
+    free(ring->slots);
+    ring->slots = NULL;
+    pthread_cond_destroy(&ring->moved);
+    pthread_mutex_destroy(&ring->lock);
+}
+
+/* Sleeps until *index is no longer seen.  The parked count goes up before
+ * *index is read again, and the other side stores its index before it
+ * reads the count (both sequentially consistent), so either this side
+ * sees the new index or the other side sees it parked and wakes it.
+ */
+static void park(ap_ring_t *ring, _Atomic size_t *index, size_t seen)
+{
+    pthread_mutex_lock(&ring->lock);
+    atomic_fetch_add(&ring->parked, 1);
+    while (atomic_load(index) == seen)
+        pthread_cond_wait(&ring->moved, &ring->lock);
+    atomic_fetch_sub(&ring->parked, 1);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+/* Wakes the other side if it is parked.  Call after storing the index. */
+static void unpark(ap_ring_t *ring)
+{
+    if (atomic_load(&ring->parked) > 0) {
+        pthread_mutex_lock(&ring->lock);
+        pthread_cond_broadcast(&ring->moved);
+        pthread_mutex_unlock(&ring->lock);
+    }
+}
+
+/* Producer: waits for a free slot and returns it.  The slot is not
+ * visible to the consumer until ap_ring_publish.
+ */
+void *ap_ring_claim(ap_ring_t *ring)
+{
+    int spins = 0;
+
+    while (ring->prod_head - ring->prod_tail > ring->mask) {
+        ring->prod_tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (ring->prod_head - ring->prod_tail <= ring->mask)
+            break;
+        if (++spins > RING_SPINS + RING_YIELDS)
+            park(ring, &ring->tail, ring->prod_tail);
+        else if (spins > RING_SPINS)
+            sched_yield();
+    }
+    return ring->slots + (ring->prod_head & ring->mask) * ring->slot_size;
+}
+
+void ap_ring_publish(ap_ring_t *ring)
+{
+    ring->prod_head++;
+    atomic_store(&ring->head, ring->prod_head);
+    unpark(ring);
+}
+
+/* Consumer: waits for a published slot and returns it.  The slot stays
+ * valid until ap_ring_release.
+ */
+void *ap_ring_peek(ap_ring_t *ring)
+{
+    int spins = 0;
+
+    while (ring->cons_head == ring->cons_tail) {
+        ring->cons_head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (ring->cons_head != ring->cons_tail)
+            break;
+        if (++spins > RING_SPINS + RING_YIELDS)
+            park(ring, &ring->head, ring->cons_head);
+        else if (spins > RING_SPINS)
+            sched_yield();
+    }
+    return ring->slots + (ring->cons_tail & ring->mask) * ring->slot_size;
+}
+
+/* Consumer: ap_ring_peek that only spins.  Returns NULL if nothing was
+ * published in that time, so the caller can tidy up before it waits.
+ */
+void *ap_ring_try_peek(ap_ring_t *ring)
+{
+    for (int spins = 0; ring->cons_head == ring->cons_tail; spins++) {
+        if (spins > RING_SPINS)
+            return NULL;
+        ring->cons_head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    }
+    return ring->slots + (ring->cons_tail & ring->mask) * ring->slot_size;
+}
+
+void ap_ring_release(ap_ring_t *ring)
+{
+    ring->cons_tail++;
+    atomic_store(&ring->tail, ring->cons_tail);
+    unpark(ring);
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
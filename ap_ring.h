@@ -0,0 +1,49 @@
+// ap_ring.h
+
+/* Bounded single-producer/single-consumer ring of fixed-size slots.
+ *
+ * The producer fills a slot in place (ap_ring_claim, then ap_ring_publish)
+ * and the consumer reads it in place (ap_ring_peek, then ap_ring_release),
+ * so nothing is copied in or out of the ring.  head and tail only ever
+ * grow; each side keeps a private copy of the other side's index and only
+ * reloads it when the ring looks full or empty.  A side that has to wait
+ * spins briefly, yields the CPU a few times and then parks on a condition
+ * variable until the other side moves, so an idle ring costs no CPU.  Publish and release only take
+ * the lock when a side is parked.
+ *
+ * Exactly one thread may produce and one thread may consume.  Include
+ * <pthread.h> before this header.
+ */
+
+#define AP_RING_CACHE_LINE 64
+
+typedef struct ap_ring_tag {
+    _Atomic size_t head;            // slots published by the producer
+    char pad_head[AP_RING_CACHE_LINE - sizeof(size_t)];
+    _Atomic size_t tail;            // slots released by the consumer
+    char pad_tail[AP_RING_CACHE_LINE - sizeof(size_t)];
+    size_t prod_head;               // producer's own copy of head
+    size_t prod_tail;               // producer's last look at tail
+    char pad_prod[AP_RING_CACHE_LINE - 2 * sizeof(size_t)];
+    size_t cons_tail;               // consumer's own copy of tail
+    size_t cons_head;               // consumer's last look at head
+    char pad_cons[AP_RING_CACHE_LINE - 2 * sizeof(size_t)];
+    _Atomic int parked;             // sides waiting on moved
+    char pad_parked[AP_RING_CACHE_LINE - sizeof(int)];
+    pthread_mutex_t lock;
+    pthread_cond_t moved;           // head or tail changed
+    size_t mask;                    // slot count - 1, a power of two
+    size_t slot_size;
+    unsigned char *slots;
+} ap_ring_t;
+
+void ap_ring_init(ap_ring_t *ring, size_t slot_count, size_t slot_size);
+void ap_ring_destroy(ap_ring_t *ring);
+void *ap_ring_claim(ap_ring_t *ring);
+void ap_ring_publish(ap_ring_t *ring);
+void *ap_ring_peek(ap_ring_t *ring);
+void *ap_ring_try_peek(ap_ring_t *ring);
+void ap_ring_release(ap_ring_t *ring);
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -0,0 +1,580 @@
+// ap_server.c
+
+#define _GNU_SOURCE     // accept4
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "twl_list.h"
+#include "ap_command.h"
+#include "ap_support.h"
+#include "ap_output.h"
+#include "ap_input.h"
+#include "ap_mpsc.h"
+#include "ap_server.h"
+
+#define TRUE  1
+#define FALSE 0
+
+#define RECORD_LINES 9
+
+enum conn_state {
+    CONN_COMMAND,
+    CONN_RECORD
+};
+
+typedef struct conn_tag {
+    int fd;
+    int state;                  // enum conn_state
+    ap_cmd_t cmd;               // CONN_RECORD: the ADD or JOINQ
+    char in[AP_SERVER_IN_SIZE];
+    size_t in_len;
+    size_t in_pos;              // first byte not yet used
+    out_buf_t out;              // replies, no flush target
+    size_t sent;                // bytes of out already written
+    unsigned int events;        // what epoll watches for
+    int eof;                    // the client will send nothing more
+    int closing;                // QUIT seen, the rest of the input is ignored
+    int broken;                 // the socket failed, drop the replies
+    struct conn_tag *prev;
+    struct conn_tag *next;
+} conn_t;
+
+/* A --collect connection, read by a thread of its own */
+typedef struct feeder_tag {
+    int fd;
+    pthread_t thread;
+    struct server_tag *sv;
+    _Atomic int done;           // the thread has finished, join it
+    struct feeder_tag *next;
+} feeder_t;
+
+typedef struct server_tag {
+    int listen_fd;
+    int epoll_fd;
+    int quiet;
+    conn_t *conns;
+    long accepted;
+    long commands;
+    int collect_fd;             // -1 without --collect
+    int wake_fd;                // eventfd, written when the inbox fills
+    _Atomic int woken;          // wake_fd written since the last drain
+    ap_mpsc_t inbox;
+    feeder_t *feeders;
+    out_buf_t dropped;          // replies to collected records
+    long collectors;
+    long collected;
+} server_t;
+
+static volatile sig_atomic_t server_stop;
+
+static void on_signal(int sig)
+{
+    (void) sig;
+    server_stop = TRUE;
+}
+
+static size_t pending(const conn_t *c)
+{
+    return c->out.len - c->sent;
+}
+
+/* Length of the line at pos, cut where fgets(line, MAXLINE, fp) would cut
+ * it, or 0 if the whole line has not arrived yet.  After end of input
+ * whatever is left is the last line.
+ */
+static size_t line_len(const conn_t *c, size_t pos)
+{
+    size_t avail = c->in_len - pos;
+    size_t max = avail < MAXLINE - 1 ? avail : MAXLINE - 1;
+    const char *nl = memchr(c->in + pos, '\n', max);
+
+    if (nl != NULL)
+        return (size_t) (nl - (c->in + pos)) + 1;
+    if (avail >= MAXLINE - 1)
+        return MAXLINE - 1;
+    return c->eof ? avail : 0;
+}
+
+/* Runs every command that is complete in the input buffer, with the
+ * connection's buffer as the output.  Returns the number run.
+ */
+static long conn_process(server_t *sv, conn_t *c, ap_server_run_t run, void *ctx)
+{
+    out_buf_t *prev = out_select(&c->out);
+    long count = 0;
+
+    while (!c->closing) {
+        if (c->state == CONN_COMMAND) {
+            size_t n = line_len(c, c->in_pos);
+            if (n == 0)
+                break;
+            const char *line = c->in + c->in_pos;
+            const char *nul = memchr(line, '\0', n);
+            c->in_pos += n;
+            ap_parse_command(line, nul != NULL ? (size_t) (nul - line) : n, &c->cmd);
+            if ((c->cmd.op == AP_OP_ADD || c->cmd.op == AP_OP_JOINQ) && c->cmd.rec == NULL) {
+                /* the client sees the prompts before it sends the record */
+                if (!sv->quiet)
+                    ap_print_prompts();
+                c->state = CONN_RECORD;
+                continue;
+            }
+        } else {
+            size_t pos = c->in_pos, n;
+            int lines = 0;
+            in_src_t src;
+
+            while (lines < RECORD_LINES && (n = line_len(c, pos)) > 0) {
+                pos += n;
+                lines++;
+            }
+            if (lines < RECORD_LINES && !c->eof)
+                break;
+            /* the record lines are parsed in place, as a mapped trace is */
+            memset(&src, 0, sizeof(src));
+            src.map = c->in + c->in_pos;
+            src.map_len = pos - c->in_pos;
+            c->cmd.rec = ap_read_info(&src, c->cmd.id);
+            c->in_pos = pos;
+            c->state = CONN_COMMAND;
+        }
+        if (c->cmd.op == AP_OP_QUIT) {
+            c->closing = TRUE;
+            break;
+        }
+        run(ctx, &c->cmd);
+        count++;
+    }
+    out_select(prev);
+
+    memmove(c->in, c->in + c->in_pos, c->in_len - c->in_pos);
+    c->in_len -= c->in_pos;
+    c->in_pos = 0;
+    return count;
+}
+
+static void conn_read(conn_t *c)
+{
+    ssize_t n = read(c->fd, c->in + c->in_len, AP_SERVER_IN_SIZE - c->in_len);
+
+    if (n > 0) {
+        c->in_len += (size_t) n;
+    } else if (n == 0) {
+        c->eof = TRUE;
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        c->eof = TRUE;
+        c->broken = TRUE;
+    }
+}
+
+/* Writes as much of the replies as the socket takes */
+static void conn_send(conn_t *c)
+{
+    while (pending(c) > 0 && !c->broken) {
+        ssize_t n = send(c->fd, c->out.data + c->sent, pending(c), MSG_NOSIGNAL);
+        if (n >= 0)
+            c->sent += (size_t) n;
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return;
+        else if (errno != EINTR)
+            c->broken = TRUE;
+    }
+    c->out.len = 0;
+    c->sent = 0;
+}
+
+static void conn_close(server_t *sv, conn_t *c)
+{
+    epoll_ctl(sv->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    if (c->prev != NULL)
+        c->prev->next = c->next;
+    else
+        sv->conns = c->next;
+    if (c->next != NULL)
+        c->next->prev = c->prev;
+    free(c->cmd.rec);
+    free(c->out.data);
+    free(c);
+}
+
+/* Sets what epoll watches for, or closes the connection once it is done.
+ * Input is not read while too many replies are waiting.
+ */
+static void conn_update(server_t *sv, conn_t *c)
+{
+    unsigned int want = 0;
+    struct epoll_event ev;
+
+    if (c->broken || ((c->eof || c->closing) && pending(c) == 0)) {
+        conn_close(sv, c);
+        return;
+    }
+    if (!c->eof && !c->closing && pending(c) < AP_SERVER_OUT_MAX)
+        want |= EPOLLIN;
+    if (pending(c) > 0)
+        want |= EPOLLOUT;
+    if (want != c->events) {
+        ev.events = want;
+        ev.data.ptr = c;
+        epoll_ctl(sv->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->events = want;
+    }
+}
+
+static void accept_all(server_t *sv)
+{
+    struct epoll_event ev;
+    int fd;
+
+    while ((fd = accept4(sv->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        conn_t *c = (conn_t *) calloc(1, sizeof(conn_t));
+        assert(c != NULL);
+        c->fd = fd;
+        c->state = CONN_COMMAND;
+        c->out.quiet = sv->quiet;
+        c->events = EPOLLIN;
+        ev.events = c->events;
+        ev.data.ptr = c;
+        if (epoll_ctl(sv->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            close(fd);
+            free(c);
+            continue;
+        }
+        c->next = sv->conns;
+        if (sv->conns != NULL)
+            sv->conns->prev = c;
+        sv->conns = c;
+        sv->accepted++;
+    }
+}
+
+/* Feeder thread.  Reads one collector's JOINQ, JOINQR and APPENDQ lines
+ * and pushes them on the inbox; other commands are ignored.  Ends at QUIT,
+ * end of input or the shutdown of its socket.
+ */
+static void *feeder_main(void *arg)
+{
+    feeder_t *f = (feeder_t *) arg;
+    server_t *sv = f->sv;
+    int fd = dup(f->fd);
+    const char *line;
+    size_t len;
+    ap_cmd_t cmd;
+    in_src_t src;
+
+    /* the stream has its own descriptor, so f->fd stays valid for the
+     * shutdown until the server closes it after the join
+     */
+    memset(&src, 0, sizeof(src));
+    src.fp = fd >= 0 ? fdopen(fd, "r") : NULL;
+    if (src.fp == NULL) {
+        if (fd >= 0)
+            close(fd);
+        atomic_store(&f->done, TRUE);
+        return NULL;
+    }
+    while (in_next_line(&src, &line, &len)) {
+        ap_info_t *rec;
+
+        ap_parse_command(line, len, &cmd);
+        if (cmd.op == AP_OP_QUIT) {
+            break;
+        } else if (cmd.op == AP_OP_JOINQ) {
+            if (cmd.rec == NULL)
+                cmd.rec = ap_read_info(&src, cmd.id);
+            rec = ap_mpsc_new_rec();
+            *rec = *cmd.rec;
+            free(cmd.rec);
+        } else if (cmd.op == AP_OP_APPENDQ) {
+            rec = ap_mpsc_new_rec();
+            rec->eth_address = cmd.id;
+            rec->mobile_count = cmd.arg;
+        } else {
+            free(cmd.rec);
+            continue;
+        }
+        ap_mpsc_push(&sv->inbox, rec, cmd.op);
+        /* the record is in before woken is looked at, so a drain that
+         * has already cleared woken either pops it or is woken again
+         */
+        if (!atomic_exchange(&sv->woken, TRUE))
+            eventfd_write(sv->wake_fd, 1);
+    }
+    fclose(src.fp);
+    atomic_store(&f->done, TRUE);
+    return NULL;
+}
+
+/* Runs the records the feeders have pushed, JOINQ or APPENDQ as they came
+ * in, with their replies dropped.  Returns the number run.
+ */
+static long collect_drain(server_t *sv, ap_server_run_t run, void *ctx)
+{
+    out_buf_t *prev;
+    eventfd_t value;
+    ap_info_t *rec;
+    ap_cmd_t cmd;
+    int op;
+    long count = 0;
+
+    if (sv->collect_fd < 0)
+        return 0;
+    eventfd_read(sv->wake_fd, &value);
+    atomic_store(&sv->woken, FALSE);
+    prev = out_select(&sv->dropped);
+    while ((rec = ap_mpsc_pop(&sv->inbox, &op)) != NULL) {
+        memset(&cmd, 0, sizeof(cmd));
+        cmd.op = op;
+        cmd.id = rec->eth_address;
+        if (op == AP_OP_JOINQ) {
+            cmd.rec = rec;
+        } else {
+            cmd.arg = rec->mobile_count;
+            free(rec);
+        }
+        run(ctx, &cmd);
+        free(cmd.rec);
+        sv->dropped.len = 0;
+        count++;
+    }
+    out_select(prev);
+    sv->collected += count;
+    return count;
+}
+
+/* Joins the feeders that have finished, or all of them after shutting
+ * down their sockets
+ */
+static void feeders_reap(server_t *sv, int all)
+{
+    feeder_t **link = &sv->feeders;
+
+    while (*link != NULL) {
+        feeder_t *f = *link;
+        if (all) {
+            shutdown(f->fd, SHUT_RDWR);
+        } else if (!atomic_load(&f->done)) {
+            link = &f->next;
+            continue;
+        }
+        pthread_join(f->thread, NULL);
+        close(f->fd);
+        *link = f->next;
+        free(f);
+    }
+}
+
+/* Starts a feeder for every waiting collector.  The sockets stay
+ * blocking, and the feeders block SIGINT and SIGTERM so the signals go to
+ * the epoll loop.
+ */
+static void accept_collectors(server_t *sv)
+{
+    sigset_t block, old;
+    int fd;
+
+    feeders_reap(sv, FALSE);
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    while ((fd = accept4(sv->collect_fd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+        feeder_t *f = (feeder_t *) calloc(1, sizeof(feeder_t));
+        int err;
+
+        assert(f != NULL);
+        f->fd = fd;
+        f->sv = sv;
+        atomic_init(&f->done, FALSE);
+        pthread_sigmask(SIG_BLOCK, &block, &old);
+        err = pthread_create(&f->thread, NULL, feeder_main, f);
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        if (err != 0) {
+            fprintf(stderr, "Cannot start a feeder: %s\n", strerror(err));
+            close(fd);
+            free(f);
+            continue;
+        }
+        f->next = sv->feeders;
+        sv->feeders = f;
+        sv->collectors++;
+    }
+}
+
+/* Binds path, replacing a socket left behind by an earlier server but
+ * nothing else.  Returns the listening socket, which is non-blocking, or
+ * -1 with errno set.
+ */
+int ap_server_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0
+            || listen(fd, AP_SERVER_BACKLOG) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+static int watch(server_t *sv, int fd, void *token)
+{
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = token;
+    return epoll_ctl(sv->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/* Closes the descriptors that are open and removes the sockets */
+static void server_close(server_t *sv, const char *path, const char *collect_path)
+{
+    if (sv->epoll_fd >= 0)
+        close(sv->epoll_fd);
+    if (sv->wake_fd >= 0)
+        close(sv->wake_fd);
+    if (sv->collect_fd >= 0) {
+        close(sv->collect_fd);
+        unlink(collect_path);
+    }
+    if (sv->listen_fd >= 0) {
+        close(sv->listen_fd);
+        unlink(path);
+    }
+}
+
+/* Serves clients on path, and collectors on collect_path unless it is
+ * NULL, until SIGINT or SIGTERM.  run executes each command; sync is
+ * called after a batch of commands, before any of their replies is sent,
+ * so a journal commit there makes every reply durable.  Returns 0, or -1
+ * with errno set if a socket cannot be set up.
+ */
+int ap_server_run(const char *path, const char *collect_path, int quiet,
+        ap_server_run_t run, ap_server_sync_t sync, void *ctx)
+{
+    server_t sv;
+    struct epoll_event events[AP_SERVER_MAX_EVENTS];
+    conn_t *ready[AP_SERVER_MAX_EVENTS];
+    struct sigaction sa;
+
+    memset(&sv, 0, sizeof(sv));
+    sv.quiet = quiet;
+    sv.epoll_fd = sv.wake_fd = sv.collect_fd = -1;
+    sv.dropped.quiet = TRUE;
+    atomic_init(&sv.woken, FALSE);
+    ap_mpsc_init(&sv.inbox);
+    sv.listen_fd = ap_server_listen(path);
+    if (sv.listen_fd < 0)
+        return -1;
+    if ((collect_path != NULL && (sv.collect_fd = ap_server_listen(collect_path)) < 0)
+            || (sv.epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0
+            || watch(&sv, sv.listen_fd, NULL) != 0
+            || (collect_path != NULL
+                && ((sv.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0
+                    || watch(&sv, sv.collect_fd, &sv.collect_fd) != 0
+                    || watch(&sv, sv.wake_fd, &sv.wake_fd) != 0))) {
+        int err = errno;
+        server_close(&sv, path, collect_path);
+        errno = err;
+        return -1;
+    }
+
+    /* no SA_RESTART, so epoll_wait returns when a signal arrives */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    server_stop = FALSE;
+
+    while (!server_stop) {
+        int count = epoll_wait(sv.epoll_fd, events, AP_SERVER_MAX_EVENTS, -1);
+        long ran = 0, drained = 0;
+        int nready = 0;
+
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            conn_t *c = (conn_t *) events[i].data.ptr;
+            if (c == NULL) {
+                accept_all(&sv);
+                continue;
+            } else if (events[i].data.ptr == &sv.collect_fd) {
+                accept_collectors(&sv);
+                continue;
+            } else if (events[i].data.ptr == &sv.wake_fd) {
+                drained += collect_drain(&sv, run, ctx);
+                continue;
+            }
+            if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && (c->events & EPOLLIN))
+                conn_read(c);
+            else if (events[i].events & (EPOLLHUP | EPOLLERR))
+                c->broken = TRUE;
+            if (!c->broken)
+                ran += conn_process(&sv, c, run, ctx);
+            ready[nready++] = c;
+        }
+        /* each connection shows up once per batch, so none is closed
+         * before all its events are handled
+         */
+        if ((ran > 0 || drained > 0) && sync != NULL)
+            sync(ctx);
+        sv.commands += ran;
+        for (int i = 0; i < nready; i++) {
+            conn_send(ready[i]);
+            conn_update(&sv, ready[i]);
+        }
+    }
+
+    /* what the collectors sent before they were cut off still runs */
+    feeders_reap(&sv, TRUE);
+    if (collect_drain(&sv, run, ctx) > 0 && sync != NULL)
+        sync(ctx);
+    while (sv.conns != NULL)
+        conn_close(&sv, sv.conns);
+    server_close(&sv, path, collect_path);
+    free(sv.dropped.data);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    fprintf(stderr, "Served %ld commands to %ld clients\n", sv.commands, sv.accepted);
+    if (collect_path != NULL)
+        fprintf(stderr, "Collected %ld records from %ld collectors\n",
+                sv.collected, sv.collectors);
+    return 0;
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
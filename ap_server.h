@@ -0,0 +1,53 @@
+// ap_server.h
+
+/* Local server mode.
+ *
+ * wifi --listen path serves the command language on a Unix domain stream
+ * socket.  One thread runs an epoll loop over the listening socket and
+ * every client, so the clients share one leaderboard and one queue and
+ * their commands run one at a time, in the order their lines arrive.
+ *
+ * Each connection keeps its own input buffer, output buffer and state:
+ *
+ *   command  waiting for a command line
+ *   record   an ADD or JOINQ line arrived and the prompts were sent; the
+ *            command runs once the nine record lines are in
+ *
+ * Nothing ever blocks on one client.  Lines are cut from whatever bytes
+ * have arrived, exactly as fgets cuts them, and a client that is slow to
+ * type its record only holds up itself.  Replies are written as far as
+ * the socket takes them and the rest waits for EPOLLOUT; a client that
+ * stops reading is not read from either once AP_SERVER_OUT_MAX bytes of
+ * replies are waiting for it.
+ *
+ * QUIT or end of input from a client ends that connection once its
+ * replies are out.  SIGINT or SIGTERM stops the server and wifi exits
+ * normally, which commits the journal.
+ *
+ * With --collect path a second socket takes collectors: data sources that
+ * only feed the queue and read no replies.  Each collector gets a feeder
+ * thread of its own that reads its JOINQ, JOINQR and APPENDQ lines with
+ * blocking reads and pushes the records on an ap_mpsc_t, so the feeders
+ * never wait for each other or for the epoll loop.  The first push after
+ * a drain writes an eventfd in the epoll set, and the loop then pops the
+ * records and runs them as JOINQ and APPENDQ commands, journaled like any
+ * other.  Records from one collector keep their order; records from
+ * different collectors interleave as they were pushed.
+ */
+
+#define AP_SERVER_MAX_EVENTS 64
+#define AP_SERVER_BACKLOG    128
+#define AP_SERVER_IN_SIZE    (16 * MAXLINE)
+#define AP_SERVER_OUT_MAX    (4 * 1024 * 1024)
+
+/* Runs one command and reports it into the current output buffer */
+typedef void (*ap_server_run_t)(void *ctx, ap_cmd_t *cmd);
+/* Called after a batch of commands, before their replies are sent */
+typedef void (*ap_server_sync_t)(void *ctx);
+
+int ap_server_listen(const char *path);
+int ap_server_run(const char *path, const char *collect_path, int quiet,
+        ap_server_run_t run, ap_server_sync_t sync, void *ctx);
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
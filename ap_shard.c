@@ -0,0 +1,646 @@
+// ap_shard.c
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include "twl_list.h"
+#include "ap_command.h"
+#include "ap_support.h"
+#include "ap_ring.h"
+#include "ap_order.h"
+#include "ap_shard.h"
+
+#define TRUE  1
+#define FALSE 0
+
+#define SHARD_JOB_SLOTS 1024
+#define SHARD_DIR_INITIAL 1024
+
+/* a ticket waiter spins, then yields a few times, then sleeps */
+#define SHARD_WAIT_SPINS 256
+#define SHARD_WAIT_YIELDS 64
+
+/* jobs besides the AP_OP_* ones */
+#define SHARD_SYNC  (-1)
+#define SHARD_QUIT  (-2)
+
+typedef struct shard_job_tag {
+    int op;                     // AP_OP_ADD inserts rec, see shard_worker
+    int eth;
+    ap_info_t *rec;
+    ap_result_t *res;
+    ap_shard_ticket_t *ticket;  // counted down when the job is done
+} shard_job_t;
+
+/* The pthread calls return the error instead of setting errno */
+static void shard_fail(const char *what, int err)
+{
+    fprintf(stderr, "%s: %s\n", what, strerror(err));
+    exit(1);
+}
+
+/* Counts a job of ticket down and wakes the waiters once it is complete.
+ * The ticket may be gone as soon as it reaches 0, so only sh is touched
+ * after that.  The count and waiting are sequentially consistent, the
+ * other way round from wait_ticket, so a waiter either sees 0 or is seen.
+ */
+static void ticket_done(ap_shards_t *sh, ap_shard_ticket_t *ticket)
+{
+    if (atomic_fetch_sub(&ticket->pending, 1) == 1 && atomic_load(&sh->waiting) > 0) {
+        pthread_mutex_lock(&sh->lock);
+        pthread_cond_broadcast(&sh->done);
+        pthread_mutex_unlock(&sh->lock);
+    }
+}
+
+/* The worker applies the list work of one shard, in the order the jobs
+ * were sent.
+ */
+static void *shard_worker(void *arg)
+{
+    ap_shard_t *s = (ap_shard_t *) arg;
+    ap_result_t scratch;
+    int quit = FALSE;
+
+    while (!quit) {
+        shard_job_t *job = (shard_job_t *) ap_ring_peek(&s->jobs);
+        switch (job->op) {
+        case AP_OP_ADD:
+            twl_list_insert_sorted(s->list, job->rec);
+            break;
+        case AP_OP_REMOVE:
+            ap_remove(s->list, job->eth, job->res);
+            break;
+        case AP_OP_FIND:
+            ap_find(s->list, job->eth, job->res);
+            break;
+        case AP_OP_INC:
+            ap_inc(s->list, job->eth, job->res);
+            break;
+        case AP_OP_DEC:
+            ap_dec(s->list, job->eth, job->res);
+            break;
+        case AP_OP_REMOVEALL:
+            ap_removeall(s->list, &scratch);
+            break;
+        case AP_OP_PRINT:
+            job->ticket->parts[s->index] = ap_copy_list(s->list);
+            break;
+        case SHARD_SYNC:
+            break;
+        case SHARD_QUIT:
+            quit = TRUE;
+            break;
+        default:
+            assert(0);
+        }
+        if (job->ticket != NULL)
+            ticket_done(s->group, job->ticket);
+        ap_ring_release(&s->jobs);
+    }
+    return NULL;
+}
+
+static void send_job(ap_shards_t *sh, int shard, int op, int eth, ap_info_t *rec,
+        ap_result_t *res, ap_shard_ticket_t *ticket)
+{
+    shard_job_t *job = (shard_job_t *) ap_ring_claim(&sh->shard[shard].jobs);
+
+    job->op = op;
+    job->eth = eth;
+    job->rec = rec;
+    job->res = res;
+    job->ticket = ticket;
+    if (ticket != NULL)
+        atomic_fetch_add_explicit(&ticket->pending, 1, memory_order_relaxed);
+    ap_ring_publish(&sh->shard[shard].jobs);
+}
+
+static void wait_ticket(ap_shards_t *sh, ap_shard_ticket_t *ticket)
+{
+    int spins = 0;
+
+    while (atomic_load_explicit(&ticket->pending, memory_order_acquire) != 0) {
+        if (++spins <= SHARD_WAIT_SPINS)
+            continue;
+        if (spins <= SHARD_WAIT_SPINS + SHARD_WAIT_YIELDS) {
+            sched_yield();
+            continue;
+        }
+        pthread_mutex_lock(&sh->lock);
+        atomic_fetch_add(&sh->waiting, 1);
+        while (atomic_load(&ticket->pending) != 0)
+            pthread_cond_wait(&sh->done, &sh->lock);
+        atomic_fetch_sub(&sh->waiting, 1);
+        pthread_mutex_unlock(&sh->lock);
+    }
+}
+
+/* Waits until every worker has run all jobs sent so far.  Afterwards the
+ * dispatcher may use the shard lists directly until it sends a new job.
+ */
+static void sync_all(ap_shards_t *sh)
+{
+    ap_shard_ticket_t ticket;
+
+    atomic_init(&ticket.pending, 0);
+    for (int i = 0; i < sh->count; i++)
+        send_job(sh, i, SHARD_SYNC, 0, NULL, NULL, &ticket);
+    wait_ticket(sh, &ticket);
+}
+
+static int shard_of(const ap_shards_t *sh, const ap_info_t *rec)
+{
+    return (int) ((unsigned int) rec->location_code % (unsigned int) sh->count);
+}
+
+/* The directory is an open addressing hash table with linear probing */
+static size_t dir_hash(const ap_shards_t *sh, int eth)
+{
+    unsigned int h = (unsigned int) eth * 2654435761u;
+    return (h ^ (h >> 16)) & sh->dir_mask;
+}
+
+static void dir_clear(ap_shards_t *sh, size_t size)
+{
+    free(sh->dir);
+    sh->dir = (ap_shard_dir_t *) malloc(size * sizeof(ap_shard_dir_t));
+    assert(sh->dir != NULL);
+    for (size_t i = 0; i < size; i++)
+        sh->dir[i].shard = -1;
+    sh->dir_mask = size - 1;
+    sh->dir_used = 0;
+}
+
+/* returns the slot of eth, or of the empty entry where it would go */
+static size_t dir_slot(const ap_shards_t *sh, int eth)
+{
+    size_t i = dir_hash(sh, eth);
+    while (sh->dir[i].shard >= 0 && sh->dir[i].eth != eth)
+        i = (i + 1) & sh->dir_mask;
+    return i;
+}
+
+static int dir_find(const ap_shards_t *sh, int eth)
+{
+    return sh->dir[dir_slot(sh, eth)].shard;
+}
+
+static void dir_insert(ap_shards_t *sh, int eth, int shard)
+{
+    if (2 * (sh->dir_used + 1) > sh->dir_mask + 1) {
+        ap_shard_dir_t *old = sh->dir;
+        size_t old_size = sh->dir_mask + 1;
+        sh->dir = NULL;
+        dir_clear(sh, 2 * old_size);
+        for (size_t i = 0; i < old_size; i++) {
+            if (old[i].shard >= 0) {
+                sh->dir[dir_slot(sh, old[i].eth)] = old[i];
+                sh->dir_used++;
+            }
+        }
+        free(old);
+    }
+    size_t i = dir_slot(sh, eth);
+    assert(sh->dir[i].shard < 0);
+    sh->dir[i].eth = eth;
+    sh->dir[i].shard = shard;
+    sh->dir_used++;
+}
+
+/* Removes eth and shifts later entries of its probe run back, so lookups
+ * never need tombstones.
+ */
+static void dir_delete(ap_shards_t *sh, int eth)
+{
+    size_t i = dir_slot(sh, eth);
+    size_t j = i;
+
+    assert(sh->dir[i].shard >= 0);
+    for (;;) {
+        sh->dir[i].shard = -1;
+        for (;;) {
+            j = (j + 1) & sh->dir_mask;
+            if (sh->dir[j].shard < 0) {
+                sh->dir_used--;
+                return;
+            }
+            size_t home = dir_hash(sh, sh->dir[j].eth);
+            /* j can move to i unless its home lies cyclically in (i, j] */
+            if (i <= j ? (home <= i || home > j) : (home <= i && home > j))
+                break;
+        }
+        sh->dir[i] = sh->dir[j];
+        i = j;
+    }
+}
+
+/* Starts count workers, each with an empty shard. */
+void ap_shards_start(ap_shards_t *sh, int count)
+{
+    int err;
+
+    assert(count >= 1 && count <= AP_SHARD_MAX);
+    memset(sh, 0, sizeof(*sh));
+    sh->count = count;
+    dir_clear(sh, SHARD_DIR_INITIAL);
+    atomic_init(&sh->waiting, 0);
+    if ((err = pthread_mutex_init(&sh->lock, NULL)) != 0)
+        shard_fail("pthread_mutex_init", err);
+    if ((err = pthread_cond_init(&sh->done, NULL)) != 0)
+        shard_fail("pthread_cond_init", err);
+    for (int i = 0; i < count; i++) {
+        ap_shard_t *s = &sh->shard[i];
+        s->index = i;
+        s->group = sh;
+        s->list = ap_create_leaderboard();
+        ap_order_init(&s->order);
+        ap_order_watch(&s->order, s->list);
+        ap_ring_init(&s->jobs, SHARD_JOB_SLOTS, sizeof(shard_job_t));
+        if ((err = pthread_create(&s->thread, NULL, shard_worker, s)) != 0)
+            shard_fail("Cannot start a shard worker", err);
+    }
+}
+
+/* Lets the workers finish their jobs, stops them and frees the shards. */
+void ap_shards_stop(ap_shards_t *sh)
+{
+    for (int i = 0; i < sh->count; i++)
+        send_job(sh, i, SHARD_QUIT, 0, NULL, NULL, NULL);
+    for (int i = 0; i < sh->count; i++) {
+        pthread_join(sh->shard[i].thread, NULL);
+        ap_ring_destroy(&sh->shard[i].jobs);
+        ap_cleanup(sh->shard[i].list);
+        ap_order_free(&sh->shard[i].order);
+    }
+    free(sh->dir);
+    sh->dir = NULL;
+    pthread_cond_destroy(&sh->done);
+    pthread_mutex_destroy(&sh->lock);
+}
+
+/* ap_add across the shards.  The outcome is decided here, so the result
+ * is complete on return; only the insert itself goes to the worker.
+ */
+void ap_shard_add(ap_shards_t *sh, ap_info_t *rec, int max_list_size, ap_result_t *res)
+{
+    res->op = AP_OP_ADD;
+    res->eth = rec->eth_address;
+    res->aux = max_list_size;
+    if (sh->total >= max_list_size) {
+        res->code = 1;
+        free(rec);
+    } else if (dir_find(sh, rec->eth_address) >= 0) {
+        res->code = 2;
+        free(rec);
+    } else {
+        int shard = shard_of(sh, rec);
+        dir_insert(sh, rec->eth_address, shard);
+        sh->total++;
+        send_job(sh, shard, AP_OP_ADD, rec->eth_address, rec, NULL, NULL);
+        res->code = 0;
+    }
+}
+
+/* REMOVE, FIND, INC and DEC.  An address the directory does not know gets
+ * the not-found result right away; otherwise the owning worker runs the
+ * ap_support function and fills in res under the ticket.
+ */
+void ap_shard_lookup(ap_shards_t *sh, int op, int eth, ap_result_t *res,
+        ap_shard_ticket_t *ticket)
+{
+    int shard = dir_find(sh, eth);
+
+    if (shard < 0) {
+        res->op = op;
+        res->eth = eth;
+        if (op == AP_OP_REMOVE || op == AP_OP_FIND) {
+            res->code = -1;
+        } else {
+            res->code = -2;
+            res->value = -2;
+        }
+        return;
+    }
+    if (op == AP_OP_REMOVE) {
+        dir_delete(sh, eth);
+        sh->total--;
+    }
+    send_job(sh, shard, op, eth, NULL, res, ticket);
+}
+
+void ap_shard_removeall(ap_shards_t *sh, ap_result_t *res)
+{
+    res->op = AP_OP_REMOVEALL;
+    res->code = 0;
+    res->value = sh->total;
+    for (int i = 0; i < sh->count; i++)
+        send_job(sh, i, AP_OP_REMOVEALL, 0, NULL, NULL, NULL);
+    sh->total = 0;
+    dir_clear(sh, sh->dir_mask + 1);
+}
+
+/* ap_dequeue across the shards, with the same outcomes */
+void ap_shard_dequeue(ap_shards_t *sh, twl_list_t *queue, int max_list_size,
+        ap_result_t *res)
+{
+    ap_info_t *rec;
+
+    res->op = AP_OP_MOVEQTOL;
+    res->aux = max_list_size;
+    if (twl_list_size(queue) == 0) {
+        res->code = 0;
+        return;
+    }
+    rec = (ap_info_t *) twl_list_remove(queue, 0);
+    res->eth = rec->eth_address;
+    if (sh->total >= max_list_size) {
+        res->code = 2;
+        free(rec);
+    } else if (dir_find(sh, rec->eth_address) >= 0) {
+        res->code = 3;
+        free(rec);
+    } else {
+        int shard = shard_of(sh, rec);
+        dir_insert(sh, rec->eth_address, shard);
+        sh->total++;
+        send_job(sh, shard, AP_OP_ADD, rec->eth_address, rec, NULL, NULL);
+        res->code = 1;
+    }
+}
+
+/* Every worker copies its shard under the ticket; ap_shard_wait merges
+ * the copies.
+ */
+void ap_shard_print(ap_shards_t *sh, ap_result_t *res, ap_shard_ticket_t *ticket)
+{
+    res->op = AP_OP_PRINT;
+    res->list = NULL;
+    for (int i = 0; i < sh->count; i++)
+        send_job(sh, i, AP_OP_PRINT, 0, NULL, res, ticket);
+}
+
+/* RANK: the owning shard's index gives the record of the AP and its place
+ * in the shard, and each other shard the records it has ahead of it.
+ */
+void ap_shard_rank(ap_shards_t *sh, int eth, ap_result_t *res)
+{
+    int shard = dir_find(sh, eth);
+
+    res->op = AP_OP_RANK;
+    res->eth = eth;
+    if (shard < 0) {
+        res->code = -1;
+        res->aux = sh->total;
+        return;
+    }
+    sync_all(sh);
+    ap_order_rank(&sh->shard[shard].order, eth, res);
+    assert(res->code == 0);
+    for (int i = 0; i < sh->count; i++) {
+        if (i != shard)
+            res->value += ap_order_ahead(&sh->shard[i].order, res->rec.mobile_count, eth);
+    }
+    res->aux = sh->total;
+}
+
+static void append_copy(twl_list_t *list, const ap_info_t *from)
+{
+    ap_info_t *rec = (ap_info_t *) malloc(sizeof(ap_info_t));
+
+    assert(rec != NULL);
+    *rec = *from;
+    twl_list_append(list, rec);
+}
+
+/* TOPK: the first k records of the merge over the shard fronts */
+void ap_shard_topk(ap_shards_t *sh, int k, ap_result_t *res)
+{
+    ap_shard_heads_t heads;
+    ap_info_t *from;
+
+    res->op = AP_OP_TOPK;
+    res->aux = sh->total;
+    res->code = k < 1 ? -1 : 0;
+    res->value = 0;
+    res->list = twl_list_construct(NULL);
+    res->owns_list = TRUE;
+    ap_shard_heads(sh, &heads);
+    while (res->value < k && (from = ap_shard_heads_next(&heads)) != NULL) {
+        append_copy(res->list, from);
+        res->value++;
+    }
+}
+
+/* RANGE: each shard's index gives its records in the range and how many
+ * it has ahead of them.  The counts add up to the position of the first
+ * and the ranges are merged.
+ */
+void ap_shard_range(ap_shards_t *sh, int lo, int hi, ap_result_t *res)
+{
+    twl_list_t *parts[AP_SHARD_MAX];
+    ap_result_t part;
+
+    sync_all(sh);
+    res->op = AP_OP_RANGE;
+    res->code = 0;
+    res->aux = 0;
+    for (int i = 0; i < sh->count; i++) {
+        memset(&part, 0, sizeof(part));
+        ap_order_range(&sh->shard[i].order, lo, hi, &part);
+        res->aux += part.aux;
+        parts[i] = part.list;
+    }
+    res->list = ap_shard_merge(parts, sh->count);
+    res->owns_list = TRUE;
+    res->value = twl_list_size(res->list);
+}
+
+/* Waits for the workers to finish res.  For a PRINT, res->list is then a
+ * merged list that the caller owns.
+ */
+void ap_shard_wait(ap_shards_t *sh, ap_result_t *res, ap_shard_ticket_t *ticket)
+{
+    wait_ticket(sh, ticket);
+    if (res->op == AP_OP_PRINT && res->list == NULL) {
+        res->list = ap_shard_merge(ticket->parts, sh->count);
+        res->owns_list = TRUE;
+    }
+}
+
+/* Merges sorted lists into one list in ap_rank_aps order.  The records
+ * move to the new list and the parts are destroyed.
+ *
+ * A binary heap holds the part whose front record comes first at the
+ * root, so each record costs O(log count) comparisons.
+ */
+twl_list_t *ap_shard_merge(twl_list_t **parts, int count)
+{
+    twl_list_t *merged = twl_list_construct(NULL);
+    int heap[AP_SHARD_MAX];
+    int n = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (twl_list_size(parts[i]) == 0)
+            continue;
+        /* sift up */
+        int c = n++;
+        while (c > 0 && ap_rank_aps(twl_list_access(parts[i], 0),
+                    twl_list_access(parts[heap[(c - 1) / 2]], 0)) == 1) {
+            heap[c] = heap[(c - 1) / 2];
+            c = (c - 1) / 2;
+        }
+        heap[c] = i;
+    }
+    while (n > 0) {
+        int top = heap[0];
+        twl_list_append(merged, twl_list_remove(parts[top], 0));
+        if (twl_list_size(parts[top]) == 0)
+            top = heap[--n];
+        /* sift down from the root */
+        int c = 0;
+        for (;;) {
+            int child = 2 * c + 1;
+            if (child >= n)
+                break;
+            if (child + 1 < n && ap_rank_aps(twl_list_access(parts[heap[child + 1]], 0),
+                        twl_list_access(parts[heap[child]], 0)) == 1)
+                child++;
+            if (ap_rank_aps(twl_list_access(parts[heap[child]], 0),
+                        twl_list_access(parts[top], 0)) != 1)
+                break;
+            heap[c] = heap[child];
+            c = child;
+        }
+        if (n > 0)
+            heap[c] = top;
+    }
+    for (int i = 0; i < count; i++)
+        ap_cleanup(parts[i]);
+    return merged;
+}
+
+/* 1 if shard a's next record comes before shard b's */
+static int heads_before(const ap_shard_heads_t *h, int a, int b)
+{
+    return ap_rank_aps(twl_list_node_data(h->next[a]), twl_list_node_data(h->next[b])) == 1;
+}
+
+/* Restores the heap below slot c, which holds shard top */
+static void heads_sift_down(ap_shard_heads_t *h, int c, int top)
+{
+    for (;;) {
+        int child = 2 * c + 1;
+        if (child >= h->n)
+            break;
+        if (child + 1 < h->n && heads_before(h, h->heap[child + 1], h->heap[child]))
+            child++;
+        if (!heads_before(h, h->heap[child], top))
+            break;
+        h->heap[c] = h->heap[child];
+        c = child;
+    }
+    h->heap[c] = top;
+}
+
+/* Waits for the workers to run all jobs sent so far and starts a merge
+ * over the fronts of the shard lists.  The records ap_shard_heads_next
+ * hands out are the shards' own, so the merge must be done before the
+ * next job is sent.
+ */
+void ap_shard_heads(ap_shards_t *sh, ap_shard_heads_t *h)
+{
+    sync_all(sh);
+    h->n = 0;
+    for (int i = 0; i < sh->count; i++) {
+        h->next[i] = twl_list_front_node(sh->shard[i].list);
+        if (h->next[i] != NULL)
+            h->heap[h->n++] = i;
+    }
+    for (int c = h->n / 2 - 1; c >= 0; c--)
+        heads_sift_down(h, c, h->heap[c]);
+}
+
+/* The next leaderboard record in ap_rank_aps order, NULL after the last.
+ * Each costs O(log count) comparisons.
+ */
+ap_info_t *ap_shard_heads_next(ap_shard_heads_t *h)
+{
+    int top;
+    ap_info_t *rec;
+
+    if (h->n == 0)
+        return NULL;
+    top = h->heap[0];
+    rec = (ap_info_t *) twl_list_node_data(h->next[top]);
+    h->next[top] = twl_list_next_node(h->next[top]);
+    if (h->next[top] == NULL) {
+        top = h->heap[--h->n];
+        if (h->n == 0)
+            return rec;
+    }
+    heads_sift_down(h, 0, top);
+    return rec;
+}
+
+/* Returns a copy of the whole leaderboard in ap_rank_aps order */
+twl_list_t *ap_shard_collect(ap_shards_t *sh)
+{
+    twl_list_t *copy = ap_create_leaderboard();
+    ap_shard_heads_t heads;
+    ap_info_t *from;
+
+    ap_shard_heads(sh, &heads);
+    while ((from = ap_shard_heads_next(&heads)) != NULL)
+        append_copy(copy, from);
+    return copy;
+}
+
+/* Replaces the shards with the records of leaderboard, which must be in
+ * ap_rank_aps order.  The records move into the shards and leaderboard is
+ * destroyed.
+ */
+void ap_shard_replace(ap_shards_t *sh, twl_list_t *leaderboard)
+{
+    sync_all(sh);
+    for (int i = 0; i < sh->count; i++) {
+        ap_cleanup(sh->shard[i].list);
+        sh->shard[i].list = ap_create_leaderboard();
+        ap_order_watch(&sh->shard[i].order, sh->shard[i].list);
+    }
+    dir_clear(sh, sh->dir_mask + 1);
+    sh->total = 0;
+    while (twl_list_size(leaderboard) > 0) {
+        ap_info_t *rec = (ap_info_t *) twl_list_remove(leaderboard, 0);
+        int shard = shard_of(sh, rec);
+        /* in order, so appending keeps each shard sorted */
+        twl_list_append(sh->shard[shard].list, rec);
+        dir_insert(sh, rec->eth_address, shard);
+        sh->total++;
+    }
+    ap_cleanup(leaderboard);
+}
+
+/* Adds up the operation counts (see twl_list.h) of the shard lists */
+void ap_shard_stats(ap_shards_t *sh, twl_list_stats_t *sum)
+{
+    twl_list_stats_t s;
+
+    sync_all(sh);
+    memset(sum, 0, sizeof(*sum));
+    for (int i = 0; i < sh->count; i++) {
+        twl_list_get_stats(sh->shard[i].list, &s);
+        sum->compares += s.compares;
+        sum->hops += s.hops;
+        sum->allocs += s.allocs;
+        sum->frees += s.frees;
+        sum->validates += s.validates;
+    }
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -0,0 +1,107 @@
+// ap_shard.h
+
+/* Sharded leaderboard.
+ *
+ * The leaderboard is split by location_code into shards.  Each shard is
+ * an ordinary sorted twl_list owned by its own worker thread, which takes
+ * jobs from an ap_ring.  Only the dispatcher (the thread that runs the
+ * commands) sends jobs.
+ *
+ * The dispatcher keeps a directory from eth address to shard and the total
+ * record count, so it alone decides what the single-list code would: an
+ * ADD or MOVEQTOL is rejected when the total reaches the leaderboard limit
+ * or the eth address is already present, and REMOVE, FIND, INC and DEC of
+ * an unknown address fail without a shard.  Only the list work itself goes
+ * to a worker.  Since a record's shard follows from its location, which
+ * never changes, an address stays in one shard for its lifetime.
+ *
+ * A result that a worker fills in comes with a ticket.  The dispatcher
+ * does not wait for it; the reader of the result calls ap_shard_wait,
+ * which also merges the per-shard copies of a PRINT into one list in
+ * ap_rank_aps order.  Jobs to one shard run in the order they were sent,
+ * so every result reflects exactly the commands before it.  A thread that
+ * waits for a ticket spins briefly and then sleeps until a worker
+ * finishes one; an idle worker sleeps on its ring (see ap_ring.h).
+ *
+ * The readers and the export are published from the shard lists in
+ * place: ap_shard_heads waits for the workers to go idle and then merges
+ * the fronts of the shards, handing out the records one by one in
+ * ap_rank_aps order, with no copy of the shards in between.
+ *
+ * Every shard also has a rank index of its list (see ap_order.h), which
+ * follows the list on the worker.  Once the workers are idle the
+ * dispatcher answers RANK by adding up the records ahead of the AP in
+ * each shard, RANGE by adding up the positions of each shard's range and
+ * merging the ranges, and TOPK from the merge of the fronts, which stops
+ * after k records.
+ */
+
+#define AP_SHARD_MAX 64
+
+typedef struct ap_shard_ticket_tag {
+    _Atomic int pending;                // shard jobs still writing the result
+    twl_list_t *parts[AP_SHARD_MAX];    // PRINT: each shard's copy
+} ap_shard_ticket_t;
+
+typedef struct ap_shard_dir_tag {
+    int eth;
+    int shard;                          // -1 for an empty entry
+} ap_shard_dir_t;
+
+typedef struct ap_shard_tag {
+    twl_list_t *list;
+    ap_order_t order;                   // rank index of list
+    ap_ring_t jobs;
+    pthread_t thread;
+    int index;
+    struct ap_shards_tag *group;
+} ap_shard_t;
+
+typedef struct ap_shards_tag {
+    int count;
+    ap_shard_t shard[AP_SHARD_MAX];
+    int total;                          // records in all shards
+    ap_shard_dir_t *dir;                // eth address -> shard, open addressing
+    size_t dir_mask;
+    size_t dir_used;
+    _Atomic int waiting;                // threads asleep on done
+    pthread_mutex_t lock;
+    pthread_cond_t done;                // a ticket came down to 0
+} ap_shards_t;
+
+/* A merge over the fronts of the shard lists, see ap_shard_heads */
+typedef struct ap_shard_heads_tag {
+    ll_node_t *next[AP_SHARD_MAX];      // each shard's next record
+    int heap[AP_SHARD_MAX];             // shards by next record, best first
+    int n;
+} ap_shard_heads_t;
+
+void ap_shards_start(ap_shards_t *sh, int count);
+void ap_shards_stop(ap_shards_t *sh);
+
+/* the leaderboard commands of wifi.c's execute */
+void ap_shard_add(ap_shards_t *sh, ap_info_t *rec, int max_list_size, ap_result_t *res);
+void ap_shard_lookup(ap_shards_t *sh, int op, int eth, ap_result_t *res,
+        ap_shard_ticket_t *ticket);
+void ap_shard_removeall(ap_shards_t *sh, ap_result_t *res);
+void ap_shard_dequeue(ap_shards_t *sh, twl_list_t *queue, int max_list_size,
+        ap_result_t *res);
+void ap_shard_print(ap_shards_t *sh, ap_result_t *res, ap_shard_ticket_t *ticket);
+void ap_shard_rank(ap_shards_t *sh, int eth, ap_result_t *res);
+void ap_shard_topk(ap_shards_t *sh, int k, ap_result_t *res);
+void ap_shard_range(ap_shards_t *sh, int lo, int hi, ap_result_t *res);
+void ap_shard_wait(ap_shards_t *sh, ap_result_t *res, ap_shard_ticket_t *ticket);
+
+/* whole-leaderboard access for SAVE, LOAD and publishing */
+twl_list_t *ap_shard_collect(ap_shards_t *sh);
+void ap_shard_replace(ap_shards_t *sh, twl_list_t *leaderboard);
+void ap_shard_heads(ap_shards_t *sh, ap_shard_heads_t *h);
+ap_info_t *ap_shard_heads_next(ap_shard_heads_t *h);
+
+/* the operation counts of all shard lists added up */
+void ap_shard_stats(ap_shards_t *sh, twl_list_stats_t *sum);
+
+twl_list_t *ap_shard_merge(twl_list_t **parts, int count);
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -0,0 +1,272 @@
+// ap_snapshot.c
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "twl_list.h"
+#include "ap_command.h"
+#include "ap_support.h"
+#include "ap_input.h"
+#include "ap_proto.h"
+#include "ap_snapshot.h"
+
+#define TRUE  1
+#define FALSE 0
+
+#define SNAP_HEADER_SIZE 24
+#define SNAP_TRAILER_SIZE 4
+
+static unsigned int crc_table[256];
+
+/* CRC-32 (IEEE 802.3), the same checksum zlib computes.  Pass 0 as the
+ * starting crc.
+ */
+unsigned int ap_crc32(unsigned int crc, const void *buf, size_t len)
+{
+    const unsigned char *p = (const unsigned char *) buf;
+
+    if (crc_table[1] == 0) {
+        for (unsigned int n = 0; n < 256; n++) {
+            unsigned int c = n;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            crc_table[n] = c;
+        }
+    }
+    crc = ~crc;
+    while (len-- > 0)
+        crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void put_u32(unsigned char *buf, unsigned int v)
+{
+    buf[0] = (unsigned char) v;
+    buf[1] = (unsigned char) (v >> 8);
+    buf[2] = (unsigned char) (v >> 16);
+    buf[3] = (unsigned char) (v >> 24);
+}
+
+static unsigned int get_u32(const unsigned char *buf)
+{
+    return (unsigned int) buf[0] | (unsigned int) buf[1] << 8
+        | (unsigned int) buf[2] << 16 | (unsigned int) buf[3] << 24;
+}
+
+static void put_u64(unsigned char *buf, long long v)
+{
+    put_u32(buf, (unsigned int) v);
+    put_u32(buf + 4, (unsigned int) ((unsigned long long) v >> 32));
+}
+
+static long long get_u64(const unsigned char *buf)
+{
+    return (long long) (get_u32(buf) | (unsigned long long) get_u32(buf + 4) << 32);
+}
+
+/* writes buf and folds it into the running checksum */
+static int put_block(FILE *fp, unsigned int *crc, const unsigned char *buf, size_t len)
+{
+    *crc = ap_crc32(*crc, buf, len);
+    return fwrite(buf, 1, len, fp) == len;
+}
+
+static int put_list(FILE *fp, unsigned int *crc, twl_list_t *list_ptr)
+{
+    unsigned char buf[AP_PROTO_REC_SIZE];
+    int count = twl_list_size(list_ptr);
+
+    /* twl_list_access keeps a rover, so this loop is linear */
+    for (int i = 0; i < count; i++) {
+        ap_proto_put_rec(buf, twl_list_access(list_ptr, i));
+        if (!put_block(fp, crc, buf, sizeof(buf)))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/* Writes both lists to path, tagged with the journal seq they include.
+ * The snapshot goes to a temporary file that
+ * is synced and then renamed over path, so a crash leaves either the old
+ * or the new snapshot, never a torn one.
+ *
+ * Returns 0 on success.  On failure returns -1 and points *why at a reason.
+ */
+int ap_snapshot_save(const char *path, twl_list_t *leaderboard, twl_list_t *queue,
+        long long seq, const char **why)
+{
+    unsigned char header[SNAP_HEADER_SIZE];
+    unsigned char trailer[SNAP_TRAILER_SIZE];
+    char tmp_path[MAXLINE + 8];
+    unsigned int crc = 0;
+    FILE *fp;
+    int ok;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        *why = strerror(errno);
+        return -1;
+    }
+    setvbuf(fp, NULL, _IOFBF, 1 << 20);
+
+    memcpy(header, AP_SNAPSHOT_MAGIC, 4);
+    put_u32(header + 4, AP_SNAPSHOT_VERSION);
+    put_u32(header + 8, (unsigned int) twl_list_size(leaderboard));
+    put_u32(header + 12, (unsigned int) twl_list_size(queue));
+    put_u64(header + 16, seq);
+    ok = put_block(fp, &crc, header, sizeof(header))
+        && put_list(fp, &crc, leaderboard)
+        && put_list(fp, &crc, queue);
+    put_u32(trailer, crc);
+    ok = ok && fwrite(trailer, 1, sizeof(trailer), fp) == sizeof(trailer);
+    ok = ok && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    if (!ok)
+        *why = strerror(errno);
+    if (fclose(fp) != 0 && ok) {
+        *why = strerror(errno);
+        ok = FALSE;
+    }
+    if (ok && rename(tmp_path, path) != 0) {
+        *why = strerror(errno);
+        ok = FALSE;
+    }
+    if (!ok) {
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+/* Maps the snapshot at path read-only for ap_snapshot_decode.  Returns 0
+ * and sets *image and *size on success; give the mapping back with
+ * ap_snapshot_unmap.  On failure returns -1 and points *why at a reason.
+ */
+int ap_snapshot_map(const char *path, const unsigned char **image, size_t *size,
+        const char **why)
+{
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        *why = strerror(errno);
+        return -1;
+    }
+    if (fstat(fd, &st) != 0) {
+        *why = strerror(errno);
+        close(fd);
+        return -1;
+    }
+    *size = (size_t) st.st_size;
+    if (*size < SNAP_HEADER_SIZE + SNAP_TRAILER_SIZE) {
+        *why = "file too short";
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        *why = strerror(errno);
+        return -1;
+    }
+    madvise(map, *size, MADV_SEQUENTIAL);
+    *image = (const unsigned char *) map;
+    return 0;
+}
+
+void ap_snapshot_unmap(const unsigned char *image, size_t size)
+{
+    munmap((void *) image, size);
+}
+
+/* Builds two new lists from a snapshot image of size bytes.  The image is
+ * checked completely (magic, version, size, checksum, leaderboard order
+ * and limit) before any list is built, so a bad one never replaces the
+ * current lists.
+ *
+ * Returns 0 and sets *leaderboard, *queue and *seq on success.  On failure
+ * returns -1 and points *why at a reason.
+ */
+int ap_snapshot_decode(const unsigned char *image, size_t size, int max_list_size,
+        twl_list_t **leaderboard, twl_list_t **queue, long long *seq, const char **why)
+{
+    const unsigned char *rec_base = image + SNAP_HEADER_SIZE;
+    unsigned int lb_count, q_count;
+    size_t body_size;
+    ap_info_t prev, cur;
+    int rc = -1;
+
+    if (size < SNAP_HEADER_SIZE + SNAP_TRAILER_SIZE) {
+        *why = "file too short";
+        return -1;
+    }
+    lb_count = get_u32(image + 8);
+    q_count = get_u32(image + 12);
+    body_size = size - SNAP_TRAILER_SIZE - SNAP_HEADER_SIZE;
+    if (memcmp(image, AP_SNAPSHOT_MAGIC, 4) != 0) {
+        *why = "not a snapshot";
+    } else if (get_u32(image + 4) != AP_SNAPSHOT_VERSION) {
+        *why = "unsupported snapshot version";
+    } else if (body_size / AP_PROTO_REC_SIZE != (size_t) lb_count + q_count
+            || body_size % AP_PROTO_REC_SIZE != 0) {
+        *why = "size does not match the record counts";
+    } else if (ap_crc32(0, image, size - SNAP_TRAILER_SIZE)
+            != get_u32(image + size - SNAP_TRAILER_SIZE)) {
+        *why = "checksum mismatch";
+    } else if (lb_count > (unsigned int) max_list_size) {
+        *why = "leaderboard larger than the leaderboard limit";
+    } else {
+        rc = 0;
+        for (unsigned int i = 0; i < lb_count + q_count && rc == 0; i++) {
+            if (!ap_proto_get_rec(rec_base + (size_t) i * AP_PROTO_REC_SIZE, &cur)) {
+                *why = "bad record";
+                rc = -1;
+            } else if (i > 0 && i < lb_count && ap_rank_aps(&prev, &cur) != 1) {
+                *why = "leaderboard out of order";
+                rc = -1;
+            }
+            prev = cur;
+        }
+    }
+
+    if (rc == 0) {
+        *seq = get_u64(image + 16);
+        /* one linear pass; records arrive in list order */
+        *leaderboard = ap_create_leaderboard();
+        *queue = twl_list_construct(NULL);
+        for (unsigned int i = 0; i < lb_count + q_count; i++) {
+            ap_info_t *rec = (ap_info_t *) malloc(sizeof(ap_info_t));
+            assert(rec != NULL);
+            ap_proto_get_rec(rec_base + (size_t) i * AP_PROTO_REC_SIZE, rec);
+            twl_list_append(i < lb_count ? *leaderboard : *queue, rec);
+        }
+    }
+    return rc;
+}
+
+/* Reads the snapshot at path into two new lists, see ap_snapshot_decode */
+int ap_snapshot_load(const char *path, int max_list_size, twl_list_t **leaderboard,
+        twl_list_t **queue, long long *seq, const char **why)
+{
+    const unsigned char *image;
+    size_t size;
+    int rc;
+
+    if (ap_snapshot_map(path, &image, &size, why) != 0)
+        return -1;
+    rc = ap_snapshot_decode(image, size, max_list_size, leaderboard, queue, seq, why);
+    ap_snapshot_unmap(image, size);
+    return rc;
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -0,0 +1,39 @@
+// ap_snapshot.h
+
+/* Binary snapshot of the leaderboard and the queue.
+ *
+ * Layout (little-endian):
+ *     "APSN"                  magic
+ *     u32 version             AP_SNAPSHOT_VERSION
+ *     u32 leaderboard count
+ *     u32 queue count
+ *     u64 journal seq         last journal entry the lists include
+ *     records                 leaderboard in ap_rank_aps order, then the
+ *                             queue front to back, AP_PROTO_REC_SIZE each
+ *     u32 crc32               of everything before it
+ *
+ * Because the leaderboard is stored in list order, a restore appends each
+ * record at the back in one linear pass with no sorted inserts.  The queue
+ * is restored unsorted in its FIFO order.
+ *
+ * LOAD decodes a mapped image rather than the file, so the journal can
+ * keep the very bytes it loaded (see ap_journal.h).
+ */
+
+#define AP_SNAPSHOT_MAGIC   "APSN"
+#define AP_SNAPSHOT_VERSION 2
+
+int ap_snapshot_save(const char *path, twl_list_t *leaderboard, twl_list_t *queue,
+        long long seq, const char **why);
+int ap_snapshot_load(const char *path, int max_list_size, twl_list_t **leaderboard,
+        twl_list_t **queue, long long *seq, const char **why);
+int ap_snapshot_map(const char *path, const unsigned char **image, size_t *size,
+        const char **why);
+void ap_snapshot_unmap(const unsigned char *image, size_t size);
+int ap_snapshot_decode(const unsigned char *image, size_t size, int max_list_size,
+        twl_list_t **leaderboard, twl_list_t **queue, long long *seq, const char **why);
+
+unsigned int ap_crc32(unsigned int crc, const void *buf, size_t len);
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
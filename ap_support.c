@@ -6,7 +6,15 @@
 #include <assert.h>
 #include <time.h>
 #include "twl_list.h"
+#include "ap_command.h"
 #include "ap_support.h"
+#include "ap_output.h"
+#include "ap_metrics.h"
+#include "ap_perf.h"
+#include "ap_tune.h"
+
+#define TRUE  1
+#define FALSE 0
 
 /* ap_rank_aps is required by the linked list ADT for sorted lists. 
  *
@@ -74,20 +82,25 @@ void ap_print_list(twl_list_t *list_ptr, const char *type_of_list)
     int counter = 0;
 
     if (num_in_list == 0) {
-        printf("%s is empty\n", type_of_list);
+        out_str(type_of_list);
+        out_str(" is empty\n");
     } else {
-        printf("%s has %d records\n", type_of_list, num_in_list);
+        out_str(type_of_list);
+        out_str(" has ");
+        out_int(num_in_list);
+        out_str(" records\n");
         rec_ptr = twl_list_access(list_ptr, counter);
         while (rec_ptr != NULL)
         {
-            printf("%d: ", counter);
+            out_int(counter);
+            out_str(": ");
             ap_print_info(rec_ptr);
             counter++;
             rec_ptr = twl_list_access(list_ptr, counter);
         }
         assert(num_in_list == counter);
     }
-    printf("\n");
+    out_char('\n');
 }
 
 /* This creates a list for storing AP records that are maintained
@@ -120,23 +133,23 @@ twl_list_t *ap_create_leaderboard(void)
  *
  * Inputs:
  *     list_ptr: pointer to the list created by the construction function
- *     ap_id: the ethernet address of the AP
+ *     new_record: the AP record, from ap_read_info.  The list takes
+ *                 ownership; a rejected record is freed.
  *     max_list_size: the limit of how many records can be stored in the
  *                    leaderboard
  *
- * print one of three outcomes for the add operation:
+ * report one of three outcomes for the add operation in res->code:
  *     0: added a record in sorted order.
  *     1: did not insert because list is full.
  *     2: did not insert because eth_address already found in list (and list
  *        is not full)
  */
-void ap_add(twl_list_t *list_ptr, int ap_id, int max_list_size)
+void ap_add(twl_list_t *list_ptr, ap_info_t *new_record, int max_list_size,
+        ap_result_t *res)
 {
     int add_result = 0; // Initialize add_result
-    
-    // Create and initialize a new AP record
-    ap_info_t *new_record = ap_create_info(ap_id);
-    
+    int ap_id = new_record->eth_address;
+
     // Check if the list is full (max_list_size)
     if (twl_list_size(list_ptr) >= max_list_size) {
         add_result = 1;
@@ -144,7 +157,7 @@ void ap_add(twl_list_t *list_ptr, int ap_id, int max_list_size)
     } else {
         // Check if a record already exists with the same eth_address in the list
         ap_info_t *existing_record = twl_list_elem_find_data_ptr(list_ptr, new_record, ap_match_eth);
-    
+
         if (existing_record != NULL) {
             add_result = 2;
             free(new_record); // Free memory allocated for the new record
@@ -154,26 +167,20 @@ void ap_add(twl_list_t *list_ptr, int ap_id, int max_list_size)
         }
     }
 
-    // Print message after determining the result of the operation.
-    
-    if (add_result == 0) {
-        printf("Inserted %d\n", ap_id);
-    } else if (add_result == 1) {
-        printf("Rejected %d because list is full with %d entries\n", ap_id, max_list_size);
-    } else if (add_result == 2) {
-        printf("Rejected %d already in list\n", ap_id);
-    } else {
-        printf("Error with return value! Fix your code.\n");
-    }
+    res->op = AP_OP_ADD;
+    res->code = add_result;
+    res->eth = ap_id;
+    res->aux = max_list_size;
 }
 
 
 
 
-/* This function prints the record with the matching eth address in the
- * leaderboard list.  
+/* This function looks up the record with the matching eth address in the
+ * leaderboard list.  res->code is 0 and res->value the mobile count if it
+ * is found, otherwise res->code is -1.
  */
-void ap_find(twl_list_t *list_ptr, int ap_id)
+void ap_find(twl_list_t *list_ptr, int ap_id, ap_result_t *res)
 {
     ap_info_t *rec_ptr = NULL;
     // Create a temporary search record
@@ -184,14 +191,16 @@ void ap_find(twl_list_t *list_ptr, int ap_id)
     //  review driver.c for an example how to use twl_list_elem_find
     //
     //  notice ap_match_eth is a function found in this file
-  
+
         rec_ptr = twl_list_elem_find_data_ptr(list_ptr, &search_record, ap_match_eth);
 
+       res->op = AP_OP_FIND;
+       res->eth = ap_id;
        if (rec_ptr == NULL) {
-           printf("Did not find access point with id: %d\n", ap_id);
+           res->code = -1;
        } else {
-           // Print information about the found access point
-           printf("%d mobiles registered with AP %d\n", rec_ptr->mobile_count, ap_id);
+           res->code = 0;
+           res->value = rec_ptr->mobile_count;
            assert(rec_ptr->eth_address == ap_id); // Verify that the correct record was found
        }
    }
@@ -201,10 +210,13 @@ void ap_find(twl_list_t *list_ptr, int ap_id)
  * AP ethernet address
  *
  * Inputs
- *     list_ptr: pointer to the leaderboard list 
+ *     list_ptr: pointer to the leaderboard list
  *     ap_id: eth_address that should be removed from the list
+ *
+ * res->code is 0 and res->rec a copy of the removed record if it was found,
+ * otherwise res->code is -1.
  */
-void ap_remove(twl_list_t *list_ptr, int ap_id)
+void ap_remove(twl_list_t *list_ptr, int ap_id, ap_result_t *res)
 {
     ap_info_t search_record;  // Create a search record with the given ap_id
     search_record.eth_address = ap_id;
@@ -213,13 +225,15 @@ void ap_remove(twl_list_t *list_ptr, int ap_id)
     // Use twl_list_elem_find_data_ptr with a pointer to the search record
     rec_ptr = twl_list_elem_find_data_ptr(list_ptr, &search_record, ap_match_eth);
 
+    res->op = AP_OP_REMOVE;
+    res->eth = ap_id;
     if (rec_ptr == NULL) {
-         printf("Remove did not find: %d\n", ap_id);
+        res->code = -1;
     } else {
         ap_info_t *removed_record = twl_list_remove(list_ptr, twl_list_elem_find_position(list_ptr, rec_ptr, ap_match_eth));
-        
-        printf("Removed: %d\n", ap_id);
-        ap_print_info(rec_ptr);
+
+        res->code = 0;
+        res->rec = *rec_ptr;
         assert(removed_record == rec_ptr);
         // Free the memory of the removed record
         free(removed_record);
@@ -227,15 +241,15 @@ void ap_remove(twl_list_t *list_ptr, int ap_id)
         // Set the rec_ptr to NULL to avoid dangling pointer
         rec_ptr = NULL;
 
-        
+
     }
 }
 
 
 
 /* Increment the mobile_count field for the access point record with
- * the matching eth_address.  If the record is found, print the new
- * value of mobile_count.  
+ * the matching eth_address.  If the record is found, res->value is the new
+ * value of mobile_count.
  *
  * The record that is changed may need to have its position in the
  * list updated (to a lower index position or nearer the front of the list) so
@@ -243,10 +257,12 @@ void ap_remove(twl_list_t *list_ptr, int ap_id)
  * defined in the ap_add function.
  *
  * Inputs
- *     list_ptr: pointer to the leaderboard 
- *     ap_id: eth_address that should have its mobile count incremented 
+ *     list_ptr: pointer to the leaderboard
+ *     ap_id: eth_address that should have its mobile count incremented
+ *
+ * res->code is the inc_result: -2 if not found, otherwise the new count.
  */
-void ap_inc(twl_list_t *list_ptr, int ap_id)
+void ap_inc(twl_list_t *list_ptr, int ap_id, ap_result_t *res)
 {
     ap_info_t comparison_ap;
     comparison_ap.eth_address = ap_id;
@@ -267,19 +283,16 @@ void ap_inc(twl_list_t *list_ptr, int ap_id)
 
         inc_result = rec_ptr->mobile_count; // Update the result
     }
-    
-    if (inc_result == -2) {
-        printf("Increment failed for AP %d because not found\n", ap_id);
-    } else if (inc_result > 0) {
-        printf("AP %d incremented to %d\n", ap_id, inc_result);
-    } else {
-        printf("Increment return value %d invalid for AP %d.  Fix your code.\n", inc_result, ap_id);
-    }
+
+    res->op = AP_OP_INC;
+    res->code = inc_result;
+    res->eth = ap_id;
+    res->value = inc_result;
 }
 
 /* Decrement the mobile_count field for the access point record with
- * the matching eth_address.  If the record is found, print the new
- * value of mobile_count.  
+ * the matching eth_address.  If the record is found, res->value is the new
+ * value of mobile_count.
  *
  * If the count is already zero it cannot be decremented.
  *
@@ -289,18 +302,20 @@ void ap_inc(twl_list_t *list_ptr, int ap_id)
  * defined in the ap_add function.
  *
  * Inputs
- *     list_ptr: pointer to the leaderboard 
- *     ap_id: eth_address that should have its mobile count decremented 
+ *     list_ptr: pointer to the leaderboard
+ *     ap_id: eth_address that should have its mobile count decremented
  *
+ * res->code is the dec_result: -2 if not found, -1 if the count is already
+ * zero, otherwise the new count.
  */
-void ap_dec(twl_list_t *list_ptr, int ap_id) {
+void ap_dec(twl_list_t *list_ptr, int ap_id, ap_result_t *res) {
     // Find the record with the matching eth_address
     ap_info_t comparison_ap;
     comparison_ap.eth_address = ap_id;
 
     ap_info_t *rec_ptr = twl_list_elem_find_data_ptr(list_ptr, &comparison_ap, ap_match_eth);
 
-    int dec_result = -2 ; 
+    int dec_result = -2 ;
 
     if (rec_ptr != NULL) {
         if (rec_ptr->mobile_count > 0) {
@@ -321,33 +336,40 @@ void ap_dec(twl_list_t *list_ptr, int ap_id) {
         }
     }
 
-    if (dec_result == -2) {
-        printf("Decrement for AP %d failed because not found\n", ap_id);
-    } else if (dec_result == -1) {
-        printf("Decrement for AP %d failed.  Count is already zero\n", ap_id);
-    } else if (dec_result >= 0) {
-        printf("AP %d decremented to %d\n", ap_id, dec_result);
-    } else {
-        printf("Decrement return value %d invalid for AP %d. Fix your code.\n", dec_result, ap_id);
-    }
+    res->op = AP_OP_DEC;
+    res->code = dec_result;
+    res->eth = ap_id;
+    res->value = dec_result;
 }
 
 
-/* prints size of each of the two lists
+/* gets the size of each of the two lists
  */
-void ap_stats(twl_list_t *leaderboard, twl_list_t *queue)
+void ap_stats(twl_list_t *leaderboard, twl_list_t *queue, ap_result_t *res)
 {
     // get the number in list and size of the list
-    int num_leaderboard = twl_list_size(leaderboard);
-    int num_queue = twl_list_size(queue);
-    printf("Leaderboard list records:  %d, ", num_leaderboard);
-    printf("Queue list records: %d\n", num_queue);
+    res->op = AP_OP_STATS;
+    res->code = 0;
+    res->value = twl_list_size(leaderboard);
+    res->aux = twl_list_size(queue);
+}
+
+/* The operation counts of both lists (see twl_list.h).  res->value is 1
+ * if they are compiled in.
+ */
+void ap_list_stats(twl_list_t *leaderboard, twl_list_t *queue, ap_result_t *res)
+{
+    res->op = AP_OP_LISTSTATS;
+    res->value = twl_list_stats_enabled();
+    twl_list_get_stats(leaderboard, &res->stats[0]);
+    twl_list_get_stats(queue, &res->stats[1]);
 }
 
 
-/* Remove all records from the leaderboard.
+/* Remove all records from the leaderboard.  res->value is the number of
+ * records removed.
  */
-void ap_removeall(twl_list_t *leaderboard)
+void ap_removeall(twl_list_t *leaderboard, ap_result_t *res)
 {
     // Iterate through the leaderboard and remove each record
     int found = 0;  // how many records are removed
@@ -358,29 +380,27 @@ void ap_removeall(twl_list_t *leaderboard)
             found++;
         }
     }
-     
-    if (found == 0) {
-        printf("No stations found\n");
-    } else {
-        printf("Removed %d station%s\n", found, found==1?"":"s");
-    }
+
+    res->op = AP_OP_REMOVEALL;
+    res->code = 0;
+    res->value = found;
 }
 
 
 /* This function moves the AP record at the front of the queue and attempts
  * to insert into the leaderboard.
  *
- * Use the identical rules as for ap_add.  Don't insert if the leaderboard 
+ * Use the identical rules as for ap_add.  Don't insert if the leaderboard
  * is full or if AP is already in the leaderboard.  If the move is rejected
- * the record is discarded (and not left in the queue). 
+ * the record is discarded (and not left in the queue).
  *
  *  Inputs
- *     queue: pointer to the first-in first-out queue 
+ *     queue: pointer to the first-in first-out queue
  *     leaderboard: pointer to the leaderboard list
  *     max_list_size: the limit of how many records can be stored in the
  *                    leaderboard
  *
- * print one of these outcomes for the move operation:
+ * report one of these outcomes for the move operation in res->code:
  *     0: there is no AP in queue
  *     1: moved a record from queue to leaderboard in sorted order.
  *     2: did not move because leaderboard is full.
@@ -389,29 +409,33 @@ void ap_removeall(twl_list_t *leaderboard)
  *
  */
 
-  void ap_dequeue(twl_list_t *queue, twl_list_t *leaderboard, int max_list_size)
+  void ap_dequeue(twl_list_t *queue, twl_list_t *leaderboard, int max_list_size,
+          ap_result_t *res)
 {
     int move_result = -2; // Initialize move_result to an invalid value
 
+    res->op = AP_OP_MOVEQTOL;
+    res->aux = max_list_size;
+
     // Check if the queue is empty
     if (twl_list_size(queue) == 0) {
-        printf("Queue is empty, no AP moved\n");
+        res->code = 0;
         return;
     }
 
     // Get the record from the front of the queue
     ap_info_t *rec_ptr = (ap_info_t *)twl_list_remove(queue, 0);
-    
+
     // Check if the leaderboard is already full
     if (twl_list_size(leaderboard) >= max_list_size) {
         move_result = 2; // Move rejected due to leaderboard full
-        
+
     } else {
         // Check if the record is already in the leaderboard
         int position_in_leaderboard = twl_list_elem_find_position(leaderboard, rec_ptr, ap_match_eth);
         if (position_in_leaderboard != -1) {
             move_result = 3; // Move rejected due to duplicate in leaderboard
-            
+
         } else {
             // Attempt to insert the record into the leaderboard in sorted order
             twl_list_insert_sorted(leaderboard, rec_ptr);
@@ -419,23 +443,10 @@ void ap_removeall(twl_list_t *leaderboard)
         }
     }
 
-    // Remove the first element from the queue
-    
-
-    // Determine the appropriate print message based on move_result
-    if (move_result == 0) {
-        printf("Queue is empty, no AP moved\n");
-    } else if (move_result == 1) {
-        printf("Moved %d\n", rec_ptr->eth_address);
-    } else if (move_result == 2) {
-        printf("Move rejected %d because leaderboard is full with %d entries\n", rec_ptr->eth_address, max_list_size);
+    res->code = move_result;
+    res->eth = rec_ptr->eth_address;
+    if (move_result != 1) {
         free(rec_ptr);
-
-    } else if (move_result == 3) {
-        printf("Move rejected %d already in leaderboard\n", rec_ptr->eth_address);
-         free(rec_ptr);
-    } else {
-        printf("Error with return value for move! Fix your code.\n");
     }
 }
 
@@ -451,17 +462,16 @@ void ap_removeall(twl_list_t *leaderboard)
  * Simply append to the back of the queue.
  *
  */
-void ap_enqueue(twl_list_t *queue, int ap_id)
+void ap_enqueue(twl_list_t *queue, ap_info_t *rec_ptr, ap_result_t *res)
 {
-    // Create a new AP record using ap_create_info (you will need to implement this function)
-    ap_info_t *rec_ptr = ap_create_info(ap_id);
+    int ap_id = rec_ptr->eth_address;
 
     // Enqueue the new record at the back of the queue
     twl_list_insert(queue, rec_ptr, TWL_LIST_BACK);
 
-    // Print a success message
-    printf("Appended to back of queue %d\n", ap_id);
-   
+    res->op = AP_OP_JOINQ;
+    res->code = 0;
+    res->eth = ap_id;
 }
 
 /* this function frees the memory for either a sorted or unsorted list.
@@ -471,51 +481,466 @@ void ap_cleanup(twl_list_t *list_ptr)
     twl_list_destruct(list_ptr);
 }
 
+/* Makes an unsorted list with copies of the records of list_ptr, in the
+ * same order.  The copy shares nothing with the original.
+ */
+twl_list_t *ap_copy_list(twl_list_t *list_ptr)
+{
+    twl_list_t *copy = twl_list_construct(NULL);
+    int count = twl_list_size(list_ptr);
+
+    for (int i = 0; i < count; i++) {
+        ap_info_t *rec = (ap_info_t *) malloc(sizeof(ap_info_t));
+        assert(rec != NULL);
+        *rec = *(ap_info_t *) twl_list_access(list_ptr, i);
+        twl_list_append(copy, rec);
+    }
+    return copy;
+}
+
+/* ap_sort_mc and ap_sort_eth report the sort_type that ran in res->code.
+ * For sort_type 0 that is the one twl_list_sort_auto chose, or 0 if the
+ * list was already in order.
+ */
+
 //ap_sort_mc for sorting based on mobile count i.e sortap x command
-void ap_sort_mc(twl_list_t *list_ptr, int sort_type) {
+void ap_sort_mc(twl_list_t *list_ptr, int sort_type, ap_result_t *res) {
     clock_t start, end;
     double elapse_time; /* time in milliseconds */
     int initialcount = twl_list_size(list_ptr);
     start = clock();
-    twl_list_sort(list_ptr, sort_type, ap_rank_aps);
+    if (sort_type == 0)
+        sort_type = twl_list_sort_auto(list_ptr, ap_rank_aps);
+    else
+        twl_list_sort(list_ptr, sort_type, ap_rank_aps);
     end = clock();
     elapse_time = 1000.0 * ((double) (end - start)) / CLOCKS_PER_SEC;
     assert(twl_list_size (list_ptr) == initialcount);
-    printf("%d\t%f\t%d\n", initialcount, elapse_time, sort_type);
+    res->op = AP_OP_SORTAP;
+    res->code = sort_type;
+    res->value = initialcount;
+    res->elapsed = elapse_time;
     }
-    
+
 //ap_sort_eth for sorting based on eth address i.e sorteth x command
-void ap_sort_eth(twl_list_t *list_ptr, int sort_type) {
+void ap_sort_eth(twl_list_t *list_ptr, int sort_type, ap_result_t *res) {
     clock_t start, end;
     double elapse_time; /* time in milliseconds */
     int initialcount = twl_list_size(list_ptr);
     start = clock();
-    twl_list_sort(list_ptr, sort_type, ap_compare_eth);
+    if (sort_type == 0)
+        sort_type = twl_list_sort_auto(list_ptr, ap_compare_eth);
+    else
+        twl_list_sort(list_ptr, sort_type, ap_compare_eth);
     end = clock();
     elapse_time = 1000.0 * ((double) (end - start)) / CLOCKS_PER_SEC;
     assert(twl_list_size (list_ptr) == initialcount);
-    printf("%d\t%f\t%d\n", initialcount, elapse_time, sort_type);
+    res->op = AP_OP_SORTETH;
+    res->code = sort_type;
+    res->value = initialcount;
+    res->elapsed = elapse_time;
     }
 
+/* TOPQ n and PARTQ n: the n best records of the queue by ap_rank_aps,
+ * best first, found with twl_list_top in O(size log n) rather than by
+ * sorting the queue.  PARTQ also moves them to the front of the queue in
+ * that order and leaves the rest as they were.  res->list gets copies of
+ * the records, since the report may be printed after the queue changed.
+ */
+void ap_topq(twl_list_t *queue, int n, int partial, ap_result_t *res)
+{
+    int size = twl_list_size(queue);
+    int count = n < size ? n : size;
+    ap_info_t **top = NULL;
+
+    res->op = partial ? AP_OP_PARTQ : AP_OP_TOPQ;
+    res->aux = size;
+    res->list = twl_list_construct(NULL);
+    res->owns_list = TRUE;
+    if (n < 1) {
+        res->code = -1;
+        return;
+    }
+    if (count == 0)
+        return;
+    if (partial) {
+        twl_list_partial_sort(queue, n, ap_rank_aps);
+    } else {
+        top = (ap_info_t **) malloc((size_t) count * sizeof(ap_info_t *));
+        assert(top != NULL);
+        twl_list_top(queue, n, ap_rank_aps, top);
+    }
+    for (int i = 0; i < count; i++) {
+        ap_info_t *rec = (ap_info_t *) malloc(sizeof(ap_info_t));
+        assert(rec != NULL);
+        *rec = partial ? *(ap_info_t *) twl_list_access(queue, i) : *top[i];
+        twl_list_append(res->list, rec);
+    }
+    free(top);
+    res->value = count;
+}
+
 //ap_APPENDQ CODE
-void ap_appendq(twl_list_t *queue, int eth_id, int mobile_cnt) {
+void ap_appendq(twl_list_t *queue, int eth_id, int mobile_cnt, int time, ap_result_t *res) {
+    res->op = AP_OP_APPENDQ;
+    res->eth = eth_id;
+    res->code = 0;
+
     // Create a new ap_info_t structure with the provided values
     ap_info_t *new_ap = (ap_info_t *)calloc(1, sizeof(ap_info_t));
     if (new_ap == NULL) {
         //printf("# Error: Memory allocation failed\n");
+        res->code = -1;
         return;
     }
 
-    new_ap->eth_address = eth_id;      
+    new_ap->eth_address = eth_id;
     new_ap->mobile_count = mobile_cnt;
+    new_ap->time_received = time;
 
     // Insert the new AP record into the queue
     twl_list_insert(queue, new_ap, twl_list_size(queue));
-    
+
     // Mark the list as unsorted using the new function
     twl_mark_the_list_unsorted(queue);
 }
-    
+
+/* Prints the records of a result list, numbered from first, and the
+ * blank line ap_print_list ends with
+ */
+static void print_records(twl_list_t *list, int first)
+{
+    int count = twl_list_size(list);
+
+    for (int i = 0; i < count; i++) {
+        out_int(first + i);
+        out_str(": ");
+        ap_print_info(twl_list_access(list, i));
+    }
+    out_char('\n');
+}
+
+/* FINDIP and FINDLOC: the first on_board records are from the leaderboard,
+ * the rest from the queue
+ */
+static void print_found(twl_list_t *list, int on_board)
+{
+    int i = 0;
+
+    for (ll_node_t *node = twl_list_front_node(list); node != NULL;
+            node = twl_list_next_node(node), i++) {
+        out_str(i < on_board ? "leaderboard: " : "queue: ");
+        ap_print_info(twl_list_node_data(node));
+    }
+    out_char('\n');
+}
+
+/* Prints the text form of a command result.  This is the only place the
+ * command outcomes are turned into text, so every input mode produces the
+ * same output.  Acknowledgements go through out_ack so quiet mode can
+ * count and drop them; query results are always printed.
+ */
+void ap_report(const ap_result_t *res)
+{
+    if (res->prompted && !out_is_quiet())
+        ap_print_prompts();
+
+    switch (res->op) {
+    case AP_OP_ADD:
+        if (!out_ack()) {
+            break;
+        } else if (res->code == 0) {
+            out_str("Inserted ");
+            out_int(res->eth);
+            out_char('\n');
+        } else if (res->code == 1) {
+            out_str("Rejected ");
+            out_int(res->eth);
+            out_str(" because list is full with ");
+            out_int(res->aux);
+            out_str(" entries\n");
+        } else if (res->code == 2) {
+            out_str("Rejected ");
+            out_int(res->eth);
+            out_str(" already in list\n");
+        } else {
+            out_str("Error with return value! Fix your code.\n");
+        }
+        break;
+    case AP_OP_FIND:
+        if (res->code != 0) {
+            out_str("Did not find access point with id: ");
+            out_int(res->eth);
+            out_char('\n');
+        } else {
+            out_int(res->value);
+            out_str(" mobiles registered with AP ");
+            out_int(res->eth);
+            out_char('\n');
+        }
+        break;
+    case AP_OP_REMOVE:
+        if (!out_ack()) {
+            break;
+        } else if (res->code != 0) {
+            out_str("Remove did not find: ");
+            out_int(res->eth);
+            out_char('\n');
+        } else {
+            out_str("Removed: ");
+            out_int(res->eth);
+            out_char('\n');
+            ap_print_info((ap_info_t *) &res->rec);
+        }
+        break;
+    case AP_OP_INC:
+        if (!out_ack()) {
+            break;
+        } else if (res->code == -2) {
+            out_str("Increment failed for AP ");
+            out_int(res->eth);
+            out_str(" because not found\n");
+        } else if (res->code > 0) {
+            out_str("AP ");
+            out_int(res->eth);
+            out_str(" incremented to ");
+            out_int(res->value);
+            out_char('\n');
+        } else {
+            out_printf("Increment return value %d invalid for AP %d.  Fix your code.\n", res->code, res->eth);
+        }
+        break;
+    case AP_OP_DEC:
+        if (!out_ack()) {
+            break;
+        } else if (res->code == -2) {
+            out_str("Decrement for AP ");
+            out_int(res->eth);
+            out_str(" failed because not found\n");
+        } else if (res->code == -1) {
+            out_str("Decrement for AP ");
+            out_int(res->eth);
+            out_str(" failed.  Count is already zero\n");
+        } else if (res->code >= 0) {
+            out_str("AP ");
+            out_int(res->eth);
+            out_str(" decremented to ");
+            out_int(res->value);
+            out_char('\n');
+        } else {
+            out_printf("Decrement return value %d invalid for AP %d. Fix your code.\n", res->code, res->eth);
+        }
+        break;
+    case AP_OP_PRINT:
+        ap_print_list(res->list, "Leaderboard");
+        break;
+    case AP_OP_PRINTQ:
+        ap_print_list(res->list, "Queue");
+        break;
+    case AP_OP_REMOVEALL:
+        if (!out_ack()) {
+            break;
+        } else if (res->value == 0) {
+            out_str("No stations found\n");
+        } else {
+            out_str("Removed ");
+            out_int(res->value);
+            out_str(res->value == 1 ? " station\n" : " stations\n");
+        }
+        break;
+    case AP_OP_JOINQ:
+        if (out_ack()) {
+            out_str("Appended to back of queue ");
+            out_int(res->eth);
+            out_char('\n');
+        }
+        break;
+    case AP_OP_MOVEQTOL:
+        if (!out_ack()) {
+            break;
+        } else if (res->code == 0) {
+            out_str("Queue is empty, no AP moved\n");
+        } else if (res->code == 1) {
+            out_str("Moved ");
+            out_int(res->eth);
+            out_char('\n');
+        } else if (res->code == 2) {
+            out_str("Move rejected ");
+            out_int(res->eth);
+            out_str(" because leaderboard is full with ");
+            out_int(res->aux);
+            out_str(" entries\n");
+        } else if (res->code == 3) {
+            out_str("Move rejected ");
+            out_int(res->eth);
+            out_str(" already in leaderboard\n");
+        } else {
+            out_str("Error with return value for move! Fix your code.\n");
+        }
+        break;
+    case AP_OP_SORTAP:
+    case AP_OP_SORTETH:
+        out_printf("%d\t%f\t%d", res->value, res->elapsed, res->code);
+        /* with --perf the counter deltas follow in ap_perf_name order */
+        for (int i = 0; res->counted && i < AP_PERF_EVENTS; i++) {
+            if (res->perf[i] < 0)
+                out_str("\t-");
+            else
+                out_printf("\t%lld", res->perf[i]);
+        }
+        out_char('\n');
+        break;
+    case AP_OP_TOPQ:
+    case AP_OP_PARTQ:
+        if (res->code != 0) {
+            out_printf("%s needs a count of at least 1\n", ap_op_name(res->op));
+            break;
+        } else if (res->value == 0) {
+            out_str("Queue is empty\n\n");
+            break;
+        }
+        if (res->op == AP_OP_TOPQ)
+            out_printf("Top %d of %d queue records\n", res->value, res->aux);
+        else
+            out_printf("Moved the top %d of %d queue records to the front\n",
+                    res->value, res->aux);
+        print_records(res->list, 0);
+        break;
+    case AP_OP_RANK:
+        if (res->code != 0)
+            out_printf("Did not find access point with id: %d\n", res->eth);
+        else
+            out_printf("AP %d is at position %d of %d with %d mobiles\n", res->eth,
+                    res->value, res->aux, res->rec.mobile_count);
+        break;
+    case AP_OP_TOPK:
+        if (res->code != 0) {
+            out_str("TOPK needs a count of at least 1\n");
+            break;
+        } else if (res->value == 0) {
+            out_str("Leaderboard is empty\n\n");
+            break;
+        }
+        out_printf("Top %d of %d leaderboard records\n", res->value, res->aux);
+        print_records(res->list, 0);
+        break;
+    case AP_OP_RANGE:
+        if (res->value == 0) {
+            out_str("No leaderboard records in the range\n\n");
+            break;
+        }
+        out_printf("%d leaderboard %s in the range\n", res->value,
+                res->value == 1 ? "record" : "records");
+        print_records(res->list, res->aux);
+        break;
+    case AP_OP_FINDIP:
+    case AP_OP_FINDLOC:
+        if (res->value + res->aux == 0) {
+            out_printf(res->op == AP_OP_FINDIP ? "No records with IP %d\n\n"
+                    : "No records at location %d\n\n", res->eth);
+            break;
+        }
+        out_printf(res->op == AP_OP_FINDIP ? "%d leaderboard and %d queue records with IP %d\n"
+                : "%d leaderboard and %d queue records at location %d\n",
+                res->value, res->aux, res->eth);
+        print_found(res->list, res->value);
+        break;
+    case AP_OP_VIEWQ:
+        if (res->code != 0) {
+            out_str("VIEWQ needs a view of 1 (rank), 2 (eth) or 3 (rate)\n");
+            break;
+        } else if (res->value == 0) {
+            out_str("Queue is empty\n\n");
+            break;
+        }
+        out_printf("Queue has %d records by %s\n", res->value,
+                res->aux == 1 ? "rank" : res->aux == 2 ? "eth" : "rate");
+        print_records(res->list, 0);
+        break;
+    case AP_OP_CALIBRATE:
+        out_str("Calibrated sort_type 0");
+        if (res->code == 0)
+            out_printf(", saved to %.*s\n", (int) res->text_len, res->text);
+        else
+            out_printf(", could not save it to %.*s: %s\n", (int) res->text_len,
+                    res->text, res->note);
+        ap_tune_report(&res->tuning);
+        break;
+    case AP_OP_PERFON:
+    case AP_OP_PERFOFF:
+        if (res->code == -1) {
+            out_printf("Performance counters are not available: %s\n", res->note);
+        } else if (res->code == -2) {
+            out_str("PERFOFF without PERFON\n");
+        } else if (res->op == AP_OP_PERFON) {
+            out_str("Performance counters started\n");
+        } else {
+            out_printf("Counted %d commands:", res->value);
+            for (int i = 0; i < AP_PERF_EVENTS; i++) {
+                if (res->perf[i] < 0)
+                    out_printf(" %s -", ap_perf_name(i));
+                else
+                    out_printf(" %s %lld", ap_perf_name(i), res->perf[i]);
+            }
+            out_char('\n');
+        }
+        break;
+    case AP_OP_METRICS:
+        ap_metrics_report(res->metrics);
+        break;
+    case AP_OP_LISTSTATS:
+        if (!res->value) {
+            out_str("List statistics are not compiled in (build with -DTWL_LIST_STATS)\n");
+            break;
+        }
+        out_str("list           compares         hops     allocs      frees  validates\n");
+        for (int i = 0; i < 2; i++) {
+            const twl_list_stats_t *s = &res->stats[i];
+            out_printf("%-11s %11ld %12ld %10ld %10ld %10ld\n",
+                    i == 0 ? "leaderboard" : "queue", s->compares, s->hops,
+                    s->allocs, s->frees, s->validates);
+        }
+        break;
+    case AP_OP_EXPIRE:
+        if (res->code == -1)
+            out_str("EXPIRE is not available with --shards\n");
+        else if (!out_ack())
+            break;
+        else if (res->code == 1)
+            out_printf("Clock set to %d\n", res->value);
+        else
+            out_printf("Expired %d leaderboard and %d queue records\n",
+                    res->value, res->aux);
+        break;
+    case AP_OP_STATS:
+        out_str("Leaderboard list records:  ");
+        out_int(res->value);
+        out_str(", Queue list records: ");
+        out_int(res->aux);
+        out_char('\n');
+        break;
+    case AP_OP_SAVE:
+    case AP_OP_LOAD:
+        if (res->code != 0) {
+            out_printf("%s %.*s failed: %s\n",
+                    res->op == AP_OP_SAVE ? "Save to" : "Load from",
+                    (int) res->text_len, res->text, res->note);
+        } else if (out_ack()) {
+            out_printf("%s %d leaderboard and %d queue records %s %.*s\n",
+                    res->op == AP_OP_SAVE ? "Saved" : "Loaded",
+                    res->value, res->aux, res->op == AP_OP_SAVE ? "to" : "from",
+                    (int) res->text_len, res->text);
+        }
+        break;
+    case AP_OP_NONE:
+        out_str("# ");
+        out_mem(res->text, res->text_len);
+        break;
+    default:
+        break;
+    }
+}
+
 // funtion to compare eth_address
 int ap_compare_eth(const ap_info_t *record_a, const ap_info_t *record_b)
 {
@@ -529,11 +954,23 @@ int ap_compare_eth(const ap_info_t *record_a, const ap_info_t *record_b)
         return 0;
 }
 
+/* Prints the prompts that ap_create_info shows while it collects a record,
+ * so input parsed by ap_read_info produces the same output text.
+ */
+void ap_print_prompts(void)
+{
+    out_str("AP IP address:AP location code:Authenticated (T/F):"
+            "Privacy (none|WEP|WPA|WPA2):Standard letter (a b e g h n s):"
+            "Band (2.4|5.0):Channel:Data rate:Time received (int):\n");
+}
+
 /* Prompts user for AP record input starting with the Mobile's IP address.
  * The input is not checked for errors but will default to an acceptable value
  * if the input is incorrect or missing.
  *
- * This function creates the memory block for the record.
+ * This function creates the memory block for the record.  The command loop
+ * uses ap_read_info instead, which parses the same nine lines from either
+ * stdin or a mapped trace.
  *
  * DO NOT CHANGE THIS FUNCTION!
  */
@@ -605,20 +1042,35 @@ ap_info_t *ap_create_info(int sta_id)
  *
  * Input is a pointer to a record, and no entries are changed.
  *
- * DO NOT CHANGE THIS FUNCTION!
+ * The text must stay byte-identical to the original printf version:
+ *   "mc: %d,eth: %d, IP: %d, Loc: %d, Auth: %s, Pri: %s, L: %c, B: %g,
+ *    C: %d, R: %g Time: %d\n"
  */
 void ap_print_info(ap_info_t *rec)
 {
     const char *pri_str[] = {"none", "WEP", "WPA", "WPA2"};
     assert(rec != NULL);
-    printf("mc: %d,", rec->mobile_count);
-    printf("eth: %d,", rec->eth_address);
-    printf(" IP: %d, Loc: %d,", rec->ip_address, rec->location_code);
-    printf(" Auth: %s,", rec->authenticated ? "T" : "F"); 
-    printf(" Pri: %s, L: %c, B: %g, C: %d,", pri_str[rec->privacy], 
-            (char) (rec->standard_letter + 'a'), rec->band, rec->channel);
-    printf(" R: %g", rec->data_rate);
-    printf(" Time: %d\n", rec->time_received);
+    out_str("mc: ");
+    out_int(rec->mobile_count);
+    out_str(",eth: ");
+    out_int(rec->eth_address);
+    out_str(", IP: ");
+    out_int(rec->ip_address);
+    out_str(", Loc: ");
+    out_int(rec->location_code);
+    out_str(rec->authenticated ? ", Auth: T, Pri: " : ", Auth: F, Pri: ");
+    out_str(pri_str[rec->privacy]);
+    out_str(", L: ");
+    out_char((char) (rec->standard_letter + 'a'));
+    out_str(", B: ");
+    out_float(rec->band);
+    out_str(", C: ");
+    out_int(rec->channel);
+    out_str(", R: ");
+    out_float(rec->data_rate);
+    out_str(" Time: ");
+    out_int(rec->time_received);
+    out_char('\n');
 }
 
 
@@ -0,0 +1,167 @@
+// ap_trace_conv.c
+
+/* Converts command traces between the text command language and the
+ * binary protocol of ap_proto.h.
+ *
+ *     ap_trace_conv -b [-f trace] > trace.bin     text to binary
+ *     ap_trace_conv -t [-f trace] > trace.txt     binary to text
+ *
+ * The input is stdin unless -f names a file, which is then mapped.  Lines
+ * that are not commands are kept as AP_OP_NONE frames, so the two
+ * conversions are inverses and wifi -b echoes them just like the text
+ * mode does.  ADDR/JOINQR lines become the same frames as the prompted
+ * forms.  Floats are written with %g when that reads back to the same
+ * value and with %.9g otherwise.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include "twl_list.h"
+#include "ap_command.h"
+#include "ap_support.h"
+#include "ap_output.h"
+#include "ap_input.h"
+#include "ap_proto.h"
+
+static void put_float_line(float f)
+{
+    char tmp[32];
+    snprintf(tmp, sizeof(tmp), "%g", f);
+    if (strtof(tmp, NULL) != f)
+        snprintf(tmp, sizeof(tmp), "%.9g", f);
+    out_str(tmp);
+    out_char('\n');
+}
+
+static void put_int_line(int v)
+{
+    out_int(v);
+    out_char('\n');
+}
+
+/* the nine lines ap_read_info parses back into the same record */
+static void put_record_lines(const ap_info_t *rec)
+{
+    const char *pri_str[] = {"none", "WEP", "WPA", "WPA2"};
+
+    put_int_line(rec->ip_address);
+    put_int_line(rec->location_code);
+    out_str(rec->authenticated ? "T\n" : "F\n");
+    out_str(pri_str[rec->privacy]);
+    out_char('\n');
+    out_char((char) (rec->standard_letter + 'a'));
+    out_char('\n');
+    put_float_line(rec->band);
+    put_int_line(rec->channel);
+    put_float_line(rec->data_rate);
+    put_int_line(rec->time_received);
+}
+
+static int text_to_binary(in_src_t *in)
+{
+    unsigned char frame[AP_PROTO_MAX_FRAME];
+    const char *line;
+    size_t line_len;
+    ap_cmd_t cmd;
+
+    out_mem(AP_PROTO_CMD_MAGIC, AP_PROTO_MAGIC_SIZE);
+    while (in_next_line(in, &line, &line_len)) {
+        ap_parse_command(line, line_len, &cmd);
+        if ((cmd.op == AP_OP_ADD || cmd.op == AP_OP_JOINQ) && cmd.rec == NULL)
+            cmd.rec = ap_read_info(in, cmd.id);
+        out_mem((const char *) frame, ap_proto_put_cmd(frame, &cmd));
+        free(cmd.rec);
+    }
+    return 0;
+}
+
+static int binary_to_text(in_src_t *in)
+{
+    ap_cmd_t cmd;
+    int got;
+
+    if (!ap_proto_get_magic(in, AP_PROTO_CMD_MAGIC)) {
+        fprintf(stderr, "input is not a binary command stream\n");
+        return 1;
+    }
+    while ((got = ap_proto_get_cmd(in, &cmd)) > 0) {
+        if (cmd.op == AP_OP_NONE) {
+            out_mem(cmd.text, cmd.text_len);
+            continue;
+        }
+        out_str(ap_op_name(cmd.op));
+        if (cmd.op == AP_OP_SAVE || cmd.op == AP_OP_LOAD) {
+            out_char(' ');
+            out_mem(cmd.text, cmd.text_len);
+        } else if (cmd.op == AP_OP_APPENDQ || cmd.op == AP_OP_RANGE
+                || cmd.op == AP_OP_EXPIRE) {
+            out_char(' ');
+            out_int(cmd.id);
+            out_char(' ');
+            out_int(cmd.arg);
+        } else if (cmd.rec != NULL || cmd.op == AP_OP_REMOVE || cmd.op == AP_OP_FIND
+                || cmd.op == AP_OP_INC || cmd.op == AP_OP_DEC
+                || cmd.op == AP_OP_SORTAP || cmd.op == AP_OP_SORTETH
+                || cmd.op == AP_OP_TOPQ || cmd.op == AP_OP_PARTQ
+                || cmd.op == AP_OP_RANK || cmd.op == AP_OP_TOPK
+                || cmd.op == AP_OP_FINDIP || cmd.op == AP_OP_FINDLOC
+                || cmd.op == AP_OP_VIEWQ) {
+            out_char(' ');
+            out_int(cmd.id);
+        }
+        out_char('\n');
+        if (cmd.rec != NULL) {
+            put_record_lines(cmd.rec);
+            free(cmd.rec);
+        }
+    }
+    if (got < 0) {
+        fprintf(stderr, "bad binary command frame\n");
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    in_src_t input;
+    const char *path = NULL;
+    int to_binary = -1;
+    int opt, rc;
+
+    while ((opt = getopt(argc, argv, "btf:")) != -1) {
+        if (opt == 'b') {
+            to_binary = 1;
+        } else if (opt == 't') {
+            to_binary = 0;
+        } else if (opt == 'f') {
+            path = optarg;
+        } else {
+            to_binary = -1;
+            break;
+        }
+    }
+    if (to_binary < 0 || optind != argc) {
+        fprintf(stderr, "Usage: %s -b|-t [-f trace]\n", argv[0]);
+        exit(1);
+    }
+
+    if (path == NULL) {
+        in_open_stdin(&input);
+    } else if (in_open_trace(&input, path) != 0) {
+        perror(path);
+        exit(1);
+    }
+    out_init(0);
+    rc = to_binary ? text_to_binary(&input) : binary_to_text(&input);
+    out_flush();
+    in_close(&input);
+    exit(rc);
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
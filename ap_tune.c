@@ -0,0 +1,216 @@
+// ap_tune.c
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <time.h>
+#include "twl_list.h"
+#include "ap_command.h"
+#include "ap_support.h"
+#include "ap_output.h"
+#include "ap_tune.h"
+
+#define TRUE  1
+#define FALSE 0
+
+#define TUNE_MIN_NS 20000000LL      // time each case for at least 20 ms
+#define TUNE_MAX_RUNS 1000
+
+static const char *class_names[TWL_SORT_CLASSES] = { "random", "nearly", "reversed" };
+
+static unsigned int tune_rng;
+
+static int next_int(int n)
+{
+    tune_rng = tune_rng * 1103515245u + 12345u;
+    return (int) ((tune_rng >> 8) % (unsigned int) n);
+}
+
+/* A list of n records of the class, not marked sorted */
+static twl_list_t *make_list(int n, int sort_class)
+{
+    ap_info_t *rec = (ap_info_t *) calloc((size_t) n, sizeof(ap_info_t));
+    twl_list_t *list = twl_list_construct(NULL);
+
+    assert(rec != NULL);
+    for (int i = 0; i < n; i++) {
+        rec[i].eth_address = i;
+        rec[i].mobile_count = next_int(4 * n);
+    }
+    if (sort_class != 0) {
+        /* in rank order, or its reverse, with 1/32 of the neighbours
+         * swapped; each swap breaks at most two pairs
+         */
+        for (int i = 0; i < n; i++)
+            rec[i].mobile_count = sort_class == 1 ? n - i : i;
+        for (int k = 0; k < n / 32; k++) {
+            int i = next_int(n - 1);
+            int mc = rec[i].mobile_count;
+            rec[i].mobile_count = rec[i + 1].mobile_count;
+            rec[i + 1].mobile_count = mc;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        ap_info_t *copy = (ap_info_t *) malloc(sizeof(ap_info_t));
+        assert(copy != NULL);
+        *copy = rec[i];
+        twl_list_append(list, copy);
+    }
+    free(rec);
+    return list;
+}
+
+static long long elapsed_ns(const struct timespec *a, const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) * 1000000000LL + (b->tv_nsec - a->tv_nsec);
+}
+
+/* Average nanoseconds of one sort of an n record list of the class */
+static double time_sort(int n, int sort_class, int sort_type)
+{
+    long long total = 0;
+    int runs = 0;
+
+    tune_rng = 12345u + (unsigned int) (n * 7 + sort_class);
+    while (runs < TUNE_MAX_RUNS && (runs == 0 || total < TUNE_MIN_NS)) {
+        twl_list_t *list = make_list(n, sort_class);
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        twl_list_sort(list, sort_type, ap_rank_aps);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        total += elapsed_ns(&start, &end);
+        runs++;
+        ap_cleanup(list);
+    }
+    return (double) total / runs;
+}
+
+/* Measures the sorts on this machine and fills in tuning.  The bucket
+ * sizes are those of the tuning in use.  Takes a few seconds.
+ */
+void ap_tune_calibrate(twl_sort_tuning_t *tuning)
+{
+    twl_list_get_sort_tuning(tuning);
+    for (int c = 0; c < TWL_SORT_CLASSES; c++) {
+        for (int b = 0; b < TWL_SORT_BUCKETS - 1; b++) {
+            double best = 0.0;
+            for (int t = 1; t <= 4; t++) {
+                double ns = time_sort(tuning->size[b], c, t);
+                if (t == 1 || ns < best) {
+                    best = ns;
+                    tuning->type[c][b] = t;
+                }
+            }
+        }
+        tuning->type[c][TWL_SORT_BUCKETS - 1] = tuning->type[c][TWL_SORT_BUCKETS - 2];
+    }
+}
+
+/* Reads a tuning file and installs it.  Returns 0, or -1 with why set
+ * and the tuning unchanged.
+ */
+int ap_tune_load(const char *path, const char **why)
+{
+    twl_sort_tuning_t tuning;
+    char line[MAXLINE], size[16];
+    int rows = 0;
+    FILE *fp = fopen(path, "r");
+
+    if (fp == NULL) {
+        *why = strerror(errno);
+        return -1;
+    }
+    twl_list_get_sort_tuning(&tuning);
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        int type[TWL_SORT_CLASSES];
+        char extra[2];
+        if (line[0] == '#' || strspn(line, " \t\r\n") == strlen(line))
+            continue;
+        if (rows == TWL_SORT_BUCKETS
+                || sscanf(line, "%15s %d %d %d %1s", size, &type[0], &type[1], &type[2],
+                    extra) != 4) {
+            *why = "not a tuning file";
+            fclose(fp);
+            return -1;
+        }
+        if (rows == TWL_SORT_BUCKETS - 1) {
+            if (strcmp(size, "*") != 0) {
+                *why = "the last size must be *";
+                fclose(fp);
+                return -1;
+            }
+            tuning.size[rows] = tuning.size[rows - 1];
+        } else {
+            tuning.size[rows] = atoi(size);
+            if (tuning.size[rows] < 1 || (rows > 0 && tuning.size[rows] < tuning.size[rows - 1])) {
+                *why = "sizes must grow";
+                fclose(fp);
+                return -1;
+            }
+        }
+        for (int c = 0; c < TWL_SORT_CLASSES; c++) {
+            if (type[c] < 1 || type[c] > 4) {
+                *why = "sort types must be 1 to 4";
+                fclose(fp);
+                return -1;
+            }
+            tuning.type[c][rows] = type[c];
+        }
+        rows++;
+    }
+    fclose(fp);
+    if (rows != TWL_SORT_BUCKETS) {
+        *why = "not a tuning file";
+        return -1;
+    }
+    twl_list_set_sort_tuning(&tuning);
+    return 0;
+}
+
+/* Writes tuning to path.  Returns 0, or -1 with why set. */
+int ap_tune_save(const char *path, const twl_sort_tuning_t *tuning, const char **why)
+{
+    FILE *fp = fopen(path, "w");
+
+    if (fp == NULL) {
+        *why = strerror(errno);
+        return -1;
+    }
+    fprintf(fp, "# sort_type 0 of twl_list_sort, written by CALIBRATE\n");
+    fprintf(fp, "# size %s %s %s\n", class_names[0], class_names[1], class_names[2]);
+    for (int b = 0; b < TWL_SORT_BUCKETS; b++) {
+        if (b == TWL_SORT_BUCKETS - 1)
+            fprintf(fp, "*");
+        else
+            fprintf(fp, "%d", tuning->size[b]);
+        for (int c = 0; c < TWL_SORT_CLASSES; c++)
+            fprintf(fp, " %d", tuning->type[c][b]);
+        fprintf(fp, "\n");
+    }
+    if (fclose(fp) != 0) {
+        *why = strerror(errno);
+        return -1;
+    }
+    return 0;
+}
+
+/* Prints the choice table for CALIBRATE */
+void ap_tune_report(const twl_sort_tuning_t *tuning)
+{
+    out_printf("%-10s %8s %8s %8s\n", "records", class_names[0], class_names[1],
+            class_names[2]);
+    for (int b = 0; b < TWL_SORT_BUCKETS; b++) {
+        if (b == TWL_SORT_BUCKETS - 1)
+            out_printf("%-10s", "larger");
+        else
+            out_printf("<= %-7d", tuning->size[b]);
+        for (int c = 0; c < TWL_SORT_CLASSES; c++)
+            out_printf(" %8d", tuning->type[c][b]);
+        out_char('\n');
+    }
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
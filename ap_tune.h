@@ -0,0 +1,29 @@
+// ap_tune.h
+
+/* Calibration of sort_type 0 (see twl_sort_tuning_t in twl_list.h).
+ *
+ * CALIBRATE times every sort_type with ap_rank_aps on lists of each class
+ * (random, nearly sorted, nearly reversed) at the bound of each size
+ * bucket, on this machine, and makes the fastest one the choice for that
+ * class and bucket.  The last bucket gets the winner of the one before,
+ * since the sorts here are all quadratic and their order no longer
+ * changes.  The result is installed at once and written to the tuning
+ * file, which wifi reads at startup (--sortconf, ap_sort.conf by
+ * default).  The file is text:
+ *
+ *     # size random nearly reversed
+ *     16 3 3 1
+ *     256 3 3 3
+ *     4096 3 3 3
+ *     * 3 3 3
+ *
+ * one line per bucket, the last with size *, and # starts a comment.
+ */
+
+void ap_tune_calibrate(twl_sort_tuning_t *tuning);
+int ap_tune_load(const char *path, const char **why);
+int ap_tune_save(const char *path, const twl_sort_tuning_t *tuning, const char **why);
+void ap_tune_report(const twl_sort_tuning_t *tuning);
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
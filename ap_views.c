@@ -0,0 +1,343 @@
+// ap_views.c
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include "twl_list.h"
+#include "ap_command.h"
+#include "ap_support.h"
+#include "ap_views.h"
+
+#define TRUE  1
+#define FALSE 0
+
+#define VIEWS_MIN_BUCKETS 64
+
+/* link of entry e in view w (0 based) on level */
+#define LINK(e, level, w) ((e)->next[(level) * AP_VIEWS + (w)])
+
+static void observe(void *ctx, twl_list_t *list, ll_node_t *node, int event);
+
+/* Orders the records that are equal in a view by everything PRINTQ shows
+ * of them, in the ap_rank_aps sense
+ */
+static int tie_break(const ap_info_t *a, const ap_info_t *b)
+{
+    int d = ap_rank_aps(a, b);
+
+    if (d == 0)
+        d = (a->ip_address < b->ip_address) - (a->ip_address > b->ip_address);
+    if (d == 0)
+        d = (a->location_code < b->location_code) - (a->location_code > b->location_code);
+    if (d == 0)
+        d = (a->authenticated < b->authenticated) - (a->authenticated > b->authenticated);
+    if (d == 0)
+        d = (a->privacy < b->privacy) - (a->privacy > b->privacy);
+    if (d == 0)
+        d = (a->standard_letter < b->standard_letter)
+            - (a->standard_letter > b->standard_letter);
+    if (d == 0)
+        d = (a->band < b->band) - (a->band > b->band);
+    if (d == 0)
+        d = (a->channel < b->channel) - (a->channel > b->channel);
+    if (d == 0)
+        d = (a->data_rate < b->data_rate) - (a->data_rate > b->data_rate);
+    if (d == 0)
+        d = (a->time_received < b->time_received) - (a->time_received > b->time_received);
+    return d;
+}
+
+/* 1 if a is closer to the front of view w (0 based) than b, -1 if b is,
+ * 0 if they show the same
+ */
+static int view_compare(int w, const ap_info_t *a, const ap_info_t *b)
+{
+    int d = 0;
+
+    if (w == AP_VIEW_ETH - 1)
+        d = ap_compare_eth(a, b);
+    else if (w == AP_VIEW_RATE - 1)
+        d = (a->data_rate > b->data_rate) - (a->data_rate < b->data_rate);
+    return d != 0 ? d : tie_break(a, b);
+}
+
+static ap_views_entry_t *new_entry(ap_info_t *rec, int height)
+{
+    ap_views_entry_t *e = (ap_views_entry_t *) malloc(sizeof(ap_views_entry_t)
+            + (size_t) (height * AP_VIEWS) * sizeof(ap_views_entry_t *));
+
+    assert(e != NULL);
+    e->rec = rec;
+    e->hash_next = NULL;
+    e->height = height;
+    for (int i = 0; i < height * AP_VIEWS; i++)
+        e->next[i] = NULL;
+    return e;
+}
+
+void ap_views_init(ap_views_t *v)
+{
+    v->head = new_entry(NULL, AP_VIEWS_LEVELS);
+    v->levels = 1;
+    v->count = 0;
+    v->bucket_count = VIEWS_MIN_BUCKETS;
+    v->buckets = (ap_views_entry_t **) calloc((size_t) v->bucket_count,
+            sizeof(ap_views_entry_t *));
+    assert(v->buckets != NULL);
+    v->rng = 2463534242u;
+    v->list = NULL;
+}
+
+/* Forgets every record */
+static void clear(ap_views_t *v)
+{
+    ap_views_entry_t *e = LINK(v->head, 0, 0);
+
+    while (e != NULL) {
+        ap_views_entry_t *next = LINK(e, 0, 0);
+        free(e);
+        e = next;
+    }
+    for (int i = 0; i < AP_VIEWS_LEVELS * AP_VIEWS; i++)
+        v->head->next[i] = NULL;
+    v->levels = 1;
+    v->count = 0;
+    memset(v->buckets, 0, (size_t) v->bucket_count * sizeof(ap_views_entry_t *));
+}
+
+/* Stops watching the list, which stays as it is */
+void ap_views_free(ap_views_t *v)
+{
+    if (v->list != NULL)
+        twl_list_unobserve(v->list, observe, v);
+    clear(v);
+    free(v->head);
+    free(v->buckets);
+}
+
+static unsigned int hash_rec(const ap_views_t *v, const ap_info_t *rec)
+{
+    return ((uint32_t) ((uintptr_t) rec >> 4) * 2654435761u)
+        & (unsigned int) (v->bucket_count - 1);
+}
+
+static ap_views_entry_t **hash_slot(ap_views_t *v, const ap_info_t *rec)
+{
+    ap_views_entry_t **slot = &v->buckets[hash_rec(v, rec)];
+
+    while (*slot != NULL && (*slot)->rec != rec)
+        slot = &(*slot)->hash_next;
+    return slot;
+}
+
+/* Doubles the buckets once there is more than one entry per bucket */
+static void hash_grow(ap_views_t *v)
+{
+    ap_views_entry_t **old = v->buckets;
+    int old_count = v->bucket_count;
+
+    v->bucket_count *= 2;
+    v->buckets = (ap_views_entry_t **) calloc((size_t) v->bucket_count,
+            sizeof(ap_views_entry_t *));
+    assert(v->buckets != NULL);
+    for (int b = 0; b < old_count; b++) {
+        ap_views_entry_t *e = old[b];
+        while (e != NULL) {
+            ap_views_entry_t *next = e->hash_next;
+            unsigned int h = hash_rec(v, e->rec);
+            e->hash_next = v->buckets[h];
+            v->buckets[h] = e;
+            e = next;
+        }
+    }
+    free(old);
+}
+
+/* 1 + the number of heads in a row of a coin that lands heads 1/4 of the
+ * time
+ */
+static int random_height(ap_views_t *v)
+{
+    int height = 1;
+
+    for (;;) {
+        v->rng ^= v->rng << 13;
+        v->rng ^= v->rng >> 17;
+        v->rng ^= v->rng << 5;
+        if ((v->rng & 3) != 0 || height == AP_VIEWS_LEVELS)
+            return height;
+        height++;
+    }
+}
+
+static void add_rec(ap_views_t *v, ap_info_t *rec)
+{
+    ap_views_entry_t **slot = hash_slot(v, rec);
+    ap_views_entry_t *e;
+
+    assert(*slot == NULL);
+    e = new_entry(rec, random_height(v));
+    *slot = e;
+    if (e->height > v->levels)
+        v->levels = e->height;
+
+    /* ahead of the records that show the same, which makes no difference */
+    for (int w = 0; w < AP_VIEWS; w++) {
+        ap_views_entry_t *x = v->head;
+        for (int level = v->levels - 1; level >= 0; level--) {
+            while (LINK(x, level, w) != NULL
+                    && view_compare(w, LINK(x, level, w)->rec, rec) > 0)
+                x = LINK(x, level, w);
+            if (level < e->height) {
+                LINK(e, level, w) = LINK(x, level, w);
+                LINK(x, level, w) = e;
+            }
+        }
+    }
+    if (++v->count > v->bucket_count)
+        hash_grow(v);
+}
+
+static void drop_rec(ap_views_t *v, const ap_info_t *rec)
+{
+    ap_views_entry_t **slot = hash_slot(v, rec);
+    ap_views_entry_t *e = *slot;
+
+    assert(e != NULL);
+    *slot = e->hash_next;
+    for (int w = 0; w < AP_VIEWS; w++) {
+        ap_views_entry_t *x = v->head;
+        for (int level = v->levels - 1; level >= 0; level--) {
+            /* above e stop ahead of the records that show the same, since
+             * e may be any of them; on e's levels walk on to it
+             */
+            if (level >= e->height) {
+                while (LINK(x, level, w) != NULL
+                        && view_compare(w, LINK(x, level, w)->rec, rec) > 0)
+                    x = LINK(x, level, w);
+            } else {
+                while (LINK(x, level, w) != e)
+                    x = LINK(x, level, w);
+                LINK(x, level, w) = LINK(e, level, w);
+            }
+        }
+    }
+    while (v->levels > 1 && LINK(v->head, v->levels - 1, 0) == NULL)
+        v->levels--;
+    free(e);
+    v->count--;
+}
+
+static void observe(void *ctx, twl_list_t *list, ll_node_t *node, int event)
+{
+    ap_views_t *v = (ap_views_t *) ctx;
+
+    (void) list;
+    switch (event) {
+    case TWL_LIST_LINKED:
+        add_rec(v, (ap_info_t *) twl_list_node_data(node));
+        break;
+    case TWL_LIST_UNLINKED:
+        drop_rec(v, (ap_info_t *) twl_list_node_data(node));
+        break;
+    case TWL_LIST_DESTROYED:
+        clear(v);
+        v->list = NULL;
+        break;
+    default:
+        /* a sort only moves the records between nodes */
+        break;
+    }
+}
+
+/* Indexes the records of list and follows its changes from now on, until
+ * it is destructed.  One list at a time.
+ */
+void ap_views_watch(ap_views_t *v, twl_list_t *list)
+{
+    assert(v->list == NULL);
+    v->list = list;
+    twl_list_observe(list, observe, v);
+    for (ll_node_t *node = twl_list_front_node(list); node != NULL;
+            node = twl_list_next_node(node))
+        add_rec(v, (ap_info_t *) twl_list_node_data(node));
+}
+
+static void copy_rec(ap_result_t *res, const ap_info_t *from)
+{
+    ap_info_t *rec = (ap_info_t *) malloc(sizeof(ap_info_t));
+
+    assert(rec != NULL);
+    *rec = *from;
+    twl_list_append(res->list, rec);
+}
+
+/* Starts the result of VIEWQ.  Returns FALSE for an unknown view. */
+static int start(int view, ap_result_t *res)
+{
+    res->op = AP_OP_VIEWQ;
+    res->aux = view;
+    res->value = 0;
+    res->list = twl_list_construct(NULL);
+    res->owns_list = TRUE;
+    res->code = view >= AP_VIEW_RANK && view <= AP_VIEW_RATE ? 0 : -1;
+    return res->code == 0;
+}
+
+void ap_views_query(ap_views_t *v, int view, ap_result_t *res)
+{
+    if (!start(view, res))
+        return;
+    for (ap_views_entry_t *e = LINK(v->head, 0, view - 1); e != NULL;
+            e = LINK(e, 0, view - 1))
+        copy_rec(res, e->rec);
+    res->value = v->count;
+}
+
+/* qsort orders of record pointers, front first */
+static int by_rank(const void *a, const void *b)
+{
+    return -view_compare(AP_VIEW_RANK - 1, *(ap_info_t * const *) a,
+            *(ap_info_t * const *) b);
+}
+
+static int by_eth(const void *a, const void *b)
+{
+    return -view_compare(AP_VIEW_ETH - 1, *(ap_info_t * const *) a,
+            *(ap_info_t * const *) b);
+}
+
+static int by_rate(const void *a, const void *b)
+{
+    return -view_compare(AP_VIEW_RATE - 1, *(ap_info_t * const *) a,
+            *(ap_info_t * const *) b);
+}
+
+/* The same answer as ap_views_query, by sorting pointers to the records */
+void ap_views_scan(twl_list_t *queue, int view, ap_result_t *res)
+{
+    static int (*const orders[AP_VIEWS])(const void *, const void *) = {
+        by_rank, by_eth, by_rate
+    };
+    int count = twl_list_size(queue);
+    ap_info_t **recs;
+    int i = 0;
+
+    if (!start(view, res))
+        return;
+    recs = (ap_info_t **) malloc((size_t) (count + 1) * sizeof(ap_info_t *));
+    assert(recs != NULL);
+    for (ll_node_t *node = twl_list_front_node(queue); node != NULL;
+            node = twl_list_next_node(node))
+        recs[i++] = (ap_info_t *) twl_list_node_data(node);
+    qsort(recs, (size_t) count, sizeof(ap_info_t *), orders[view - 1]);
+    for (i = 0; i < count; i++)
+        copy_rec(res, recs[i]);
+    free(recs);
+    res->value = count;
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -0,0 +1,72 @@
+// ap_views.h
+
+/* Several orders of the queue at once, for VIEWQ view.
+ *
+ * SORTAP and SORTETH put the queue in one order at a time, and going back
+ * and forth between them sorts it again every time.  With --views wifi
+ * keeps every queue record in three sorted orders at once:
+ *
+ *     AP_VIEW_RANK     1   ap_rank_aps, as SORTAP
+ *     AP_VIEW_ETH      2   ap_compare_eth, as SORTETH
+ *     AP_VIEW_RATE     3   highest data_rate first, then ap_rank_aps
+ *
+ * The orders are skip lists that share their entries: each record has a
+ * single entry, allocated once, that holds its links in all the views,
+ * and the records themselves are the queue's, not copies.  Adding or
+ * removing a record costs O(log n) per view, and VIEWQ walks a view from
+ * the front with no sorting at all.
+ *
+ * Records that are equal in a view are ordered by the rest of their
+ * fields, so every view is a total order of what PRINTQ shows and the
+ * answer does not depend on the order the records came in.
+ *
+ * The index watches the queue as an observer (see twl_list_observer_t),
+ * like ap_lookup.h, and finds a record's entry through a hash of the
+ * record pointer.  The sorts move the record pointers between nodes, so
+ * they leave the views as they are.  A record must not change while it
+ * is indexed.
+ *
+ * Without --views the same query copies the queue and sorts the copy; the
+ * answer is the same either way.
+ */
+
+#define AP_VIEWS 3                  // rank, eth, rate
+#define AP_VIEWS_LEVELS 24          // enough for 4^24 records
+
+enum ap_view {
+    AP_VIEW_RANK = 1,
+    AP_VIEW_ETH = 2,
+    AP_VIEW_RATE = 3
+};
+
+typedef struct ap_views_entry_tag {
+    ap_info_t *rec;                 // the queue's record
+    struct ap_views_entry_tag *hash_next;
+    int height;
+    struct ap_views_entry_tag *next[];  // height * AP_VIEWS links, the
+                                        // views of level 0 first
+} ap_views_entry_t;
+
+typedef struct ap_views_tag {
+    ap_views_entry_t *head;         // AP_VIEWS_LEVELS levels, no record
+    int levels;                     // levels in use
+    int count;
+    ap_views_entry_t **buckets;     // record hash, chained by hash_next
+    int bucket_count;               // power of two
+    unsigned int rng;               // picks entry heights
+    twl_list_t *list;               // the watched list, NULL once destructed
+} ap_views_t;
+
+void ap_views_init(ap_views_t *v);
+void ap_views_free(ap_views_t *v);
+void ap_views_watch(ap_views_t *v, twl_list_t *list);
+
+/* VIEWQ view: copies of the queue records in res->list, in the order of
+ * view.  res->code is -1 for an unknown view, else 0; res->value is the
+ * records and res->aux the view.
+ */
+void ap_views_query(ap_views_t *v, int view, ap_result_t *res);
+void ap_views_scan(twl_list_t *queue, int view, ap_result_t *res);
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
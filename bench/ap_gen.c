@@ -0,0 +1,75 @@
+// ap_gen.c
+
+/* Writes a seeded wifi command trace on stdout (see ap_workload.h).
+ *
+ *     ap_gen [-s seed] [-n commands] [-i ids] [-z skew] [-m mix]
+ *
+ * The defaults are seed 1, 100000 commands, 10000 ids, skew 1.0 and the
+ * mix AP_WORKLOAD_MIX.  The trace ends with STATS and QUIT, so
+ *
+ *     bench/ap_gen -n 1000000 > big.txt
+ *     ./wifi -q -f big.txt 1000
+ *
+ * replays it.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "twl_list.h"
+#include "ap_command.h"
+#include "ap_support.h"
+#include "ap_workload.h"
+
+#define TRUE  1
+#define FALSE 0
+
+int main(int argc, char *argv[])
+{
+    ap_workload_t w;
+    char line[MAXLINE];
+    uint64_t seed = 1;
+    long commands = 100000;
+    int ids = 10000;
+    double skew = 1.0;
+    const char *mix = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:n:i:z:m:")) != -1) {
+        if (opt == 's') {
+            seed = strtoull(optarg, NULL, 10);
+        } else if (opt == 'n') {
+            commands = atol(optarg);
+        } else if (opt == 'i') {
+            ids = atoi(optarg);
+        } else if (opt == 'z') {
+            skew = atof(optarg);
+        } else if (opt == 'm') {
+            mix = optarg;
+        } else {
+            exit(1);
+        }
+    }
+    if (optind != argc || commands < 0 || ids < 1 || skew < 0.0) {
+        fprintf(stderr, "usage: ap_gen [-s seed] [-n commands] [-i ids] [-z skew] [-m mix]\n");
+        exit(1);
+    }
+
+    ap_workload_init(&w, seed, ids, skew);
+    if (mix != NULL && ap_workload_mix(&w, mix) != 0) {
+        fprintf(stderr, "bad mix %s\n", mix);
+        exit(1);
+    }
+    for (long i = 0; i < commands; i++) {
+        size_t len = ap_workload_line(&w, line, sizeof(line));
+        line[len] = '\n';
+        fwrite(line, 1, len + 1, stdout);
+    }
+    printf("STATS\nQUIT\n");
+    ap_workload_free(&w);
+    return 0;
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
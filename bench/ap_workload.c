@@ -0,0 +1,190 @@
+// ap_workload.c
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <assert.h>
+#include "twl_list.h"
+#include "ap_command.h"
+#include "ap_workload.h"
+
+#define TRUE  1
+#define FALSE 0
+
+static uint64_t next_u64(ap_workload_t *w)
+{
+    w->rng ^= w->rng >> 12;
+    w->rng ^= w->rng << 25;
+    w->rng ^= w->rng >> 27;
+    return w->rng * 0x2545F4914F6CDD1DULL;
+}
+
+/* uniform in 0 .. n - 1 */
+static int next_int(ap_workload_t *w, int n)
+{
+    return (int) (next_u64(w) % (uint64_t) n);
+}
+
+/* uniform in [0, 1) */
+static double next_double(ap_workload_t *w)
+{
+    return (double) (next_u64(w) >> 11) / 9007199254740992.0;
+}
+
+void ap_workload_init(ap_workload_t *w, uint64_t seed, int ids, double skew)
+{
+    double sum = 0.0;
+
+    assert(ids > 0 && skew >= 0.0);
+    /* splitmix64 of the seed, so that nearby seeds give unrelated traces
+     * and seed 0 does not leave xorshift stuck at 0
+     */
+    seed += 0x9E3779B97F4A7C15ULL;
+    seed = (seed ^ (seed >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    seed = (seed ^ (seed >> 27)) * 0x94D049BB133111EBULL;
+    w->rng = (seed ^ (seed >> 31)) | 1;
+
+    w->ids = ids;
+    w->cdf = (double *) malloc((size_t) ids * sizeof(double));
+    assert(w->cdf != NULL);
+    for (int k = 1; k <= ids; k++) {
+        sum += 1.0 / pow((double) k, skew);
+        w->cdf[k - 1] = sum;
+    }
+    for (int k = 0; k < ids; k++)
+        w->cdf[k] /= sum;
+    w->time = 1700000000;
+    w->total_weight = 0;
+    if (ap_workload_mix(w, AP_WORKLOAD_MIX) != 0)
+        assert(FALSE);
+}
+
+/* Sets the weights from a mix string.  Returns -1 if it names something
+ * that is not a generated verb, or if every weight is 0.
+ */
+int ap_workload_mix(ap_workload_t *w, const char *mix)
+{
+    static const int verbs[] = {
+        AP_OP_ADD, AP_OP_INC, AP_OP_DEC, AP_OP_FIND, AP_OP_REMOVE,
+        AP_OP_JOINQ, AP_OP_APPENDQ, AP_OP_MOVEQTOL
+    };
+    int weight[AP_OP_COUNT];
+    int total = 0;
+    const char *p = mix;
+
+    memset(weight, 0, sizeof(weight));
+    while (*p != '\0') {
+        const char *eq = strchr(p, '=');
+        size_t len;
+        int op = -1;
+        char *end;
+        long n;
+
+        if (eq == NULL)
+            return -1;
+        len = (size_t) (eq - p);
+        for (size_t i = 0; i < sizeof(verbs) / sizeof(verbs[0]); i++) {
+            const char *name = ap_op_name(verbs[i]);
+            if (strlen(name) == len && strncmp(name, p, len) == 0)
+                op = verbs[i];
+        }
+        n = strtol(eq + 1, &end, 10);
+        if (op < 0 || end == eq + 1 || n < 0 || n > 1000000
+                || (*end != ',' && *end != '\0'))
+            return -1;
+        weight[op] = (int) n;
+        p = *end == ',' ? end + 1 : end;
+    }
+    for (int op = 0; op < AP_OP_COUNT; op++)
+        total += weight[op];
+    if (total == 0)
+        return -1;
+    memcpy(w->weight, weight, sizeof(weight));
+    w->total_weight = total;
+    return 0;
+}
+
+static int next_id(ap_workload_t *w)
+{
+    double u = next_double(w);
+    int lo = 0, hi = w->ids - 1;
+
+    /* the first k with cdf[k] > u */
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (w->cdf[mid] > u)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo + 1;
+}
+
+/* The inline record of ADDR and JOINQR, with fields a real AP could have.
+ * The draws are made one statement at a time, since the order in which
+ * function arguments are evaluated is unspecified.
+ */
+static int put_record(ap_workload_t *w, char *buf, size_t size, int id)
+{
+    static const char *privacy[] = { "none", "WEP", "WPA", "WPA2" };
+    static const char letters[] = "abeghns";
+    static const char *rate_24[] = { "1", "2", "5.5", "11" };
+    static const char *rate_5[] = { "6", "9", "12", "18", "24", "36", "48", "54" };
+    int ip = next_int(w, 1 << 30);
+    int loc = 1 + next_int(w, 100);
+    int auth = next_int(w, 2);
+    int priv = next_int(w, 4);
+    int letter = next_int(w, 7);
+    int five = next_int(w, 2);
+    int channel = five ? 1 + next_int(w, 24) : 1 + next_int(w, 11);
+    const char *rate = five ? rate_5[next_int(w, 8)] : rate_24[next_int(w, 4)];
+
+    return snprintf(buf, size, "%d %d %d %s %s %c %s %d %s %d", id, ip, loc,
+            auth ? "T" : "F", privacy[priv], letters[letter], five ? "5.0" : "2.4",
+            channel, rate, w->time++);
+}
+
+/* Writes the next command line, without a newline, into buf and returns
+ * its length
+ */
+size_t ap_workload_line(ap_workload_t *w, char *buf, size_t size)
+{
+    int pick = next_int(w, w->total_weight);
+    int op = 0;
+    int id, n;
+
+    while (pick >= w->weight[op]) {
+        pick -= w->weight[op];
+        op++;
+    }
+    switch (op) {
+    case AP_OP_ADD:
+    case AP_OP_JOINQ:
+        n = snprintf(buf, size, "%s ", op == AP_OP_ADD ? "ADDR" : "JOINQR");
+        n += put_record(w, buf + n, size - (size_t) n, next_id(w));
+        break;
+    case AP_OP_APPENDQ:
+        id = next_id(w);
+        n = snprintf(buf, size, "APPENDQ %d %d", id, next_int(w, 100));
+        break;
+    case AP_OP_MOVEQTOL:
+        n = snprintf(buf, size, "MOVEQTOL");
+        break;
+    default:
+        n = snprintf(buf, size, "%s %d", ap_op_name(op), next_id(w));
+        break;
+    }
+    assert(n > 0 && (size_t) n < size);
+    return (size_t) n;
+}
+
+void ap_workload_free(ap_workload_t *w)
+{
+    free(w->cdf);
+    w->cdf = NULL;
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
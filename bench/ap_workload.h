@@ -0,0 +1,36 @@
+// ap_workload.h
+
+/* Seeded generator of wifi command traces.
+ *
+ * Every line is a command of the wifi command language, one of ADD, INC,
+ * DEC, FIND, REMOVE, JOINQ, APPENDQ and MOVEQTOL, drawn with the relative
+ * weights of the mix.  ADD and JOINQ are written in their single-line
+ * forms ADDR and JOINQR, so a trace needs no prompts.  The AP ids are
+ * 1 .. ids, drawn from a Zipf distribution: id k comes up in proportion
+ * to 1 / k^skew, so skew 0 is uniform and skew 1 makes a few ids hot.
+ *
+ * The same seed and settings always give the same trace.
+ *
+ * A mix is a comma separated list of VERB=weight, for example
+ *     ADD=30,INC=30,FIND=20,REMOVE=10,MOVEQTOL=10
+ * Verbs that are not named get weight 0.
+ */
+
+#define AP_WORKLOAD_MIX "ADD=25,INC=25,DEC=10,FIND=20,REMOVE=5,JOINQ=5,APPENDQ=5,MOVEQTOL=5"
+
+typedef struct ap_workload_tag {
+    uint64_t rng;               // xorshift64* state
+    int ids;
+    double *cdf;                // cdf[k - 1]: chance of an id <= k
+    int weight[AP_OP_COUNT];    // by enum ap_op
+    int total_weight;
+    int time;                   // time_received of the next record
+} ap_workload_t;
+
+void ap_workload_init(ap_workload_t *w, uint64_t seed, int ids, double skew);
+int ap_workload_mix(ap_workload_t *w, const char *mix);
+size_t ap_workload_line(ap_workload_t *w, char *buf, size_t size);
+void ap_workload_free(ap_workload_t *w);
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -0,0 +1,176 @@
+// mpsc_bench.c
+
+/* Ingestion throughput with 1, 2, 4 and 8 producer threads.
+ *
+ * Each producer makes AP records and hands them to one consumer, which
+ * links them onto the back of a queue list the way JOINQ does.  Two ways
+ * of handing them over are timed:
+ *
+ *   mutex  the producers malloc a record and twl_list_append it to a
+ *          shared list under one pthread mutex, which is what JOINQ from
+ *          several threads would need without the queue
+ *   mpsc   the producers push on an ap_mpsc_t and the consumer pops into
+ *          its own list
+ *
+ * Build from the top of the tree with make bench/mpsc_bench and run as
+ * bench/mpsc_bench [records per producer].
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <assert.h>
+#include <pthread.h>
+#include <time.h>
+#include "twl_list.h"
+#include "ap_command.h"
+#include "ap_mpsc.h"
+
+#define TRUE  1
+#define FALSE 0
+
+#define MAX_PRODUCERS 8
+
+typedef struct bench_tag {
+    int producers;
+    long per_producer;
+    ap_mpsc_t inbox;
+    twl_list_t *list;
+    pthread_mutex_t lock;
+    _Atomic int go;
+} bench_t;
+
+typedef struct producer_tag {
+    bench_t *b;
+    int index;
+} producer_t;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fill(ap_info_t *rec, int index, long i)
+{
+    rec->eth_address = (int) (index * 100000000L + i);
+    rec->mobile_count = (int) (i % 997);
+}
+
+static void *mutex_producer(void *arg)
+{
+    producer_t *p = (producer_t *) arg;
+    bench_t *b = p->b;
+
+    while (!atomic_load(&b->go))
+        ;
+    for (long i = 0; i < b->per_producer; i++) {
+        ap_info_t *rec = (ap_info_t *) calloc(1, sizeof(ap_info_t));
+        assert(rec != NULL);
+        fill(rec, p->index, i);
+        pthread_mutex_lock(&b->lock);
+        twl_list_append(b->list, rec);
+        pthread_mutex_unlock(&b->lock);
+    }
+    return NULL;
+}
+
+static void *mpsc_producer(void *arg)
+{
+    producer_t *p = (producer_t *) arg;
+    bench_t *b = p->b;
+
+    while (!atomic_load(&b->go))
+        ;
+    for (long i = 0; i < b->per_producer; i++) {
+        ap_info_t *rec = ap_mpsc_new_rec();
+        fill(rec, p->index, i);
+        ap_mpsc_push(&b->inbox, rec, AP_OP_JOINQ);
+    }
+    return NULL;
+}
+
+/* Checks that every producer's records arrived once and in its order */
+static void check(twl_list_t *list, int producers, long per_producer)
+{
+    long next[MAX_PRODUCERS] = {0};
+    int count = twl_list_size(list);
+
+    assert(count == producers * per_producer);
+    for (int i = 0; i < count; i++) {
+        ap_info_t *rec = twl_list_access(list, i);
+        int index = rec->eth_address / 100000000;
+        assert(rec->eth_address % 100000000 == next[index]);
+        next[index]++;
+    }
+}
+
+/* Runs one case and returns records per second */
+static double run(int producers, long per_producer, int use_mpsc)
+{
+    bench_t b;
+    producer_t p[MAX_PRODUCERS];
+    pthread_t thread[MAX_PRODUCERS];
+    long total = producers * per_producer;
+    double start;
+    int op;
+
+    b.producers = producers;
+    b.per_producer = per_producer;
+    b.list = twl_list_construct(NULL);
+    ap_mpsc_init(&b.inbox);
+    pthread_mutex_init(&b.lock, NULL);
+    atomic_init(&b.go, FALSE);
+    for (int i = 0; i < producers; i++) {
+        p[i].b = &b;
+        p[i].index = i;
+        int err = pthread_create(&thread[i], NULL,
+                use_mpsc ? mpsc_producer : mutex_producer, &p[i]);
+        if (err != 0) {
+            fprintf(stderr, "Cannot start a producer: %s\n", strerror(err));
+            exit(1);
+        }
+    }
+
+    start = now_sec();
+    atomic_store(&b.go, TRUE);
+    if (use_mpsc) {
+        /* the main thread is the consumer */
+        for (long got = 0; got < total; ) {
+            ap_info_t *rec = ap_mpsc_pop(&b.inbox, &op);
+            if (rec == NULL)
+                continue;
+            twl_list_append(b.list, rec);
+            got++;
+        }
+    }
+    for (int i = 0; i < producers; i++)
+        pthread_join(thread[i], NULL);
+    double elapsed = now_sec() - start;
+
+    check(b.list, producers, per_producer);
+    assert(ap_mpsc_pop(&b.inbox, &op) == NULL);
+    twl_list_destruct(b.list);
+    pthread_mutex_destroy(&b.lock);
+    return total / elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+    long per_producer = argc > 1 ? atol(argv[1]) : 1000000;
+
+    assert(per_producer > 0 && per_producer < 100000000);
+    printf("%d records per producer\n", (int) per_producer);
+    printf("producers   mutex Mrec/s   mpsc Mrec/s\n");
+    for (int producers = 1; producers <= MAX_PRODUCERS; producers *= 2) {
+        double mutex_rate = run(producers, per_producer, FALSE);
+        double mpsc_rate = run(producers, per_producer, TRUE);
+        printf("%9d %14.2f %13.2f\n", producers, mutex_rate / 1e6, mpsc_rate / 1e6);
+    }
+    return 0;
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
@@ -0,0 +1,275 @@
+// sort_bench.c
+
+/* Compares the twl_list_sort sort_types on queues of many shapes.
+ *
+ *     sort_bench [-r repeats] [-s seed] [-c cap | -c type=cap] [size ...]
+ *
+ * For every size (10 to 10^7 by default), distribution and comparator it
+ * builds a queue and sorts it with each sort_type through ap_sort_mc
+ * (ap_rank_aps) or ap_sort_eth (ap_compare_eth), repeats times on a fresh
+ * copy of the same queue (5 by default).  It prints one CSV line per case
+ * with the median, minimum and maximum nanoseconds of the ap_sort_* call,
+ * timed here with CLOCK_MONOTONIC; the milliseconds ap_sort_* reports come
+ * from clock() and are too coarse for the small sizes.  When the list
+ * counters are compiled in (make LIST_STATS=1) it also gives the
+ * comparisons, hops and list_debug_validate calls of one run.
+ *
+ * The distributions are of the sort key, the mobile count for ap_rank_aps
+ * and the eth address for ap_compare_eth:
+ *     random      keys from 0 .. 4n
+ *     sorted      random keys already in the comparator's order
+ *     reverse     random keys in the opposite order
+ *     fewunique   keys from 0 .. 7
+ *     manyties    nine in ten keys 0, the rest from 0 .. n
+ *
+ * After every run the queue must have the same size and the same records
+ * and must be in order; anything else aborts.
+ *
+ * All four sort_types are quadratic in this tree.  1 to 3 are by design,
+ * and MergeSort is too, because twl_list_insert validates the whole list on
+ * every call.  So sizes above the cap (10000 records by default) are skipped.
+ * -c n sets the cap of every sort_type and -c type=n the cap of one; -c
+ * may be repeated.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <unistd.h>
+#include <time.h>
+#include "twl_list.h"
+#include "ap_command.h"
+#include "ap_support.h"
+
+#define TRUE  1
+#define FALSE 0
+
+#define SORT_TYPES 4
+#define MAX_REPEATS 101
+
+enum { DIST_RANDOM, DIST_SORTED, DIST_REVERSE, DIST_FEWUNIQUE, DIST_MANYTIES, DIST_COUNT };
+
+static const char *dist_names[DIST_COUNT] = {
+    "random", "sorted", "reverse", "fewunique", "manyties"
+};
+
+typedef struct comparator_tag {
+    const char *name;
+    int (*fcomp)(const mydata_t *, const mydata_t *);
+    int by_eth;             // the key is the eth address, else the mobile count
+} comparator_t;
+
+static const comparator_t comparators[] = {
+    { "ap_rank_aps", ap_rank_aps, FALSE },
+    { "ap_compare_eth", ap_compare_eth, TRUE },
+};
+
+static uint64_t rng;
+
+static int next_int(int n)
+{
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return (int) ((rng * 0x2545F4914F6CDD1DULL >> 33) % (uint64_t) n);
+}
+
+/* qsort into the comparator's order, or the reverse of it */
+static int (*qsort_fcomp)(const mydata_t *, const mydata_t *);
+static int qsort_sign;
+
+static int qsort_compare(const void *a, const void *b)
+{
+    return -qsort_sign * qsort_fcomp((const ap_info_t *) a, (const ap_info_t *) b);
+}
+
+/* The records of one case, in queue order */
+static ap_info_t *make_records(int n, int dist, const comparator_t *c, uint64_t seed)
+{
+    ap_info_t *rec = (ap_info_t *) calloc((size_t) n, sizeof(ap_info_t));
+
+    assert(rec != NULL);
+    rng = (seed * 0x9E3779B97F4A7C15ULL + (uint64_t) n * 31 + (uint64_t) dist) | 1;
+    for (int i = 0; i < n; i++) {
+        int key;
+        if (dist == DIST_FEWUNIQUE)
+            key = next_int(8);
+        else if (dist == DIST_MANYTIES)
+            key = next_int(10) < 9 ? 0 : next_int(n);
+        else
+            key = next_int(4 * n);
+        if (c->by_eth) {
+            rec[i].eth_address = key;
+            rec[i].mobile_count = next_int(100);
+        } else {
+            rec[i].eth_address = i;
+            rec[i].mobile_count = key;
+        }
+        rec[i].location_code = i;   // tells the records apart
+    }
+    if (dist == DIST_SORTED || dist == DIST_REVERSE) {
+        qsort_fcomp = c->fcomp;
+        qsort_sign = dist == DIST_SORTED ? 1 : -1;
+        qsort(rec, (size_t) n, sizeof(ap_info_t), qsort_compare);
+    }
+    return rec;
+}
+
+static twl_list_t *make_queue(const ap_info_t *rec, int n)
+{
+    twl_list_t *queue = twl_list_construct(NULL);
+
+    for (int i = 0; i < n; i++) {
+        ap_info_t *copy = (ap_info_t *) malloc(sizeof(ap_info_t));
+        assert(copy != NULL);
+        *copy = rec[i];
+        twl_list_append(queue, copy);
+    }
+    return queue;
+}
+
+/* Asserts the queue holds each of the n records once, in order */
+static void verify(twl_list_t *queue, int n, const comparator_t *c)
+{
+    char *seen = (char *) calloc((size_t) n, 1);
+    ap_info_t *prev = NULL;
+
+    assert(seen != NULL);
+    assert(twl_list_size(queue) == n);
+    for (int i = 0; i < n; i++) {
+        ap_info_t *rec = twl_list_access(queue, i);
+        assert(rec->location_code >= 0 && rec->location_code < n);
+        assert(!seen[rec->location_code]);
+        seen[rec->location_code] = 1;
+        if (prev != NULL)
+            assert(c->fcomp(prev, rec) != -1);
+        prev = rec;
+    }
+    free(seen);
+}
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_ll(const void *a, const void *b)
+{
+    long long x = *(const long long *) a, y = *(const long long *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void run_case(int n, int dist, const comparator_t *c, int sort_type,
+        int repeats, const ap_info_t *rec)
+{
+    long long ns[MAX_REPEATS];
+    twl_list_stats_t stats;
+
+    for (int r = 0; r < repeats; r++) {
+        twl_list_t *queue = make_queue(rec, n);
+        twl_list_stats_t before;
+        ap_result_t res;
+        long long start;
+
+        twl_list_get_stats(queue, &before);
+        start = now_ns();
+        if (c->by_eth)
+            ap_sort_eth(queue, sort_type, &res);
+        else
+            ap_sort_mc(queue, sort_type, &res);
+        ns[r] = now_ns() - start;
+        twl_list_get_stats(queue, &stats);
+        stats.compares -= before.compares;
+        stats.hops -= before.hops;
+        stats.validates -= before.validates;
+        verify(queue, n, c);
+        ap_cleanup(queue);
+    }
+    qsort(ns, (size_t) repeats, sizeof(long long), compare_ll);
+
+    printf("%d,%s,%s,%d,%d,%lld,%lld,%lld", sort_type, c->name, dist_names[dist],
+            n, repeats, ns[repeats / 2], ns[0], ns[repeats - 1]);
+    if (twl_list_stats_enabled())
+        printf(",%ld,%ld,%ld\n", stats.compares, stats.hops, stats.validates);
+    else
+        printf(",,,\n");
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    static const int default_sizes[] = { 10, 100, 1000, 10000, 100000, 1000000, 10000000 };
+    int cap[SORT_TYPES + 1] = { 0, 10000, 10000, 10000, 10000 };
+    int repeats = 5;
+    uint64_t seed = 1;
+    int size_count, opt;
+
+    while ((opt = getopt(argc, argv, "r:s:c:")) != -1) {
+        if (opt == 'r') {
+            repeats = atoi(optarg);
+        } else if (opt == 's') {
+            seed = strtoull(optarg, NULL, 10);
+        } else if (opt == 'c') {
+            const char *eq = strchr(optarg, '=');
+            if (eq == NULL) {
+                for (int t = 1; t <= SORT_TYPES; t++)
+                    cap[t] = atoi(optarg);
+            } else {
+                int t = atoi(optarg);
+                if (t < 1 || t > SORT_TYPES) {
+                    fprintf(stderr, "no sort_type %d\n", t);
+                    exit(1);
+                }
+                cap[t] = atoi(eq + 1);
+            }
+        } else {
+            exit(1);
+        }
+    }
+    if (repeats < 1 || repeats > MAX_REPEATS) {
+        fprintf(stderr, "usage: sort_bench [-r repeats] [-s seed] [-c cap | -c type=cap] "
+                "[size ...]\n(repeats 1 to %d)\n", MAX_REPEATS);
+        exit(1);
+    }
+    size_count = optind < argc ? argc - optind
+        : (int) (sizeof(default_sizes) / sizeof(default_sizes[0]));
+
+    printf("sort_type,comparator,distribution,size,repeats,median_ns,min_ns,max_ns,"
+            "compares,hops,validates\n");
+    for (int i = 0; i < size_count; i++) {
+        int n = optind < argc ? atoi(argv[optind + i]) : default_sizes[i];
+        int runs = FALSE;
+
+        if (n < 1) {
+            fprintf(stderr, "sizes must be at least 1\n");
+            exit(1);
+        }
+        for (int t = 1; t <= SORT_TYPES; t++) {
+            if (n <= cap[t])
+                runs = TRUE;
+            else
+                fprintf(stderr, "skipping sort_type %d at %d records, over its cap %d\n",
+                        t, n, cap[t]);
+        }
+        if (!runs)
+            continue;
+        for (int dist = 0; dist < DIST_COUNT; dist++) {
+            for (size_t k = 0; k < sizeof(comparators) / sizeof(comparators[0]); k++) {
+                ap_info_t *rec = make_records(n, dist, &comparators[k], seed);
+                for (int t = 1; t <= SORT_TYPES; t++) {
+                    if (n <= cap[t])
+                        run_case(n, dist, &comparators[k], t, repeats, rec);
+                }
+                free(rec);
+            }
+        }
+    }
+    return 0;
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
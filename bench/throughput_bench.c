@@ -0,0 +1,220 @@
+// throughput_bench.c
+
+/* End to end command throughput for a range of leaderboard sizes.
+ *
+ *     throughput_bench [-s seed] [-n commands] [-i ids] [-z skew] [-m mix]
+ *                      [size ...]
+ *
+ * For every leaderboard size (10, 100, 1000 and 10000 by default) a child
+ * process generates the same seeded trace (see ap_workload.h), parses it
+ * up front, and then times running it the way wifi does: each command
+ * goes to its ap_support function and ap_report formats the result into
+ * an output buffer that is written to /dev/null.  Each size runs in its
+ * own process so that the memory high-water mark, the maxrss of
+ * getrusage, belongs to that size alone.  It includes the parsed trace.
+ *
+ * The defaults are seed 1, 200000 commands, 10000 ids, skew 1.0 and the
+ * mix AP_WORKLOAD_MIX.  make bench builds and runs it.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "twl_list.h"
+#include "ap_command.h"
+#include "ap_support.h"
+#include "ap_output.h"
+#include "ap_workload.h"
+
+#define TRUE  1
+#define FALSE 0
+
+typedef struct bench_opts_tag {
+    uint64_t seed;
+    long commands;
+    int ids;
+    double skew;
+    const char *mix;
+} bench_opts_t;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The trace as parsed commands */
+static ap_cmd_t *make_trace(const bench_opts_t *o)
+{
+    ap_workload_t w;
+    char line[MAXLINE];
+    ap_cmd_t *cmds = (ap_cmd_t *) malloc((size_t) o->commands * sizeof(ap_cmd_t));
+
+    assert(cmds != NULL);
+    ap_workload_init(&w, o->seed, o->ids, o->skew);
+    if (o->mix != NULL && ap_workload_mix(&w, o->mix) != 0)
+        assert(FALSE);
+    for (long i = 0; i < o->commands; i++) {
+        size_t len = ap_workload_line(&w, line, sizeof(line));
+        ap_parse_command(line, len, &cmds[i]);
+        assert(cmds[i].op != AP_OP_NONE);
+        cmds[i].text = NULL;        // points into line
+        cmds[i].text_len = 0;
+    }
+    ap_workload_free(&w);
+    return cmds;
+}
+
+/* The part of wifi's execute the generated verbs need */
+static void execute(twl_list_t *leaderboard, twl_list_t *queue, int size,
+        ap_cmd_t *cmd, ap_result_t *res)
+{
+    memset(res, 0, sizeof(*res));
+    switch (cmd->op) {
+    case AP_OP_ADD:
+        ap_add(leaderboard, cmd->rec, size, res);
+        break;
+    case AP_OP_JOINQ:
+        ap_enqueue(queue, cmd->rec, res);
+        break;
+    case AP_OP_REMOVE:
+        ap_remove(leaderboard, cmd->id, res);
+        break;
+    case AP_OP_FIND:
+        ap_find(leaderboard, cmd->id, res);
+        break;
+    case AP_OP_INC:
+        ap_inc(leaderboard, cmd->id, res);
+        break;
+    case AP_OP_DEC:
+        ap_dec(leaderboard, cmd->id, res);
+        break;
+    case AP_OP_APPENDQ:
+        ap_appendq(queue, cmd->id, cmd->arg, 0, res);
+        break;
+    case AP_OP_MOVEQTOL:
+        ap_dequeue(queue, leaderboard, size, res);
+        break;
+    default:
+        assert(FALSE);
+    }
+    cmd->rec = NULL;
+}
+
+/* Runs in the child for one leaderboard size */
+static void run_size(const bench_opts_t *o, int size)
+{
+    ap_cmd_t *cmds = make_trace(o);
+    twl_list_t *leaderboard = ap_create_leaderboard();
+    twl_list_t *queue = twl_list_construct(NULL);
+    FILE *null = fopen("/dev/null", "w");
+    char *store = (char *) malloc(OUT_BUF_SIZE);
+    out_buf_t sink = { store, 0, OUT_BUF_SIZE, null, FALSE, 0 };
+    ap_result_t res;
+    struct rusage ru;
+    double start, elapsed;
+
+    assert(null != NULL && store != NULL);
+    out_select(&sink);
+    start = now_sec();
+    for (long i = 0; i < o->commands; i++) {
+        execute(leaderboard, queue, size, &cmds[i], &res);
+        ap_report(&res);
+    }
+    out_flush();
+    elapsed = now_sec() - start;
+    getrusage(RUSAGE_SELF, &ru);
+
+    printf("%10d %10ld %9.3f %12.0f %10ld %8d %8d\n", size, o->commands, elapsed,
+            o->commands / elapsed, ru.ru_maxrss, twl_list_size(leaderboard),
+            twl_list_size(queue));
+    ap_cleanup(leaderboard);
+    ap_cleanup(queue);
+    free(cmds);
+    fclose(null);
+    free(store);
+}
+
+int main(int argc, char *argv[])
+{
+    static const int default_sizes[] = { 10, 100, 1000, 10000 };
+    bench_opts_t o = { 1, 200000, 10000, 1.0, NULL };
+    int opt, status;
+
+    while ((opt = getopt(argc, argv, "s:n:i:z:m:")) != -1) {
+        if (opt == 's') {
+            o.seed = strtoull(optarg, NULL, 10);
+        } else if (opt == 'n') {
+            o.commands = atol(optarg);
+        } else if (opt == 'i') {
+            o.ids = atoi(optarg);
+        } else if (opt == 'z') {
+            o.skew = atof(optarg);
+        } else if (opt == 'm') {
+            o.mix = optarg;
+        } else {
+            exit(1);
+        }
+    }
+    if (o.commands < 1 || o.ids < 1 || o.skew < 0.0) {
+        fprintf(stderr, "usage: throughput_bench [-s seed] [-n commands] [-i ids] "
+                "[-z skew] [-m mix] [size ...]\n");
+        exit(1);
+    }
+    if (o.mix != NULL) {
+        ap_workload_t w;
+        ap_workload_init(&w, o.seed, 1, 0.0);
+        if (ap_workload_mix(&w, o.mix) != 0) {
+            fprintf(stderr, "bad mix %s\n", o.mix);
+            exit(1);
+        }
+        ap_workload_free(&w);
+    }
+
+    printf("seed %llu, %ld commands, %d ids, skew %g, mix %s\n",
+            (unsigned long long) o.seed, o.commands, o.ids, o.skew,
+            o.mix != NULL ? o.mix : AP_WORKLOAD_MIX);
+    printf("      size   commands   seconds      ops/sec  maxrss_kb   leader    queue\n");
+    for (int i = 0; ; i++) {
+        int size;
+        pid_t pid;
+
+        if (optind < argc) {
+            if (optind + i >= argc)
+                break;
+            size = atoi(argv[optind + i]);
+        } else {
+            if (i >= (int) (sizeof(default_sizes) / sizeof(default_sizes[0])))
+                break;
+            size = default_sizes[i];
+        }
+        if (size < 2) {
+            fprintf(stderr, "leaderboard size must be at least 2\n");
+            exit(1);
+        }
+        fflush(stdout);
+        pid = fork();
+        assert(pid >= 0);
+        if (pid == 0) {
+            run_size(&o, size);
+            fflush(stdout);
+            _exit(0);
+        }
+        if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status)
+                || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "size %d failed\n", size);
+            exit(1);
+        }
+    }
+    return 0;
+}
+
+/* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */
+/* vi:set ts=8 sts=4 sw=4 et: */
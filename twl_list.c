@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 #include "twl_list.h"   // defines public functions for two-way linked list ADT
 
 #define TRUE  1
@@ -12,6 +13,59 @@
 // prototypes for private functions used in twl_list.c only
 void list_debug_validate(twl_list_t *L);
 
+/* Operation counters, kept only with -DTWL_LIST_STATS.  STAT adds n to a
+ * counter of list L; STATS_ADD folds the counters of a temporary list into
+ * the list it was made for.
+ *
+ * The finds only read the list, and several threads may run them on one
+ * list at once (the views of ap_readers.h).  They tally in locals and add
+ * the tallies once with STAT_SHARED, an atomic add.
+ */
+#ifdef TWL_LIST_STATS
+#define STAT(L, field, n) ((L)->ll_stats.field += (n))
+#define STAT_SHARED(L, field, n) \
+    __atomic_fetch_add(&(L)->ll_stats.field, (n), __ATOMIC_RELAXED)
+#define STATS_ADD(to, from) do { \
+        (to)->ll_stats.compares += (from)->ll_stats.compares; \
+        (to)->ll_stats.hops += (from)->ll_stats.hops; \
+        (to)->ll_stats.allocs += (from)->ll_stats.allocs; \
+        (to)->ll_stats.frees += (from)->ll_stats.frees; \
+        (to)->ll_stats.validates += (from)->ll_stats.validates; \
+    } while (0)
+#else
+#define STAT(L, field, n) ((void) 0)
+#define STAT_SHARED(L, field, n) ((void) (n))
+#define STATS_ADD(to, from) ((void) 0)
+#endif
+
+/* The choices of sort_type 0 until twl_list_set_sort_tuning.  Every
+ * sort_type is quadratic here and the selection sorts do the least work
+ * per step, so they are the default; the insertion sort finds the place of
+ * each record of a reversed list at once.
+ */
+static twl_sort_tuning_t sort_tuning = {
+    { 16, 256, 4096, 4096 },
+    {
+        { 3, 3, 3, 3 },     // random
+        { 3, 3, 3, 3 },     // nearly sorted
+        { 1, 3, 3, 3 },     // nearly reversed
+    }
+};
+
+/* Counts the call, then runs the unchanged list_debug_validate */
+static void validate(twl_list_t *L)
+{
+    STAT(L, validates, 1);
+    list_debug_validate(L);
+}
+
+/* Tells the observers of L about node, see twl_list_observer_t */
+static void notify(twl_list_t *L, ll_node_t *node, int event)
+{
+    for (int i = 0; i < L->ll_observer_count; i++)
+        L->ll_observers[i].fn(L->ll_observers[i].ctx, L, node, event);
+}
+
 /* ----- below are the functions  ----- */
 
 /* Allocates a new, empty list 
@@ -35,7 +89,13 @@ twl_list_t *twl_list_construct(int (*compare_function)(const mydata_t *, const m
         L->ll_front = NULL;
         L->ll_back = NULL;
         L->ll_count = 0;
+        L->ll_rover = NULL;
+        L->ll_rover_pos = 0;
         L->ll_comp_function = compare_function;
+        L->ll_observer_count = 0;
+#ifdef TWL_LIST_STATS
+        memset(&L->ll_stats, 0, sizeof(L->ll_stats));
+#endif
         
         if (compare_function == NULL) {
             L->ll_is_sorted = FALSE;
@@ -56,6 +116,7 @@ void twl_list_destruct(twl_list_t *list_ptr)
 {
     //list_debug_validate(list_ptr);
     assert(list_ptr != NULL);
+    notify(list_ptr, NULL, TWL_LIST_DESTROYED);
 
     // Free all elements in the list and the header block
 
@@ -83,6 +144,11 @@ void twl_list_destruct(twl_list_t *list_ptr)
  * return value: pointer to the mydata_t element accessed in the list at the
  * index position.  A value NULL is returned if the pos_index does not 
  * correspond to an element in the list.
+ *
+ * The node found is remembered in ll_rover, and a later access at the same
+ * or a larger index starts walking from there.  A loop over the positions
+ * 0, 1, 2, ... is therefore linear instead of quadratic.  Every function
+ * that adds or removes a node clears the rover.
  */
 mydata_t * twl_list_access(twl_list_t *list_ptr, int pos_index)
 {
@@ -115,12 +181,19 @@ mydata_t * twl_list_access(twl_list_t *list_ptr, int pos_index)
 ll_node_t *current = list_ptr->ll_front;
 int position = 0;
 
+   if (list_ptr->ll_rover != NULL && list_ptr->ll_rover_pos <= pos_index) {
+       current = list_ptr->ll_rover;
+       position = list_ptr->ll_rover_pos;
+   }
    while (current != NULL && position < pos_index) {
        current = current->next;
        position++;
+       STAT(list_ptr, hops, 1);
    }
 // Check if the position was found and return the data pointer
 if (current != NULL) {
+    list_ptr->ll_rover = current;
+    list_ptr->ll_rover_pos = position;
     return current->data_ptr;
 } else {
     // Return NULL if the position does not correspond to an element in the list
@@ -152,14 +225,20 @@ mydata_t * twl_list_elem_find_data_ptr(twl_list_t *list_ptr, mydata_t *elem_ptr,
     //list_debug_validate(list_ptr);
 
     ll_node_t *current = list_ptr->ll_front;
+    long hops = 0;
 
     while (current != NULL) {
         if (compare_function(current->data_ptr, elem_ptr) == 0) {
+            STAT_SHARED(list_ptr, compares, hops + 1);
+            STAT_SHARED(list_ptr, hops, hops);
             return current->data_ptr;
         }
         current = current->next;
+        hops++;
     }
 
+    STAT_SHARED(list_ptr, compares, hops);
+    STAT_SHARED(list_ptr, hops, hops);
     return NULL;
 }
 /* Similar to twl_list_elem_find_data_ptr, this function finds an element in 
@@ -181,12 +260,16 @@ int twl_list_elem_find_position(twl_list_t *list_ptr, mydata_t *elem_ptr,
 
     while (current != NULL) {
         if (compare_function(current->data_ptr, elem_ptr) == 0) {
+            STAT_SHARED(list_ptr, compares, position + 1);
+            STAT_SHARED(list_ptr, hops, position);
             return position;
         }
         current = current->next;
         position++;
     }
 
+    STAT_SHARED(list_ptr, compares, position);
+    STAT_SHARED(list_ptr, hops, position);
     return -1; // Element not found
 }
 
@@ -219,6 +302,7 @@ void twl_list_insert(twl_list_t *list_ptr, mydata_t *elem_ptr, int pos_index)
 
     // Create a new node
     ll_node_t *new_node = (ll_node_t *)malloc(sizeof(ll_node_t));
+    STAT(list_ptr, allocs, 1);
     new_node->data_ptr = elem_ptr;
     new_node->prev = NULL;
     new_node->next = NULL;
@@ -245,6 +329,7 @@ void twl_list_insert(twl_list_t *list_ptr, mydata_t *elem_ptr, int pos_index)
         while (current != NULL && index < pos_index) {
             current = current->next;
             index++;
+            STAT(list_ptr, hops, 1);
         }
 
         new_node->prev = current->prev;
@@ -256,8 +341,10 @@ void twl_list_insert(twl_list_t *list_ptr, mydata_t *elem_ptr, int pos_index)
     }
 
     list_ptr->ll_count++;
+    list_ptr->ll_rover = NULL;
     list_ptr->ll_is_sorted = FALSE; // Mark the list as unsorted
-    list_debug_validate(list_ptr);
+    notify(list_ptr, new_node, TWL_LIST_LINKED);
+    validate(list_ptr);
 }
 
 /* Inserts the element into the specified sorted list at the proper position,
@@ -296,6 +383,7 @@ void twl_list_insert_sorted(twl_list_t *list_ptr, mydata_t *elem_ptr)
 
     /* Create a new node for the new element */
     ll_node_t *new_node = (ll_node_t *)malloc(sizeof(ll_node_t));
+    STAT(list_ptr, allocs, 1);
     new_node->data_ptr = elem_ptr;
     new_node->prev = NULL;
     new_node->next = NULL;
@@ -305,6 +393,8 @@ void twl_list_insert_sorted(twl_list_t *list_ptr, mydata_t *elem_ptr)
         list_ptr->ll_front = new_node;
         list_ptr->ll_back = new_node;
         list_ptr->ll_count++;
+        list_ptr->ll_rover = NULL;
+        notify(list_ptr, new_node, TWL_LIST_LINKED);
         return; // No need for further processing
     }
 
@@ -312,9 +402,13 @@ void twl_list_insert_sorted(twl_list_t *list_ptr, mydata_t *elem_ptr)
     ll_node_t *current = list_ptr->ll_front;
     ll_node_t *previous = NULL;
 
-    while (current != NULL && list_ptr->ll_comp_function(elem_ptr, current->data_ptr) < 0) {
+    while (current != NULL) {
+        STAT(list_ptr, compares, 1);
+        if (list_ptr->ll_comp_function(elem_ptr, current->data_ptr) >= 0)
+            break;
         previous = current;
         current = current->next;
+        STAT(list_ptr, hops, 1);
     }
 
     /* Insert the new element before the existing element */
@@ -340,14 +434,52 @@ void twl_list_insert_sorted(twl_list_t *list_ptr, mydata_t *elem_ptr)
 
     /* Update the list count */
     list_ptr->ll_count++;
+    list_ptr->ll_rover = NULL;
+    notify(list_ptr, new_node, TWL_LIST_LINKED);
 
     
-   list_debug_validate(list_ptr);
+   validate(list_ptr);
 }
 
 
 
 
+/* Appends the element at the back of the list in constant time.
+ *
+ * This is for rebuilding a list from a source that is already in list
+ * order, such as a snapshot.  If the list is sorted the element must not
+ * rank ahead of the current back element, so the list stays sorted; this
+ * is checked with an assert.  An unsorted list simply grows at the back.
+ *
+ * Unlike twl_list_insert this does not run list_debug_validate on every
+ * call, which would make rebuilding a list quadratic.
+ */
+void twl_list_append(twl_list_t *list_ptr, mydata_t *elem_ptr)
+{
+    assert(list_ptr != NULL && elem_ptr != NULL);
+
+    ll_node_t *new_node = (ll_node_t *)malloc(sizeof(ll_node_t));
+    assert(new_node != NULL);
+    STAT(list_ptr, allocs, 1);
+    new_node->data_ptr = elem_ptr;
+    new_node->next = NULL;
+    new_node->prev = list_ptr->ll_back;
+
+    if (list_ptr->ll_back == NULL) {
+        list_ptr->ll_front = new_node;
+    } else {
+        if (list_ptr->ll_is_sorted == TRUE) {
+            STAT(list_ptr, compares, 1);
+            assert(list_ptr->ll_comp_function(list_ptr->ll_back->data_ptr, elem_ptr) != -1);
+        }
+        list_ptr->ll_back->next = new_node;
+    }
+    list_ptr->ll_back = new_node;
+    list_ptr->ll_count++;
+    list_ptr->ll_rover = NULL;
+    notify(list_ptr, new_node, TWL_LIST_LINKED);
+}
+
 /* Removes the element from the specified list that is found at the 
  * specified list position.  A pointer to the data element is returned.
  *
@@ -383,6 +515,7 @@ mydata_t *twl_list_remove(twl_list_t *list_ptr, int pos_index)
     if (pos_index == TWL_LIST_FRONT || pos_index == 0) {
         // Remove from the front
         ll_node_t *temp = list_ptr->ll_front;
+        notify(list_ptr, temp, TWL_LIST_UNLINKED);
         removed_data = temp->data_ptr;
         list_ptr->ll_front = temp->next;
         if (list_ptr->ll_front != NULL) {
@@ -392,10 +525,12 @@ mydata_t *twl_list_remove(twl_list_t *list_ptr, int pos_index)
             list_ptr->ll_back = NULL;
         }
         free(temp);
+        STAT(list_ptr, frees, 1);
         temp = NULL; // Set the freed pointer to NULL
     } else if (pos_index == TWL_LIST_BACK || pos_index == list_ptr->ll_count - 1) {
         // Remove from the back
         ll_node_t *temp = list_ptr->ll_back;
+        notify(list_ptr, temp, TWL_LIST_UNLINKED);
         removed_data = temp->data_ptr;
         list_ptr->ll_back = temp->prev;
         if (list_ptr->ll_back != NULL) {
@@ -405,6 +540,7 @@ mydata_t *twl_list_remove(twl_list_t *list_ptr, int pos_index)
             list_ptr->ll_front = NULL;
         }
         free(temp);
+        STAT(list_ptr, frees, 1);
         temp = NULL; // Set the freed pointer to NULL
     } else {
         // Remove from a specific position
@@ -414,27 +550,102 @@ mydata_t *twl_list_remove(twl_list_t *list_ptr, int pos_index)
         while (current != NULL && index < pos_index) {
             current = current->next;
             index++;
+            STAT(list_ptr, hops, 1);
         }
 
         if (current != NULL) {
+            notify(list_ptr, current, TWL_LIST_UNLINKED);
             removed_data = current->data_ptr;
             current->prev->next = current->next;
             if (current->next != NULL) {
                 current->next->prev = current->prev;
             }
             free(current);
+            STAT(list_ptr, frees, 1);
             current = NULL; // Set the freed pointer to NULL
         }
     }
 
     if (removed_data != NULL) {
         list_ptr->ll_count--;
+        list_ptr->ll_rover = NULL;
     }
 
     //list_debug_validate(list_ptr);
     return removed_data;
 }
 
+/* Registers fn to be called with ctx on the node events of the list, see
+ * twl_list_observer_t.  A list takes up to TWL_LIST_OBSERVERS of them.
+ */
+void twl_list_observe(twl_list_t *list_ptr, twl_list_observer_fn fn, void *ctx)
+{
+    assert(list_ptr != NULL && fn != NULL);
+    assert(list_ptr->ll_observer_count < TWL_LIST_OBSERVERS);
+    list_ptr->ll_observers[list_ptr->ll_observer_count].fn = fn;
+    list_ptr->ll_observers[list_ptr->ll_observer_count].ctx = ctx;
+    list_ptr->ll_observer_count++;
+}
+
+/* Stops calling fn with ctx, if it was registered */
+void twl_list_unobserve(twl_list_t *list_ptr, twl_list_observer_fn fn, void *ctx)
+{
+    assert(list_ptr != NULL);
+    for (int i = 0; i < list_ptr->ll_observer_count; i++) {
+        if (list_ptr->ll_observers[i].fn == fn && list_ptr->ll_observers[i].ctx == ctx) {
+            list_ptr->ll_observer_count--;
+            list_ptr->ll_observers[i] = list_ptr->ll_observers[list_ptr->ll_observer_count];
+            return;
+        }
+    }
+}
+
+/* Removes the node, a handle an observer kept, in constant time and
+ * returns its data pointer.  Like twl_list_remove, the data is not freed.
+ */
+mydata_t *twl_list_remove_node(twl_list_t *list_ptr, ll_node_t *node)
+{
+    mydata_t *removed_data;
+
+    assert(list_ptr != NULL && node != NULL && list_ptr->ll_count > 0);
+    notify(list_ptr, node, TWL_LIST_UNLINKED);
+    removed_data = node->data_ptr;
+    if (node->prev != NULL)
+        node->prev->next = node->next;
+    else
+        list_ptr->ll_front = node->next;
+    if (node->next != NULL)
+        node->next->prev = node->prev;
+    else
+        list_ptr->ll_back = node->prev;
+    free(node);
+    STAT(list_ptr, frees, 1);
+    list_ptr->ll_count--;
+    list_ptr->ll_rover = NULL;
+    return removed_data;
+}
+
+/* Walking the nodes, for an observer that indexes a list.  The front node
+ * is NULL for an empty list and the next node NULL after the back.
+ */
+ll_node_t *twl_list_front_node(twl_list_t *list_ptr)
+{
+    assert(list_ptr != NULL);
+    return list_ptr->ll_front;
+}
+
+ll_node_t *twl_list_next_node(ll_node_t *node)
+{
+    assert(node != NULL);
+    return node->next;
+}
+
+mydata_t *twl_list_node_data(ll_node_t *node)
+{
+    assert(node != NULL);
+    return node->data_ptr;
+}
+
 
 
 
@@ -459,6 +670,13 @@ int twl_list_size(twl_list_t *list_ptr)
 
 //sorting funtion (twl_sort)
 void twl_list_sort(twl_list_t *list_ptr, int sort_type, int (*fcomp)(const mydata_t *, const mydata_t *)){
+    twl_list_observer_t observers[TWL_LIST_OBSERVERS];
+    int observer_count;
+
+    if (sort_type == 0) {
+        twl_list_sort_auto(list_ptr, fcomp);
+        return;
+    }
     // Check if the list is empty or contains only one element (no need to sort)
     list_ptr->ll_comp_function = fcomp;
     ll_node_t *start = list_ptr->ll_front;
@@ -467,12 +685,20 @@ void twl_list_sort(twl_list_t *list_ptr, int sort_type, int (*fcomp)(const mydat
         return;
     }
 
+    /* the sorts move the data through the functions above; the observers
+     * hear about the result once, at the end
+     */
+    observer_count = list_ptr->ll_observer_count;
+    memcpy(observers, list_ptr->ll_observers, sizeof(observers));
+    list_ptr->ll_observer_count = 0;
+
     // Initialize a new sorted list
     twl_list_t *sorted_list = twl_list_construct(fcomp);
 
     // Implement different sorting algorithms based on sort_type
     if (sort_type == 1) {
         InsertionSort(list_ptr, sorted_list, fcomp);
+        STATS_ADD(sorted_list, list_ptr);
         *list_ptr = *sorted_list;
     } else if (sort_type == 2) {
         RecursiveSelectionSort(list_ptr, start, end, fcomp);
@@ -488,12 +714,273 @@ void twl_list_sort(twl_list_t *list_ptr, int sort_type, int (*fcomp)(const mydat
     // Update the original list to point to the sorted list
     free(sorted_list);// Free the temporary sorted list structure
     list_ptr->ll_is_sorted = TRUE;
-    list_debug_validate(list_ptr);
+    memcpy(list_ptr->ll_observers, observers, sizeof(observers));
+    list_ptr->ll_observer_count = observer_count;
+    notify(list_ptr, NULL, TWL_LIST_RESHAPED);
+    validate(list_ptr);
 }
 
 
 
 
+/* 1 if the list counters are compiled in */
+int twl_list_stats_enabled(void)
+{
+#ifdef TWL_LIST_STATS
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+/* Copies the counters of the list into stats; all zero without
+ * TWL_LIST_STATS
+ */
+void twl_list_get_stats(twl_list_t *list_ptr, twl_list_stats_t *stats)
+{
+    assert(list_ptr != NULL && stats != NULL);
+#ifdef TWL_LIST_STATS
+    *stats = list_ptr->ll_stats;
+#else
+    memset(stats, 0, sizeof(*stats));
+#endif
+}
+
+/* The sort_type that sort_type 0 picks for the list, or 0 if the list is
+ * already in order.  See twl_sort_tuning_t.
+ */
+static int sort_choice(twl_list_t *list_ptr, int (*fcomp)(const mydata_t *, const mydata_t *))
+{
+    int n = list_ptr->ll_count;
+    int descents = 0;
+    int sort_class, bucket;
+
+    if (n <= 1)
+        return 0;
+    if (list_ptr->ll_is_sorted == TRUE && list_ptr->ll_comp_function == fcomp)
+        return 0;
+    for (ll_node_t *N = list_ptr->ll_front; N->next != NULL; N = N->next) {
+        STAT(list_ptr, compares, 1);
+        STAT(list_ptr, hops, 1);
+        if (fcomp(N->data_ptr, N->next->data_ptr) == -1)
+            descents++;
+    }
+    if (descents == 0)
+        return 0;
+    if (descents <= (n - 1) / 8)
+        sort_class = 1;
+    else if (descents >= (n - 1) - (n - 1) / 8)
+        sort_class = 2;
+    else
+        sort_class = 0;
+    for (bucket = 0; bucket < TWL_SORT_BUCKETS - 1; bucket++) {
+        if (n <= sort_tuning.size[bucket])
+            break;
+    }
+    return sort_tuning.type[sort_class][bucket];
+}
+
+/* Sorts the list with the sort_type that suits it (sort_type 0 of
+ * twl_list_sort) and returns that sort_type, or 0 if the list was
+ * already in order and nothing was moved.
+ */
+int twl_list_sort_auto(twl_list_t *list_ptr, int (*fcomp)(const mydata_t *, const mydata_t *))
+{
+    int sort_type;
+
+    assert(list_ptr != NULL && fcomp != NULL);
+    sort_type = sort_choice(list_ptr, fcomp);
+    if (sort_type != 0) {
+        twl_list_sort(list_ptr, sort_type, fcomp);
+        return sort_type;
+    }
+    /* what twl_list_sort leaves behind */
+    list_ptr->ll_comp_function = fcomp;
+    if (list_ptr->ll_count > 1) {
+        list_ptr->ll_is_sorted = TRUE;
+        validate(list_ptr);
+    }
+    return 0;
+}
+
+void twl_list_get_sort_tuning(twl_sort_tuning_t *tuning)
+{
+    *tuning = sort_tuning;
+}
+
+/* Replaces the choices of sort_type 0.  Every type must be 1 to 4 and the
+ * bucket sizes must not decrease.
+ */
+void twl_list_set_sort_tuning(const twl_sort_tuning_t *tuning)
+{
+    for (int b = 0; b < TWL_SORT_BUCKETS; b++) {
+        assert(b == 0 || tuning->size[b] >= tuning->size[b - 1]);
+        for (int c = 0; c < TWL_SORT_CLASSES; c++)
+            assert(tuning->type[c][b] >= 1 && tuning->type[c][b] <= 4);
+    }
+    sort_tuning = *tuning;
+}
+
+/* TRUE if node a comes after node b in fcomp order */
+static int goes_after(twl_list_t *L, ll_node_t *a, ll_node_t *b,
+        int (*fcomp)(const mydata_t *, const mydata_t *))
+{
+    (void) L;
+    STAT(L, compares, 1);
+    return fcomp(a->data_ptr, b->data_ptr) == -1;
+}
+
+/* heap[0 .. k-1] is a heap with the node that comes last at the root */
+static void heap_down(twl_list_t *L, ll_node_t **heap, int k, int i,
+        int (*fcomp)(const mydata_t *, const mydata_t *))
+{
+    for (;;) {
+        int last = i, child = 2 * i + 1;
+        if (child < k && goes_after(L, heap[child], heap[last], fcomp))
+            last = child;
+        if (child + 1 < k && goes_after(L, heap[child + 1], heap[last], fcomp))
+            last = child + 1;
+        if (last == i)
+            return;
+        ll_node_t *N = heap[i];
+        heap[i] = heap[last];
+        heap[last] = N;
+        i = last;
+    }
+}
+
+static void heap_up(twl_list_t *L, ll_node_t **heap, int i,
+        int (*fcomp)(const mydata_t *, const mydata_t *))
+{
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!goes_after(L, heap[i], heap[parent], fcomp))
+            return;
+        ll_node_t *N = heap[i];
+        heap[i] = heap[parent];
+        heap[parent] = N;
+        i = parent;
+    }
+}
+
+/* Fills top with the k nodes that come first in fcomp order, in that
+ * order; k must be 1 to the list size.  A heap of the best k seen so far
+ * keeps the one that comes last at its root, so each further node costs
+ * one comparison, or O(log k) when it displaces the root: O(n log k) in
+ * all.  A list already sorted by fcomp just gives its first k nodes.
+ */
+static void select_top(twl_list_t *L, int k, int (*fcomp)(const mydata_t *, const mydata_t *),
+        ll_node_t **top)
+{
+    int count = 0;
+
+    if (L->ll_is_sorted == TRUE && L->ll_comp_function == fcomp) {
+        for (ll_node_t *N = L->ll_front; count < k; N = N->next) {
+            STAT(L, hops, 1);
+            top[count++] = N;
+        }
+        return;
+    }
+    for (ll_node_t *N = L->ll_front; N != NULL; N = N->next) {
+        STAT(L, hops, 1);
+        if (count < k) {
+            top[count] = N;
+            heap_up(L, top, count++, fcomp);
+        } else if (goes_after(L, top[0], N, fcomp)) {
+            top[0] = N;
+            heap_down(L, top, k, 0, fcomp);
+        }
+    }
+    /* take the last one off the heap into the back, k - 1 times */
+    for (int last = k - 1; last > 0; last--) {
+        ll_node_t *N = top[0];
+        top[0] = top[last];
+        top[last] = N;
+        heap_down(L, top, last, 0, fcomp);
+    }
+}
+
+/* Finds the n elements that come first in fcomp order without sorting
+ * or changing the list.  Fills top with them in that order and returns
+ * how many there are, n or the list size if that is smaller.  top must
+ * hold that many pointers.
+ */
+int twl_list_top(twl_list_t *list_ptr, int n, int (*fcomp)(const mydata_t *, const mydata_t *),
+        mydata_t **top)
+{
+    int k;
+    ll_node_t **nodes;
+
+    assert(list_ptr != NULL && fcomp != NULL && top != NULL);
+    k = n < list_ptr->ll_count ? n : list_ptr->ll_count;
+    if (k <= 0)
+        return 0;
+    nodes = (ll_node_t **) malloc((size_t) k * sizeof(ll_node_t *));
+    assert(nodes != NULL);
+    select_top(list_ptr, k, fcomp, nodes);
+    for (int i = 0; i < k; i++)
+        top[i] = nodes[i]->data_ptr;
+    free(nodes);
+    return k;
+}
+
+/* Moves the n elements that come first in fcomp order to the front of
+ * the list, in that order.  The others stay behind them in the order they
+ * were in.  Returns how many were moved, n or the list size if that is
+ * smaller.
+ *
+ * The list counts as sorted afterwards only if every element was moved
+ * or it was already sorted by fcomp.
+ */
+int twl_list_partial_sort(twl_list_t *list_ptr, int n,
+        int (*fcomp)(const mydata_t *, const mydata_t *))
+{
+    int k;
+    ll_node_t **nodes;
+
+    assert(list_ptr != NULL && fcomp != NULL);
+    k = n < list_ptr->ll_count ? n : list_ptr->ll_count;
+    if (k <= 0)
+        return 0;
+    nodes = (ll_node_t **) malloc((size_t) k * sizeof(ll_node_t *));
+    assert(nodes != NULL);
+    select_top(list_ptr, k, fcomp, nodes);
+
+    /* unlink the k nodes, then put them back at the front, last first */
+    for (int i = 0; i < k; i++) {
+        ll_node_t *N = nodes[i];
+        if (N->prev != NULL)
+            N->prev->next = N->next;
+        else
+            list_ptr->ll_front = N->next;
+        if (N->next != NULL)
+            N->next->prev = N->prev;
+        else
+            list_ptr->ll_back = N->prev;
+    }
+    for (int i = k - 1; i >= 0; i--) {
+        ll_node_t *N = nodes[i];
+        N->prev = NULL;
+        N->next = list_ptr->ll_front;
+        if (list_ptr->ll_front != NULL)
+            list_ptr->ll_front->prev = N;
+        else
+            list_ptr->ll_back = N;
+        list_ptr->ll_front = N;
+    }
+    free(nodes);
+    list_ptr->ll_rover = NULL;
+
+    if (k == list_ptr->ll_count) {
+        list_ptr->ll_comp_function = fcomp;
+        list_ptr->ll_is_sorted = TRUE;
+    } else if (list_ptr->ll_comp_function != fcomp) {
+        list_ptr->ll_is_sorted = FALSE;
+    }
+    validate(list_ptr);
+    return k;
+}
+
 // Function for marking the list as unsorted
 void twl_mark_the_list_unsorted(twl_list_t *list) {
     if (list != NULL) {
@@ -562,6 +1049,7 @@ void list_debug_validate(twl_list_t *L)
 
 // insertion sort
 void InsertionSort(twl_list_t *list_ptr, twl_list_t *sorted_list, int (*fcomp)(const mydata_t *, const mydata_t *)) {
+    (void) fcomp;
     while (twl_list_size(list_ptr) > 0) {
         mydata_t *elem = twl_list_remove(list_ptr, 0); // Remove the first element from the unsorted list
         twl_list_insert_sorted(sorted_list, elem); // Insert it into the sorted list
@@ -575,13 +1063,16 @@ ll_node_t* FindMax(twl_list_t *list_ptr, ll_node_t *start, ll_node_t *end, int (
     ll_node_t* i = start; 
     ll_node_t* j = start; 
 
+    (void) list_ptr;
+
 
     do 
     {
         i = i->next; 
+        STAT(list_ptr, hops, 1);
 
         
-        if (i != NULL && fcomp(i->data_ptr, j->data_ptr) > 0)  
+        if (i != NULL && (STAT(list_ptr, compares, 1), fcomp(i->data_ptr, j->data_ptr)) > 0)  
         {
             j = i; 
         }
@@ -602,6 +1093,7 @@ void RecursiveSelectionSort(twl_list_t* list_ptr, ll_node_t* start, ll_node_t* e
         start->data_ptr = MaxPosition->data_ptr;
         MaxPosition->data_ptr = temp;
 
+        STAT(list_ptr, hops, 1);
         RecursiveSelectionSort(list_ptr, start->next, end, fcomp);
     }
 }
@@ -624,6 +1116,7 @@ void IterativeSelectionSort(twl_list_t* list_ptr, ll_node_t* start, ll_node_t* e
 
         // Move to the next node
         current = current->next;
+        STAT(list_ptr, hops, 1);
     } 
     while (current != NULL && current != end->next);
 }
@@ -662,6 +1155,7 @@ void MergeSort(twl_list_t *list_ptr, int (*fcomp)(const mydata_t *, const mydata
         mydata_t *left_data = twl_list_access(LeftList, 0);
         mydata_t *right_data = twl_list_access(RightList, 0);
 
+        STAT(list_ptr, compares, 1);
         if (fcomp(left_data, right_data) >= 0) {
             mydata_t *data = twl_list_remove(LeftList, 0);
             twl_list_insert(list_ptr, data, twl_list_size(list_ptr));
@@ -682,7 +1176,9 @@ void MergeSort(twl_list_t *list_ptr, int (*fcomp)(const mydata_t *, const mydata
         twl_list_insert(list_ptr, data, twl_list_size(list_ptr));
     }
 
-    // Destruct the temporary lists
+    // Destruct the temporary lists, keeping what they counted
+    STATS_ADD(list_ptr, LeftList);
+    STATS_ADD(list_ptr, RightList);
     twl_list_destruct(LeftList);
     twl_list_destruct(RightList);
 }
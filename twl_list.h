@@ -5,6 +5,43 @@
 #define TWL_LIST_FRONT -2023
 #define TWL_LIST_BACK  -914
 
+/* Operation counters of one list.  They are kept only when the program is
+ * built with -DTWL_LIST_STATS; otherwise the counting compiles to nothing
+ * and twl_list_get_stats reports zeros.  Every file must then be built
+ * with the same setting, since the list header grows.
+ *
+ * The comparisons and hops of list_debug_validate are not counted, only
+ * the calls; each call walks the whole list.  A sort's temporary lists
+ * add their counts to the list being sorted.
+ */
+typedef struct twl_list_stats_tag {
+    long compares;      // comparison function calls
+    long hops;          // next/prev steps while walking the list
+    long allocs;        // nodes allocated
+    long frees;         // nodes freed
+    long validates;     // list_debug_validate calls
+} twl_list_stats_t;
+
+/* Tuning of sort_type 0, the automatic choice of twl_list_sort.
+ *
+ * The choice first walks the list once and counts the neighbours that
+ * are out of order.  With none the list is left as it is.  Otherwise the
+ * count puts the list in a class, and its size puts it in a bucket:
+ *     class  0 random, 1 nearly sorted (at most 1/8 of the pairs out of
+ *            order), 2 nearly reversed (at most 1/8 in order)
+ *     bucket the first b with size <= size[b]; the last bucket takes
+ *            every larger list
+ * type[class][bucket] is the sort_type to run.  A list that is already
+ * marked sorted by the same comparison function is not walked at all.
+ */
+#define TWL_SORT_CLASSES 3
+#define TWL_SORT_BUCKETS 4
+
+typedef struct twl_sort_tuning_tag {
+    int size[TWL_SORT_BUCKETS];
+    int type[TWL_SORT_CLASSES][TWL_SORT_BUCKETS];
+} twl_sort_tuning_t;
+
 typedef struct ll_node_tag {
     // twl_list.c private members 
     mydata_t *data_ptr;
@@ -12,15 +49,50 @@ typedef struct ll_node_tag {
     struct ll_node_tag *next;
 } ll_node_t;
 
+/* Observers of the nodes of a list.  An index can keep node handles of a
+ * list, to reach a record in O(1), as long as it hears about every node
+ * that is linked or unlinked.  fn is called with
+ *     TWL_LIST_LINKED      node was just linked into the list
+ *     TWL_LIST_UNLINKED    node is about to be unlinked and freed; its
+ *                          data stays with the caller
+ *     TWL_LIST_RESHAPED    a sort replaced or reordered the nodes, node is
+ *                          NULL; forget the list's nodes and walk it again
+ *     TWL_LIST_DESTROYED   the list is being destructed, node is NULL
+ * Moving nodes within the list, as twl_list_partial_sort does, keeps the
+ * handles valid and is not reported.
+ */
+#define TWL_LIST_OBSERVERS 4
+
+#define TWL_LIST_LINKED    1
+#define TWL_LIST_UNLINKED  2
+#define TWL_LIST_RESHAPED  3
+#define TWL_LIST_DESTROYED 4
+
+struct twl_list_tag;
+
+typedef void (*twl_list_observer_fn)(void *ctx, struct twl_list_tag *list_ptr,
+        ll_node_t *node, int event);
+
+typedef struct twl_list_observer_tag {
+    twl_list_observer_fn fn;
+    void *ctx;
+} twl_list_observer_t;
+
 typedef struct twl_list_tag {
     // twl_list.c private members
     ll_node_t *ll_front;
     ll_node_t *ll_back;
-    ll_node_t *ll_rover;
+    ll_node_t *ll_rover;        // last node found by twl_list_access
+    int ll_rover_pos;           // its position
     int ll_count;
     int ll_is_sorted;
     // twl_list.c private procedure for sorted insert 
     int (*ll_comp_function)(const mydata_t *, const mydata_t *);
+    twl_list_observer_t ll_observers[TWL_LIST_OBSERVERS];
+    int ll_observer_count;
+#ifdef TWL_LIST_STATS
+    twl_list_stats_t ll_stats;
+#endif
 } twl_list_t;
 
 /* public prototype definitions */
@@ -37,13 +109,40 @@ int twl_list_elem_find_position(twl_list_t *list_ptr, mydata_t *elem_ptr,
 
 void twl_list_insert(twl_list_t *list_ptr, mydata_t *elem_ptr, int pos_index);
 void twl_list_insert_sorted(twl_list_t *list_ptr, mydata_t *elem_ptr);
+void twl_list_append(twl_list_t *list_ptr, mydata_t *elem_ptr);
 
 mydata_t * twl_list_remove(twl_list_t *list_ptr, int pos_index);
 
+/* node handles, see twl_list_observer_t */
+void twl_list_observe(twl_list_t *list_ptr, twl_list_observer_fn fn, void *ctx);
+void twl_list_unobserve(twl_list_t *list_ptr, twl_list_observer_fn fn, void *ctx);
+mydata_t *twl_list_remove_node(twl_list_t *list_ptr, ll_node_t *node);
+ll_node_t *twl_list_front_node(twl_list_t *list_ptr);
+ll_node_t *twl_list_next_node(ll_node_t *node);
+mydata_t *twl_list_node_data(ll_node_t *node);
+
 int twl_list_size(twl_list_t *list_ptr);
 void twl_list_sort(twl_list_t *list_ptr, int sort_type, int (*fcomp)(const mydata_t *, const mydata_t *));
 void twl_mark_the_list_unsorted(twl_list_t *list_ptr);
 
+/* sort_type 0, see twl_sort_tuning_t */
+int twl_list_sort_auto(twl_list_t *list_ptr, int (*fcomp)(const mydata_t *, const mydata_t *));
+void twl_list_get_sort_tuning(twl_sort_tuning_t *tuning);
+void twl_list_set_sort_tuning(const twl_sort_tuning_t *tuning);
+
+/* the first n elements in fcomp order, in O(size log n) */
+int twl_list_top(twl_list_t *list_ptr, int n, int (*fcomp)(const mydata_t *, const mydata_t *),
+        mydata_t **top);
+int twl_list_partial_sort(twl_list_t *list_ptr, int n,
+        int (*fcomp)(const mydata_t *, const mydata_t *));
+
+/* operation counters, see twl_list_stats_t */
+int twl_list_stats_enabled(void);
+void twl_list_get_stats(twl_list_t *list_ptr, twl_list_stats_t *stats);
+
+/* asserts the list is consistent; it only reads the list */
+void list_debug_validate(twl_list_t *L);
+
 //sorting algoritms
 void InsertionSort(twl_list_t *list_ptr, twl_list_t *sorted_list, int (*fcomp)(const mydata_t *, const mydata_t *));
 void RecursiveSelectionSort(twl_list_t* list_ptr, ll_node_t* start, ll_node_t* end,  int (*fcomp)(const mydata_t *, const mydata_t *));
@@ -5,29 +5,1108 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
 #include "twl_list.h"
+#include "ap_command.h"
 #include "ap_support.h"
+#include "ap_output.h"
+#include "ap_input.h"
+#include "ap_proto.h"
+#include "ap_snapshot.h"
+#include "ap_journal.h"
+#include "ap_ring.h"
+#include "ap_order.h"
+#include "ap_shard.h"
+#include "ap_readers.h"
+#include "ap_server.h"
+#include "ap_export.h"
+#include "ap_cdc.h"
+#include "ap_metrics.h"
+#include "ap_perf.h"
+#include "ap_tune.h"
+#include "ap_expire.h"
+#include "ap_lookup.h"
+#include "ap_views.h"
+#include "ap_coalesce.h"
+
+#define TRUE  1
+#define FALSE 0
+
+typedef struct wifi_state_tag {
+    twl_list_t *leaderboard;    // sorted, size limited to lb_listsize;
+                                // NULL when sharded
+    twl_list_t *queue;          // unsorted FIFO, not limited
+    int lb_listsize;
+    ap_journal_t *journal;      // NULL without --journal
+    in_src_t *input;
+    int binary;                 // binary protocol in and out
+    int interactive;            // a person is watching the output
+    int quiet;
+    int pipelined;              // parse, execute and output on three threads
+    ap_shards_t *shards;        // the leaderboard with --shards, else NULL
+    ap_readers_t *readers;      // --readers, else NULL
+    ap_export_t *exported;      // --export, else NULL
+    ap_cdc_t *cdc;              // --cdc, else NULL
+    ap_metrics_t *metrics;      // latency per verb, owned by the executor
+    ap_perf_t *perf;            // hardware counters of the executor thread
+    int perf_sorts;             // --perf: count every sort
+    int perf_range;             // between PERFON and PERFOFF
+    int perf_commands;          // commands since PERFON
+    long long perf_start[AP_PERF_EVENTS];
+    const char *sort_conf;      // where CALIBRATE saves the tuning
+    ap_order_t *order;          // rank index of the leaderboard, NULL with
+                                // --shards
+    ap_expire_t *expire;        // expiry index of both lists, NULL until
+                                // the first EXPIRE that removes
+    int clock;                  // the latest EXPIRE now, 0 before the first
+    int expire_ttl;             // --expire, -1 without
+    int latest;                 // the largest time_received of ADD and
+                                // JOINQ, the time of the input
+    int expire_last;            // latest at the last --expire tick
+    ap_coalesce_t *coalesce;    // --coalesce, NULL without or when a
+                                // person is watching
+    ap_lookup_t *lookup;        // --lookup, NULL without or with --shards
+    ap_views_t *views;          // --views, else NULL
+} wifi_state_t;
+
+/* Slots of the pipeline rings.  Lines and paths are copied into the slot,
+ * since the input buffer they point into is reused by the next read.
+ */
+#define PIPE_SLOTS 1024
+
+typedef struct pipe_cmd_tag {
+    ap_cmd_t cmd;
+    char text[MAXLINE];
+} pipe_cmd_t;
+
+typedef struct pipe_res_tag {
+    ap_result_t res;
+    ap_shard_ticket_t ticket;
+    char text[MAXLINE];
+} pipe_res_t;
+
+typedef struct pipeline_tag {
+    wifi_state_t *st;
+    ap_ring_t commands;         // reader -> executor
+    ap_ring_t results;          // executor -> writer
+} pipeline_t;
+
+/* SAVE and LOAD.  A load builds both lists before it touches the state,
+ * so a bad snapshot leaves the current lists as they were, and journals
+ * the snapshot it read once it has succeeded.  A replayed LOAD decodes
+ * that copy instead of the file.  A save syncs the journal first, so the
+ * snapshot includes every entry up to journal->seq, and then empties it
+ * with that seq as its base.
+ */
+static void snapshot(wifi_state_t *st, ap_cmd_t *cmd, ap_result_t *res)
+{
+    char path[MAXLINE];
+    twl_list_t *leaderboard, *queue;
+    const unsigned char *image;
+    size_t size;
+    long long seq = 0;
+
+    assert(cmd->text_len < MAXLINE);
+    memcpy(path, cmd->text, cmd->text_len);
+    path[cmd->text_len] = '\0';
+    res->op = cmd->op;
+    res->text = cmd->text;
+    res->text_len = cmd->text_len;
+    if (cmd->op == AP_OP_SAVE) {
+        if (st->journal != NULL) {
+            ap_journal_commit(st->journal);
+            seq = st->journal->seq;
+        }
+        leaderboard = st->shards != NULL ? ap_shard_collect(st->shards) : st->leaderboard;
+        res->code = ap_snapshot_save(path, leaderboard, st->queue, seq, &res->note);
+        if (st->shards != NULL)
+            ap_cleanup(leaderboard);
+        if (res->code == 0 && st->journal != NULL) {
+            ap_journal_reset(st->journal);
+            /* the snapshot has no clock; a replay sets it again first */
+            if (st->clock > 0) {
+                ap_cmd_t set_clock;
+                memset(&set_clock, 0, sizeof(set_clock));
+                set_clock.op = AP_OP_EXPIRE;
+                set_clock.id = st->clock;
+                set_clock.arg = -1;
+                ap_journal_append(st->journal, &set_clock);
+            }
+        }
+    } else if (cmd->image != NULL) {
+        res->code = ap_snapshot_decode(cmd->image, cmd->image_len, st->lb_listsize,
+                &leaderboard, &queue, &seq, &res->note);
+    } else {
+        res->code = ap_snapshot_map(path, &image, &size, &res->note);
+        if (res->code == 0) {
+            res->code = ap_snapshot_decode(image, size, st->lb_listsize, &leaderboard,
+                    &queue, &seq, &res->note);
+            if (res->code == 0 && st->journal != NULL)
+                ap_journal_append_load(st->journal, cmd, image, size);
+            ap_snapshot_unmap(image, size);
+        }
+    }
+    if (cmd->op == AP_OP_LOAD && res->code == 0) {
+        if (st->shards != NULL) {
+            ap_shard_replace(st->shards, leaderboard);
+        } else {
+            ap_cleanup(st->leaderboard);
+            st->leaderboard = leaderboard;
+        }
+        ap_cleanup(st->queue);
+        st->queue = queue;
+        if (st->order != NULL)
+            ap_order_watch(st->order, st->leaderboard);
+        if (st->expire != NULL) {
+            ap_expire_watch(st->expire, st->leaderboard);
+            ap_expire_watch(st->expire, st->queue);
+        }
+        if (st->lookup != NULL) {
+            ap_lookup_watch(st->lookup, st->leaderboard);
+            ap_lookup_watch(st->lookup, st->queue);
+        }
+        if (st->views != NULL)
+            ap_views_watch(st->views, st->queue);
+    }
+    res->value = st->shards != NULL ? st->shards->total : twl_list_size(st->leaderboard);
+    res->aux = twl_list_size(st->queue);
+}
+
+/* Opens the counters on first use, on the executor thread they count.
+ * Returns FALSE if the machine has none.
+ */
+static int perf_ready(wifi_state_t *st)
+{
+    if (st->perf->state == 0 && ap_perf_open(st->perf) != 0 && st->perf_sorts)
+        fprintf(stderr, "Performance counters are not available: %s\n", st->perf->why);
+    return st->perf->state == 1;
+}
+
+/* SORTAP and SORTETH, with the counter deltas of the sort for --perf */
+static void sort_queue(wifi_state_t *st, ap_cmd_t *cmd, ap_result_t *res)
+{
+    long long before[AP_PERF_EVENTS], after[AP_PERF_EVENTS];
+    int counted = st->perf_sorts && perf_ready(st);
+
+    if (counted)
+        ap_perf_read(st->perf, before);
+    if (cmd->op == AP_OP_SORTAP)
+        ap_sort_mc(st->queue, cmd->id, res);
+    else
+        ap_sort_eth(st->queue, cmd->id, res);
+    if (counted) {
+        ap_perf_read(st->perf, after);
+        ap_perf_delta(before, after, res->perf);
+        res->counted = TRUE;
+    }
+}
+
+/* PERFON and PERFOFF */
+static void perf_range(wifi_state_t *st, ap_cmd_t *cmd, ap_result_t *res)
+{
+    long long now[AP_PERF_EVENTS];
+
+    res->op = cmd->op;
+    if (!perf_ready(st)) {
+        res->code = -1;
+        res->note = st->perf->why;
+    } else if (cmd->op == AP_OP_PERFON) {
+        st->perf_range = TRUE;
+        st->perf_commands = 0;
+        ap_perf_read(st->perf, st->perf_start);
+    } else if (!st->perf_range) {
+        res->code = -2;
+    } else {
+        ap_perf_read(st->perf, now);
+        ap_perf_delta(st->perf_start, now, res->perf);
+        res->counted = TRUE;
+        res->value = st->perf_commands;
+        st->perf_range = FALSE;
+    }
+}
+
+/* CALIBRATE: measures the sorts, uses the result from now on and saves it */
+static void calibrate(wifi_state_t *st, ap_result_t *res)
+{
+    res->op = AP_OP_CALIBRATE;
+    ap_tune_calibrate(&res->tuning);
+    twl_list_set_sort_tuning(&res->tuning);
+    res->code = ap_tune_save(st->sort_conf, &res->tuning, &res->note);
+    res->text = st->sort_conf;
+    res->text_len = strlen(st->sort_conf);
+}
+
+/* EXPIRE now ttl: removes the records of both lists with a time_received
+ * before now - ttl, and moves the clock INC and DEC refresh records to up
+ * to now.  A ttl below 0 only moves the clock.  The expiry index is built
+ * by the first EXPIRE that removes, so a run without one does not keep it.
+ */
+static void expire(wifi_state_t *st, ap_cmd_t *cmd, ap_result_t *res)
+{
+    long long cutoff = (long long) cmd->id - cmd->arg;
+    twl_list_t *list;
+    ap_info_t *rec;
+
+    res->op = AP_OP_EXPIRE;
+    if (st->shards != NULL) {
+        res->code = -1;
+        return;
+    }
+    if (cmd->id > st->clock)
+        st->clock = cmd->id;
+    if (cmd->arg < 0) {
+        res->code = 1;
+        res->value = st->clock;
+        return;
+    }
+    if (st->expire == NULL) {
+        st->expire = (ap_expire_t *) malloc(sizeof(ap_expire_t));
+        assert(st->expire != NULL);
+        ap_expire_init(st->expire);
+        ap_expire_watch(st->expire, st->leaderboard);
+        ap_expire_watch(st->expire, st->queue);
+    }
+    while ((rec = ap_expire_next(st->expire, cutoff, &list)) != NULL) {
+        if (list == st->leaderboard)
+            res->value++;
+        else
+            res->aux++;
+        free(rec);
+    }
+}
+
+/* FINDIP and FINDLOC on the merged shards */
+static void lookup_sharded(wifi_state_t *st, ap_cmd_t *cmd, ap_result_t *res)
+{
+    twl_list_t *leaderboard = ap_shard_collect(st->shards);
+
+    ap_lookup_scan(cmd->op, cmd->id, leaderboard, st->queue, res);
+    ap_cleanup(leaderboard);
+}
+
+/* The leaderboard commands when the leaderboard is sharded.  Returns
+ * FALSE for the commands that do not depend on the sharding.
+ */
+static int execute_sharded(wifi_state_t *st, ap_cmd_t *cmd, ap_result_t *res,
+        ap_shard_ticket_t *ticket)
+{
+    switch (cmd->op) {
+    case AP_OP_ADD:
+        ap_shard_add(st->shards, cmd->rec, st->lb_listsize, res);
+        cmd->rec = NULL;
+        return TRUE;
+    case AP_OP_REMOVE:
+    case AP_OP_FIND:
+    case AP_OP_INC:
+    case AP_OP_DEC:
+        ap_shard_lookup(st->shards, cmd->op, cmd->id, res, ticket);
+        return TRUE;
+    case AP_OP_PRINT:
+        ap_shard_print(st->shards, res, ticket);
+        return TRUE;
+    case AP_OP_REMOVEALL:
+        ap_shard_removeall(st->shards, res);
+        return TRUE;
+    case AP_OP_MOVEQTOL:
+        ap_shard_dequeue(st->shards, st->queue, st->lb_listsize, res);
+        return TRUE;
+    case AP_OP_STATS:
+        res->op = AP_OP_STATS;
+        res->value = st->shards->total;
+        res->aux = twl_list_size(st->queue);
+        return TRUE;
+    case AP_OP_LISTSTATS:
+        res->op = AP_OP_LISTSTATS;
+        res->value = twl_list_stats_enabled();
+        ap_shard_stats(st->shards, &res->stats[0]);
+        twl_list_get_stats(st->queue, &res->stats[1]);
+        return TRUE;
+    case AP_OP_RANK:
+        ap_shard_rank(st->shards, cmd->id, res);
+        return TRUE;
+    case AP_OP_TOPK:
+        ap_shard_topk(st->shards, cmd->id, res);
+        return TRUE;
+    case AP_OP_RANGE:
+        ap_shard_range(st->shards, cmd->id, cmd->arg, res);
+        return TRUE;
+    case AP_OP_FINDIP:
+    case AP_OP_FINDLOC:
+        lookup_sharded(st, cmd, res);
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+/* Applies one parsed command to the lists and describes the outcome in
+ * res.  Every input mode goes through here.  When the leaderboard is
+ * sharded, res may still be filled in by a shard worker after this
+ * returns; wait with ap_shard_wait on the ticket before reading it.
+ */
+static void execute(wifi_state_t *st, ap_cmd_t *cmd, ap_result_t *res,
+        ap_shard_ticket_t *ticket)
+{
+    ap_info_t *heard;
+
+    memset(res, 0, sizeof(*res));
+    res->prompted = cmd->prompted;
+    if ((cmd->op == AP_OP_ADD || cmd->op == AP_OP_JOINQ)
+            && cmd->rec->time_received > st->latest)
+        st->latest = cmd->rec->time_received;
+    if (st->shards != NULL) {
+        atomic_init(&ticket->pending, 0);
+        if (execute_sharded(st, cmd, res, ticket))
+            return;
+    }
+
+    switch (cmd->op) {
+    case AP_OP_ADD:
+        ap_add(st->leaderboard, cmd->rec, st->lb_listsize, res);
+        cmd->rec = NULL;
+        break;
+    case AP_OP_JOINQ:
+        ap_enqueue(st->queue, cmd->rec, res);
+        cmd->rec = NULL;
+        break;
+    case AP_OP_REMOVE:
+        ap_remove(st->leaderboard, cmd->id, res);
+        break;
+    case AP_OP_FIND:
+        ap_find(st->leaderboard, cmd->id, res);
+        break;
+    case AP_OP_INC:
+        ap_inc(st->leaderboard, cmd->id, res);
+        break;
+    case AP_OP_DEC:
+        ap_dec(st->leaderboard, cmd->id, res);
+        break;
+    case AP_OP_PRINT:
+        res->op = AP_OP_PRINT;
+        res->list = st->leaderboard;
+        break;
+    case AP_OP_REMOVEALL:
+        ap_removeall(st->leaderboard, res);
+        break;
+    case AP_OP_MOVEQTOL:
+        ap_dequeue(st->queue, st->leaderboard, st->lb_listsize, res);
+        break;
+    case AP_OP_SORTAP:
+    case AP_OP_SORTETH:
+        /* twl_list_sort reports a bad sort_type with printf.  In the
+         * pipeline the writer owns the output buffer, so there the message
+         * is not ordered with it.
+         */
+        if (!st->pipelined)
+            out_flush();
+        sort_queue(st, cmd, res);
+        break;
+    case AP_OP_APPENDQ:
+        /* the record has no time of its own */
+        ap_appendq(st->queue, cmd->id, cmd->arg, st->clock, res);
+        break;
+    case AP_OP_PRINTQ:
+        res->op = AP_OP_PRINTQ;
+        res->list = st->queue;
+        break;
+    case AP_OP_TOPQ:
+    case AP_OP_PARTQ:
+        ap_topq(st->queue, cmd->id, cmd->op == AP_OP_PARTQ, res);
+        break;
+    case AP_OP_RANK:
+        ap_order_rank(st->order, cmd->id, res);
+        break;
+    case AP_OP_TOPK:
+        ap_order_topk(st->order, cmd->id, res);
+        break;
+    case AP_OP_RANGE:
+        ap_order_range(st->order, cmd->id, cmd->arg, res);
+        break;
+    case AP_OP_STATS:
+        ap_stats(st->leaderboard, st->queue, res);
+        break;
+    case AP_OP_SAVE:
+    case AP_OP_LOAD:
+        snapshot(st, cmd, res);
+        break;
+    case AP_OP_METRICS:
+        /* the report may be printed on another thread */
+        res->op = AP_OP_METRICS;
+        res->metrics = (ap_metrics_t *) malloc(sizeof(ap_metrics_t));
+        assert(res->metrics != NULL);
+        *res->metrics = *st->metrics;
+        break;
+    case AP_OP_LISTSTATS:
+        ap_list_stats(st->leaderboard, st->queue, res);
+        break;
+    case AP_OP_PERFON:
+    case AP_OP_PERFOFF:
+        perf_range(st, cmd, res);
+        break;
+    case AP_OP_CALIBRATE:
+        calibrate(st, res);
+        break;
+    case AP_OP_EXPIRE:
+        expire(st, cmd, res);
+        break;
+    case AP_OP_FINDIP:
+    case AP_OP_FINDLOC:
+        if (st->lookup != NULL)
+            ap_lookup_find(st->lookup, cmd->op, cmd->id, st->leaderboard, res);
+        else
+            ap_lookup_scan(cmd->op, cmd->id, st->leaderboard, st->queue, res);
+        break;
+    case AP_OP_VIEWQ:
+        if (st->views != NULL)
+            ap_views_query(st->views, cmd->id, res);
+        else
+            ap_views_scan(st->queue, cmd->id, res);
+        break;
+    default:
+        res->op = AP_OP_NONE;
+        res->text = cmd->text;
+        res->text_len = cmd->text_len;
+        break;
+    }
+    /* INC and DEC count as hearing from the AP */
+    if ((cmd->op == AP_OP_INC || cmd->op == AP_OP_DEC) && st->shards == NULL) {
+        heard = ap_order_find(st->order, cmd->id);
+        if (heard != NULL && heard->time_received < st->clock)
+            heard->time_received = st->clock;
+    }
+}
+
+/* Commits the journal before a read that would wait for input, so the
+ * group's window does not stay open while nothing comes in.  Not for the
+ * pipeline reader, which does not own the journal.
+ */
+static void sync_if_idle(wifi_state_t *st)
+{
+    if (st->journal != NULL && st->journal->pending > 0 && !in_ready(st->input))
+        ap_journal_commit(st->journal);
+}
+
+/* Reads the next command from the input.  Returns FALSE at the end of
+ * the input.
+ */
+static int next_command(wifi_state_t *st, ap_cmd_t *cmd)
+{
+    const char *line;
+    size_t line_len;
+
+    if (st->binary) {
+        int got = ap_proto_get_cmd(st->input, cmd);
+        if (got < 0)
+            fprintf(stderr, "bad binary command frame\n");
+        return got > 0;
+    }
+
+    /* the source splits lines exactly like fgets with MAXLINE */
+    if (!in_next_line(st->input, &line, &line_len))
+        return FALSE;
+    ap_parse_command(line, line_len, cmd);
+    if ((cmd->op == AP_OP_ADD || cmd->op == AP_OP_JOINQ) && cmd->rec == NULL) {
+        /* the nine record lines follow the command.  A person has to see
+         * the prompts before typing them.
+         */
+        cmd->prompted = TRUE;
+        if (st->interactive) {
+            if (!st->quiet)
+                ap_print_prompts();
+            out_flush();
+            cmd->prompted = FALSE;
+        }
+        cmd->rec = ap_read_info(st->input, cmd->id);
+    }
+    return TRUE;
+}
+
+/* publish with --shards: one merge over the fronts of the shards fills
+ * the export and builds the copy the readers take over
+ */
+static void publish_sharded(wifi_state_t *st, int queue_size)
+{
+    twl_list_t *copy = st->readers != NULL ? ap_create_leaderboard() : NULL;
+    ap_shard_heads_t heads;
+    ap_info_t *from;
+
+    ap_shard_heads(st->shards, &heads);
+    if (st->exported != NULL)
+        ap_export_begin(st->exported);
+    while ((from = ap_shard_heads_next(&heads)) != NULL) {
+        if (st->exported != NULL)
+            ap_export_put(st->exported, from);
+        if (copy != NULL) {
+            ap_info_t *rec = (ap_info_t *) malloc(sizeof(ap_info_t));
+            assert(rec != NULL);
+            *rec = *from;
+            twl_list_append(copy, rec);
+        }
+    }
+    if (st->exported != NULL)
+        ap_export_end(st->exported, queue_size);
+    if (copy != NULL)
+        ap_readers_publish_copy(st->readers, copy, queue_size);
+}
+
+/* Hands the readers and the export the current leaderboard */
+static void publish(wifi_state_t *st)
+{
+    int queue_size = twl_list_size(st->queue);
+
+    if (st->shards != NULL) {
+        publish_sharded(st, queue_size);
+        return;
+    }
+    if (st->readers != NULL)
+        ap_readers_publish(st->readers, st->leaderboard, queue_size);
+    if (st->exported != NULL)
+        ap_export_publish(st->exported, st->leaderboard, queue_size);
+}
+
+/* Counts a command that changed the lists and publishes once the readers
+ * or the export are due
+ */
+static void changed(wifi_state_t *st)
+{
+    int due = FALSE;
+
+    if (st->readers != NULL && ap_readers_changed(st->readers))
+        due = TRUE;
+    if (st->exported != NULL && ap_export_changed(st->exported))
+        due = TRUE;
+    if (due)
+        publish(st);
+}
+
+/* Publishes the export and the query readers' view if they are behind,
+ * and writes out the change stream.  Called where the input may pause for
+ * a while.
+ */
+static void catch_up(wifi_state_t *st)
+{
+    if ((st->exported != NULL && st->exported->changes > 0)
+            || (st->readers != NULL && st->readers->query_fd >= 0 && st->readers->changes > 0))
+        publish(st);
+    if (st->cdc != NULL)
+        ap_cdc_flush(st->cdc);
+}
+
+/* Journals a command that changes the lists and then runs it.  A SORTAP
+ * or SORTETH with sort type 0 is journaled after it runs, with the sort
+ * type it chose, so a replay sorts the same way whatever the tuning is by
+ * then and orders the ties the same.  LOAD journals itself.
+ */
+static void apply(wifi_state_t *st, ap_cmd_t *cmd, ap_result_t *res,
+        ap_shard_ticket_t *ticket)
+{
+    int changes = ap_journal_mutates(cmd->op);
+    int auto_sort = (cmd->op == AP_OP_SORTAP || cmd->op == AP_OP_SORTETH) && cmd->id == 0;
+    int old_rank = -1;
+    struct timespec start, end;
+
+    if (st->journal != NULL) {
+        if (changes && cmd->op != AP_OP_LOAD && !auto_sort)
+            ap_journal_append(st->journal, cmd);
+        else
+            ap_journal_poll(st->journal);
+    }
+    if (st->cdc != NULL && changes)
+        old_rank = ap_cdc_before(st->cdc, st->leaderboard, cmd);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    execute(st, cmd, res, ticket);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ap_metrics_record(st->metrics, cmd->op, (end.tv_sec - start.tv_sec) * 1000000000LL
+            + (end.tv_nsec - start.tv_nsec));
+    /* 0 if the queue was already in order, which a replay finds again */
+    if (st->journal != NULL && auto_sort) {
+        ap_cmd_t sorted = *cmd;
+        sorted.id = res->code;
+        ap_journal_append(st->journal, &sorted);
+    }
+    if (st->cdc != NULL && changes)
+        ap_cdc_after(st->cdc, st->leaderboard, cmd, res, old_rank);
+    if (st->perf_range && cmd->op != AP_OP_PERFON)
+        st->perf_commands++;
+    if (changes)
+        changed(st);
+}
+
+/* --expire: before the first command after the time of the input moved
+ * on, an EXPIRE of the records more than the ttl older than it.  Now is
+ * the largest time_received the input gave so far, not the wall clock, so
+ * the ttl is in the units of the input and a replay expires the same.  It
+ * is journaled like any other and prints nothing.
+ */
+static void expire_tick(wifi_state_t *st)
+{
+    int now = st->latest;
+    ap_cmd_t cmd;
+    ap_result_t res;
+    ap_shard_ticket_t ticket;
+
+    if (st->expire_ttl < 0 || now <= st->expire_last)
+        return;
+    st->expire_last = now;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.op = AP_OP_EXPIRE;
+    cmd.id = now;
+    cmd.arg = st->expire_ttl;
+    apply(st, &cmd, &res, &ticket);
+}
+
+static void report(wifi_state_t *st, const ap_result_t *res)
+{
+    if (st->binary)
+        ap_proto_put_result(res);
+    else
+        ap_report(res);
+}
+
+/* Runs one command and reports it into the current output buffer */
+static void run_one(wifi_state_t *st, ap_cmd_t *cmd)
+{
+    ap_result_t res;
+    ap_shard_ticket_t ticket;
+
+    expire_tick(st);
+    apply(st, cmd, &res, &ticket);
+    if (st->shards != NULL)
+        ap_shard_wait(st->shards, &res, &ticket);
+    report(st, &res);
+    if (res.owns_list)
+        ap_cleanup(res.list);
+    free(res.metrics);
+}
+
+/* Moves the i-th AP of a coalesced batch to its final count, with the
+ * change stream event and the refresh of an INC or DEC
+ */
+static void settle(wifi_state_t *st, int i)
+{
+    ap_coalesce_ap_t *ap = &st->coalesce->aps[i];
+    ap_cmd_t move;
+    ap_result_t moved;
+    int old_rank = -1;
+
+    if (ap->rec == NULL)
+        return;
+    memset(&move, 0, sizeof(move));
+    memset(&moved, 0, sizeof(moved));
+    move.op = moved.op = AP_OP_INC;
+    move.id = moved.eth = ap->eth;
+    moved.code = moved.value = ap->count;
+    if (st->cdc != NULL && ap->rec->mobile_count != ap->count)
+        old_rank = ap_cdc_before(st->cdc, st->leaderboard, &move);
+    if (ap_coalesce_settle(st->coalesce, i, st->leaderboard) && st->cdc != NULL)
+        ap_cdc_after(st->cdc, st->leaderboard, &move, &moved, old_rank);
+    if (ap->rec->time_received < st->clock)
+        ap->rec->time_received = st->clock;
+}
+
+/* --coalesce: runs cmd, an INC or DEC, as one batch with the INC and DEC
+ * commands right after it, up to the window (see ap_coalesce.h).  Leaves
+ * the command after the batch in cmd and returns FALSE at the end of the
+ * input.
+ */
+static int run_coalesced(wifi_state_t *st, ap_cmd_t *cmd)
+{
+    ap_coalesce_t *co = st->coalesce;
+    struct timespec start, end;
+    long long ns;
+    int more;
+
+    do {
+        ap_coalesce_add(co, cmd);
+        sync_if_idle(st);
+        more = next_command(st, cmd);
+    } while (more && (cmd->op == AP_OP_INC || cmd->op == AP_OP_DEC)
+            && co->count < co->window);
+
+    expire_tick(st);
+    if (st->journal != NULL) {
+        for (int i = 0; i < co->count; i++)
+            ap_journal_append(st->journal, &co->cmds[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ap_coalesce_plan(co, st->order);
+    for (int i = 0; i < co->ap_count; i++)
+        settle(st, i);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    /* the batch's time is shared out over its commands */
+    ns = ((end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec))
+        / co->count;
+    for (int i = 0; i < co->count; i++) {
+        ap_metrics_record(st->metrics, co->cmds[i].op, ns);
+        report(st, &co->results[i]);
+        changed(st);
+    }
+    if (st->perf_range)
+        st->perf_commands += co->count;
+    ap_coalesce_reset(co);
+    return more;
+}
+
+/* One command at a time on the calling thread, or a batch of INC and DEC
+ * with --coalesce
+ */
+static void run_serial(wifi_state_t *st)
+{
+    ap_cmd_t cmd;
+    int more = next_command(st, &cmd);
+
+    while (more && cmd.op != AP_OP_QUIT) {
+        if (st->coalesce != NULL && (cmd.op == AP_OP_INC || cmd.op == AP_OP_DEC)) {
+            more = run_coalesced(st, &cmd);
+        } else {
+            run_one(st, &cmd);
+            sync_if_idle(st);
+            more = next_command(st, &cmd);
+        }
+        if (st->interactive) {
+            if (st->journal != NULL)
+                ap_journal_commit(st->journal);
+            catch_up(st);
+            out_flush();
+        }
+    }
+}
+
+/* Server callbacks.  The clients' commands run on the server thread, and
+ * a batch of them is journaled and exported before any of its replies
+ * goes out.
+ */
+static void serve_command(void *ctx, ap_cmd_t *cmd)
+{
+    run_one((wifi_state_t *) ctx, cmd);
+}
+
+static void serve_sync(void *ctx)
+{
+    wifi_state_t *st = (wifi_state_t *) ctx;
+    if (st->journal != NULL)
+        ap_journal_commit(st->journal);
+    catch_up(st);
+}
+
+/* Executor stage.  It is the only thread that touches the lists.  A QUIT
+ * command, which the reader also sends at the end of the input, is passed
+ * on to stop the writer.
+ */
+static void *pipe_executor(void *arg)
+{
+    pipeline_t *pl = (pipeline_t *) arg;
+
+    for (;;) {
+        pipe_cmd_t *in = (pipe_cmd_t *) ap_ring_try_peek(&pl->commands);
+        pipe_res_t *out;
+
+        /* the reader is waiting for input; sync before waiting on it */
+        if (in == NULL) {
+            if (pl->st->journal != NULL)
+                ap_journal_commit(pl->st->journal);
+            in = (pipe_cmd_t *) ap_ring_peek(&pl->commands);
+        }
+        out = (pipe_res_t *) ap_ring_claim(&pl->results);
+
+        if (in->cmd.op == AP_OP_QUIT) {
+            out->res.op = AP_OP_QUIT;
+            atomic_init(&out->ticket.pending, 0);
+            ap_ring_publish(&pl->results);
+            ap_ring_release(&pl->commands);
+            break;
+        }
+        expire_tick(pl->st);
+        apply(pl->st, &in->cmd, &out->res, &out->ticket);
+        /* the writer prints a copy while this thread goes on changing
+         * the list
+         */
+        if (out->res.list != NULL && !out->res.owns_list) {
+            out->res.list = ap_copy_list(out->res.list);
+            out->res.owns_list = TRUE;
+        }
+        if (out->res.text != NULL) {
+            memcpy(out->text, out->res.text, out->res.text_len);
+            out->res.text = out->text;
+        }
+        ap_ring_publish(&pl->results);
+        ap_ring_release(&pl->commands);
+    }
+    return NULL;
+}
+
+/* Writer stage.  It is the only thread that uses the output buffer. */
+static void *pipe_writer(void *arg)
+{
+    pipeline_t *pl = (pipeline_t *) arg;
+
+    for (;;) {
+        pipe_res_t *in = (pipe_res_t *) ap_ring_peek(&pl->results);
+        /* a shard worker may still be writing any field of the result */
+        if (pl->st->shards != NULL)
+            ap_shard_wait(pl->st->shards, &in->res, &in->ticket);
+        if (in->res.op == AP_OP_QUIT) {
+            ap_ring_release(&pl->results);
+            break;
+        }
+        report(pl->st, &in->res);
+        if (in->res.owns_list)
+            ap_cleanup(in->res.list);
+        free(in->res.metrics);
+        ap_ring_release(&pl->results);
+    }
+    return NULL;
+}
+
+/* Runs the commands through three stages: this thread reads and parses,
+ * the executor applies them to the lists and the writer formats the
+ * output.  Each command passes through the stages in input order, so the
+ * output is the same as run_serial's.
+ */
+static void run_pipeline(wifi_state_t *st)
+{
+    pipeline_t pl;
+    pthread_t executor, writer;
+    int more, err;
+
+    pl.st = st;
+    ap_ring_init(&pl.commands, PIPE_SLOTS, sizeof(pipe_cmd_t));
+    ap_ring_init(&pl.results, PIPE_SLOTS, sizeof(pipe_res_t));
+    if ((err = pthread_create(&executor, NULL, pipe_executor, &pl)) != 0
+            || (err = pthread_create(&writer, NULL, pipe_writer, &pl)) != 0) {
+        fprintf(stderr, "Cannot start the pipeline threads: %s\n", strerror(err));
+        exit(1);
+    }
+
+    do {
+        pipe_cmd_t *slot = (pipe_cmd_t *) ap_ring_claim(&pl.commands);
+        more = next_command(st, &slot->cmd) && slot->cmd.op != AP_OP_QUIT;
+        if (!more) {
+            slot->cmd.op = AP_OP_QUIT;
+        } else if (slot->cmd.text != NULL) {
+            memcpy(slot->text, slot->cmd.text, slot->cmd.text_len);
+            slot->cmd.text = slot->text;
+        }
+        ap_ring_publish(&pl.commands);
+    } while (more);
+
+    pthread_join(executor, NULL);
+    pthread_join(writer, NULL);
+    ap_ring_destroy(&pl.commands);
+    ap_ring_destroy(&pl.results);
+}
 
 int main(int argc, char * argv[])
 {
-    
-    twl_list_t *ap_leaderboard;
-    twl_list_t *ap_queue;
-    char line[MAXLINE];
-    char command[MAXLINE];
-    char junk[MAXLINE];
-    int num_items;
-    int ap_id;
-    int mob_cnt = 0; 
-
-    if (argc != 2) {
-        //printf("Error with input paramters.  Usage: ./lab2 leaderboard_size\n");
+
+    wifi_state_t state;
+    in_src_t input;
+    ap_cmd_t cmd;
+    ap_result_t res;
+    const char *trace_path = NULL;
+    const char *restore_path = NULL;
+    const char *journal_path = NULL;
+    const char *listen_path = NULL;
+    const char *collect_path = NULL;
+    const char *query_path = NULL;
+    const char *export_name = NULL;
+    const char *cdc_path = NULL;
+    ap_cdc_t *cdc = NULL;
+    ap_metrics_t *metrics;
+    int dump_metrics = 0;
+    int expire_ttl = -1;
+    int coalesce_window = 0;
+    int use_lookup = 0;
+    int use_views = 0;
+    int perf_sorts = 0;
+    const char *sort_conf = "ap_sort.conf";
+    ap_perf_t perf;
+    ap_export_t exported;
+    ap_journal_t journal;
+    ap_shards_t shards;
+    ap_shard_ticket_t ticket;
+    ap_readers_t readers;
+    long long snapshot_seq = 0;
+    int shard_count = 0;
+    int reader_count = 0;
+    int quiet = 0;
+    int binary = 0;
+    int pipelined = 0;
+    int opt;
+
+    /* -q: quiet mode, acknowledgements are counted but not printed
+     * -f trace: replay a trace file through a read-only mapping instead of
+     *           reading stdin.  The output is identical.
+     * -b: the input is the binary protocol of ap_proto.h and the output is
+     *     binary responses
+     * -p: pipeline parsing, list work and output on three threads.  The
+     *     output is identical.  Ignored when the output is a terminal.
+     * --restore snapshot: start from a snapshot written by SAVE
+     * --journal file: log the commands that change the lists to file and
+     *           replay the ones the snapshot does not include at startup
+     * --shards n: split the leaderboard by location into n shards, each on
+     *           its own thread (see ap_shard.h).  Implies -p.
+     * --readers n: run n reader threads against published views of the
+     *           leaderboard as a self-test (see ap_readers.h)
+     * --query path: with --readers, the readers serve FIND, PRINT and
+     *           STATS to clients on a Unix domain socket from the views
+     *           instead (see ap_readers.h)
+     * --listen path: serve clients on a Unix domain socket instead of
+     *           reading the input (see ap_server.h)
+     * --collect path: with --listen, also take collectors on a second
+     *           socket, each feeding the queue from a thread of its own
+     *           through a lock-free queue (see ap_server.h, ap_mpsc.h)
+     * --export /name: publish the leaderboard in the shared memory object
+     *           /name for other processes (see ap_export.h)
+     * --cdc file: write a stream of leaderboard rank changes to file
+     *           (see ap_cdc.h).  Not with --shards.
+     * --metrics: print the latency of each verb on stderr at the end
+     *           (see ap_metrics.h)
+     * --perf: add hardware counter deltas to the SORTAP and SORTETH
+     *           line (see ap_perf.h)
+     * --sortconf file: the tuning of sort_type 0, read at startup if it
+     *           exists and written by CALIBRATE (see ap_tune.h).
+     *           ap_sort.conf by default.
+     * --expire ttl: whenever the input's time, the largest time_received
+     *           of ADD and JOINQ so far, moves on, remove the records not
+     *           heard from in the ttl before it (see ap_expire.h).  Not
+     *           with --shards.
+     * --coalesce n: run up to n consecutive INC and DEC commands as one
+     *           batch that moves each AP once (see ap_coalesce.h).  The
+     *           output is identical.  Not with -p, --shards or --listen,
+     *           and ignored when the output is a terminal.
+     * --lookup: keep indexes of both lists by IP address and location for
+     *           FINDIP and FINDLOC (see ap_lookup.h).  The output is
+     *           identical.  Not with --shards.
+     * --views: keep the queue in every VIEWQ order at once (see
+     *           ap_views.h).  The output is identical.
+     */
+    static const struct option long_opts[] = {
+        {"restore", required_argument, NULL, 'r'},
+        {"journal", required_argument, NULL, 'j'},
+        {"shards", required_argument, NULL, 's'},
+        {"readers", required_argument, NULL, 'R'},
+        {"query", required_argument, NULL, 'Q'},
+        {"listen", required_argument, NULL, 'L'},
+        {"collect", required_argument, NULL, 'G'},
+        {"export", required_argument, NULL, 'E'},
+        {"cdc", required_argument, NULL, 'C'},
+        {"metrics", no_argument, NULL, 'M'},
+        {"perf", no_argument, NULL, 'P'},
+        {"sortconf", required_argument, NULL, 'T'},
+        {"expire", required_argument, NULL, 'X'},
+        {"coalesce", required_argument, NULL, 'W'},
+        {"lookup", no_argument, NULL, 'K'},
+        {"views", no_argument, NULL, 'V'},
+        {NULL, 0, NULL, 0}
+    };
+    while ((opt = getopt_long(argc, argv, "qf:bp", long_opts, NULL)) != -1) {
+        if (opt == 'r') {
+            restore_path = optarg;
+        } else if (opt == 'j') {
+            journal_path = optarg;
+        } else if (opt == 's') {
+            shard_count = atoi(optarg);
+            if (shard_count < 1 || shard_count > AP_SHARD_MAX) {
+                fprintf(stderr, "--shards must be 1 to %d\n", AP_SHARD_MAX);
+                exit(1);
+            }
+        } else if (opt == 'R') {
+            reader_count = atoi(optarg);
+            if (reader_count < 1 || reader_count > AP_READERS_MAX) {
+                fprintf(stderr, "--readers must be 1 to %d\n", AP_READERS_MAX);
+                exit(1);
+            }
+        } else if (opt == 'Q') {
+            query_path = optarg;
+        } else if (opt == 'L') {
+            listen_path = optarg;
+        } else if (opt == 'G') {
+            collect_path = optarg;
+        } else if (opt == 'E') {
+            export_name = optarg;
+        } else if (opt == 'C') {
+            cdc_path = optarg;
+        } else if (opt == 'M') {
+            dump_metrics = 1;
+        } else if (opt == 'P') {
+            perf_sorts = 1;
+        } else if (opt == 'T') {
+            sort_conf = optarg;
+            if (strlen(sort_conf) >= MAXLINE) {
+                fprintf(stderr, "--sortconf path is too long\n");
+                exit(1);
+            }
+        } else if (opt == 'X') {
+            expire_ttl = atoi(optarg);
+            if (expire_ttl < 0) {
+                fprintf(stderr, "--expire needs a ttl of at least 0\n");
+                exit(1);
+            }
+        } else if (opt == 'W') {
+            coalesce_window = atoi(optarg);
+            if (coalesce_window < 1 || coalesce_window > AP_COALESCE_MAX) {
+                fprintf(stderr, "--coalesce must be 1 to %d\n", AP_COALESCE_MAX);
+                exit(1);
+            }
+        } else if (opt == 'K') {
+            use_lookup = 1;
+        } else if (opt == 'V') {
+            use_views = 1;
+        } else if (opt == 'q') {
+            quiet = 1;
+        } else if (opt == 'f') {
+            trace_path = optarg;
+        } else if (opt == 'b') {
+            binary = 1;
+        } else if (opt == 'p') {
+            pipelined = 1;
+        } else {
+            exit(1);
+        }
+    }
+    if (listen_path != NULL && (binary || trace_path != NULL)) {
+        fprintf(stderr, "--listen cannot be used with -b or -f\n");
+        exit(1);
+    }
+    if (query_path != NULL && reader_count == 0) {
+        fprintf(stderr, "--query needs --readers\n");
         exit(1);
     }
-    int lb_listsize = atoi(argv[1]);
+    if (collect_path != NULL && listen_path == NULL) {
+        fprintf(stderr, "--collect needs --listen\n");
+        exit(1);
+    }
+    if (cdc_path != NULL && shard_count > 0) {
+        fprintf(stderr, "--cdc cannot be used with --shards\n");
+        exit(1);
+    }
+    if (coalesce_window > 0 && (pipelined || shard_count > 0 || listen_path != NULL)) {
+        fprintf(stderr, "--coalesce cannot be used with -p, --shards or --listen\n");
+        exit(1);
+    }
+    if (expire_ttl >= 0 && shard_count > 0) {
+        fprintf(stderr, "--expire cannot be used with --shards\n");
+        exit(1);
+    }
+    if (use_lookup && shard_count > 0) {
+        fprintf(stderr, "--lookup cannot be used with --shards\n");
+        exit(1);
+    }
+    if (argc - optind != 1) {
+        //printf("Error with input paramters.  Usage: ./lab2 [-q] [-b] [-f trace] leaderboard_size\n");
+        exit(1);
+    }
+    int lb_listsize = atoi(argv[optind]);
     if (lb_listsize < 2) {
-        //printf("Invalid leaderboard size %d from input %s\n", lb_listsize, argv[1]);
+        //printf("Invalid leaderboard size %d from input %s\n", lb_listsize, argv[optind]);
         exit(1);
     } else {
         //printf("Leaderboard lists the top %d access points\n", lb_listsize);
@@ -38,52 +1117,250 @@ int main(int argc, char * argv[])
     //printf("         : STATS; QUIT\n");
     //printf("Sorting  : SORTAP x; SORTETH x\n");
 
+    if (trace_path == NULL) {
+        in_open_stdin(&input);
+    } else if (in_open_trace(&input, trace_path) != 0) {
+        perror(trace_path);
+        exit(1);
+    }
+
+    /* output is buffered; flush after every command only if a person is
+     * watching, otherwise at buffer full and at exit
+     */
+    out_init(quiet);
+    if (binary) {
+        if (!ap_proto_get_magic(&input, AP_PROTO_CMD_MAGIC)) {
+            fprintf(stderr, "input is not a binary command stream\n");
+            exit(1);
+        }
+        out_mem(AP_PROTO_RES_MAGIC, AP_PROTO_MAGIC_SIZE);
+    }
+
     /* this list is sorted and the size of the list is limited */
-    ap_leaderboard = ap_create_leaderboard();
+    state.leaderboard = ap_create_leaderboard();
 
     /* this list is unsorted and the list size is not limited */
-    ap_queue = twl_list_construct(NULL);
-
-    /* remember fgets includes newline \n unless line too long */
-    while (fgets(line, MAXLINE, stdin) != NULL) {
-        num_items = sscanf(line, "%s%d%d%s", command, &ap_id, &mob_cnt, junk);
-        if (num_items == 2 && strcmp(command, "ADD") == 0) {
-            ap_add(ap_leaderboard, ap_id, lb_listsize);
-        } else if (num_items == 2 && strcmp(command, "REMOVE") == 0) {
-            ap_remove(ap_leaderboard, ap_id);
-        } else if (num_items == 2 && strcmp(command, "FIND") == 0) {
-            ap_find(ap_leaderboard, ap_id);
-        } else if (num_items == 2 && strcmp(command, "INC") == 0) {
-            ap_inc(ap_leaderboard, ap_id);
-        } else if (num_items == 2 && strcmp(command, "DEC") == 0) {
-            ap_dec(ap_leaderboard, ap_id);
-        } else if (num_items == 1 && strcmp(command, "PRINT") == 0) {
-            ap_print_list(ap_leaderboard, "Leaderboard");
-        } else if (num_items == 1 && strcmp(command, "REMOVEALL") == 0) {
-            ap_removeall(ap_leaderboard);
-        } else if (num_items == 2 && strcmp(command, "JOINQ") == 0) {
-            ap_enqueue(ap_queue, ap_id);
-        } else if (num_items == 1 && strcmp(command, "MOVEQTOL") == 0) {
-            ap_dequeue(ap_queue, ap_leaderboard, lb_listsize);
-        } else if (num_items == 2 && strcmp(command, "SORTAP") == 0) {
-            ap_sort_mc(ap_queue, ap_id); 
-        }else if (num_items == 2 && strcmp(command, "SORTETH") == 0) {
-            ap_sort_eth(ap_queue, ap_id);
-        }else if (num_items == 3 && strcmp(command, "APPENDQ") == 0) {
-            ap_appendq(ap_queue, ap_id , mob_cnt);
-        }else if (num_items == 1 && strcmp(command, "PRINTQ") == 0) {
-            ap_print_list(ap_queue, "Queue");
-        } else if (num_items == 1 && strcmp(command, "STATS") == 0) {
-            ap_stats(ap_leaderboard, ap_queue);
-        } else if (num_items == 1 && strcmp(command, "QUIT") == 0) {
-            ap_cleanup(ap_leaderboard);
-            ap_cleanup(ap_queue);
-            //printf("Goodbye\n");
-            break;
-        } else {
-            printf("# %s", line);
+    state.queue = twl_list_construct(NULL);
+    state.lb_listsize = lb_listsize;
+    state.journal = NULL;
+    state.input = &input;
+    state.binary = binary;
+    state.interactive = !binary && listen_path == NULL && isatty(STDOUT_FILENO);
+    state.quiet = quiet;
+    state.pipelined = (pipelined || shard_count > 0) && !state.interactive
+        && listen_path == NULL;
+    state.shards = NULL;
+    state.readers = NULL;
+    state.exported = NULL;
+    state.cdc = NULL;
+    state.order = NULL;
+    state.expire = NULL;
+    state.clock = 0;
+    state.expire_ttl = expire_ttl;
+    state.latest = 0;
+    state.expire_last = 0;
+    state.coalesce = NULL;
+    state.lookup = NULL;
+    state.views = NULL;
+    if (coalesce_window > 0 && !state.interactive) {
+        state.coalesce = (ap_coalesce_t *) malloc(sizeof(ap_coalesce_t));
+        assert(state.coalesce != NULL);
+        ap_coalesce_init(state.coalesce, coalesce_window);
+    }
+    metrics = (ap_metrics_t *) malloc(sizeof(ap_metrics_t));
+    assert(metrics != NULL);
+    ap_metrics_init(metrics);
+    state.metrics = metrics;
+    ap_perf_init(&perf);
+    state.perf = &perf;
+    state.perf_sorts = perf_sorts;
+    state.perf_range = FALSE;
+    state.perf_commands = 0;
+    state.sort_conf = sort_conf;
+    if (access(sort_conf, F_OK) == 0) {
+        const char *why;
+        if (ap_tune_load(sort_conf, &why) != 0)
+            fprintf(stderr, "Ignoring the sort tuning in %s: %s\n", sort_conf, why);
+    }
+
+    if (restore_path != NULL) {
+        twl_list_t *leaderboard, *queue;
+        const char *why;
+        if (ap_snapshot_load(restore_path, lb_listsize, &leaderboard, &queue,
+                    &snapshot_seq, &why) != 0) {
+            fprintf(stderr, "Cannot restore from %s: %s\n", restore_path, why);
+            exit(1);
+        }
+        ap_cleanup(state.leaderboard);
+        ap_cleanup(state.queue);
+        state.leaderboard = leaderboard;
+        state.queue = queue;
+    }
+
+    if (shard_count > 0) {
+        ap_shards_start(&shards, shard_count);
+        ap_shard_replace(&shards, state.leaderboard);
+        state.leaderboard = NULL;
+        state.shards = &shards;
+    } else {
+        state.order = (ap_order_t *) malloc(sizeof(ap_order_t));
+        assert(state.order != NULL);
+        ap_order_init(state.order);
+        ap_order_watch(state.order, state.leaderboard);
+        if (use_lookup) {
+            state.lookup = (ap_lookup_t *) malloc(sizeof(ap_lookup_t));
+            assert(state.lookup != NULL);
+            ap_lookup_init(state.lookup);
+            ap_lookup_watch(state.lookup, state.leaderboard);
+            ap_lookup_watch(state.lookup, state.queue);
+        }
+    }
+    if (use_views) {
+        state.views = (ap_views_t *) malloc(sizeof(ap_views_t));
+        assert(state.views != NULL);
+        ap_views_init(state.views);
+        ap_views_watch(state.views, state.queue);
+    }
+
+    if (journal_path != NULL) {
+        const char *why;
+        long long seq;
+        long replayed = 0;
+        if (ap_journal_open(&journal, journal_path, &why) != 0) {
+            fprintf(stderr, "Cannot open journal %s: %s\n", journal_path, why);
+            exit(1);
+        }
+        /* entries up to snapshot_seq are already in the lists, and the
+         * ones after it must all be in the journal.  Replay prints nothing.
+         */
+        if (journal.base > snapshot_seq) {
+            fprintf(stderr, "Journal %s follows seq %lld but the lists start at seq %lld\n",
+                    journal_path, journal.base, snapshot_seq);
+            exit(1);
+        }
+        while (ap_journal_next(&journal, &cmd, &seq)) {
+            if (seq > snapshot_seq) {
+                execute(&state, &cmd, &res, &ticket);
+                if (state.shards != NULL)
+                    ap_shard_wait(state.shards, &res, &ticket);
+                if (res.owns_list)
+                    ap_cleanup(res.list);
+                free(res.metrics);
+                replayed++;
+            }
+            free(cmd.rec);
+        }
+        if (journal.seq < snapshot_seq) {
+            fprintf(stderr, "Journal %s ends at seq %lld but the lists start at seq %lld\n",
+                    journal_path, journal.seq, snapshot_seq);
+            exit(1);
+        }
+        if (replayed > 0)
+            fprintf(stderr, "Replayed %ld journal entries\n", replayed);
+        state.journal = &journal;
+    }
+
+    if (reader_count > 0) {
+        twl_list_t *leaderboard = state.shards != NULL
+            ? ap_shard_collect(state.shards) : state.leaderboard;
+        if (ap_readers_start(&readers, reader_count, leaderboard, twl_list_size(state.queue),
+                    query_path) != 0) {
+            perror(query_path);
+            exit(1);
+        }
+        if (state.shards != NULL)
+            ap_cleanup(leaderboard);
+        state.readers = &readers;
+    }
+
+    if (export_name != NULL) {
+        const char *why;
+        if (ap_export_open(&exported, export_name, lb_listsize, &why) != 0) {
+            fprintf(stderr, "Cannot export to %s: %s\n", export_name, why);
+            exit(1);
+        }
+        state.exported = &exported;
+        publish(&state);
+    }
+
+    /* the stream starts from the lists as restored and replayed */
+    if (cdc_path != NULL) {
+        FILE *sink = fopen(cdc_path, "w");
+        if (sink == NULL) {
+            perror(cdc_path);
+            exit(1);
+        }
+        cdc = (ap_cdc_t *) malloc(sizeof(ap_cdc_t));
+        assert(cdc != NULL);
+        ap_cdc_init(cdc, sink);
+        state.cdc = cdc;
+    }
+
+    if (listen_path != NULL) {
+        if (ap_server_run(listen_path, collect_path, quiet, serve_command, serve_sync,
+                    &state) != 0) {
+            perror(listen_path);
+            exit(1);
+        }
+    } else if (state.pipelined) {
+        run_pipeline(&state);
+    } else {
+        run_serial(&state);
+    }
+    if (dump_metrics) {
+        /* the same table as METRICS, through a buffer that flushes to
+         * stderr
+         */
+        char store[4096];
+        out_buf_t err = { store, 0, sizeof(store), stderr, FALSE, 0 };
+        out_buf_t *prev = out_select(&err);
+        ap_metrics_report(state.metrics);
+        out_flush();
+        out_select(prev);
+    }
+    free(state.metrics);
+    ap_perf_close(state.perf);
+    if (state.exported != NULL) {
+        catch_up(&state);
+        ap_export_close(state.exported);
+    }
+    if (state.cdc != NULL) {
+        ap_cdc_close(state.cdc);
+        free(state.cdc);
+    }
+    if (state.readers != NULL)
+        ap_readers_stop(state.readers);
+    if (state.journal != NULL)
+        ap_journal_close(state.journal);
+    if (state.shards != NULL) {
+        ap_shards_stop(state.shards);
+    } else {
+        ap_order_free(state.order);
+        free(state.order);
+        if (state.expire != NULL) {
+            ap_expire_free(state.expire);
+            free(state.expire);
         }
+        if (state.lookup != NULL) {
+            ap_lookup_free(state.lookup);
+            free(state.lookup);
+        }
+        ap_cleanup(state.leaderboard);
+    }
+    if (state.views != NULL) {
+        ap_views_free(state.views);
+        free(state.views);
+    }
+    ap_cleanup(state.queue);
+    if (state.coalesce != NULL) {
+        ap_coalesce_free(state.coalesce);
+        free(state.coalesce);
     }
+    //printf("Goodbye\n");
+    in_close(&input);
+    if (quiet)
+        fprintf(stderr, "%ld acknowledgements suppressed\n", out_ack_count());
+    out_flush();
     exit(0);
 }
 /* commands specified to vim. ts: tabstop, sts: soft tabstop sw: shiftwidth */